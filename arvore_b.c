@@ -1,870 +1,4242 @@
 /*
  * ============================================================================
- * Árvore-B Paginada de Ordem 3 para Indexação de Banco de Dados de Imagens
+ * Árvore-B Paginada (ordem configurável) para Indexação de Banco de Dados de Imagens
  * Estrutura de Dados II - Trabalho 2
  * ============================================================================
  */
 
 //Comando para compilação: gcc -Wall -Wextra -std=c11 -O2 -o arvore_b.exe arvore_b.c; if ($?) { Write-Host "[OK] Compilado com sucesso!" -ForegroundColor Green } else { Write-Host "[ERRO] Falha na compilacao" -ForegroundColor Red }
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L          // mmap e demais chamadas POSIX com -std=c11
+#endif
+#ifdef __linux__
+#define _GNU_SOURCE                      // copy_file_range na compactação
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <limits.h>
+#include <ctype.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>                          // _commit (fsync)
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 
 //Definições de constantes
-#define ORDEM 3                          // Ordem da Árvore-B
-#define MAX_CHAVES (ORDEM - 1)           // 2 chaves por nó
-#define MIN_CHAVES ((ORDEM - 1) / 2)     // 1 chave mínima (exceto raiz)
-#define MAX_FILHOS ORDEM                 // 3 filhos por nó
+#define ORDEM_MINIMA 3                   // Menor ordem aceita (2 chaves por nó)
+#define TAM_PAGINA 4096                  // Tamanho de uma página em disco (1 bloco)
+#define MAGICO_INDICE 0x42545249         // Assinatura do arquivo de índice (chaves id + limiar)
 
 #define TAM_NOME_ARQUIVO 256
-#define TAM_MAX_IMAGEM (640 * 480)       // 640x480 pixels
+#define MAGICO_REGISTRO 0x474D4952       // Assinatura de cada registro de imagem
+#define MAGICO_LIVRES_DADOS 0x52425542   // Listas de buracos de dados.bin válidas no cabeçalho
+#define NUM_CLASSES_DADOS 32             // Classes de tamanho dos buracos (potências de 2)
+#define MAX_TENTATIVAS_BURACO 8          // Buracos examinados por classe em uma alocação
+
+// Bit do offset_dados de uma chave que indica a geração do arquivo de dados
+// (durante a compactação incremental há dois: dados.bin e dados_novo.bin)
+// offset_dados tem 64 bits mesmo onde long tem 32 (Windows), então o bit
+// nunca coincide com um offset de arquivo
+#define BIT_GERACAO_DADOS (1LL << 62)
+#define OFFSET_REGISTRO(o) ((long)((o) & ~BIT_GERACAO_DADOS))
+#define GERACAO_OFFSET(o) (((o) & BIT_GERACAO_DADOS) != 0)
+
+#define MAGICO_NOMES 0x4D4F4E44         // Assinatura do dicionário de nomes
 
 #define ARQUIVO_INDICE "models/indice.bin"
 #define ARQUIVO_DADOS "models/dados.bin"
+#define ARQUIVO_DADOS_NOVO "models/dados_novo.bin"   // Destino da compactação incremental
+#define ARQUIVO_DADOS_TEMP "models/dados_temp.bin"   // Compactação inteira: dados e índice novos
+#define ARQUIVO_INDICE_TEMP "models/indice_temp.bin"
+#define ARQUIVO_TROCA "models/compactacao.troca"    // Os dois temporários estão completos
+#define ARQUIVO_NOMES "models/nomes.bin"
+#define ARQUIVO_LOG "models/indice.log"  // Log de escrita antecipada das páginas do índice
+
+#define MAGICO_LOG 0x474F4C57            // Assinatura de cada commit no log
+#define LIMITE_LOG (8L * 1024 * 1024)    // Bytes de log que disparam um checkpoint
+
+#define ID_NOME_AUSENTE 0xFFFFFFFFu      // Nome fora do dicionário (nenhuma chave o usa)
 
 /**
- * Chave: Combina nome do arquivo e limiar aplicado
- * Usada para indexação na Árvore-B
+ * Chave: Combina o id do nome do arquivo (no dicionário de nomes) e o
+ * limiar aplicado
+ * Usada para indexação na Árvore-B; id e limiar formam um inteiro de
+ * 8 bytes (ver valor_chave), comparado de uma vez
  */
 typedef struct {
-    char nome_arquivo[TAM_NOME_ARQUIVO];
+    unsigned int id_nome;
     int limiar;
-    long offset_dados;                   
+    long long offset_dados;              // Offset do registro (com o bit de geração)
 } Chave;
 
-//Pagina: Estrutura de nó da Árvore-B
+/**
+ * Pagina: Estrutura de nó da Árvore-B
+ * Os vetores de chaves e filhos são dimensionados pela ordem do índice
+ * e alocados no mesmo bloco da página (um único free libera tudo)
+ */
 typedef struct {
     int num_chaves;                      
-    Chave chaves[MAX_CHAVES];            
-    long filhos[MAX_FILHOS];             
+    Chave *chaves;                       // ordem - 1 posições (+1 de folga)
+    long *filhos;                        // ordem posições (+1 de folga)
     bool eh_folha;                       
     long offset_proprio;                 
+    long proxima_folha;                  // Folha seguinte no modo B+ (-1 = nenhuma)
+    struct Quadro *quadro;               // Quadro do buffer que possui a página
 } Pagina;
 
+/**
+ * Cabeçalho de cada página no arquivo de índice (página com slots)
+ * Logo depois vem o vetor de slots (offset de cada célula na página, em
+ * ordem de chave); as células ocupam o fim da página, crescendo para trás.
+ * Célula: prefixo (1 byte, bytes iniciais do valor da chave em big-endian
+ * iguais aos da chave anterior), os 8 - prefixo bytes restantes,
+ * offset_dados e, em páginas internas, o filho à esquerda da chave
+ */
+typedef struct {
+    int num_chaves;
+    int eh_folha;
+    long offset_proprio;
+    long ultimo_filho;                   // Filho à direita da última chave (folha: próxima folha)
+    int inicio_celulas;                  // Offset da célula mais baixa
+} CabecalhoPagina;
+
+typedef unsigned short SlotPagina;
+
 /**
  * Cabeçalho do arquivo de índice
- * Mantém metadados da Árvore-B
+ * Mantém metadados da Árvore-B (ocupa o primeiro bloco do arquivo)
  */
 typedef struct {
+    unsigned int magico;                 // Assinatura do formato
+    int ordem;                           // Ordem escolhida na criação
     long offset_raiz;                    // Offset da raiz
     long proximo_offset;                 // Próximo espaço livre
     int altura;                          // Altura da árvore
     int num_paginas;                     // Total de páginas
+    int folhas_encadeadas;               // Modo B+: chaves só nas folhas, encadeadas
+    long primeira_livre;                 // Lista de páginas livres (0 = vazia)
+    int num_paginas_livres;              // Páginas na lista livre
+    unsigned int magico_livres_dados;    // MAGICO_LIVRES_DADOS quando as listas abaixo valem
+    long livres_dados[NUM_CLASSES_DADOS];// Buracos de dados.bin por classe (-1 = vazia)
+    long bytes_livres_dados;             // Bytes nos buracos de dados.bin
+    int geracao_dados;                   // Geração (0/1) das chaves que apontam para dados.bin
+    int compactacao_ativa;               // Compactação incremental em andamento
+    unsigned long long progresso_compactacao;  // Valor da última chave já migrada
 } CabecalhoIndice;
 
 /**
- * Registro de imagem no arquivo de dados
+ * Cabeçalho de um commit no log (indice.log)
+ * Seguem num_paginas pares (offset, página serializada), o cabeçalho do
+ * índice e os nomes novos do dicionário (como em nomes.bin); a soma cobre
+ * esses bytes, e um commit incompleto ou com soma errada (gravação
+ * interrompida) encerra o log
+ */
+typedef struct {
+    unsigned magico;
+    int num_paginas;
+    int num_nomes;                       // Nomes no dicionário depois do commit
+    int tamanho_nomes;                   // Bytes dos nomes novos
+    long offset_nomes;                   // Onde eles entram em nomes.bin
+    unsigned long long soma;             // FNV-1a de tudo que segue
+} CabecalhoLog;
+
+// Bytes de uma página disponíveis para slots e células
+#define TAM_UTIL_PAGINA ((int)(TAM_PAGINA - sizeof(CabecalhoPagina)))
+
+// Slot + célula de uma chave: prefixo, sufixo do valor, offset_dados e filho
+#define TAM_VALOR_CHAVE 8
+#define TAM_FIXO_CELULA ((int)(sizeof(SlotPagina) + 1 + sizeof(long long)))
+#define MIN_TAM_CHAVE_DISCO TAM_FIXO_CELULA                      // Chave igual à anterior, em folha
+#define MAX_TAM_CHAVE_DISCO (TAM_FIXO_CELULA + TAM_VALOR_CHAVE + (int)sizeof(long))
+
+// A ordem limita o número de chaves; a maior é a de uma página cheia de
+// chaves mínimas (em geral o limite que vale é o de bytes)
+#define ORDEM_MAXIMA (TAM_UTIL_PAGINA / MIN_TAM_CHAVE_DISCO + 1)
+
+// Limites derivados da ordem do índice aberto
+#define MAX_CHAVES(bd) ((bd)->cabecalho.ordem - 1)
+#define MIN_CHAVES(bd) (MAX_CHAVES(bd) / 2)         // Exceto raiz
+#define MAX_FILHOS(bd) ((bd)->cabecalho.ordem)
+#define MODO_BMAIS(bd) ((bd)->cabecalho.folhas_encadeadas != 0)
+#define COMPACTANDO(bd) ((bd)->cabecalho.compactacao_ativa != 0)
+
+// Ocupação mínima em bytes (exceto raiz): com ela, duas páginas abaixo do
+// mínimo mais a separadora sempre cabem em uma página só
+#define MIN_BYTES_PAGINA (TAM_UTIL_PAGINA / 2 - MAX_TAM_CHAVE_DISCO)
+
+/**
+ * Imagem em memória
+ * Os pixels ficam em um vetor alocado do tamanho exato (largura * altura),
+ * ou direto no arquivo mapeado de onde a imagem foi lida (P5 sem cópia)
  */
 typedef struct {
-    char nome_original[TAM_NOME_ARQUIVO];
     int limiar;
     int largura;
     int altura;
     int max_valor;
-    unsigned char dados[TAM_MAX_IMAGEM];
+    unsigned char *dados;
+    void *mapeamento;                    // Arquivo que contém os pixels (NULL = vetor próprio)
+    size_t tamanho_mapeamento;
 } RegistroImagem;
 
+// Codificação dos pixels de um registro
+#define CODIFICACAO_BYTES 0              // Um byte por pixel
+#define CODIFICACAO_BITS 1               // Imagem binária (0/255): 1 bit por pixel
+#define CODIFICACAO_RLE 2                // Imagem binária: comprimentos das sequências de bits
+#define NUM_CODIFICACOES 3
+
+#define TAM_BUFFER_EXPORTACAO (256 * 1024)   // Texto de um P2 formatado por escrita
+#define TAM_BLOCO_COPIA (1024 * 1024)    // Bytes por leitura na cópia de registros da compactação
+#define PIXELS_POR_LINHA_P2 20
+#define BLOCO_LIMIARIZACAO 4096          // Pixels da origem por bloco (cabe no cache L1)
+
+/**
+ * Cabeçalho de um registro no arquivo de dados
+ * Os tamanho_dados bytes de pixels codificados vêm logo em seguida.
+ * O limiar não faz parte do registro: chaves com limiares diferentes que
+ * geram a mesma imagem compartilham um único registro.
+ */
+typedef struct {
+    unsigned long long hash;             // Hash do conteúdo (dimensões + pixels)
+    unsigned magico;
+    int largura;
+    int altura;
+    int max_valor;
+    int codificacao;
+    int tamanho_dados;
+    int referencias;                     // Chaves que apontam para o registro
+} CabecalhoRegistro;
+
+/**
+ * Quadro do buffer de páginas: uma página do índice residente em memória
+ */
+typedef struct Quadro {
+    Pagina *pagina;                      // Memória da página (pertence ao buffer)
+    long offset;                         // Chave do quadro no arquivo de índice
+    int pinos;                           // Usuários atuais; só sai do buffer com 0
+    bool sujo;                           // Modificada desde a última gravação
+    struct Quadro *anterior_lru;         // Lista LRU (mais recente no início)
+    struct Quadro *proximo_lru;
+    struct Quadro *proximo_balde;        // Encadeamento na tabela de offsets
+} Quadro;
+
+/**
+ * Buffer LRU de páginas do índice com semântica pin/unpin
+ */
+typedef struct {
+    Quadro **baldes;                     // Tabela hash offset -> quadro
+    int num_baldes;                      // Potência de 2
+    int capacidade;                      // Máximo de quadros sem pino
+    int num_quadros;
+    Quadro *lru_inicio;
+    Quadro *lru_fim;
+    long acertos;
+    long faltas;
+} BufferPaginas;
+
+/**
+ * Tabela hash (endereçamento aberto) de registros do arquivo de dados
+ * Aceita várias entradas com o mesmo hash (colisões são conferidas pelo conteúdo)
+ */
+typedef struct {
+    unsigned long long hash;
+    long offset;                         // -1 = vazio, -2 = removido
+} EntradaRegistro;
+
+typedef struct {
+    EntradaRegistro *entradas;
+    int capacidade;                      // Potência de 2
+    int num_entradas;
+    int num_removidas;
+} MapaRegistros;
+
+/**
+ * Cabeçalho do dicionário de nomes
+ * Os nomes vêm em seguida, na ordem dos ids: tamanho (1 byte) e bytes
+ */
+typedef struct {
+    unsigned magico;
+    int num_nomes;
+} CabecalhoNomes;
+
+/**
+ * Nome do dicionário na ordem alfabética, para as consultas por prefixo
+ */
+typedef struct {
+    const char *nome;
+    unsigned int id;
+} NomeOrdenado;
+
+/**
+ * Dicionário persistente nome do arquivo -> id de 32 bits
+ * O id é a posição do nome no arquivo; ids nunca são reaproveitados
+ */
+typedef struct {
+    FILE *arquivo;
+    char **nomes;                        // id -> nome
+    int num_nomes;
+    int capacidade_nomes;
+    int num_gravados;                    // Nomes já gravados no arquivo
+    long fim_arquivo;                    // Onde entra o próximo nome gravado
+    int *tabela;                         // Hash do nome -> id (-1 = vazio)
+    int capacidade_tabela;               // Potência de 2
+    NomeOrdenado *ordenados;             // Nomes em ordem alfabética (só os num_ordenados primeiros ids)
+    int num_ordenados;
+} DicionarioNomes;
+
+/**
+ * Página do índice (modo sombra) ou referência de registro que um commit
+ * deixou de usar; só é liberada depois desse commit e quando nenhum
+ * instantâneo aberto ainda pode lê-la
+ */
+typedef struct {
+    long long offset;                    // Página do índice ou offset_dados da chave
+    unsigned long versao;                // Primeira versão que já não a usa
+    bool pagina;
+} Liberacao;
+
 /**
  * Estrutura principal do banco de dados
  */
 typedef struct {
     FILE *arquivo_indice;
     FILE *arquivo_dados;
-    Pagina *raiz_ram;                    
+    Pagina *raiz_ram;                    // Fica sempre com um pino no buffer
     CabecalhoIndice cabecalho;
+    bool cabecalho_sujo;                 // Cabeçalho alterado e ainda não gravado
+    BufferPaginas buffer;
+    int ops_por_commit;                  // Operações agrupadas em cada commit
+    int ops_pendentes;                   // Operações desde o último commit
+    MapaRegistros registros;             // Hash do conteúdo -> registro em dados.bin
+    DicionarioNomes nomes;               // Nome do arquivo -> id usado nas chaves
+    int passo_compactacao;               // Chaves migradas por operação na compactação incremental
+    FILE *arquivo_novo;                  // dados_novo.bin (só durante a compactação incremental)
+    MapaRegistros registros_novos;       // Hash do conteúdo -> registro em dados_novo.bin
+    MapaRegistros copiados;              // Offset em dados.bin -> offset em dados_novo.bin
+    bool mapear_indice;                  // Modo mmap pedido na abertura
+    unsigned char *mapa_indice;          // indice.bin mapeado (NULL = fseek/fread)
+    long tamanho_mapa;                   // Bytes mapeados (arquivo estendido até aqui)
+    FILE *arquivo_log;                   // indice.log (NULL = sem log)
+    long bytes_dados_sincronizados;      // bytes_escritos_dados no último fsync dos dados
+    bool paginas_sombra;                 // Alterações em cópias das páginas; o commit troca a raiz
+    unsigned long versao;                // Commits feitos (marca as liberações adiadas)
+    long raiz_confirmada;                // Raiz e altura gravadas no último commit
+    int altura_confirmada;
+    Liberacao *liberacoes;               // Em ordem de versão
+    int num_liberacoes;
+    int capacidade_liberacoes;
+    struct Instantaneo *instantaneos;    // Instantâneos abertos
+    int num_instantaneos;
+    long *buracos_pendentes;             // Registros sem referências à espera do commit
+    int num_buracos_pendentes;
+    int capacidade_buracos_pendentes;
 } BancoDados;
 
+#define CAPACIDADE_BUFFER_PADRAO 256     // Páginas em cache (1 MiB em disco)
+#define CAPACIDADE_BUFFER_MINIMA 8
+#define OPS_POR_COMMIT_PADRAO 1
+#define PASSO_COMPACTACAO_PADRAO 256
+#define CRESCIMENTO_MAPA_INDICE (256 * TAM_PAGINA)   // Passo de extensão de indice.bin mapeado
+
+/**
+ * Opções usadas ao abrir o banco
+ */
+typedef struct {
+    int ordem;                           // Ordem de um índice novo (0 = padrão)
+    int capacidade_buffer;               // Páginas no buffer (0 = padrão)
+    int ops_por_commit;                  // Commit a cada N operações (0 = padrão)
+    bool folhas_encadeadas;              // Índice novo em modo B+
+    int passo_compactacao;               // Chaves por passo da compactação incremental (0 = padrão)
+    bool mapear_indice;                  // Acessa indice.bin por mmap (só POSIX)
+    bool usar_log;                       // Commits atômicos e duráveis com o log
+    bool paginas_sombra;                 // Cópia na escrita e troca atômica da raiz no commit
+} OpcoesBanco;
+
+/**
+ * Operações com histograma de latência
+ */
+typedef enum {
+    OP_INSERIR,
+    OP_BUSCAR,
+    OP_REMOVER,
+    OP_PERCURSO,
+    OP_COMPACTAR,
+    OP_EXPORTAR,
+    NUM_OPERACOES
+} OperacaoMedida;
+
+#define NUM_BALDES_LATENCIA 32           // Balde i: latências abaixo de 2^i us
+
+/**
+ * Histograma de latências em potências de 2 de microssegundos
+ */
+typedef struct {
+    long contagem;
+    double total_us;
+    double maximo_us;
+    long baldes[NUM_BALDES_LATENCIA];
+} HistogramaLatencia;
+
+/**
+ * Contadores de E/S e de operações da árvore, sempre ligados
+ * Contam apenas indice.bin e dados.bin (inclusive os temporários da compactação)
+ */
+typedef struct {
+    long paginas_lidas;
+    long paginas_escritas;
+    long cabecalhos_escritos;
+    long fseeks;
+    long fflushes;
+    long bytes_lidos_indice;
+    long bytes_escritos_indice;
+    long bytes_lidos_dados;
+    long bytes_escritos_dados;
+    long divisoes;
+    long fusoes;
+    long emprestimos;
+    long registros_reaproveitados;       // Inserções que reusaram um registro igual
+    long registros_em_buracos;           // Registros gravados em buracos de dados.bin
+    long chaves_migradas;                // Chaves movidas pela compactação incremental
+    long extensoes_copiadas;             // Trechos de registros vizinhos copiados de uma vez
+    long fsyncs;
+    long commits_log;
+    long bytes_escritos_log;
+    long checkpoints;                    // Log esvaziado depois do fsync de indice.bin
+    long commits_refeitos;               // Commits do log reaplicados na abertura
+    long copias_sombra;                  // Páginas copiadas em vez de alteradas no lugar
+    long registros_por_codificacao[NUM_CODIFICACOES];
+    HistogramaLatencia latencias[NUM_OPERACOES];
+} Metricas;
+
+Metricas metricas;
+
 // Declarações de funções
 void remover_recursivo(BancoDados *bd, Pagina *pagina, Chave *chave);
-void preencher(BancoDados *bd, Pagina *pagina, int idx);
-long compactar_paginas_recursivo(BancoDados *bd, Pagina *pagina, FILE *temp_indice, CabecalhoIndice *novo_cabecalho);
+int alterar_referencias(BancoDados *bd, long long offset_chave, int delta);
+void gravar_dicionario(DicionarioNomes *dic);
+const char* nome_do_id(BancoDados *bd, unsigned int id);
+bool passo_compactacao(BancoDados *bd, int max_chaves);
+void adiar_liberacao(BancoDados *bd, long long offset, bool pagina);
+void ligar_buracos_pendentes(BancoDados *bd);
+unsigned long long hash_fnv(unsigned long long hash, const void *dados, size_t tamanho);
 
 
 // Funções auxiliares
+/**
+ * Id do nome nos 32 bits altos e limiar nos baixos: a ordem do inteiro é a
+ * ordem das chaves (por id, depois por limiar)
+ */
+unsigned long long valor_chave(const Chave *chave) {
+    return ((unsigned long long)chave->id_nome << 32) | (unsigned int)chave->limiar;
+}
+
+/**
+ * Limiares aceitos nas chaves: valor_chave guarda o limiar sem sinal nos 32
+ * bits baixos, e só de 0 a 255 essa ordem é a dos limiares (e a que as
+ * consultas por intervalo e prefixo percorrem)
+ */
+bool limiar_valido(int limiar) {
+    return limiar >= 0 && limiar <= 255;
+}
+
 int comparar_chaves(const Chave *a, const Chave *b) {
-    int cmp = strcmp(a->nome_arquivo, b->nome_arquivo);
-    if (cmp != 0) return cmp;
-    return a->limiar - b->limiar;
+    unsigned long long va = valor_chave(a), vb = valor_chave(b);
+    return (va > vb) - (va < vb);
 }
 
-Pagina* criar_pagina(bool eh_folha) {
-    Pagina *pagina = (Pagina*)calloc(1, sizeof(Pagina));
-    pagina->num_chaves = 0;
-    pagina->eh_folha = eh_folha;
-    pagina->offset_proprio = -1;
-    
-    for (int i = 0; i < MAX_FILHOS; i++) {
-        pagina->filhos[i] = -1;
-    }
-    
+/**
+ * Aloca uma página para a ordem informada
+ * Os vetores ficam logo após a estrutura, no mesmo bloco de memória, com
+ * uma posição extra para o estouro temporário antes de uma divisão
+ */
+Pagina* alocar_memoria_pagina(int ordem) {
+    size_t tamanho = sizeof(Pagina) + ordem * sizeof(Chave) + (ordem + 1) * sizeof(long);
+    Pagina *pagina = (Pagina*)calloc(1, tamanho);
+    pagina->chaves = (Chave*)(pagina + 1);
+    pagina->filhos = (long*)(pagina->chaves + ordem);
     return pagina;
 }
 
-// Funções de leitura e escrita de arquivos
-void escrever_cabecalho(FILE *arquivo, CabecalhoIndice *cab) {
-    fseek(arquivo, 0, SEEK_SET);
-    fwrite(cab, sizeof(CabecalhoIndice), 1, arquivo);
-    fflush(arquivo);
+/**
+ * Bytes iniciais (em big-endian) iguais nos dois valores de chave
+ * Chaves vizinhas do mesmo nome diferem só no último byte
+ */
+int prefixo_comum(unsigned long long a, unsigned long long b) {
+    unsigned long long diferenca = a ^ b;
+    int n = 0;
+    while (n < TAM_VALOR_CHAVE && (diferenca >> (56 - 8 * n)) == 0) n++;
+    return n;
 }
 
 /**
- * Lê o cabeçalho do arquivo de índice
+ * Bytes de slot + célula da chave na página, com o valor comprimido contra a
+ * chave anterior (NULL para a primeira)
  */
-void ler_cabecalho(FILE *arquivo, CabecalhoIndice *cab) {
-    fseek(arquivo, 0, SEEK_SET);
-    fread(cab, sizeof(CabecalhoIndice), 1, arquivo);
+int tamanho_chave_disco(const Chave *chave, const Chave *anterior, bool eh_folha) {
+    int prefixo = anterior ? prefixo_comum(valor_chave(chave), valor_chave(anterior)) : 0;
+    return TAM_FIXO_CELULA + (TAM_VALOR_CHAVE - prefixo) + (eh_folha ? 0 : (int)sizeof(long));
 }
 
-void escrever_pagina(FILE *arquivo, Pagina *pagina, long offset) {
-    fseek(arquivo, offset, SEEK_SET);
-    fwrite(pagina, sizeof(Pagina), 1, arquivo);
-    fflush(arquivo);
+/**
+ * Bytes ocupados por slots e células de um trecho de chaves
+ * Para de contar assim que passar de limite
+ */
+int tamanho_chaves_disco_ate(const Chave *chaves, int n, bool eh_folha, int limite) {
+    int total = 0;
+    for (int i = 0; i < n && total <= limite; i++) {
+        total += tamanho_chave_disco(&chaves[i], i > 0 ? &chaves[i - 1] : NULL, eh_folha);
+    }
+    return total;
 }
 
-Pagina* ler_pagina(FILE *arquivo, long offset) {
-    if (offset == -1) return NULL;
-    
-    Pagina *pagina = (Pagina*)malloc(sizeof(Pagina));
-    fseek(arquivo, offset, SEEK_SET);
-    fread(pagina, sizeof(Pagina), 1, arquivo);
-    
-    return pagina;
+int tamanho_chaves_disco(const Chave *chaves, int n, bool eh_folha) {
+    return tamanho_chaves_disco_ate(chaves, n, eh_folha, INT_MAX);
 }
 
-long alocar_pagina(BancoDados *bd) {
-    long offset = bd->cabecalho.proximo_offset;
-    bd->cabecalho.proximo_offset += sizeof(Pagina);
-    bd->cabecalho.num_paginas++;
-    escrever_cabecalho(bd->arquivo_indice, &bd->cabecalho);
-    return offset;
+/**
+ * Uma página estoura pelo número de chaves (ordem) ou pelos bytes em disco
+ */
+bool excede_limites(const Chave *chaves, int n, bool eh_folha, int max_chaves) {
+    if (n > max_chaves) return true;
+    if (n * MAX_TAM_CHAVE_DISCO <= TAM_UTIL_PAGINA) return false;
+    return tamanho_chaves_disco_ate(chaves, n, eh_folha, TAM_UTIL_PAGINA) > TAM_UTIL_PAGINA;
 }
 
-// Funções de busca
-int buscar_posicao(Pagina *pagina, Chave *chave) {
-    int i = 0;
-    while (i < pagina->num_chaves && comparar_chaves(chave, &pagina->chaves[i]) > 0) {
-        i++;
-    }
-    return i;
+/**
+ * Fica abaixo do mínimo só quem está abaixo dos dois: chaves e bytes
+ */
+bool abaixo_limites(const Chave *chaves, int n, bool eh_folha, int max_chaves) {
+    return n < max_chaves / 2 && tamanho_chaves_disco_ate(chaves, n, eh_folha, MIN_BYTES_PAGINA) < MIN_BYTES_PAGINA;
 }
 
 /**
- * Busca uma chave na árvore
- * Retorna true se encontrada, false caso contrário
+ * Indica se a página passou do máximo e precisa ser dividida
  */
-bool buscar(BancoDados *bd, Chave *chave, Chave *resultado) {
-    Pagina *pagina_atual = bd->raiz_ram;
-    
-    while (pagina_atual != NULL) {
-        int i = buscar_posicao(pagina_atual, chave);
-        
-        if (i < pagina_atual->num_chaves && 
-            comparar_chaves(chave, &pagina_atual->chaves[i]) == 0) {
-            if (resultado) {
-                *resultado = pagina_atual->chaves[i];
-            }
-            if (pagina_atual != bd->raiz_ram) {
-                free(pagina_atual);
-            }
-            return true;
-        }
-        
+bool pagina_excedida(BancoDados *bd, Pagina *pagina) {
+    return excede_limites(pagina->chaves, pagina->num_chaves, pagina->eh_folha, MAX_CHAVES(bd));
+}
 
-        if (pagina_atual->eh_folha) {
-            if (pagina_atual != bd->raiz_ram) {
-                free(pagina_atual);
-            }
-            return false;
-        }
-        
-        long offset_filho = pagina_atual->filhos[i];
-        if (pagina_atual != bd->raiz_ram) {
-            free(pagina_atual);
-        }
-        pagina_atual = ler_pagina(bd->arquivo_indice, offset_filho);
-    }
-    
-    return false;
+bool pagina_abaixo_minimo(BancoDados *bd, Pagina *pagina) {
+    return abaixo_limites(pagina->chaves, pagina->num_chaves, pagina->eh_folha, MAX_CHAVES(bd));
 }
 
-//Funções de inserção
-void dividir_filho(BancoDados *bd, Pagina *pai, int indice, Pagina *filho_cheio) {
-    Pagina *novo_filho = criar_pagina(filho_cheio->eh_folha);
-    novo_filho->num_chaves = 0;  // Inicialmente vazio
-    novo_filho->offset_proprio = alocar_pagina(bd);
-    
-    // Se não é folha, move o último filho para o novo nó
-    if (!filho_cheio->eh_folha) {
-        novo_filho->filhos[0] = filho_cheio->filhos[2];
-    }
-    
-    filho_cheio->num_chaves = 1;  // Fica com K0
-    
-    // Move chaves e filhos do pai para abrir espaço
-    for (int j = pai->num_chaves; j > indice; j--) {
-        pai->chaves[j] = pai->chaves[j - 1];
-    }
-    for (int j = pai->num_chaves + 1; j > indice + 1; j--) {
-        pai->filhos[j] = pai->filhos[j - 1];
-    }
-    
-    // Insere a chave do meio no pai
-    pai->chaves[indice] = filho_cheio->chaves[MIN_CHAVES];
-    pai->filhos[indice + 1] = novo_filho->offset_proprio;
-    pai->num_chaves++;
-    
-    // Escreve as páginas no disco
-    escrever_pagina(bd->arquivo_indice, filho_cheio, filho_cheio->offset_proprio);
-    escrever_pagina(bd->arquivo_indice, novo_filho, novo_filho->offset_proprio);
-    
-    free(novo_filho);
+/**
+ * Indica se a página pode perder uma chave (qualquer uma) sem ficar abaixo
+ * do mínimo
+ */
+bool pagina_pode_ceder(BancoDados *bd, Pagina *pagina) {
+    return pagina->num_chaves - 1 >= MIN_CHAVES(bd) ||
+           tamanho_chaves_disco_ate(pagina->chaves, pagina->num_chaves, pagina->eh_folha,
+                                    MIN_BYTES_PAGINA + MAX_TAM_CHAVE_DISCO) >=
+           MIN_BYTES_PAGINA + MAX_TAM_CHAVE_DISCO;
 }
 
 /**
- * Insere em uma página que não está cheia
+ * Escolhe a chave que sobe na divisão de um trecho de n chaves: as duas
+ * metades não podem estourar, e entre as válidas fica a de ocupação mais
+ * equilibrada (a ocupação é a maior fração entre chaves e bytes)
+ * Com copia (folhas do modo B+) a chave escolhida sobe como cópia e fica
+ * como a primeira da metade direita
  */
-void inserir_nao_cheio(BancoDados *bd, Pagina *pagina, Chave *chave) {
-    int i = pagina->num_chaves - 1;
+int escolher_divisao(const Chave *chaves, int n, bool eh_folha, int max_chaves, bool copia) {
+    // acumulado[i]: bytes das chaves 0..i-1 comprimidas em sequência
+    int *acumulado = malloc((n + 1) * sizeof(int));
+    acumulado[0] = 0;
+    for (int i = 0; i < n; i++) {
+        acumulado[i + 1] = acumulado[i] +
+                           tamanho_chave_disco(&chaves[i], i > 0 ? &chaves[i - 1] : NULL, eh_folha);
+    }
     
-    if (pagina->eh_folha) {
-        // Insere diretamente na folha
-        while (i >= 0 && comparar_chaves(chave, &pagina->chaves[i]) < 0) {
-            pagina->chaves[i + 1] = pagina->chaves[i];
-            i--;
-        }
-        pagina->chaves[i + 1] = *chave;
-        pagina->num_chaves++;
-        
-        if (pagina == bd->raiz_ram) {
-            escrever_pagina(bd->arquivo_indice, pagina, pagina->offset_proprio);
-        }
-    } else {
-        // Encontra o filho onde deve inserir
-        while (i >= 0 && comparar_chaves(chave, &pagina->chaves[i]) < 0) {
-            i--;
-        }
-        i++;
+    int melhor = n / 2;
+    double melhor_ocupacao = -1;
+    bool melhor_valida = false;
+    int inicio_direita = copia ? 0 : 1;     // Primeira chave da direita: i + inicio_direita
+    for (int i = 1; i + inicio_direita < n; i++) {
+        int d = i + inicio_direita;
+        int bytes_esq = acumulado[i];
+        // A primeira chave da direita perde a compressão
+        int bytes_dir = tamanho_chave_disco(&chaves[d], NULL, eh_folha) +
+                        acumulado[n] - acumulado[d + 1];
+        int n_esq = i, n_dir = n - d;
+        bool valida = n_esq <= max_chaves && n_dir <= max_chaves &&
+                      bytes_esq <= TAM_UTIL_PAGINA && bytes_dir <= TAM_UTIL_PAGINA;
         
-        Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
+        double ocup_esq = (double)n_esq / max_chaves;
+        if ((double)bytes_esq / TAM_UTIL_PAGINA > ocup_esq) ocup_esq = (double)bytes_esq / TAM_UTIL_PAGINA;
+        double ocup_dir = (double)n_dir / max_chaves;
+        if ((double)bytes_dir / TAM_UTIL_PAGINA > ocup_dir) ocup_dir = (double)bytes_dir / TAM_UTIL_PAGINA;
+        double ocupacao = ocup_esq < ocup_dir ? ocup_esq : ocup_dir;
         
-        if (filho->num_chaves == MAX_CHAVES) {
-            // Filho está cheio, divide
-            dividir_filho(bd, pagina, i, filho);
-            
-            if (comparar_chaves(chave, &pagina->chaves[i]) > 0) {
-                i++;
-            }
-            
-            free(filho);
-            filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
+        if ((valida && !melhor_valida) || (valida == melhor_valida && ocupacao > melhor_ocupacao)) {
+            melhor = i;
+            melhor_ocupacao = ocupacao;
+            melhor_valida = valida;
         }
-        
-        inserir_nao_cheio(bd, filho, chave);
-        escrever_pagina(bd->arquivo_indice, filho, filho->offset_proprio);
-        free(filho);
     }
+    free(acumulado);
+    return melhor;
 }
 
+// Funções de métricas
+const char *NOMES_OPERACOES[NUM_OPERACOES] = {
+    "inserir", "buscar", "remover", "percurso", "compactar", "exportar"
+};
+
 /**
- * Insere uma chave na árvore
+ * Relógio de parede em segundos, para medir latência e vazão
  */
-void inserir(BancoDados *bd, Chave *chave) {
-    Pagina *raiz = bd->raiz_ram;
-    
-    if (raiz->num_chaves == MAX_CHAVES) {
-        // Raiz está cheia, cria nova raiz
-        Pagina *nova_raiz = criar_pagina(false);
-        nova_raiz->offset_proprio = alocar_pagina(bd);
-        nova_raiz->filhos[0] = raiz->offset_proprio;
-        
-        // Escreve a raiz antiga no disco
-        escrever_pagina(bd->arquivo_indice, raiz, raiz->offset_proprio);
-        
-        dividir_filho(bd, nova_raiz, 0, raiz);
-        
-        // Atualiza a raiz
-        bd->raiz_ram = nova_raiz;
-        free(raiz);
-        raiz = nova_raiz;
-        
-        bd->cabecalho.offset_raiz = nova_raiz->offset_proprio;
-        bd->cabecalho.altura++;
-        escrever_cabecalho(bd->arquivo_indice, &bd->cabecalho);
-    }
-    
-    inserir_nao_cheio(bd, raiz, chave);
-    escrever_pagina(bd->arquivo_indice, raiz, raiz->offset_proprio);
+double agora_segundos() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-//Funções de remoção
-Chave obter_predecessor(BancoDados *bd, Pagina *pagina, int idx) {
-    Pagina *atual = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-    while (!atual->eh_folha) {
-        Pagina *proximo = ler_pagina(bd->arquivo_indice, atual->filhos[atual->num_chaves]);
-        free(atual);
-        atual = proximo;
+/**
+ * Conta no histograma da operação o tempo decorrido desde o início
+ */
+void registrar_latencia(OperacaoMedida operacao, double inicio) {
+    double us = (agora_segundos() - inicio) * 1e6;
+    HistogramaLatencia *h = &metricas.latencias[operacao];
+    
+    int balde = 0;
+    while (balde < NUM_BALDES_LATENCIA - 1 && us >= (double)(1L << balde)) {
+        balde++;
     }
-    Chave pred = atual->chaves[atual->num_chaves - 1];
-    free(atual);
-    return pred;
+    h->baldes[balde]++;
+    h->contagem++;
+    h->total_us += us;
+    if (us > h->maximo_us) h->maximo_us = us;
 }
 
 /**
- * Obtém a chave sucessora (menor chave da subárvore direita)
+ * Estima um percentil pelo limite superior do balde onde ele cai
  */
-Chave obter_sucessor(BancoDados *bd, Pagina *pagina, int idx) {
-    Pagina *atual = ler_pagina(bd->arquivo_indice, pagina->filhos[idx + 1]);
-    while (!atual->eh_folha) {
-        Pagina *proximo = ler_pagina(bd->arquivo_indice, atual->filhos[0]);
-        free(atual);
-        atual = proximo;
+double percentil_histograma(HistogramaLatencia *h, double p) {
+    long alvo = (long)(p * h->contagem);
+    long acumulado = 0;
+    for (int i = 0; i < NUM_BALDES_LATENCIA; i++) {
+        acumulado += h->baldes[i];
+        if (acumulado > alvo) {
+            return (double)(1L << i);
+        }
     }
-    Chave suc = atual->chaves[0];
-    free(atual);
-    return suc;
+    return h->maximo_us;
 }
 
 /**
- * Faz merge de um filho com seu irmão
+ * Escreve contadores e histogramas em JSON
+ * Com compacto = true sai tudo em uma linha (modo em lote)
  */
-void merge(BancoDados *bd, Pagina *pagina, int idx) {
-    Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-    Pagina *irmao = ler_pagina(bd->arquivo_indice, pagina->filhos[idx + 1]);
-    
-    // Puxa a chave do pai para o filho
-    filho->chaves[filho->num_chaves] = pagina->chaves[idx];
-    filho->num_chaves++;
+void escrever_metricas_json(BancoDados *bd, FILE *saida, bool compacto) {
+    const char *nl = compacto ? "" : "\n";
+    const char *ind = compacto ? "" : "  ";
+    const char *sp = compacto ? "" : " ";
     
-    // Copia chaves do irmão
-    for (int i = 0; i < irmao->num_chaves; i++) {
-        filho->chaves[filho->num_chaves] = irmao->chaves[i];
-        filho->num_chaves++;
-    }
+    fprintf(saida, "{%s", nl);
+    fprintf(saida, "%s\"indice\":%s{\"ordem\":%d,\"bmais\":%s,\"altura\":%d,\"paginas\":%d,\"paginas_livres\":%d,"
+            "\"mmap\":%s},%s",
+            ind, sp, bd->cabecalho.ordem, MODO_BMAIS(bd) ? "true" : "false",
+            bd->cabecalho.altura, bd->cabecalho.num_paginas,
+            bd->cabecalho.num_paginas_livres, bd->mapa_indice ? "true" : "false", nl);
+    fprintf(saida, "%s\"buffer\":%s{\"quadros\":%d,\"capacidade\":%d,\"acertos\":%ld,\"faltas\":%ld},%s",
+            ind, sp, bd->buffer.num_quadros, bd->buffer.capacidade,
+            bd->buffer.acertos, bd->buffer.faltas, nl);
+    fprintf(saida, "%s\"es\":%s{\"paginas_lidas\":%ld,\"paginas_escritas\":%ld,\"cabecalhos_escritos\":%ld,"
+            "\"fseeks\":%ld,\"fflushes\":%ld,\"fsyncs\":%ld,\"bytes_lidos_indice\":%ld,\"bytes_escritos_indice\":%ld,"
+            "\"bytes_lidos_dados\":%ld,\"bytes_escritos_dados\":%ld},%s",
+            ind, sp, metricas.paginas_lidas, metricas.paginas_escritas, metricas.cabecalhos_escritos,
+            metricas.fseeks, metricas.fflushes, metricas.fsyncs,
+            metricas.bytes_lidos_indice, metricas.bytes_escritos_indice,
+            metricas.bytes_lidos_dados, metricas.bytes_escritos_dados, nl);
+    fprintf(saida, "%s\"log\":%s{\"ativo\":%s,\"commits\":%ld,\"bytes\":%ld,\"checkpoints\":%ld,\"refeitos\":%ld},%s",
+            ind, sp, bd->arquivo_log ? "true" : "false", metricas.commits_log, metricas.bytes_escritos_log,
+            metricas.checkpoints, metricas.commits_refeitos, nl);
+    fprintf(saida, "%s\"sombra\":%s{\"ativo\":%s,\"versao\":%lu,\"paginas_copiadas\":%ld,"
+            "\"liberacoes_pendentes\":%d,\"instantaneos\":%d},%s",
+            ind, sp, bd->paginas_sombra ? "true" : "false", bd->versao, metricas.copias_sombra,
+            bd->num_liberacoes, bd->num_instantaneos, nl);
+    fprintf(saida, "%s\"arvore\":%s{\"divisoes\":%ld,\"fusoes\":%ld,\"emprestimos\":%ld},%s",
+            ind, sp, metricas.divisoes, metricas.fusoes, metricas.emprestimos, nl);
+    fprintf(saida, "%s\"dados\":%s{\"registros_unicos\":%d,\"registros_reaproveitados\":%ld,"
+            "\"bytes_livres\":%ld,\"gravados_em_buracos\":%ld,"
+            "\"compactacao_ativa\":%s,\"chaves_migradas\":%ld,\"extensoes_copiadas\":%ld,"
+            "\"codificacoes\":{\"bytes\":%ld,\"bits\":%ld,\"rle\":%ld}},%s",
+            ind, sp, bd->registros.num_entradas, metricas.registros_reaproveitados,
+            bd->cabecalho.bytes_livres_dados, metricas.registros_em_buracos,
+            COMPACTANDO(bd) ? "true" : "false", metricas.chaves_migradas,
+            metricas.extensoes_copiadas,
+            metricas.registros_por_codificacao[CODIFICACAO_BYTES],
+            metricas.registros_por_codificacao[CODIFICACAO_BITS],
+            metricas.registros_por_codificacao[CODIFICACAO_RLE], nl);
     
-    // Copia filhos do irmão (se não for folha)
-    if (!filho->eh_folha) {
-        int pos = filho->num_chaves - irmao->num_chaves - 1;
-        for (int i = 0; i <= irmao->num_chaves; i++) {
-            filho->filhos[pos + i] = irmao->filhos[i];
+    fprintf(saida, "%s\"latencias_us\":%s{%s", ind, sp, nl);
+    for (int op = 0; op < NUM_OPERACOES; op++) {
+        HistogramaLatencia *h = &metricas.latencias[op];
+        fprintf(saida, "%s%s\"%s\":%s{\"n\":%ld,\"media\":%.2f,\"p50\":%.0f,\"p99\":%.0f,\"max\":%.2f,\"baldes\":[",
+                ind, ind, NOMES_OPERACOES[op], sp, h->contagem,
+                h->contagem > 0 ? h->total_us / h->contagem : 0.0,
+                h->contagem > 0 ? percentil_histograma(h, 0.50) : 0.0,
+                h->contagem > 0 ? percentil_histograma(h, 0.99) : 0.0,
+                h->maximo_us);
+        // Só os baldes não vazios: [limite superior em us, contagem]
+        bool primeiro = true;
+        for (int i = 0; i < NUM_BALDES_LATENCIA; i++) {
+            if (h->baldes[i] == 0) continue;
+            fprintf(saida, "%s[%ld,%ld]", primeiro ? "" : ",", 1L << i, h->baldes[i]);
+            primeiro = false;
         }
+        fprintf(saida, "]}%s%s", op < NUM_OPERACOES - 1 ? "," : "", nl);
     }
-    
-    for (int i = idx; i < pagina->num_chaves - 1; i++) {
-        pagina->chaves[i] = pagina->chaves[i + 1];
-    }
-    
-    for (int i = idx + 1; i < pagina->num_chaves; i++) {
-        pagina->filhos[i] = pagina->filhos[i + 1];
-    }
-    
-    pagina->num_chaves--;
-    
-    escrever_pagina(bd->arquivo_indice, filho, filho->offset_proprio);
-    escrever_pagina(bd->arquivo_indice, pagina, pagina->offset_proprio);
-    
-    free(filho);
-    free(irmao);
+    fprintf(saida, "%s}%s}\n", ind, nl);
 }
 
-void emprestar_do_anterior(BancoDados *bd, Pagina *pagina, int idx) {
-    Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-    Pagina *irmao = ler_pagina(bd->arquivo_indice, pagina->filhos[idx - 1]);
-    
-    // Move chaves do filho para frente
-    for (int i = filho->num_chaves - 1; i >= 0; i--) {
-        filho->chaves[i + 1] = filho->chaves[i];
-    }
-    
-    // Move filhos (se não for folha)
-    if (!filho->eh_folha) {
-        for (int i = filho->num_chaves; i >= 0; i--) {
-            filho->filhos[i + 1] = filho->filhos[i];
-        }
-    }
-    
-    filho->chaves[0] = pagina->chaves[idx - 1];
-    
-    pagina->chaves[idx - 1] = irmao->chaves[irmao->num_chaves - 1];
+// Funções de leitura e escrita de arquivos
+void escrever_cabecalho(FILE *arquivo, CabecalhoIndice *cab) {
+    fseek(arquivo, 0, SEEK_SET);
+    fwrite(cab, sizeof(CabecalhoIndice), 1, arquivo);
+    metricas.cabecalhos_escritos++;
+    metricas.fseeks++;
+    metricas.bytes_escritos_indice += sizeof(CabecalhoIndice);
+}
+
+/**
+ * Marca o cabeçalho em memória para ser gravado no próximo commit
+ */
+void marcar_cabecalho_sujo(BancoDados *bd) {
+    bd->cabecalho_sujo = true;
+}
+
+/**
+ * Lê o cabeçalho do arquivo de índice
+ */
+bool ler_cabecalho(FILE *arquivo, CabecalhoIndice *cab) {
+    fseek(arquivo, 0, SEEK_SET);
+    metricas.fseeks++;
+    if (fread(cab, sizeof(CabecalhoIndice), 1, arquivo) != 1) return false;
+    metricas.bytes_lidos_indice += sizeof(CabecalhoIndice);
+    return cab->magico == MAGICO_INDICE &&
+           cab->ordem >= ORDEM_MINIMA && cab->ordem <= ORDEM_MAXIMA;
+}
+
+/**
+ * Converte a página para o formato de disco (bloco de TAM_PAGINA bytes)
+ * Os slots seguem o cabeçalho e as células são gravadas do fim do bloco
+ * para trás, com o valor de cada chave comprimido contra o da anterior
+ */
+void serializar_pagina(const Pagina *pagina, unsigned char *buffer) {
+    memset(buffer, 0, TAM_PAGINA);
     
-    if (!filho->eh_folha) {
-        filho->filhos[0] = irmao->filhos[irmao->num_chaves];
+    SlotPagina *slots = (SlotPagina*)(buffer + sizeof(CabecalhoPagina));
+    int fim = TAM_PAGINA;
+    unsigned long long anterior = 0;
+    for (int i = 0; i < pagina->num_chaves; i++) {
+        const Chave *chave = &pagina->chaves[i];
+        unsigned long long valor = valor_chave(chave);
+        int prefixo = i > 0 ? prefixo_comum(valor, anterior) : 0;
+        int sufixo = TAM_VALOR_CHAVE - prefixo;
+        int tamanho = TAM_FIXO_CELULA - (int)sizeof(SlotPagina) + sufixo +
+                      (pagina->eh_folha ? 0 : (int)sizeof(long));
+        anterior = valor;
+        
+        fim -= tamanho;
+        if (fim < (int)(sizeof(CabecalhoPagina) + (i + 1) * sizeof(SlotPagina))) {
+            // Nunca deveria acontecer: as operações dividem páginas excedidas
+            fprintf(stderr, "[ERRO] Pagina %ld excede %d bytes\n", pagina->offset_proprio, TAM_PAGINA);
+            exit(1);
+        }
+        
+        unsigned char *celula = buffer + fim;
+        celula[0] = (unsigned char)prefixo;
+        for (int b = prefixo; b < TAM_VALOR_CHAVE; b++) {
+            celula[1 + b - prefixo] = (unsigned char)(valor >> (56 - 8 * b));
+        }
+        unsigned char *pos = celula + 1 + sufixo;
+        memcpy(pos, &chave->offset_dados, sizeof(long long));
+        if (!pagina->eh_folha) {
+            memcpy(pos + sizeof(long long), &pagina->filhos[i], sizeof(long));
+        }
+        slots[i] = (SlotPagina)fim;
     }
     
-    filho->num_chaves++;
-    irmao->num_chaves--;
-    
-    escrever_pagina(bd->arquivo_indice, filho, filho->offset_proprio);
-    escrever_pagina(bd->arquivo_indice, irmao, irmao->offset_proprio);
-    escrever_pagina(bd->arquivo_indice, pagina, pagina->offset_proprio);
-    
-    free(filho);
-    free(irmao);
+    CabecalhoPagina cab;
+    memset(&cab, 0, sizeof(CabecalhoPagina));
+    cab.num_chaves = pagina->num_chaves;
+    cab.eh_folha = pagina->eh_folha;
+    cab.offset_proprio = pagina->offset_proprio;
+    if (pagina->eh_folha) {
+        cab.ultimo_filho = pagina->proxima_folha;
+    } else {
+        cab.ultimo_filho = pagina->num_chaves < 0 ? -1 : pagina->filhos[pagina->num_chaves];
+    }
+    cab.inicio_celulas = fim;
+    memcpy(buffer, &cab, sizeof(CabecalhoPagina));
 }
 
 /**
- * Empresta uma chave do irmão seguinte
+ * Reconstrói as chaves a partir dos slots; cada valor completa o prefixo
+ * da chave anterior com o sufixo da célula
  */
-void emprestar_do_proximo(BancoDados *bd, Pagina *pagina, int idx) {
-    Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-    Pagina *irmao = ler_pagina(bd->arquivo_indice, pagina->filhos[idx + 1]);
+void desserializar_pagina(const unsigned char *buffer, int ordem, Pagina *pagina) {
+    CabecalhoPagina cab;
+    memcpy(&cab, buffer, sizeof(CabecalhoPagina));
+    pagina->num_chaves = cab.num_chaves;
+    pagina->eh_folha = cab.eh_folha;
+    pagina->offset_proprio = cab.offset_proprio;
+    // Página nunca gravada (zerada) ou marcada como inválida: sem chaves
+    int n = cab.num_chaves < 0 ? 0 : (cab.num_chaves > ordem ? ordem : cab.num_chaves);
     
-    // Move chave do pai para o filho
-    filho->chaves[filho->num_chaves] = pagina->chaves[idx];
+    const SlotPagina *slots = (const SlotPagina*)(buffer + sizeof(CabecalhoPagina));
+    unsigned long long valor = 0;
+    for (int i = 0; i < n; i++) {
+        const unsigned char *celula = buffer + slots[i];
+        Chave *chave = &pagina->chaves[i];
+        int prefixo = i > 0 && celula[0] <= TAM_VALOR_CHAVE ? celula[0] : 0;
+        if (prefixo < TAM_VALOR_CHAVE) {
+            valor = prefixo > 0 ? valor & (~0ULL << (64 - 8 * prefixo)) : 0;
+        }
+        for (int b = prefixo; b < TAM_VALOR_CHAVE; b++) {
+            valor |= (unsigned long long)celula[1 + b - prefixo] << (56 - 8 * b);
+        }
+        chave->id_nome = (unsigned int)(valor >> 32);
+        chave->limiar = (int)(unsigned int)valor;
+        const unsigned char *pos = celula + 1 + TAM_VALOR_CHAVE - prefixo;
+        memcpy(&chave->offset_dados, pos, sizeof(long long));
+        if (!pagina->eh_folha) {
+            memcpy(&pagina->filhos[i], pos + sizeof(long long), sizeof(long));
+        } else {
+            pagina->filhos[i] = -1;
+        }
+    }
+    pagina->filhos[n] = pagina->eh_folha ? -1 : cab.ultimo_filho;
+    pagina->proxima_folha = pagina->eh_folha ? cab.ultimo_filho : -1;
+}
+
+void escrever_pagina_arquivo(FILE *arquivo, Pagina *pagina, long offset) {
+    unsigned char buffer[TAM_PAGINA];
+    serializar_pagina(pagina, buffer);
+    fseek(arquivo, offset, SEEK_SET);
+    fwrite(buffer, TAM_PAGINA, 1, arquivo);
+    metricas.paginas_escritas++;
+    metricas.fseeks++;
+    metricas.bytes_escritos_indice += TAM_PAGINA;
+}
+
+/**
+ * Registra a alteração de uma página do buffer
+ * A gravação em disco fica para o próximo commit (ou para o descarte do quadro)
+ */
+void escrever_pagina(BancoDados *bd, Pagina *pagina) {
+    (void)bd;
+    pagina->quadro->sujo = true;
+}
+
+/**
+ * Grava uma página em indice.bin: no modo mmap, serializada direto no
+ * mapeamento; senão, com fseek + fwrite
+ */
+void gravar_pagina_indice(BancoDados *bd, Pagina *pagina, long offset) {
+    if (bd->mapa_indice && offset + TAM_PAGINA <= bd->tamanho_mapa) {
+        serializar_pagina(pagina, bd->mapa_indice + offset);
+        metricas.paginas_escritas++;
+        metricas.bytes_escritos_indice += TAM_PAGINA;
+        return;
+    }
+    escrever_pagina_arquivo(bd->arquivo_indice, pagina, offset);
+}
+
+void ler_pagina_disco(BancoDados *bd, long offset, Pagina *pagina) {
+    if (bd->mapa_indice && offset + TAM_PAGINA <= bd->tamanho_mapa) {
+        // Desserializa direto do mapeamento: sem fseek, fread nem cópia do bloco
+        metricas.paginas_lidas++;
+        metricas.bytes_lidos_indice += TAM_PAGINA;
+        desserializar_pagina(bd->mapa_indice + offset, bd->cabecalho.ordem, pagina);
+        return;
+    }
+    unsigned char buffer[TAM_PAGINA];
+    fseek(bd->arquivo_indice, offset, SEEK_SET);
+    metricas.fseeks++;
+    if (fread(buffer, TAM_PAGINA, 1, bd->arquivo_indice) != 1) {
+        memset(buffer, 0, TAM_PAGINA);
+    } else {
+        metricas.bytes_lidos_indice += TAM_PAGINA;
+    }
+    metricas.paginas_lidas++;
+    desserializar_pagina(buffer, bd->cabecalho.ordem, pagina);
+}
+
+// Funções do mapeamento do índice
+/**
+ * Mapeia indice.bin (modo mmap), estendendo o arquivo até pelo menos
+ * tamanho bytes, em passos de CRESCIMENTO_MAPA_INDICE: as páginas que
+ * alocar_pagina criar em seguida já caem dentro do mapeamento
+ * Nenhum ponteiro para o mapeamento sobrevive a uma leitura ou gravação
+ * (as páginas do buffer são desserializadas), então remapear é seguro
+ * Se falhar, o índice volta para fseek/fread
+ */
+bool mapear_indice(BancoDados *bd, long tamanho) {
+#ifndef _WIN32
+    if (bd->mapa_indice) {
+        munmap(bd->mapa_indice, (size_t)bd->tamanho_mapa);
+        bd->mapa_indice = NULL;
+        bd->tamanho_mapa = 0;
+    }
+    fflush(bd->arquivo_indice);
+    int fd = fileno(bd->arquivo_indice);
+    long capacidade = (tamanho + CRESCIMENTO_MAPA_INDICE - 1) / CRESCIMENTO_MAPA_INDICE * CRESCIMENTO_MAPA_INDICE;
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+    if ((long)st.st_size > capacidade) {
+        capacidade = (long)st.st_size;
+    } else if ((long)st.st_size < capacidade && ftruncate(fd, (off_t)capacidade) != 0) {
+        return false;
+    }
+    void *base = mmap(NULL, (size_t)capacidade, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) return false;
+    bd->mapa_indice = base;
+    bd->tamanho_mapa = capacidade;
+    return true;
+#else
+    (void)bd;
+    (void)tamanho;
+    return false;
+#endif
+}
+
+/**
+ * Desfaz o mapeamento e corta de indice.bin a sobra da última extensão
+ */
+void desmapear_indice(BancoDados *bd) {
+#ifndef _WIN32
+    if (!bd->mapa_indice) return;
+    munmap(bd->mapa_indice, (size_t)bd->tamanho_mapa);
+    bd->mapa_indice = NULL;
+    bd->tamanho_mapa = 0;
+    fflush(bd->arquivo_indice);
+    if (ftruncate(fileno(bd->arquivo_indice), (off_t)bd->cabecalho.proximo_offset) != 0) {
+        fprintf(stderr, "Aviso: nao foi possivel ajustar o tamanho de %s\n", ARQUIVO_INDICE);
+    }
+#else
+    (void)bd;
+#endif
+}
+
+// Funções do buffer de páginas
+void inicializar_buffer(BufferPaginas *buffer, int capacidade) {
+    if (capacidade < CAPACIDADE_BUFFER_MINIMA) capacidade = CAPACIDADE_BUFFER_MINIMA;
+    buffer->capacidade = capacidade;
+    buffer->num_baldes = 1;
+    while (buffer->num_baldes < 2 * capacidade) buffer->num_baldes *= 2;
+    buffer->baldes = calloc(buffer->num_baldes, sizeof(Quadro*));
+    buffer->num_quadros = 0;
+    buffer->lru_inicio = NULL;
+    buffer->lru_fim = NULL;
+    buffer->acertos = 0;
+    buffer->faltas = 0;
+}
+
+int balde_do_offset(BufferPaginas *buffer, long offset) {
+    return (int)((offset / TAM_PAGINA) & (buffer->num_baldes - 1));
+}
+
+Quadro* buscar_quadro(BufferPaginas *buffer, long offset) {
+    Quadro *q = buffer->baldes[balde_do_offset(buffer, offset)];
+    while (q != NULL && q->offset != offset) {
+        q = q->proximo_balde;
+    }
+    return q;
+}
+
+void remover_da_lru(BufferPaginas *buffer, Quadro *q) {
+    if (q->anterior_lru) q->anterior_lru->proximo_lru = q->proximo_lru;
+    else buffer->lru_inicio = q->proximo_lru;
+    if (q->proximo_lru) q->proximo_lru->anterior_lru = q->anterior_lru;
+    else buffer->lru_fim = q->anterior_lru;
+    q->anterior_lru = q->proximo_lru = NULL;
+}
+
+void inserir_na_lru(BufferPaginas *buffer, Quadro *q) {
+    q->anterior_lru = NULL;
+    q->proximo_lru = buffer->lru_inicio;
+    if (buffer->lru_inicio) buffer->lru_inicio->anterior_lru = q;
+    buffer->lru_inicio = q;
+    if (!buffer->lru_fim) buffer->lru_fim = q;
+}
+
+void inserir_no_balde(BufferPaginas *buffer, Quadro *q) {
+    int b = balde_do_offset(buffer, q->offset);
+    q->proximo_balde = buffer->baldes[b];
+    buffer->baldes[b] = q;
+}
+
+void remover_do_balde(BufferPaginas *buffer, Quadro *q) {
+    Quadro **ref = &buffer->baldes[balde_do_offset(buffer, q->offset)];
+    while (*ref != q) ref = &(*ref)->proximo_balde;
+    *ref = q->proximo_balde;
+}
+
+/**
+ * Obtém um quadro para um novo offset
+ * Reaproveita o quadro sem pino menos usado quando o buffer está cheio;
+ * se todos estiverem presos (ou, com o log, sujos), cresce além da
+ * capacidade temporariamente
+ */
+Quadro* obter_quadro(BancoDados *bd, long offset) {
+    BufferPaginas *buffer = &bd->buffer;
+    Quadro *q = NULL;
     
-    // Move primeiro filho do irmão
-    if (!filho->eh_folha) {
-        filho->filhos[filho->num_chaves + 1] = irmao->filhos[0];
+    if (buffer->num_quadros >= buffer->capacidade) {
+        for (Quadro *v = buffer->lru_fim; v != NULL; v = v->anterior_lru) {
+            // Com o log, uma página suja só vai para o disco no commit
+            if (v->pinos == 0 && !(v->sujo && bd->arquivo_log)) {
+                q = v;
+                break;
+            }
+        }
     }
     
-    // Move primeira chave do irmão para o pai
-    pagina->chaves[idx] = irmao->chaves[0];
+    if (q) {
+        // Página modificada sai do buffer: grava antes de reaproveitar o quadro
+        if (q->sujo) {
+            gravar_pagina_indice(bd, q->pagina, q->offset);
+        }
+        remover_da_lru(buffer, q);
+        remover_do_balde(buffer, q);
+    } else {
+        q = calloc(1, sizeof(Quadro));
+        q->pagina = alocar_memoria_pagina(bd->cabecalho.ordem);
+        q->pagina->quadro = q;
+        buffer->num_quadros++;
+    }
     
-    // Move chaves do irmão
-    for (int i = 1; i < irmao->num_chaves; i++) {
-        irmao->chaves[i - 1] = irmao->chaves[i];
+    q->offset = offset;
+    q->pinos = 1;
+    q->sujo = false;
+    inserir_no_balde(buffer, q);
+    inserir_na_lru(buffer, q);
+    return q;
+}
+
+void descartar_quadro(BufferPaginas *buffer, Quadro *q) {
+    remover_da_lru(buffer, q);
+    remover_do_balde(buffer, q);
+    free(q->pagina);
+    free(q);
+    buffer->num_quadros--;
+}
+
+/**
+ * Esvazia o buffer (usado quando o arquivo de índice é substituído)
+ */
+void limpar_buffer(BufferPaginas *buffer) {
+    while (buffer->lru_inicio) {
+        descartar_quadro(buffer, buffer->lru_inicio);
     }
+}
+
+void destruir_buffer(BufferPaginas *buffer) {
+    limpar_buffer(buffer);
+    free(buffer->baldes);
+    buffer->baldes = NULL;
+}
+
+/**
+ * Lê uma página do índice através do buffer
+ * A página volta presa (pin) e deve ser devolvida com liberar_pagina
+ */
+Pagina* ler_pagina(BancoDados *bd, long offset) {
+    if (offset == -1) return NULL;
     
-    // Move filhos do irmão
-    if (!irmao->eh_folha) {
-        for (int i = 1; i <= irmao->num_chaves; i++) {
-            irmao->filhos[i - 1] = irmao->filhos[i];
-        }
+    Quadro *q = buscar_quadro(&bd->buffer, offset);
+    if (q) {
+        bd->buffer.acertos++;
+        q->pinos++;
+        remover_da_lru(&bd->buffer, q);
+        inserir_na_lru(&bd->buffer, q);
+        return q->pagina;
     }
     
-    filho->num_chaves++;
-    irmao->num_chaves--;
+    bd->buffer.faltas++;
+    q = obter_quadro(bd, offset);
+    ler_pagina_disco(bd, offset, q->pagina);
+    return q->pagina;
+}
+
+/**
+ * Devolve uma página ao buffer (unpin)
+ */
+void liberar_pagina(BancoDados *bd, Pagina *pagina) {
+    if (pagina == NULL) return;
     
-    escrever_pagina(bd->arquivo_indice, filho, filho->offset_proprio);
-    escrever_pagina(bd->arquivo_indice, irmao, irmao->offset_proprio);
-    escrever_pagina(bd->arquivo_indice, pagina, pagina->offset_proprio);
+    Quadro *q = pagina->quadro;
+    q->pinos--;
     
-    free(filho);
-    free(irmao);
+    // Quadro extra criado com o buffer todo preso: sai assim que é solto
+    // (com o log, se estiver sujo, só depois do commit)
+    if (q->pinos == 0 && bd->buffer.num_quadros > bd->buffer.capacidade &&
+        !(q->sujo && bd->arquivo_log)) {
+        if (q->sujo) {
+            gravar_pagina_indice(bd, q->pagina, q->offset);
+        }
+        descartar_quadro(&bd->buffer, q);
+    }
 }
 
 /**
- * Preenche um filho que tem poucas chaves
+ * Reserva o offset de uma página nova: reaproveita a primeira da lista de
+ * páginas livres e só estende o arquivo quando a lista está vazia
  */
-void preencher(BancoDados *bd, Pagina *pagina, int idx) {
-    // Tenta emprestar do irmão anterior
-    if (idx != 0) {
-        Pagina *irmao_ant = ler_pagina(bd->arquivo_indice, pagina->filhos[idx - 1]);
-        // Só empresta se irmão tem mais que MIN_CHAVES
-        if (irmao_ant->num_chaves > MIN_CHAVES) {
-            free(irmao_ant);
-            emprestar_do_anterior(bd, pagina, idx);
-            return;
+long alocar_pagina(BancoDados *bd) {
+    long offset = bd->cabecalho.primeira_livre;
+    if (offset > 0 && offset < bd->cabecalho.proximo_offset) {
+        Pagina *livre = ler_pagina(bd, offset);
+        if (livre->num_chaves == -1) {
+            bd->cabecalho.primeira_livre = livre->proxima_folha;
+            bd->cabecalho.num_paginas_livres--;
+        } else {
+            offset = 0;
         }
-        free(irmao_ant);
+        liberar_pagina(bd, livre);
+    } else {
+        offset = 0;
     }
-    
-    // Tenta emprestar do irmão seguinte
-    if (idx != pagina->num_chaves) {
-        Pagina *irmao_prox = ler_pagina(bd->arquivo_indice, pagina->filhos[idx + 1]);
-        // Só empresta se irmão tem mais que MIN_CHAVES
-        if (irmao_prox->num_chaves > MIN_CHAVES) {
-            free(irmao_prox);
-            emprestar_do_proximo(bd, pagina, idx);
-            return;
+    if (offset == 0 && bd->cabecalho.primeira_livre > 0) {
+        // Lista mais nova que o cabeçalho gravado (queda no meio de um commit
+        // do modo sombra): descarta o resto dela, que a compactação recupera
+        bd->cabecalho.primeira_livre = 0;
+        bd->cabecalho.num_paginas_livres = 0;
+    }
+    if (offset == 0) {
+        offset = bd->cabecalho.proximo_offset;
+        bd->cabecalho.proximo_offset += TAM_PAGINA;
+        if (bd->mapa_indice && bd->cabecalho.proximo_offset > bd->tamanho_mapa) {
+            mapear_indice(bd, bd->cabecalho.proximo_offset);
         }
-        free(irmao_prox);
     }
+    bd->cabecalho.num_paginas++;
+    marcar_cabecalho_sujo(bd);
+    return offset;
+}
+
+/**
+ * Põe uma página presa no início da lista de páginas livres
+ * Em disco ela fica com num_chaves = -1 e o campo do encadeamento das folhas
+ * aponta para a próxima página livre
+ */
+void empilhar_pagina_livre(BancoDados *bd, Pagina *pagina) {
+    pagina->num_chaves = -1;
+    pagina->eh_folha = true;
+    pagina->proxima_folha = bd->cabecalho.primeira_livre;
+    escrever_pagina(bd, pagina);
     
-    // Não pode emprestar: faz merge
-    // Dá preferência para merge com irmão direito se ele estiver vazio
-    if (idx != pagina->num_chaves) {
-        Pagina *irmao_dir = ler_pagina(bd->arquivo_indice, pagina->filhos[idx + 1]);
-        if (irmao_dir->num_chaves == 0) {
-            free(irmao_dir);
-            merge(bd, pagina, idx);  // Merge com irmão direito vazio
-            return;
+    bd->cabecalho.primeira_livre = pagina->offset_proprio;
+    bd->cabecalho.num_paginas_livres++;
+    marcar_cabecalho_sujo(bd);
+}
+
+/**
+ * No modo sombra, uma página limpa no buffer pertence à versão confirmada:
+ * as criadas ou copiadas depois do último commit ficam sujas até ele (se
+ * uma delas sair do buffer antes, é só copiada de novo)
+ */
+bool pagina_confirmada(BancoDados *bd, Pagina *pagina) {
+    return bd->paginas_sombra && !pagina->quadro->sujo;
+}
+
+/**
+ * Devolve uma página presa que saiu da árvore para a lista de páginas
+ * livres; a página continua presa e deve ser solta com liberar_pagina
+ * No modo sombra, uma página da versão confirmada fica intacta até ninguém
+ * mais poder lê-la (ver liberar_versoes)
+ */
+void devolver_pagina(BancoDados *bd, Pagina *pagina) {
+    bd->cabecalho.num_paginas--;
+    marcar_cabecalho_sujo(bd);
+    if (pagina_confirmada(bd, pagina)) {
+        adiar_liberacao(bd, pagina->offset_proprio, true);
+        return;
+    }
+    empilhar_pagina_livre(bd, pagina);
+}
+
+// Funções de versões e instantâneos (modo sombra)
+/**
+ * Instantâneo: a versão confirmada do índice no momento em que foi aberto
+ * Enquanto ele estiver aberto, nenhuma página ou registro dessa versão é
+ * reaproveitado, então um cursor aberto nele (cursor_abrir_instantaneo)
+ * continua lendo a mesma versão durante inserções, remoções e commits
+ */
+typedef struct Instantaneo {
+    long offset_raiz;
+    int altura;
+    unsigned long versao;
+    struct Instantaneo *proximo;         // Lista dos instantâneos abertos
+} Instantaneo;
+
+/**
+ * Guarda uma página ou referência de registro que a transação atual deixou
+ * de usar, para liberar depois do commit
+ */
+void adiar_liberacao(BancoDados *bd, long long offset, bool pagina) {
+    if (bd->num_liberacoes == bd->capacidade_liberacoes) {
+        bd->capacidade_liberacoes = bd->capacidade_liberacoes > 0 ? 2 * bd->capacidade_liberacoes : 64;
+        bd->liberacoes = realloc(bd->liberacoes, bd->capacidade_liberacoes * sizeof(Liberacao));
+    }
+    Liberacao *liberacao = &bd->liberacoes[bd->num_liberacoes++];
+    liberacao->offset = offset;
+    liberacao->versao = bd->versao + 1;  // Versão que o próximo commit cria
+    liberacao->pagina = pagina;
+}
+
+/**
+ * Libera o que commits já confirmados deixaram de usar e nenhum instantâneo
+ * aberto ainda lê: as páginas vão para a lista livre e os registros perdem
+ * a referência (e viram buracos se ficarem sem nenhuma)
+ */
+void liberar_versoes(BancoDados *bd) {
+    unsigned long limite = bd->versao;
+    for (Instantaneo *inst = bd->instantaneos; inst != NULL; inst = inst->proximo) {
+        if (inst->versao < limite) limite = inst->versao;
+    }
+    
+    int liberadas = 0;
+    while (liberadas < bd->num_liberacoes && bd->liberacoes[liberadas].versao <= limite) {
+        Liberacao *liberacao = &bd->liberacoes[liberadas++];
+        if (liberacao->pagina) {
+            Pagina *pagina = ler_pagina(bd, liberacao->offset);
+            empilhar_pagina_livre(bd, pagina);
+            liberar_pagina(bd, pagina);
+        } else {
+            alterar_referencias(bd, liberacao->offset, -1);
         }
-        free(irmao_dir);
-        merge(bd, pagina, idx);
-    } else {
-        merge(bd, pagina, idx - 1);
     }
+    bd->num_liberacoes -= liberadas;
+    memmove(bd->liberacoes, bd->liberacoes + liberadas, bd->num_liberacoes * sizeof(Liberacao));
 }
 
 /**
- * Remove uma chave de uma folha
+ * Abre um instantâneo da versão confirmada (só no modo sombra)
+ * As alterações ainda sem commit não fazem parte dele
  */
-void remover_de_folha(Pagina *pagina, int idx) {
-    for (int i = idx + 1; i < pagina->num_chaves; i++) {
-        pagina->chaves[i - 1] = pagina->chaves[i];
+bool abrir_instantaneo(BancoDados *bd, Instantaneo *inst) {
+    if (!bd->paginas_sombra) {
+        return false;
     }
-    pagina->num_chaves--;
+    inst->offset_raiz = bd->raiz_confirmada;
+    inst->altura = bd->altura_confirmada;
+    inst->versao = bd->versao;
+    inst->proximo = bd->instantaneos;
+    bd->instantaneos = inst;
+    bd->num_instantaneos++;
+    return true;
 }
 
 /**
- * Remove uma chave de um nó interno
+ * Fecha um instantâneo (os cursores abertos nele precisam estar fechados)
+ * O que só ele segurava é liberado na hora
  */
-void remover_de_nao_folha(BancoDados *bd, Pagina *pagina, int idx) {
-    Chave chave = pagina->chaves[idx];
+void fechar_instantaneo(BancoDados *bd, Instantaneo *inst) {
+    Instantaneo **ref = &bd->instantaneos;
+    while (*ref != NULL && *ref != inst) {
+        ref = &(*ref)->proximo;
+    }
+    if (*ref == NULL) {
+        return;
+    }
+    *ref = inst->proximo;
+    bd->num_instantaneos--;
+    liberar_versoes(bd);
+}
+
+// Funções do log de escrita antecipada
+/**
+ * Leva um arquivo até o disco: fflush e fsync (_commit no Windows)
+ */
+void sincronizar_arquivo(FILE *arquivo) {
+    fflush(arquivo);
+#ifndef _WIN32
+    fsync(fileno(arquivo));
+#else
+    _commit(_fileno(arquivo));
+#endif
+    metricas.fflushes++;
+    metricas.fsyncs++;
+}
+
+/**
+ * Grava um bloco de página já serializado em indice.bin (no mapeamento, no
+ * modo mmap)
+ */
+void escrever_bloco_indice(BancoDados *bd, const unsigned char *bloco, long offset) {
+    if (bd->mapa_indice && offset + TAM_PAGINA <= bd->tamanho_mapa) {
+        memcpy(bd->mapa_indice + offset, bloco, TAM_PAGINA);
+    } else {
+        fseek(bd->arquivo_indice, offset, SEEK_SET);
+        fwrite(bloco, TAM_PAGINA, 1, bd->arquivo_indice);
+        metricas.fseeks++;
+    }
+    metricas.paginas_escritas++;
+    metricas.bytes_escritos_indice += TAM_PAGINA;
+}
+
+/**
+ * Monta o commit no log: cabeçalho, pares (offset, página serializada), o
+ * cabeçalho do índice e os nomes ainda não gravados em nomes.bin (chamada
+ * antes de gravar_dicionario). Retorna o bloco inteiro (tamanho em *tamanho)
+ */
+unsigned char* montar_commit_log(BancoDados *bd, Quadro **sujos, int num_sujos, long *tamanho) {
+    DicionarioNomes *dic = &bd->nomes;
+    int tamanho_nomes = 0;
+    for (int id = dic->num_gravados; id < dic->num_nomes; id++) {
+        tamanho_nomes += 1 + (int)strlen(dic->nomes[id]);
+    }
     
-    Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-    Pagina *irmao = ler_pagina(bd->arquivo_indice, pagina->filhos[idx + 1]);
+    long tam_entrada = (long)sizeof(long) + TAM_PAGINA;
+    *tamanho = (long)sizeof(CabecalhoLog) + num_sujos * tam_entrada + (long)sizeof(CabecalhoIndice) +
+               tamanho_nomes;
+    unsigned char *commit = malloc(*tamanho);
     
-    if (filho->num_chaves > MIN_CHAVES) {
-        // Substitui pela chave predecessora
-        Chave pred = obter_predecessor(bd, pagina, idx);
-        pagina->chaves[idx] = pred;
-        free(filho);
-        free(irmao);
-        
-        filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-        remover_recursivo(bd, filho, &pred);
-        escrever_pagina(bd->arquivo_indice, filho, filho->offset_proprio);
-        free(filho);
-    } else if (irmao->num_chaves > MIN_CHAVES) {
-        // Substitui pela chave sucessora
-        Chave suc = obter_sucessor(bd, pagina, idx);
-        pagina->chaves[idx] = suc;
-        free(filho);
-        free(irmao);
-        
-        irmao = ler_pagina(bd->arquivo_indice, pagina->filhos[idx + 1]);
-        remover_recursivo(bd, irmao, &suc);
-        escrever_pagina(bd->arquivo_indice, irmao, irmao->offset_proprio);
-        free(irmao);
-    } else {
-        // Ambos filhos têm MIN_CHAVES: faz merge e remove do resultado
-        free(filho);
-        free(irmao);
-        merge(bd, pagina, idx);
-        // Após merge, a chave já foi movida para o filho fundido
-        // Agora remove do filho fundido
-        filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-        remover_recursivo(bd, filho, &chave);
-        escrever_pagina(bd->arquivo_indice, filho, filho->offset_proprio);
-        free(filho);
+    unsigned char *p = commit + sizeof(CabecalhoLog);
+    for (int i = 0; i < num_sujos; i++) {
+        memcpy(p, &sujos[i]->offset, sizeof(long));
+        serializar_pagina(sujos[i]->pagina, p + sizeof(long));
+        p += tam_entrada;
+    }
+    memcpy(p, &bd->cabecalho, sizeof(CabecalhoIndice));
+    p += sizeof(CabecalhoIndice);
+    for (int id = dic->num_gravados; id < dic->num_nomes; id++) {
+        unsigned char tam = (unsigned char)strlen(dic->nomes[id]);
+        *p++ = tam;
+        memcpy(p, dic->nomes[id], tam);
+        p += tam;
     }
+    
+    CabecalhoLog cab;
+    memset(&cab, 0, sizeof(cab));
+    cab.magico = MAGICO_LOG;
+    cab.num_paginas = num_sujos;
+    cab.num_nomes = dic->num_nomes;
+    cab.tamanho_nomes = tamanho_nomes;
+    cab.offset_nomes = dic->fim_arquivo;
+    cab.soma = hash_fnv(14695981039346656037ULL, commit + sizeof(CabecalhoLog),
+                        *tamanho - sizeof(CabecalhoLog));
+    memcpy(commit, &cab, sizeof(CabecalhoLog));
+    return commit;
 }
 
 /**
- * Remove uma chave recursivamente
+ * Checkpoint: com indice.bin no disco, os commits do log já não são
+ * necessários e o log recomeça vazio
  */
-void remover_recursivo(BancoDados *bd, Pagina *pagina, Chave *chave) {
-    int idx = buscar_posicao(pagina, chave);
+void checkpoint_log(BancoDados *bd) {
+#ifndef _WIN32
+    if (bd->mapa_indice) {
+        msync(bd->mapa_indice, (size_t)bd->tamanho_mapa, MS_SYNC);
+    }
+#endif
+    sincronizar_arquivo(bd->arquivo_indice);
+    if (bd->nomes.arquivo) sincronizar_arquivo(bd->nomes.arquivo);
+    bd->arquivo_log = freopen(ARQUIVO_LOG, "w+b", bd->arquivo_log);
+    metricas.checkpoints++;
+}
+
+/**
+ * Reaplica em indice.bin e nomes.bin os commits completos do log
+ * (recuperação depois de uma queda) e apaga o log
+ * Os commits guardam páginas e nomes inteiros, então refazer um commit que
+ * já chegou aos arquivos não muda nada
+ * Retorna o número de commits refeitos
+ */
+int refazer_log(FILE *arquivo_indice) {
+    FILE *log = fopen(ARQUIVO_LOG, "rb");
+    if (!log) {
+        return 0;
+    }
     
-    if (idx < pagina->num_chaves && comparar_chaves(chave, &pagina->chaves[idx]) == 0) {
-        if (pagina->eh_folha) {
-            remover_de_folha(pagina, idx);
-        } else {
-            remover_de_nao_folha(bd, pagina, idx);
-        }
-    } else {
-        if (pagina->eh_folha) {
-            return; // Chave não encontrada
+    FILE *arquivo_nomes = NULL;
+    long tam_entrada = (long)sizeof(long) + TAM_PAGINA;
+    int refeitos = 0;
+    CabecalhoLog cab;
+    while (fread(&cab, sizeof(CabecalhoLog), 1, log) == 1) {
+        if (cab.magico != MAGICO_LOG || cab.num_paginas < 0 || cab.tamanho_nomes < 0) break;
+        long tamanho = cab.num_paginas * tam_entrada + (long)sizeof(CabecalhoIndice) + cab.tamanho_nomes;
+        unsigned char *corpo = malloc(tamanho);
+        if (fread(corpo, 1, tamanho, log) != (size_t)tamanho ||
+            hash_fnv(14695981039346656037ULL, corpo, tamanho) != cab.soma) {
+            free(corpo);
+            break;                       // Commit interrompido: não chegou a valer
         }
         
-        bool flag = (idx == pagina->num_chaves);
-        
-        // Preenche preventivamente se o filho está no mínimo
-        Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-        if (filho->num_chaves <= MIN_CHAVES) {
-            free(filho);
-            preencher(bd, pagina, idx);
-            
-            // Após preencher, recarrega o filho correto
-            if (flag && idx > pagina->num_chaves) {
-                filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx - 1]);
-            } else {
-                filho = ler_pagina(bd->arquivo_indice, pagina->filhos[idx]);
-            }
+        unsigned char *p = corpo;
+        for (int i = 0; i < cab.num_paginas; i++) {
+            long offset;
+            memcpy(&offset, p, sizeof(long));
+            fseek(arquivo_indice, offset, SEEK_SET);
+            fwrite(p + sizeof(long), TAM_PAGINA, 1, arquivo_indice);
+            p += tam_entrada;
         }
+        fseek(arquivo_indice, 0, SEEK_SET);
+        fwrite(p, sizeof(CabecalhoIndice), 1, arquivo_indice);
+        p += sizeof(CabecalhoIndice);
         
-        remover_recursivo(bd, filho, chave);
-        escrever_pagina(bd->arquivo_indice, filho, filho->offset_proprio);
-        free(filho);
+        if (cab.tamanho_nomes > 0 && (arquivo_nomes || (arquivo_nomes = fopen(ARQUIVO_NOMES, "r+b")))) {
+            CabecalhoNomes cab_nomes = {MAGICO_NOMES, cab.num_nomes};
+            fseek(arquivo_nomes, cab.offset_nomes, SEEK_SET);
+            fwrite(p, 1, cab.tamanho_nomes, arquivo_nomes);
+            fseek(arquivo_nomes, 0, SEEK_SET);
+            fwrite(&cab_nomes, sizeof(CabecalhoNomes), 1, arquivo_nomes);
+        }
+        free(corpo);
+        refeitos++;
+    }
+    fclose(log);
+    
+    if (arquivo_nomes) {
+        sincronizar_arquivo(arquivo_nomes);
+        fclose(arquivo_nomes);
+    }
+    if (refeitos > 0) {
+        sincronizar_arquivo(arquivo_indice);
     }
+    remove(ARQUIVO_LOG);
+    metricas.commits_refeitos += refeitos;
+    return refeitos;
+}
+
+int comparar_quadros_por_offset(const void *a, const void *b) {
+    long oa = (*(Quadro* const*)a)->offset;
+    long ob = (*(Quadro* const*)b)->offset;
+    return (oa > ob) - (oa < ob);
 }
 
 /**
- * Remove uma chave da árvore
+ * Commit: grava de uma vez as páginas sujas (em ordem de offset) e o
+ * cabeçalho, com um único fflush por arquivo
+ * Com o log, as páginas e o cabeçalho vão antes para indice.log, com um
+ * único fsync: o commit vale inteiro ou não vale, e indice.bin dispensa o
+ * fflush (só é sincronizado no checkpoint)
+ * No modo sombra as páginas sujas são todas novas (nenhuma da versão
+ * confirmada é regravada): elas chegam ao disco com um fsync antes do
+ * cabeçalho, e a gravação do cabeçalho (um setor) troca a raiz de uma vez
  */
-bool remover(BancoDados *bd, Chave *chave) {
-    if (!buscar(bd, chave, NULL)) {
-        return false;
+void confirmar(BancoDados *bd) {
+    // Registros antes das páginas que apontam para eles
+    fflush(bd->arquivo_dados);
+    if (bd->arquivo_novo) fflush(bd->arquivo_novo);
+    metricas.fflushes++;
+    
+    BufferPaginas *buffer = &bd->buffer;
+    Quadro **sujos = malloc(buffer->num_quadros * sizeof(Quadro*));
+    int num_sujos = 0;
+    
+    for (Quadro *q = buffer->lru_inicio; q != NULL; q = q->proximo_lru) {
+        if (q->sujo) sujos[num_sujos++] = q;
     }
+    qsort(sujos, num_sujos, sizeof(Quadro*), comparar_quadros_por_offset);
     
-    remover_recursivo(bd, bd->raiz_ram, chave);
+    bool gravou_cabecalho = bd->cabecalho_sujo;
+    bool commit_log = bd->arquivo_log && (num_sujos > 0 || gravou_cabecalho ||
+                                          bd->nomes.num_gravados < bd->nomes.num_nomes);
+    bool commit_sombra = bd->paginas_sombra && (num_sujos > 0 || gravou_cabecalho);
+    if ((commit_log || commit_sombra) && metricas.bytes_escritos_dados != bd->bytes_dados_sincronizados) {
+        // Registros que as páginas usam chegam ao disco antes do commit (com
+        // o log, os nomes novos vão no próprio commit)
+        sincronizar_arquivo(bd->arquivo_dados);
+        if (bd->arquivo_novo) sincronizar_arquivo(bd->arquivo_novo);
+        bd->bytes_dados_sincronizados = metricas.bytes_escritos_dados;
+    }
     
-    // Se a raiz ficou vazia
-    if (bd->raiz_ram->num_chaves == 0) {
-        if (!bd->raiz_ram->eh_folha) {
-            // Raiz interna vazia: promove o único filho restante
-            long novo_offset_raiz = bd->raiz_ram->filhos[0];
-            Pagina *nova_raiz = ler_pagina(bd->arquivo_indice, novo_offset_raiz);
-            
-            // Marca a antiga raiz como inválida
-            long offset_raiz_antiga = bd->raiz_ram->offset_proprio;
-            bd->raiz_ram->num_chaves = -1;
-            escrever_pagina(bd->arquivo_indice, bd->raiz_ram, offset_raiz_antiga);
-            
-            free(bd->raiz_ram);
-            bd->raiz_ram = nova_raiz;
-            
-            bd->cabecalho.offset_raiz = novo_offset_raiz;
-            bd->cabecalho.altura--;
-            escrever_cabecalho(bd->arquivo_indice, &bd->cabecalho);
-            
-            // Escreve nova raiz
-            escrever_pagina(bd->arquivo_indice, bd->raiz_ram, bd->raiz_ram->offset_proprio);
-            return true;
-        }
+    unsigned char *commit = NULL;
+    if (commit_log) {
+        long tamanho;
+        commit = montar_commit_log(bd, sujos, num_sujos, &tamanho);
+        fwrite(commit, 1, tamanho, bd->arquivo_log);
+        sincronizar_arquivo(bd->arquivo_log);
+        metricas.commits_log++;
+        metricas.bytes_escritos_log += tamanho;
     }
     
-    // Limpa filhos vazios após remoção (múltiplas passadas se necessário)
-    bool houve_merge = true;
-    while (houve_merge && !bd->raiz_ram->eh_folha && bd->raiz_ram->num_chaves > 0) {
-        houve_merge = false;
-        for (int i = 0; i <= bd->raiz_ram->num_chaves; i++) {
-            Pagina *filho = ler_pagina(bd->arquivo_indice, bd->raiz_ram->filhos[i]);
-            if (filho->num_chaves == 0) {
-                free(filho);
-                // Funde filho vazio com irmão
-                if (i > 0) {
-                    merge(bd, bd->raiz_ram, i - 1);
-                    houve_merge = true;
-                    break;
-                } else if (i < bd->raiz_ram->num_chaves) {
-                    merge(bd, bd->raiz_ram, i);
-                    houve_merge = true;
-                    break;
-                }
-            } else {
-                free(filho);
-            }
+    // Nomes novos vão para o dicionário junto com as páginas que usam seus ids
+    int nomes_gravados = bd->nomes.num_gravados;
+    gravar_dicionario(&bd->nomes);
+    
+    for (int i = 0; i < num_sujos; i++) {
+        if (commit) {
+            // Mesma imagem que foi para o log
+            escrever_bloco_indice(bd, commit + sizeof(CabecalhoLog) +
+                                  i * ((long)sizeof(long) + TAM_PAGINA) + sizeof(long),
+                                  sujos[i]->offset);
+        } else {
+            gravar_pagina_indice(bd, sujos[i]->pagina, sujos[i]->offset);
         }
+        sujos[i]->sujo = false;
     }
+    free(sujos);
+    free(commit);
     
-    escrever_pagina(bd->arquivo_indice, bd->raiz_ram, bd->raiz_ram->offset_proprio);
+    if (commit_sombra) {
+        // Tudo que a raiz nova alcança já está no disco antes de ela valer
+        sincronizar_arquivo(bd->arquivo_indice);
+        if (bd->nomes.num_gravados != nomes_gravados) {
+            sincronizar_arquivo(bd->nomes.arquivo);
+        }
+    }
     
-    // Verifica novamente se raiz ficou vazia após merges
-    if (bd->raiz_ram->num_chaves == 0 && !bd->raiz_ram->eh_folha) {
-        long novo_offset_raiz = bd->raiz_ram->filhos[0];
-        Pagina *nova_raiz = ler_pagina(bd->arquivo_indice, novo_offset_raiz);
+    if (gravou_cabecalho) {
+        escrever_cabecalho(bd->arquivo_indice, &bd->cabecalho);
+        bd->cabecalho_sujo = false;
+    }
+    
+    if (commit_sombra) {
+        sincronizar_arquivo(bd->arquivo_indice);
+        bd->versao++;
+        bd->raiz_confirmada = bd->cabecalho.offset_raiz;
+        bd->altura_confirmada = bd->cabecalho.altura;
+    } else if (num_sujos > 0 || gravou_cabecalho) {
+        if (!bd->arquivo_log) {
+            fflush(bd->arquivo_indice);
+            metricas.fflushes++;
+        }
+        bd->versao++;
+    }
+    bd->ops_pendentes = 0;
+    
+    if (bd->num_liberacoes > 0) {
+        // Páginas e registros que a versão anterior usava (as alterações
+        // vão no próximo commit)
+        liberar_versoes(bd);
+    }
+    if (bd->num_buracos_pendentes > 0) {
+        // O índice confirmado já não aponta para eles: o próximo grupo pode
+        // reaproveitar o espaço
+        ligar_buracos_pendentes(bd);
+    }
+    
+    if (bd->arquivo_log) {
+        // Quadros extras que seguravam páginas sujas já podem sair
+        for (Quadro *q = buffer->lru_fim; q != NULL && buffer->num_quadros > buffer->capacidade; ) {
+            Quadro *anterior = q->anterior_lru;
+            if (q->pinos == 0) descartar_quadro(buffer, q);
+            q = anterior;
+        }
+        if (ftell(bd->arquivo_log) >= LIMITE_LOG) {
+            checkpoint_log(bd);
+        }
+    }
+}
+
+/**
+ * Conta uma operação concluída e faz o commit a cada ops_por_commit
+ * Com uma compactação incremental em andamento, cada operação também
+ * avança um passo dela
+ */
+void registrar_operacao(BancoDados *bd) {
+    if (COMPACTANDO(bd)) {
+        passo_compactacao(bd, bd->passo_compactacao);
+    }
+    bd->ops_pendentes++;
+    if (bd->ops_pendentes >= bd->ops_por_commit) {
+        confirmar(bd);
+    }
+}
+
+/**
+ * Cria uma página nova no fim do índice, já presa no buffer
+ */
+Pagina* criar_pagina(BancoDados *bd, bool eh_folha) {
+    long offset = alocar_pagina(bd);
+    // Página reaproveitada da lista livre ainda está no buffer
+    Pagina *pagina = buscar_quadro(&bd->buffer, offset) ? ler_pagina(bd, offset)
+                                                          : obter_quadro(bd, offset)->pagina;
+    pagina->num_chaves = 0;
+    pagina->eh_folha = eh_folha;
+    pagina->offset_proprio = offset;
+    pagina->proxima_folha = -1;
+    
+    for (int i = 0; i <= MAX_FILHOS(bd); i++) {
+        pagina->filhos[i] = -1;
+    }
+    
+    // Ainda não existe em disco (no modo sombra, sujo = fora da versão confirmada)
+    escrever_pagina(bd, pagina);
+    return pagina;
+}
+
+/**
+ * Página pronta para ser alterada no lugar: no modo sombra, uma página da
+ * versão confirmada é copiada para um offset novo, e a original fica para
+ * quem ainda lê aquela versão
+ * Recebe e devolve a página presa; quem chamou atualiza quem aponta para ela
+ */
+Pagina* copiar_para_escrita(BancoDados *bd, Pagina *pagina) {
+    if (!pagina_confirmada(bd, pagina)) {
+        return pagina;
+    }
+    metricas.copias_sombra++;
+    Pagina *copia = criar_pagina(bd, pagina->eh_folha);
+    copia->num_chaves = pagina->num_chaves;
+    memcpy(copia->chaves, pagina->chaves, pagina->num_chaves * sizeof(Chave));
+    memcpy(copia->filhos, pagina->filhos, (pagina->num_chaves + 1) * sizeof(long));
+    copia->proxima_folha = pagina->proxima_folha;
+    
+    devolver_pagina(bd, pagina);
+    liberar_pagina(bd, pagina);
+    return copia;
+}
+
+/**
+ * Lê o filho i de uma página já alterável, pronto para também ser alterado
+ * (no modo sombra, a cópia passa a ser o filho)
+ */
+Pagina* ler_filho_para_escrita(BancoDados *bd, Pagina *pagina, int i) {
+    Pagina *filho = ler_pagina(bd, pagina->filhos[i]);
+    if (pagina_confirmada(bd, filho)) {
+        filho = copiar_para_escrita(bd, filho);
+        pagina->filhos[i] = filho->offset_proprio;
+        escrever_pagina(bd, pagina);
+    }
+    return filho;
+}
+
+/**
+ * Deixa a raiz alterável antes de uma inserção ou remoção (no modo sombra,
+ * a raiz nova só vale para os leitores depois do commit)
+ */
+void preparar_raiz(BancoDados *bd) {
+    if (!pagina_confirmada(bd, bd->raiz_ram)) {
+        return;
+    }
+    // O pino permanente passa da raiz antiga para a cópia
+    bd->raiz_ram = copiar_para_escrita(bd, bd->raiz_ram);
+    bd->cabecalho.offset_raiz = bd->raiz_ram->offset_proprio;
+    marcar_cabecalho_sujo(bd);
+}
+
+// Funções de busca
+
+/**
+ * Primeira posição cuja chave não é menor que a procurada (busca binária)
+ */
+int buscar_posicao(Pagina *pagina, const Chave *chave) {
+    int inicio = 0, fim = pagina->num_chaves;
+    while (inicio < fim) {
+        int meio = (inicio + fim) / 2;
+        if (comparar_chaves(chave, &pagina->chaves[meio]) > 0) {
+            inicio = meio + 1;
+        } else {
+            fim = meio;
+        }
+    }
+    return inicio;
+}
+
+/**
+ * Filho por onde desce quem procura a chave
+ * No modo B+ a separadora igual à chave leva à direita: a chave está na folha
+ */
+int posicao_filho(BancoDados *bd, Pagina *pagina, const Chave *chave) {
+    int i = buscar_posicao(pagina, chave);
+    if (MODO_BMAIS(bd) && i < pagina->num_chaves && comparar_chaves(chave, &pagina->chaves[i]) == 0) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Busca uma chave na árvore
+ * Retorna true se encontrada, false caso contrário
+ */
+bool buscar_na_arvore(BancoDados *bd, Chave *chave, Chave *resultado) {
+    if (chave->id_nome == ID_NOME_AUSENTE) return false;
+    Pagina *pagina_atual = bd->raiz_ram;
+    
+    while (pagina_atual != NULL) {
+        // No modo B+ as chaves das páginas internas são só separadoras
+        int i = pagina_atual->eh_folha ? buscar_posicao(pagina_atual, chave) :
+                                         posicao_filho(bd, pagina_atual, chave);
         
-        long offset_raiz_antiga = bd->raiz_ram->offset_proprio;
-        bd->raiz_ram->num_chaves = -1;
-        escrever_pagina(bd->arquivo_indice, bd->raiz_ram, offset_raiz_antiga);
+        if (i < pagina_atual->num_chaves && 
+            comparar_chaves(chave, &pagina_atual->chaves[i]) == 0) {
+            if (resultado) {
+                *resultado = pagina_atual->chaves[i];
+            }
+            if (pagina_atual != bd->raiz_ram) {
+                liberar_pagina(bd, pagina_atual);
+            }
+            return true;
+        }
         
-        free(bd->raiz_ram);
-        bd->raiz_ram = nova_raiz;
+
+        if (pagina_atual->eh_folha) {
+            if (pagina_atual != bd->raiz_ram) {
+                liberar_pagina(bd, pagina_atual);
+            }
+            return false;
+        }
         
-        bd->cabecalho.offset_raiz = novo_offset_raiz;
-        bd->cabecalho.altura--;
-        escrever_cabecalho(bd->arquivo_indice, &bd->cabecalho);
-        escrever_pagina(bd->arquivo_indice, bd->raiz_ram, bd->raiz_ram->offset_proprio);
+        long offset_filho = pagina_atual->filhos[i];
+        if (pagina_atual != bd->raiz_ram) {
+            liberar_pagina(bd, pagina_atual);
+        }
+        pagina_atual = ler_pagina(bd, offset_filho);
+    }
+    
+    return false;
+}
+
+/**
+ * Busca com registro de latência (interface pública)
+ */
+bool buscar(BancoDados *bd, Chave *chave, Chave *resultado) {
+    double inicio = agora_segundos();
+    bool encontrada = buscar_na_arvore(bd, chave, resultado);
+    registrar_latencia(OP_BUSCAR, inicio);
+    return encontrada;
+}
+
+//Funções de inserção
+void dividir_filho(BancoDados *bd, Pagina *pai, int indice, Pagina *filho_cheio) {
+    metricas.divisoes++;
+    Pagina *novo_filho = criar_pagina(bd, filho_cheio->eh_folha);
+    
+    // A chave escolhida sobe (metades equilibradas em chaves e bytes); as
+    // seguintes vão para o novo nó. Numa folha do modo B+ sobe uma cópia e a
+    // própria chave também vai para o novo nó, que entra no encadeamento.
+    bool copia = filho_cheio->eh_folha && MODO_BMAIS(bd);
+    int meio = escolher_divisao(filho_cheio->chaves, filho_cheio->num_chaves,
+                                filho_cheio->eh_folha, MAX_CHAVES(bd), copia);
+    int inicio_novo = copia ? meio : meio + 1;
+    novo_filho->num_chaves = filho_cheio->num_chaves - inicio_novo;
+    for (int j = 0; j < novo_filho->num_chaves; j++) {
+        novo_filho->chaves[j] = filho_cheio->chaves[inicio_novo + j];
+    }
+    if (copia) {
+        novo_filho->proxima_folha = filho_cheio->proxima_folha;
+        filho_cheio->proxima_folha = novo_filho->offset_proprio;
+    }
+    
+    // Se não é folha, move os filhos correspondentes para o novo nó
+    if (!filho_cheio->eh_folha) {
+        for (int j = 0; j <= novo_filho->num_chaves; j++) {
+            novo_filho->filhos[j] = filho_cheio->filhos[meio + 1 + j];
+        }
+    }
+    
+    filho_cheio->num_chaves = meio;  // Fica com as chaves antes do meio
+    
+    // Move chaves e filhos do pai para abrir espaço
+    for (int j = pai->num_chaves; j > indice; j--) {
+        pai->chaves[j] = pai->chaves[j - 1];
+    }
+    for (int j = pai->num_chaves + 1; j > indice + 1; j--) {
+        pai->filhos[j] = pai->filhos[j - 1];
+    }
+    
+    // Insere a chave do meio no pai
+    pai->chaves[indice] = filho_cheio->chaves[meio];
+    pai->filhos[indice + 1] = novo_filho->offset_proprio;
+    pai->num_chaves++;
+    
+    // Escreve as páginas no disco
+    escrever_pagina(bd, filho_cheio);
+    escrever_pagina(bd, novo_filho);
+    
+    liberar_pagina(bd, novo_filho);
+}
+
+/**
+ * Insere recursivamente a partir de uma página
+ * A página pode terminar com uma chave a mais; quem chamou faz a divisão
+ */
+void inserir_recursivo(BancoDados *bd, Pagina *pagina, Chave *chave) {
+    int i = pagina->eh_folha ? buscar_posicao(pagina, chave) : posicao_filho(bd, pagina, chave);
+    
+    if (pagina->eh_folha) {
+        // Insere diretamente na folha
+        for (int j = pagina->num_chaves; j > i; j--) {
+            pagina->chaves[j] = pagina->chaves[j - 1];
+        }
+        pagina->chaves[i] = *chave;
+        pagina->num_chaves++;
+        return;
+    }
+    
+    Pagina *filho = ler_filho_para_escrita(bd, pagina, i);
+    inserir_recursivo(bd, filho, chave);
+    
+    if (pagina_excedida(bd, filho)) {
+        // Filho estourou, divide e sobe a chave do meio
+        dividir_filho(bd, pagina, i, filho);
+    } else {
+        escrever_pagina(bd, filho);
+    }
+    liberar_pagina(bd, filho);
+}
+
+/**
+ * Raiz estourou: cria uma nova raiz acima dela e divide a antiga
+ */
+void dividir_raiz(BancoDados *bd) {
+    Pagina *raiz = bd->raiz_ram;
+    Pagina *nova_raiz = criar_pagina(bd, false);
+    nova_raiz->filhos[0] = raiz->offset_proprio;
+    
+    dividir_filho(bd, nova_raiz, 0, raiz);
+    
+    // Atualiza a raiz
+    bd->raiz_ram = nova_raiz;
+    liberar_pagina(bd, raiz);
+    
+    bd->cabecalho.offset_raiz = nova_raiz->offset_proprio;
+    bd->cabecalho.altura++;
+    marcar_cabecalho_sujo(bd);
+}
+
+/**
+ * Insere uma chave na árvore
+ * Retorna false, sem inserir, se o limiar estiver fora de 0 a 255
+ */
+bool inserir(BancoDados *bd, Chave *chave) {
+    if (!limiar_valido(chave->limiar)) {
+        return false;
+    }
+    double inicio = agora_segundos();
+    
+    preparar_raiz(bd);
+    inserir_recursivo(bd, bd->raiz_ram, chave);
+    
+    if (pagina_excedida(bd, bd->raiz_ram)) {
+        dividir_raiz(bd);
+    }
+    
+    escrever_pagina(bd, bd->raiz_ram);
+    registrar_latencia(OP_INSERIR, inicio);
+    return true;
+}
+
+//Funções de remoção
+Chave obter_predecessor(BancoDados *bd, Pagina *pagina, int idx) {
+    Pagina *atual = ler_pagina(bd, pagina->filhos[idx]);
+    while (!atual->eh_folha) {
+        Pagina *proximo = ler_pagina(bd, atual->filhos[atual->num_chaves]);
+        liberar_pagina(bd, atual);
+        atual = proximo;
+    }
+    Chave pred = atual->chaves[atual->num_chaves - 1];
+    liberar_pagina(bd, atual);
+    return pred;
+}
+
+/**
+ * Faz merge de um filho com seu irmão
+ */
+void merge(BancoDados *bd, Pagina *pagina, int idx) {
+    metricas.fusoes++;
+    Pagina *filho = ler_filho_para_escrita(bd, pagina, idx);
+    Pagina *irmao = ler_pagina(bd, pagina->filhos[idx + 1]);
+    
+    // Copia filhos do irmão (se não for folha) logo após os do filho
+    if (!filho->eh_folha) {
+        int pos = filho->num_chaves + 1;
+        for (int i = 0; i <= irmao->num_chaves; i++) {
+            filho->filhos[pos + i] = irmao->filhos[i];
+        }
+    }
+    
+    // Puxa a chave do pai para o filho; folhas do modo B+ só juntam as
+    // chaves (a separadora é uma cópia) e pulam o irmão no encadeamento
+    if (filho->eh_folha && MODO_BMAIS(bd)) {
+        filho->proxima_folha = irmao->proxima_folha;
+    } else {
+        filho->chaves[filho->num_chaves] = pagina->chaves[idx];
+        filho->num_chaves++;
+    }
+    
+    // Copia chaves do irmão
+    for (int i = 0; i < irmao->num_chaves; i++) {
+        filho->chaves[filho->num_chaves] = irmao->chaves[i];
+        filho->num_chaves++;
+    }
+    
+    for (int i = idx; i < pagina->num_chaves - 1; i++) {
+        pagina->chaves[i] = pagina->chaves[i + 1];
+    }
+    
+    for (int i = idx + 1; i < pagina->num_chaves; i++) {
+        pagina->filhos[i] = pagina->filhos[i + 1];
+    }
+    
+    pagina->num_chaves--;
+    
+    escrever_pagina(bd, filho);
+    escrever_pagina(bd, pagina);
+    
+    // O irmão foi absorvido: a página volta para a lista livre
+    devolver_pagina(bd, irmao);
+    liberar_pagina(bd, filho);
+    liberar_pagina(bd, irmao);
+}
+
+void emprestar_do_anterior(BancoDados *bd, Pagina *pagina, int idx) {
+    metricas.emprestimos++;
+    Pagina *filho = ler_filho_para_escrita(bd, pagina, idx);
+    Pagina *irmao = ler_filho_para_escrita(bd, pagina, idx - 1);
+    
+    // Move chaves do filho para frente
+    for (int i = filho->num_chaves - 1; i >= 0; i--) {
+        filho->chaves[i + 1] = filho->chaves[i];
+    }
+    
+    // Move filhos (se não for folha)
+    if (!filho->eh_folha) {
+        for (int i = filho->num_chaves; i >= 0; i--) {
+            filho->filhos[i + 1] = filho->filhos[i];
+        }
+    }
+    
+    // Folha do modo B+: a última chave do irmão passa direto e vira a
+    // nova separadora (cópia)
+    bool encadeada = filho->eh_folha && MODO_BMAIS(bd);
+    filho->chaves[0] = encadeada ? irmao->chaves[irmao->num_chaves - 1] : pagina->chaves[idx - 1];
+    
+    pagina->chaves[idx - 1] = irmao->chaves[irmao->num_chaves - 1];
+    
+    if (!filho->eh_folha) {
+        filho->filhos[0] = irmao->filhos[irmao->num_chaves];
+    }
+    
+    filho->num_chaves++;
+    irmao->num_chaves--;
+    
+    escrever_pagina(bd, filho);
+    escrever_pagina(bd, irmao);
+    escrever_pagina(bd, pagina);
+    
+    liberar_pagina(bd, filho);
+    liberar_pagina(bd, irmao);
+}
+
+/**
+ * Empresta uma chave do irmão seguinte
+ */
+void emprestar_do_proximo(BancoDados *bd, Pagina *pagina, int idx) {
+    metricas.emprestimos++;
+    Pagina *filho = ler_filho_para_escrita(bd, pagina, idx);
+    Pagina *irmao = ler_filho_para_escrita(bd, pagina, idx + 1);
+    
+    // Move chave do pai para o filho (folha do modo B+: a primeira do irmão)
+    bool encadeada = filho->eh_folha && MODO_BMAIS(bd);
+    filho->chaves[filho->num_chaves] = encadeada ? irmao->chaves[0] : pagina->chaves[idx];
+    
+    // Move primeiro filho do irmão
+    if (!filho->eh_folha) {
+        filho->filhos[filho->num_chaves + 1] = irmao->filhos[0];
+    }
+    
+    // Move primeira chave do irmão para o pai (modo B+: cópia da que passa a
+    // ser a primeira do irmão)
+    pagina->chaves[idx] = encadeada ? irmao->chaves[1] : irmao->chaves[0];
+    
+    // Move chaves do irmão
+    for (int i = 1; i < irmao->num_chaves; i++) {
+        irmao->chaves[i - 1] = irmao->chaves[i];
+    }
+    
+    // Move filhos do irmão
+    if (!irmao->eh_folha) {
+        for (int i = 1; i <= irmao->num_chaves; i++) {
+            irmao->filhos[i - 1] = irmao->filhos[i];
+        }
+    }
+    
+    filho->num_chaves++;
+    irmao->num_chaves--;
+    
+    escrever_pagina(bd, filho);
+    escrever_pagina(bd, irmao);
+    escrever_pagina(bd, pagina);
+    
+    liberar_pagina(bd, filho);
+    liberar_pagina(bd, irmao);
+}
+
+/**
+ * Indica se o filho idx pode ceder uma chave (filhos fora da página: não)
+ */
+bool filho_pode_ceder(BancoDados *bd, Pagina *pagina, int idx) {
+    if (idx < 0 || idx > pagina->num_chaves) {
+        return false;
+    }
+    Pagina *filho = ler_pagina(bd, pagina->filhos[idx]);
+    bool pode = pagina_pode_ceder(bd, filho);
+    liberar_pagina(bd, filho);
+    return pode;
+}
+
+bool filho_abaixo_minimo(BancoDados *bd, Pagina *pagina, int idx) {
+    Pagina *filho = ler_pagina(bd, pagina->filhos[idx]);
+    bool abaixo = pagina_abaixo_minimo(bd, filho);
+    liberar_pagina(bd, filho);
+    return abaixo;
+}
+
+/**
+ * Preenche um filho que ficou abaixo do mínimo de chaves
+ * Com o mínimo em bytes, uma chave emprestada pode ocupar menos que a
+ * removida (as células são comprimidas), então empresta até o filho sair
+ * do mínimo ou os irmãos não poderem mais ceder
+ */
+void preencher(BancoDados *bd, Pagina *pagina, int idx) {
+    // Tenta emprestar do irmão anterior
+    while (filho_pode_ceder(bd, pagina, idx - 1)) {
+        emprestar_do_anterior(bd, pagina, idx);
+        if (!filho_abaixo_minimo(bd, pagina, idx)) {
+            return;
+        }
+    }
+
+    // Tenta emprestar do irmão seguinte
+    while (filho_pode_ceder(bd, pagina, idx + 1)) {
+        emprestar_do_proximo(bd, pagina, idx);
+        if (!filho_abaixo_minimo(bd, pagina, idx)) {
+            return;
+        }
+    }
+    
+    // Não pode emprestar: faz merge com um dos irmãos
+    if (idx != pagina->num_chaves) {
+        merge(bd, pagina, idx);
+    } else {
+        merge(bd, pagina, idx - 1);
+    }
+}
+
+/**
+ * Grava um filho recém-modificado e corrige estouro ou falta de chaves
+ */
+void corrigir_filho(BancoDados *bd, Pagina *pagina, int idx, Pagina *filho) {
+    if (pagina_excedida(bd, filho)) {
+        dividir_filho(bd, pagina, idx, filho);
+        return;
+    }
+    
+    escrever_pagina(bd, filho);
+    if (pagina_abaixo_minimo(bd, filho)) {
+        preencher(bd, pagina, idx);
+    }
+}
+
+/**
+ * Remove uma chave de uma folha
+ */
+void remover_de_folha(Pagina *pagina, int idx) {
+    for (int i = idx + 1; i < pagina->num_chaves; i++) {
+        pagina->chaves[i - 1] = pagina->chaves[i];
+    }
+    pagina->num_chaves--;
+}
+
+/**
+ * Remove uma chave de um nó interno
+ * Substitui pela predecessora e a remove da subárvore esquerda
+ */
+void remover_de_nao_folha(BancoDados *bd, Pagina *pagina, int idx) {
+    Chave pred = obter_predecessor(bd, pagina, idx);
+    pagina->chaves[idx] = pred;
+    
+    Pagina *filho = ler_filho_para_escrita(bd, pagina, idx);
+    remover_recursivo(bd, filho, &pred);
+    corrigir_filho(bd, pagina, idx, filho);
+    liberar_pagina(bd, filho);
+}
+
+/**
+ * Remove uma chave recursivamente
+ * A página pode terminar abaixo do mínimo; quem chamou faz a correção
+ */
+void remover_recursivo(BancoDados *bd, Pagina *pagina, Chave *chave) {
+    int idx = buscar_posicao(pagina, chave);
+    bool achou = idx < pagina->num_chaves && comparar_chaves(chave, &pagina->chaves[idx]) == 0;
+    
+    if (achou && pagina->eh_folha) {
+        remover_de_folha(pagina, idx);
+        return;
+    }
+    if (achou && !MODO_BMAIS(bd)) {
+        remover_de_nao_folha(bd, pagina, idx);
+        return;
+    }
+    
+    if (pagina->eh_folha) {
+        return; // Chave não encontrada
+    }
+    if (achou) {
+        // Modo B+: a separadora fica (continua separando) e a chave sai da folha
+        idx++;
+    }
+    
+    Pagina *filho = ler_filho_para_escrita(bd, pagina, idx);
+    remover_recursivo(bd, filho, chave);
+    corrigir_filho(bd, pagina, idx, filho);
+    liberar_pagina(bd, filho);
+}
+
+/**
+ * Remove uma chave da árvore
+ */
+bool remover(BancoDados *bd, Chave *chave) {
+    double inicio = agora_segundos();
+    Chave removida;
+    if (!buscar_na_arvore(bd, chave, &removida)) {
+        registrar_latencia(OP_REMOVER, inicio);
+        return false;
+    }
+    
+    preparar_raiz(bd);
+    remover_recursivo(bd, bd->raiz_ram, chave);
+    
+    // Raiz interna vazia: promove o único filho restante
+    if (bd->raiz_ram->num_chaves == 0 && !bd->raiz_ram->eh_folha) {
+        Pagina *nova_raiz = ler_filho_para_escrita(bd, bd->raiz_ram, 0);
+        
+        // A antiga raiz volta para a lista livre
+        devolver_pagina(bd, bd->raiz_ram);
+        liberar_pagina(bd, bd->raiz_ram);
+        bd->raiz_ram = nova_raiz;
+        
+        bd->cabecalho.offset_raiz = nova_raiz->offset_proprio;
+        bd->cabecalho.altura--;
+        marcar_cabecalho_sujo(bd);
+    } else if (pagina_excedida(bd, bd->raiz_ram)) {
+        // As células comprimem o prefixo comum com a chave anterior: trocar
+        // uma separadora (pelo antecessor ou por um empréstimo) pode encurtar
+        // esse prefixo e fazer uma raiz cheia passar do tamanho da página
+        dividir_raiz(bd);
+    }
+    
+    escrever_pagina(bd, bd->raiz_ram);
+    // A referência só é solta depois do commit: até lá o índice confirmado
+    // (e, no modo sombra, os leitores dele) ainda pode carregar o registro
+    adiar_liberacao(bd, removida.offset_dados, false);
+    registrar_latencia(OP_REMOVER, inicio);
+    return true;
+}
+
+// Funções de cursor (consultas por intervalo)
+#define MAX_NIVEIS_CURSOR 64             // Altura máxima percorrida (um índice íntegro nem chega perto)
+
+/**
+ * Cursor de consulta por intervalo de chaves
+ * Guarda a pilha de páginas da raiz até a posição atual, presas no buffer:
+ * cada página do caminho é lida uma única vez, e uma consulta que devolve k
+ * chaves lê O(log n + k / chaves por página) páginas. No modo B+ a pilha
+ * tem só a folha atual e o cursor segue o encadeamento das folhas. A árvore
+ * não pode ser alterada com um cursor aberto (a não ser que ele esteja num
+ * instantâneo do modo sombra).
+ */
+typedef struct {
+    BancoDados *bd;
+    Pagina *raiz;                        // Raiz presa pelo banco (NULL num instantâneo)
+    Pagina *paginas[MAX_NIVEIS_CURSOR];
+    int posicoes[MAX_NIVEIS_CURSOR];     // Próxima chave de cada página da pilha
+    int num_niveis;
+    bool descer;                         // Falta descer à subárvore da posição do topo
+    unsigned long long fim;              // Maior valor de chave aceito
+    bool invalido;                       // Caminho mais fundo que a pilha: a consulta falhou
+} Cursor;
+
+/**
+ * Põe a página no topo da pilha; num caminho mais fundo que
+ * MAX_NIVEIS_CURSOR (índice corrompido, com um ciclo de filhos) solta a
+ * página, marca o cursor como inválido e retorna false
+ */
+bool empilhar_cursor(Cursor *cursor, Pagina *pagina, int posicao) {
+    if (cursor->num_niveis == MAX_NIVEIS_CURSOR) {
+        if (pagina != cursor->raiz) {
+            liberar_pagina(cursor->bd, pagina);
+        }
+        if (!cursor->invalido) {
+            fprintf(stderr, "Aviso: indice com mais de %d niveis; consulta interrompida.\n",
+                    MAX_NIVEIS_CURSOR);
+        }
+        cursor->invalido = true;
+        return false;
+    }
+    cursor->paginas[cursor->num_niveis] = pagina;
+    cursor->posicoes[cursor->num_niveis] = posicao;
+    cursor->num_niveis++;
+    return true;
+}
+
+void desempilhar_cursor(Cursor *cursor) {
+    Pagina *pagina = cursor->paginas[--cursor->num_niveis];
+    if (pagina != cursor->raiz) {
+        liberar_pagina(cursor->bd, pagina);
+    }
+}
+
+/**
+ * Desce do filho indicado até a folha mais à esquerda
+ */
+void descer_cursor(Cursor *cursor, long offset) {
+    while (true) {
+        Pagina *pagina = ler_pagina(cursor->bd, offset);
+        if (!empilhar_cursor(cursor, pagina, 0) || pagina->eh_folha) break;
+        offset = pagina->filhos[0];
+    }
+}
+
+/**
+ * Posiciona o cursor (com bd e raiz já preenchidos) a partir de uma raiz
+ * presa antes da primeira chave >= inicio
+ */
+void posicionar_cursor(Cursor *cursor, Pagina *pagina, const Chave *inicio, const Chave *fim) {
+    BancoDados *bd = cursor->bd;
+    cursor->num_niveis = 0;
+    cursor->descer = false;
+    cursor->fim = valor_chave(fim);
+    cursor->invalido = false;
+    
+    if (MODO_BMAIS(bd)) {
+        // Só a folha fica presa: as seguintes vêm pelo encadeamento
+        while (!pagina->eh_folha) {
+            Pagina *filho = ler_pagina(bd, pagina->filhos[posicao_filho(bd, pagina, inicio)]);
+            if (pagina != cursor->raiz) liberar_pagina(bd, pagina);
+            pagina = filho;
+        }
+        empilhar_cursor(cursor, pagina, buscar_posicao(pagina, inicio));
+        return;
+    }
+    while (true) {
+        int i = buscar_posicao(pagina, inicio);
+        if (!empilhar_cursor(cursor, pagina, i) || pagina->eh_folha) break;
+        pagina = ler_pagina(bd, pagina->filhos[i]);
+    }
+}
+
+/**
+ * Posiciona o cursor antes da primeira chave >= inicio; cursor_proximo
+ * devolve as chaves em ordem até a última <= fim
+ */
+void cursor_abrir(BancoDados *bd, Cursor *cursor, const Chave *inicio, const Chave *fim) {
+    cursor->bd = bd;
+    cursor->raiz = bd->raiz_ram;
+    posicionar_cursor(cursor, bd->raiz_ram, inicio, fim);
+}
+
+/**
+ * Cursor na versão de um instantâneo: todas as páginas do caminho, raiz
+ * inclusive, ficam presas pelo próprio cursor, e nenhuma delas é alterada
+ * ou reaproveitada enquanto o instantâneo estiver aberto
+ */
+void cursor_abrir_instantaneo(BancoDados *bd, Cursor *cursor, const Instantaneo *inst,
+                              const Chave *inicio, const Chave *fim) {
+    cursor->bd = bd;
+    cursor->raiz = NULL;
+    posicionar_cursor(cursor, ler_pagina(bd, inst->offset_raiz), inicio, fim);
+}
+
+/**
+ * Cursor em todas as chaves do índice
+ */
+void cursor_abrir_tudo(BancoDados *bd, Cursor *cursor) {
+    Chave inicio = {0, 0, 0};
+    Chave fim = {UINT_MAX, -1, 0};       // Maior valor_chave possível
+    cursor_abrir(bd, cursor, &inicio, &fim);
+}
+
+/**
+ * Solta as páginas ainda presas pelo cursor
+ */
+void cursor_fechar(Cursor *cursor) {
+    while (cursor->num_niveis > 0) {
+        desempilhar_cursor(cursor);
+    }
+}
+
+/**
+ * Próxima chave do intervalo; false (e o cursor fechado) quando acabar ou
+ * se o cursor ficou inválido
+ */
+bool cursor_proximo(Cursor *cursor, Chave *chave) {
+    if (cursor->invalido) {
+        cursor_fechar(cursor);
+        return false;
+    }
+    while (cursor->num_niveis > 0) {
+        int topo = cursor->num_niveis - 1;
+        Pagina *pagina = cursor->paginas[topo];
+        int i = cursor->posicoes[topo];
+        
+        if (cursor->descer) {
+            // A chave interna anterior já saiu: agora vem a subárvore à direita dela
+            cursor->descer = false;
+            descer_cursor(cursor, pagina->filhos[i]);
+            if (cursor->invalido) {
+                cursor_fechar(cursor);
+                return false;
+            }
+            continue;
+        }
+        if (i >= pagina->num_chaves) {
+            long proxima = pagina->proxima_folha;    // Sempre -1 fora do modo B+
+            desempilhar_cursor(cursor);
+            if (proxima >= 0) {
+                empilhar_cursor(cursor, ler_pagina(cursor->bd, proxima), 0);
+            }
+            continue;
+        }
+        if (valor_chave(&pagina->chaves[i]) > cursor->fim) {
+            cursor_fechar(cursor);
+            return false;
+        }
+        
+        *chave = pagina->chaves[i];
+        cursor->posicoes[topo] = i + 1;
+        cursor->descer = !pagina->eh_folha;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Página (ainda presa pelo cursor) e posição da chave que cursor_proximo
+ * acabou de devolver; serve para alterar o offset_dados dela no lugar
+ */
+Pagina* cursor_pagina_atual(Cursor *cursor, int *posicao) {
+    int topo = cursor->num_niveis - 1;
+    *posicao = cursor->posicoes[topo] - 1;
+    return cursor->paginas[topo];
+}
+
+/**
+ * Cursor nas chaves dos ids primeiro..ultimo com limiares de limiar_min a
+ * limiar_max (o filtro de limiar vale nas pontas do intervalo)
+ */
+void cursor_abrir_ids(BancoDados *bd, Cursor *cursor, unsigned int primeiro, unsigned int ultimo,
+                      int limiar_min, int limiar_max) {
+    Chave inicio = {primeiro, limiar_min, 0};
+    Chave fim = {ultimo, limiar_max, 0};
+    cursor_abrir(bd, cursor, &inicio, &fim);
+}
+
+// Funções de percurso
+/**
+ * Percurso em ordem - interface pública
+ * Usa o cursor: cada página é lida uma vez (no modo B+, só as folhas, em
+ * sequência pelo encadeamento)
+ */
+void percurso_em_ordem(BancoDados *bd) {
+    double inicio = agora_segundos();
+    printf("\n=== Percurso em Ordem (Chaves Ordenadas) ===\n");
+    Cursor cursor;
+    Chave chave;
+    cursor_abrir_tudo(bd, &cursor);
+    while (cursor_proximo(&cursor, &chave)) {
+        printf("  %s, limiar=%d (offset: %ld)\n", 
+               nome_do_id(bd, chave.id_nome), 
+               chave.limiar,
+               OFFSET_REGISTRO(chave.offset_dados));
+    }
+    printf("============================================\n\n");
+    registrar_latencia(OP_PERCURSO, inicio);
+}
+
+// Funções de visualização de páginas
+void imprimir_pagina(BancoDados *bd, Pagina *pagina, int num_pagina) {
+    if (pagina->num_chaves < 0) {
+        printf("Página [%d]: (offset: %ld, livre, proxima livre: %ld)\n\n",
+               num_pagina, pagina->offset_proprio, pagina->proxima_folha);
+        return;
+    }
+    printf("Página [%d]: (offset: %ld, folha: %s, chaves: %d)\n", 
+           num_pagina, 
+           pagina->offset_proprio,
+           pagina->eh_folha ? "SIM" : "NÃO",
+           pagina->num_chaves);
+    
+    for (int i = 0; i < pagina->num_chaves; i++) {
+        printf("  Chave [%s], limiar=[%d], offset_dados=%ld\n",
+               nome_do_id(bd, pagina->chaves[i].id_nome),
+               pagina->chaves[i].limiar,
+               OFFSET_REGISTRO(pagina->chaves[i].offset_dados));
+    }
+    
+    if (pagina->eh_folha && pagina->proxima_folha >= 0) {
+        printf("  Proxima folha: [%ld]\n", pagina->proxima_folha);
+    }
+    if (!pagina->eh_folha) {
+        printf("  Filhos: ");
+        for (int i = 0; i <= pagina->num_chaves; i++) {
+            printf("[%ld] ", pagina->filhos[i]);
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+/**
+ * Visualiza todas as páginas do arquivo de índice
+ */
+void visualizar_paginas(BancoDados *bd) {
+    printf("\n=== Visualização de Páginas do Índice ===\n");
+    printf("Total de páginas: %d\n", bd->cabecalho.num_paginas);
+    printf("Altura da árvore: %d\n\n", bd->cabecalho.altura);
+    
+    long offset = TAM_PAGINA;
+    int num_pagina = 0;
+    
+    while (offset < bd->cabecalho.proximo_offset) {
+        Pagina *pagina = ler_pagina(bd, offset);
+        imprimir_pagina(bd, pagina, num_pagina);
+        liberar_pagina(bd, pagina);
+        
+        offset += TAM_PAGINA;
+        num_pagina++;
+    }
+    
+    printf("=========================================\n\n");
+}
+
+// Funções de manipulação de imagens
+
+/**
+ * Indica se as dimensões cabem em um vetor de pixels (sem estouro de int)
+ */
+bool dimensoes_validas(int largura, int altura) {
+    return largura > 0 && altura > 0 && (long)largura * altura <= INT_MAX;
+}
+
+/**
+ * Aloca o vetor de pixels para as dimensões informadas
+ */
+bool alocar_imagem(RegistroImagem *img, int largura, int altura) {
+    img->dados = NULL;
+    img->mapeamento = NULL;
+    if (!dimensoes_validas(largura, altura)) {
+        return false;
+    }
+    img->largura = largura;
+    img->altura = altura;
+    img->dados = malloc((size_t)largura * altura);
+    return img->dados != NULL;
+}
+
+/**
+ * Arquivo inteiro em memória: mapeado (POSIX) ou lido de uma vez em um bloco
+ */
+typedef struct {
+    const unsigned char *dados;
+    size_t tamanho;
+    void *base;
+} ArquivoMapeado;
+
+bool mapear_arquivo(const char *nome, ArquivoMapeado *arq) {
+    arq->dados = NULL;
+    arq->base = NULL;
+    arq->tamanho = 0;
+#ifndef _WIN32
+    int fd = open(nome, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    posix_madvise(base, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+    arq->tamanho = (size_t)st.st_size;
+#else
+    FILE *fp = fopen(nome, "rb");
+    if (!fp) return false;
+    fseek(fp, 0, SEEK_END);
+    long tamanho = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    void *base = tamanho > 0 ? malloc(tamanho) : NULL;
+    if (!base || fread(base, 1, tamanho, fp) != (size_t)tamanho) {
+        free(base);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    arq->tamanho = (size_t)tamanho;
+#endif
+    arq->base = base;
+    arq->dados = base;
+    return true;
+}
+
+void desmapear_memoria(void *base, size_t tamanho) {
+#ifndef _WIN32
+    munmap(base, tamanho);
+#else
+    (void)tamanho;
+    free(base);
+#endif
+}
+
+void liberar_imagem(RegistroImagem *img) {
+    if (img->mapeamento) {
+        desmapear_memoria(img->mapeamento, img->tamanho_mapeamento);
+        img->mapeamento = NULL;
+    } else {
+        free(img->dados);
+    }
+    img->dados = NULL;
+}
+
+/**
+ * Indica se a imagem só tem pixels 0 e 255 (resultado da limiarização)
+ */
+bool imagem_binaria(const RegistroImagem *img) {
+    int total_pixels = img->largura * img->altura;
+    for (int i = 0; i < total_pixels; i++) {
+        if (img->dados[i] != 0 && img->dados[i] != 255) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Empacota pixels 0/255 em bits, 8 por byte (o primeiro pixel no bit mais alto)
+ */
+void empacotar_bits(const unsigned char *pixels, unsigned char *bits, int total_pixels) {
+    int bytes_cheios = total_pixels / 8;
+    for (int i = 0; i < bytes_cheios; i++) {
+        const unsigned char *p = pixels + 8 * i;
+        bits[i] = (unsigned char)(((p[0] & 0x80)     ) | ((p[1] & 0x80) >> 1) |
+                                  ((p[2] & 0x80) >> 2) | ((p[3] & 0x80) >> 3) |
+                                  ((p[4] & 0x80) >> 4) | ((p[5] & 0x80) >> 5) |
+                                  ((p[6] & 0x80) >> 6) | ((p[7] & 0x80) >> 7));
+    }
+    
+    int resto = total_pixels % 8;
+    if (resto > 0) {
+        unsigned char byte = 0;
+        for (int j = 0; j < resto; j++) {
+            byte |= (pixels[8 * bytes_cheios + j] & 0x80) >> j;
+        }
+        bits[bytes_cheios] = byte;
+    }
+}
+
+/**
+ * Tabela de expansão: cada byte empacotado vira 8 pixels 0/255 prontos
+ */
+unsigned char tabela_expansao[256][8];
+bool tabela_expansao_pronta = false;
+
+void preparar_tabela_expansao() {
+    for (int byte = 0; byte < 256; byte++) {
+        for (int j = 0; j < 8; j++) {
+            tabela_expansao[byte][j] = (byte & (0x80 >> j)) ? 255 : 0;
+        }
+    }
+    tabela_expansao_pronta = true;
+}
+
+/**
+ * Expande bits em pixels 0/255
+ * Cada byte é uma consulta à tabela e uma cópia de 8 bytes de uma vez
+ */
+void expandir_bits(const unsigned char *bits, unsigned char *pixels, int total_pixels) {
+    if (!tabela_expansao_pronta) {
+        preparar_tabela_expansao();
+    }
+    
+    int bytes_cheios = total_pixels / 8;
+    for (int i = 0; i < bytes_cheios; i++) {
+        memcpy(pixels + 8 * i, tabela_expansao[bits[i]], 8);
+    }
+    
+    int resto = total_pixels % 8;
+    if (resto > 0) {
+        memcpy(pixels + 8 * bytes_cheios, tabela_expansao[bits[bytes_cheios]], resto);
+    }
+}
+
+// Codecs de registro: cada codificação do cabeçalho tem um par codificar/decodificar
+// codificar devolve o tamanho gerado, ou -1 se passar da capacidade
+
+int codificar_bytes(const RegistroImagem *img, unsigned char *saida, int capacidade) {
+    int total_pixels = img->largura * img->altura;
+    if (total_pixels > capacidade) return -1;
+    memcpy(saida, img->dados, total_pixels);
+    return total_pixels;
+}
+
+bool decodificar_bytes(const unsigned char *dados, int tamanho, RegistroImagem *img) {
+    int total_pixels = img->largura * img->altura;
+    if (tamanho != total_pixels) return false;
+    memcpy(img->dados, dados, total_pixels);
+    return true;
+}
+
+int codificar_bits(const RegistroImagem *img, unsigned char *saida, int capacidade) {
+    int total_pixels = img->largura * img->altura;
+    int tamanho = (total_pixels + 7) / 8;
+    if (tamanho > capacidade) return -1;
+    empacotar_bits(img->dados, saida, total_pixels);
+    return tamanho;
+}
+
+bool decodificar_bits(const unsigned char *dados, int tamanho, RegistroImagem *img) {
+    int total_pixels = img->largura * img->altura;
+    if (tamanho != (total_pixels + 7) / 8) return false;
+    expandir_bits(dados, img->dados, total_pixels);
+    return true;
+}
+
+/**
+ * RLE sobre os bits: comprimentos das sequências alternadas de pixels 0 e
+ * 255 (começando por 0, possivelmente vazia), cada um em varint de 7 bits
+ */
+int codificar_rle(const RegistroImagem *img, unsigned char *saida, int capacidade) {
+    int total_pixels = img->largura * img->altura;
+    int tamanho = 0;
+    unsigned char cor = 0;
+    int i = 0;
+    
+    while (i < total_pixels) {
+        int inicio = i;
+        while (i < total_pixels && img->dados[i] == cor) i++;
+        
+        unsigned comprimento = (unsigned)(i - inicio);
+        do {
+            if (tamanho == capacidade) return -1;
+            unsigned char byte = comprimento & 0x7F;
+            comprimento >>= 7;
+            saida[tamanho++] = byte | (comprimento ? 0x80 : 0);
+        } while (comprimento);
+        
+        cor ^= 255;
+    }
+    return tamanho;
+}
+
+/**
+ * Cada sequência vira um memset direto no vetor de pixels
+ */
+bool decodificar_rle(const unsigned char *dados, int tamanho, RegistroImagem *img) {
+    int total_pixels = img->largura * img->altura;
+    int pos = 0, i = 0;
+    unsigned char cor = 0;
+    
+    while (i < tamanho) {
+        unsigned comprimento = 0;
+        int deslocamento = 0;
+        unsigned char byte;
+        do {
+            if (i == tamanho) return false;
+            byte = dados[i++];
+            // Quinto byte: só os 4 bits que ainda cabem em 32, sem continuação
+            if (deslocamento == 28 && byte > 0x0F) return false;
+            comprimento |= (unsigned)(byte & 0x7F) << deslocamento;
+            deslocamento += 7;
+        } while (byte & 0x80);
+        
+        if (comprimento > (unsigned)(total_pixels - pos)) return false;
+        memset(img->dados + pos, cor, comprimento);
+        pos += comprimento;
+        cor ^= 255;
+    }
+    return pos == total_pixels;
+}
+
+typedef struct {
+    const char *nome;
+    bool so_binaria;                     // Só serve para imagens 0/255
+    int (*codificar)(const RegistroImagem *img, unsigned char *saida, int capacidade);
+    bool (*decodificar)(const unsigned char *dados, int tamanho, RegistroImagem *img);
+} CodecRegistro;
+
+const CodecRegistro CODECS[NUM_CODIFICACOES] = {
+    [CODIFICACAO_BYTES] = {"bytes", false, codificar_bytes, decodificar_bytes},
+    [CODIFICACAO_BITS]  = {"bits",  true,  codificar_bits,  decodificar_bits},
+    [CODIFICACAO_RLE]   = {"rle",   true,  codificar_rle,   decodificar_rle},
+};
+
+/**
+ * Gera a versão binária da imagem (aloca img_bin->dados)
+ */
+void aplicar_limiarizacao(RegistroImagem *img_orig, RegistroImagem *img_bin, int limiar) {
+    alocar_imagem(img_bin, img_orig->largura, img_orig->altura);
+    img_bin->max_valor = img_orig->max_valor;
+    img_bin->limiar = limiar;
+    
+    int total_pixels = img_orig->largura * img_orig->altura;
+    for (int i = 0; i < total_pixels; i++) {
+        img_bin->dados[i] = (img_orig->dados[i] >= limiar) ? 255 : 0;
+    }
+}
+
+/**
+ * Limiariza um bloco de pixels com um limiar de 0 a 255
+ * Com SSE2, 16 pixels por comparação: p >= t equivale a max(p, t) == p
+ */
+void limiarizar_bloco(const unsigned char *origem, unsigned char *destino, int n, int limiar) {
+    int i = 0;
+#ifdef __SSE2__
+    __m128i t = _mm_set1_epi8((char)limiar);
+    for (; i + 16 <= n; i += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(origem + i));
+        _mm_storeu_si128((__m128i*)(destino + i), _mm_cmpeq_epi8(_mm_max_epu8(p, t), p));
+    }
+#endif
+    for (; i < n; i++) {
+        destino[i] = (origem[i] >= limiar) ? 255 : 0;
+    }
+}
+
+/**
+ * Gera as versões binárias da imagem para vários limiares em uma única
+ * passada (aloca saidas[k].dados). A origem é percorrida em blocos que
+ * ficam no cache enquanto todos os limiares são aplicados.
+ */
+void limiarizar_multiplos(const RegistroImagem *img_orig, const int *limiares, int num_limiares,
+                          RegistroImagem *saidas) {
+    int total_pixels = img_orig->largura * img_orig->altura;
+    for (int k = 0; k < num_limiares; k++) {
+        alocar_imagem(&saidas[k], img_orig->largura, img_orig->altura);
+        saidas[k].max_valor = img_orig->max_valor;
+        saidas[k].limiar = limiares[k];
+        // Acima de 255 nenhum pixel passa; abaixo de 0 todos passam, como com 0
+        if (limiares[k] > 255) {
+            memset(saidas[k].dados, 0, total_pixels);
+        }
+    }
+
+    for (int inicio = 0; inicio < total_pixels; inicio += BLOCO_LIMIARIZACAO) {
+        int n = total_pixels - inicio < BLOCO_LIMIARIZACAO ? total_pixels - inicio : BLOCO_LIMIARIZACAO;
+        for (int k = 0; k < num_limiares; k++) {
+            if (limiares[k] > 255) continue;
+            limiarizar_bloco(img_orig->dados + inicio, saidas[k].dados + inicio, n,
+                             limiares[k] < 0 ? 0 : limiares[k]);
+        }
+    }
+}
+
+/**
+ * Pula espaços e comentários (de '#' até o fim da linha) do cabeçalho PGM
+ */
+const unsigned char* pular_separadores_pgm(const unsigned char *p, const unsigned char *fim) {
+    while (p < fim) {
+        if (*p == '#') {
+            while (p < fim && *p != '\n') p++;
+        } else if (isspace(*p)) {
+            p++;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+/**
+ * Lê um inteiro decimal sem sinal; retorna NULL se não houver dígito ou se
+ * o número não couber em um int
+ */
+const unsigned char* ler_inteiro_pgm(const unsigned char *p, const unsigned char *fim, int *valor) {
+    if (p == fim || (unsigned)(*p - '0') > 9) return NULL;
+    int v = 0;
+    while (p < fim && (unsigned)(*p - '0') <= 9) {
+        int digito = *p - '0';
+        if (v > (INT_MAX - digito) / 10) return NULL;
+        v = v * 10 + digito;
+        p++;
+    }
+    *valor = v;
+    return p;
+}
+
+/**
+ * Converte os pixels de um P2: números separados por espaços
+ * Retorna false se o arquivo terminar antes de total_pixels valores ou se
+ * algum valor passar de max_valor (que é no máximo 255)
+ */
+bool ler_pixels_p2(const unsigned char *p, const unsigned char *fim, unsigned char *pixels,
+                   int total_pixels, int max_valor) {
+    for (int i = 0; i < total_pixels; i++) {
+        while (p < fim && isspace(*p)) p++;
+        if (p == fim || (unsigned)(*p - '0') > 9) {
+            return false;
+        }
+        unsigned valor = 0;
+        do {
+            valor = valor * 10 + (*p++ - '0');
+            if (valor > (unsigned)max_valor) return false;
+        } while (p < fim && (unsigned)(*p - '0') <= 9);
+        pixels[i] = (unsigned char)valor;
+    }
+    return true;
+}
+
+/**
+ * Lê arquivo PGM (P2 ou P5 de 8 bits)
+ * O arquivo é mapeado em memória (ou lido em um único bloco) e o cabeçalho e
+ * os pixels ASCII são convertidos direto do buffer. Os pixels de um P5 ficam
+ * no próprio mapeamento, sem cópia; liberar_imagem desfaz o mapeamento.
+ */
+bool ler_pgm(const char *nome_arquivo, RegistroImagem *img) {
+    img->dados = NULL;
+    img->mapeamento = NULL;
+    ArquivoMapeado arq;
+    if (!mapear_arquivo(nome_arquivo, &arq)) {
+        fprintf(stderr, "Erro ao abrir arquivo %s\n", nome_arquivo);
+        return false;
+    }
+    
+    const unsigned char *p = arq.dados;
+    const unsigned char *fim = arq.dados + arq.tamanho;
+    if (arq.tamanho < 2 || p[0] != 'P' || (p[1] != '2' && p[1] != '5')) {
+        fprintf(stderr, "Formato não suportado (apenas P2 e P5)\n");
+        desmapear_memoria(arq.base, arq.tamanho);
+        return false;
+    }
+    bool binario = (p[1] == '5');
+    p += 2;
+    
+    // Largura, altura e valor máximo, com comentários em qualquer ponto
+    int campos[3] = {0, 0, 0};
+    for (int c = 0; c < 3 && p; c++) {
+        p = pular_separadores_pgm(p, fim);
+        p = ler_inteiro_pgm(p, fim, &campos[c]);
+    }
+    // Um único espaço em branco entre o valor máximo e os pixels
+    if (!p || p == fim || !isspace(*p) || campos[2] <= 0 || campos[2] > 255) {
+        fprintf(stderr, "Cabecalho PGM invalido em %s (apenas 8 bits por pixel)\n", nome_arquivo);
+        desmapear_memoria(arq.base, arq.tamanho);
+        return false;
+    }
+    p++;
+    
+    int largura = campos[0], altura = campos[1];
+    if (!dimensoes_validas(largura, altura)) {
+        fprintf(stderr, "Dimensoes invalidas: %dx%d\n", largura, altura);
+        desmapear_memoria(arq.base, arq.tamanho);
+        return false;
+    }
+    img->largura = largura;
+    img->altura = altura;
+    img->max_valor = campos[2];
+    img->limiar = 0;
+    
+    size_t total_pixels = (size_t)largura * altura;
+    if (binario) {
+        if ((size_t)(fim - p) < total_pixels) {
+            fprintf(stderr, "Arquivo %s termina antes dos pixels\n", nome_arquivo);
+            desmapear_memoria(arq.base, arq.tamanho);
+            return false;
+        }
+        // Os bytes são usados como estão: com max_valor abaixo de 255,
+        // nenhum pode passar dele
+        for (size_t i = 0; img->max_valor < 255 && i < total_pixels; i++) {
+            if (p[i] > img->max_valor) {
+                fprintf(stderr, "Pixels invalidos em %s (acima de %d)\n", nome_arquivo, img->max_valor);
+                desmapear_memoria(arq.base, arq.tamanho);
+                return false;
+            }
+        }
+        img->dados = (unsigned char*)p;
+        img->mapeamento = arq.base;
+        img->tamanho_mapeamento = arq.tamanho;
+        return true;
+    }
+    
+    bool ok = alocar_imagem(img, largura, altura) &&
+              ler_pixels_p2(p, fim, img->dados, (int)total_pixels, img->max_valor);
+    desmapear_memoria(arq.base, arq.tamanho);
+    if (!ok) {
+        fprintf(stderr, "Pixels invalidos em %s (faltando ou acima de %d)\n", nome_arquivo, img->max_valor);
+        liberar_imagem(img);
+    }
+    return ok;
+}
+
+/**
+ * Hash FNV-1a de 64 bits
+ */
+unsigned long long hash_fnv(unsigned long long hash, const void *dados, size_t tamanho) {
+    const unsigned char *p = dados;
+    for (size_t i = 0; i < tamanho; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Preenche o cabeçalho e devolve os pixels codificados (alocados)
+ * O hash cobre dimensões, max_valor, codificação e pixels
+ */
+unsigned char* codificar_imagem(const RegistroImagem *img, CabecalhoRegistro *cab) {
+    memset(cab, 0, sizeof(CabecalhoRegistro));
+    cab->magico = MAGICO_REGISTRO;
+    cab->largura = img->largura;
+    cab->altura = img->altura;
+    cab->max_valor = img->max_valor;
+    cab->referencias = 1;
+    
+    // Testa os codecs aplicáveis e fica com o menor resultado; cada tentativa
+    // para assim que passar do melhor tamanho já obtido
+    int total_pixels = img->largura * img->altura;
+    bool binaria = imagem_binaria(img);
+    unsigned char *dados = malloc(total_pixels);
+    unsigned char *tentativa = malloc(total_pixels);
+    cab->codificacao = CODIFICACAO_BYTES;
+    cab->tamanho_dados = codificar_bytes(img, dados, total_pixels);
+    
+    for (int c = 0; c < NUM_CODIFICACOES; c++) {
+        if (c == CODIFICACAO_BYTES || (CODECS[c].so_binaria && !binaria)) continue;
+        int tamanho = CODECS[c].codificar(img, tentativa, cab->tamanho_dados - 1);
+        if (tamanho >= 0) {
+            unsigned char *troca = dados;
+            dados = tentativa;
+            tentativa = troca;
+            cab->codificacao = c;
+            cab->tamanho_dados = tamanho;
+        }
+    }
+    free(tentativa);
+    metricas.registros_por_codificacao[cab->codificacao]++;
+    
+    // Campo a campo: o hash não depende da disposição do struct
+    unsigned long long hash = 14695981039346656037ULL;
+    hash = hash_fnv(hash, &cab->largura, sizeof(cab->largura));
+    hash = hash_fnv(hash, &cab->altura, sizeof(cab->altura));
+    hash = hash_fnv(hash, &cab->max_valor, sizeof(cab->max_valor));
+    hash = hash_fnv(hash, &cab->codificacao, sizeof(cab->codificacao));
+    hash = hash_fnv(hash, &cab->tamanho_dados, sizeof(cab->tamanho_dados));
+    cab->hash = hash_fnv(hash, dados, cab->tamanho_dados);
+    return dados;
+}
+
+/**
+ * Grava um registro já codificado no offset informado ou, com -1, no fim
+ * do arquivo
+ */
+long gravar_registro(FILE *arquivo_dados, long offset, CabecalhoRegistro *cab, const unsigned char *dados) {
+    if (offset < 0) {
+        fseek(arquivo_dados, 0, SEEK_END);
+        offset = ftell(arquivo_dados);
+    } else {
+        fseek(arquivo_dados, offset, SEEK_SET);
+    }
+    fwrite(cab, sizeof(CabecalhoRegistro), 1, arquivo_dados);
+    fwrite(dados, 1, cab->tamanho_dados, arquivo_dados);
+    metricas.fseeks++;
+    metricas.bytes_escritos_dados += sizeof(CabecalhoRegistro) + cab->tamanho_dados;
+    return offset;
+}
+
+/**
+ * Lê o cabeçalho de um registro e confere a assinatura
+ */
+bool ler_cabecalho_registro(FILE *arquivo_dados, long offset, CabecalhoRegistro *cab) {
+    fseek(arquivo_dados, offset, SEEK_SET);
+    metricas.fseeks++;
+    if (fread(cab, sizeof(CabecalhoRegistro), 1, arquivo_dados) != 1) {
+        return false;
+    }
+    metricas.bytes_lidos_dados += sizeof(CabecalhoRegistro);
+    return cab->magico == MAGICO_REGISTRO && cab->tamanho_dados >= 0;
+}
+
+void escrever_cabecalho_registro(FILE *arquivo_dados, long offset, const CabecalhoRegistro *cab) {
+    fseek(arquivo_dados, offset, SEEK_SET);
+    fwrite(cab, sizeof(CabecalhoRegistro), 1, arquivo_dados);
+    metricas.fseeks++;
+    metricas.bytes_escritos_dados += sizeof(CabecalhoRegistro);
+}
+
+/**
+ * Salva imagem no arquivo de dados, sem procurar registro igual
+ * O registro ocupa só o cabeçalho mais os pixels codificados com o codec
+ * que gerar menos bytes
+ */
+long salvar_imagem(FILE *arquivo_dados, RegistroImagem *img) {
+    CabecalhoRegistro cab;
+    unsigned char *dados = codificar_imagem(img, &cab);
+    long offset = gravar_registro(arquivo_dados, -1, &cab, dados);
+    free(dados);
+    return offset;
+}
+
+/**
+ * Carrega imagem do arquivo de dados (aloca img->dados)
+ * Lê o cabeçalho e depois apenas os bytes codificados do registro, que o
+ * codec indicado no cabeçalho decodifica para um byte por pixel
+ */
+bool carregar_imagem(FILE *arquivo_dados, long offset, RegistroImagem *img) {
+    img->dados = NULL;
+    img->mapeamento = NULL;
+    CabecalhoRegistro cab;
+    if (!ler_cabecalho_registro(arquivo_dados, offset, &cab) ||
+        !alocar_imagem(img, cab.largura, cab.altura)) {
+        return false;
+    }
+    img->limiar = 0;                     // O limiar está na chave, não no registro
+    img->max_valor = cab.max_valor;
+    
+    if (cab.codificacao < 0 || cab.codificacao >= NUM_CODIFICACOES) {
+        liberar_imagem(img);
+        return false;
+    }
+    
+    unsigned char *dados = malloc(cab.tamanho_dados > 0 ? cab.tamanho_dados : 1);
+    size_t lido = fread(dados, 1, cab.tamanho_dados, arquivo_dados);
+    metricas.bytes_lidos_dados += lido;
+    
+    bool ok = lido == (size_t)cab.tamanho_dados &&
+              CODECS[cab.codificacao].decodificar(dados, cab.tamanho_dados, img);
+    free(dados);
+    if (!ok) {
+        liberar_imagem(img);
+    }
+    return ok;
+}
+
+/**
+ * Copia um registro para o fim de outro arquivo sem decodificar os pixels
+ * Retorna o offset no destino (e o cabeçalho copiado), ou -1 se o registro
+ * for inválido
+ */
+long copiar_registro(FILE *origem, long offset, FILE *destino, CabecalhoRegistro *cab) {
+    if (!ler_cabecalho_registro(origem, offset, cab)) {
+        return -1;
+    }
+    
+    unsigned char *dados = malloc(cab->tamanho_dados);
+    if (fread(dados, 1, cab->tamanho_dados, origem) != (size_t)cab->tamanho_dados) {
+        free(dados);
+        return -1;
+    }
+    metricas.bytes_lidos_dados += cab->tamanho_dados;
+    
+    long novo_offset = gravar_registro(destino, -1, cab, dados);
+    free(dados);
+    return novo_offset;
+}
+
+/**
+ * Lê um bloco do arquivo de dados a partir de um offset, sem passar pelo
+ * buffer do FILE* (pread no POSIX)
+ * Retorna o número de bytes lidos
+ */
+long ler_bloco_dados(FILE *arquivo, long offset, unsigned char *bloco, long tamanho) {
+#ifndef _WIN32
+    long lido = 0;
+    while (lido < tamanho) {
+        ssize_t n = pread(fileno(arquivo), bloco + lido, (size_t)(tamanho - lido), (off_t)(offset + lido));
+        if (n <= 0) break;
+        lido += n;
+    }
+#else
+    fseek(arquivo, offset, SEEK_SET);
+    metricas.fseeks++;
+    long lido = (long)fread(bloco, 1, (size_t)tamanho, arquivo);
+#endif
+    metricas.bytes_lidos_dados += lido;
+    return lido;
+}
+
+/**
+ * Copia uma extensão (registros vizinhos) de um arquivo para um offset de outro
+ * No Linux usa copy_file_range: os bytes não passam pela memória do processo
+ * (e o sistema de arquivos pode até compartilhar os blocos). Sem suporte,
+ * ou em outros sistemas, copia em blocos de TAM_BLOCO_COPIA bytes
+ */
+bool copiar_extensao(FILE *origem, long offset, FILE *destino, long offset_destino, long tamanho,
+                     unsigned char *bloco) {
+    long copiado = 0;
+#ifdef __linux__
+    off_t de = offset, para = offset_destino;
+    while (copiado < tamanho) {
+        ssize_t n = copy_file_range(fileno(origem), &de, fileno(destino), &para,
+                                    (size_t)(tamanho - copiado), 0);
+        if (n <= 0) break;               // EXDEV, ENOSYS...: segue em blocos
+        copiado += n;
+    }
+    metricas.bytes_lidos_dados += copiado;
+    metricas.bytes_escritos_dados += copiado;
+#endif
+    while (copiado < tamanho) {
+        long parte = tamanho - copiado < TAM_BLOCO_COPIA ? tamanho - copiado : TAM_BLOCO_COPIA;
+        long lido = ler_bloco_dados(origem, offset + copiado, bloco, parte);
+        if (lido <= 0) {
+            return false;
+        }
+#ifndef _WIN32
+        for (long escrito = 0; escrito < lido; ) {
+            ssize_t n = pwrite(fileno(destino), bloco + escrito, (size_t)(lido - escrito),
+                               (off_t)(offset_destino + copiado + escrito));
+            if (n <= 0) {
+                return false;
+            }
+            escrito += n;
+        }
+#else
+        fseek(destino, offset_destino + copiado, SEEK_SET);
+        metricas.fseeks++;
+        if (fwrite(bloco, 1, (size_t)lido, destino) != (size_t)lido) {
+            return false;
+        }
+#endif
+        metricas.bytes_escritos_dados += lido;
+        copiado += lido;
+    }
+    metricas.extensoes_copiadas++;
+    return true;
+}
+
+/**
+ * Arquivo de saída das exportações: descritor POSIX (write/writev) ou, no
+ * Windows, FILE* sem buffer próprio, já que as escritas chegam em blocos
+ */
+typedef struct {
+#ifndef _WIN32
+    int fd;
+#else
+    FILE *fp;
+#endif
+    bool erro;
+} SaidaArquivo;
+
+bool abrir_saida(SaidaArquivo *saida, const char *nome) {
+    saida->erro = false;
+#ifndef _WIN32
+    saida->fd = open(nome, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return saida->fd >= 0;
+#else
+    saida->fp = fopen(nome, "wb");
+    if (saida->fp) setvbuf(saida->fp, NULL, _IONBF, 0);
+    return saida->fp != NULL;
+#endif
+}
+
+/**
+ * Escreve os blocos (até 2) em ordem com o menor número de chamadas possível
+ */
+void escrever_blocos_saida(SaidaArquivo *saida, const void *const *blocos, const size_t *tamanhos, int num_blocos) {
+    if (saida->erro) return;
+#ifndef _WIN32
+    struct iovec vetor[2];
+    int n = 0;
+    for (int i = 0; i < num_blocos && n < 2; i++) {
+        vetor[n].iov_base = (void*)blocos[i];
+        vetor[n].iov_len = tamanhos[i];
+        n++;
+    }
+    // Escrita parcial: continua de onde parou
+    int primeiro = 0;
+    while (primeiro < n) {
+        ssize_t escrito = writev(saida->fd, vetor + primeiro, n - primeiro);
+        if (escrito < 0) {
+            saida->erro = true;
+            return;
+        }
+        while (primeiro < n && (size_t)escrito >= vetor[primeiro].iov_len) {
+            escrito -= vetor[primeiro].iov_len;
+            primeiro++;
+        }
+        if (primeiro < n) {
+            vetor[primeiro].iov_base = (char*)vetor[primeiro].iov_base + escrito;
+            vetor[primeiro].iov_len -= escrito;
+        }
+    }
+#else
+    for (int i = 0; i < num_blocos; i++) {
+        if (fwrite(blocos[i], 1, tamanhos[i], saida->fp) != tamanhos[i]) {
+            saida->erro = true;
+            return;
+        }
+    }
+#endif
+}
+
+void escrever_saida(SaidaArquivo *saida, const void *dados, size_t tamanho) {
+    escrever_blocos_saida(saida, &dados, &tamanho, 1);
+}
+
+bool fechar_saida(SaidaArquivo *saida) {
+#ifndef _WIN32
+    bool ok = close(saida->fd) == 0;
+#else
+    bool ok = fclose(saida->fp) == 0;
+#endif
+    return ok && !saida->erro;
+}
+
+/**
+ * Tabela de formatação do P2: texto decimal de cada valor seguido de um
+ * espaço, em 4 bytes fixos para ser copiado de uma vez
+ */
+char tabela_decimal[256][4];
+unsigned char tamanho_decimal[256];
+bool tabela_decimal_pronta = false;
+
+void preparar_tabela_decimal() {
+    for (int v = 0; v < 256; v++) {
+        char texto[8];
+        int n = snprintf(texto, sizeof(texto), "%d ", v);
+        memcpy(tabela_decimal[v], texto, 4);
+        tamanho_decimal[v] = (unsigned char)n;
+    }
+    tabela_decimal_pronta = true;
+}
+
+// Reaproveitado por todas as exportações (com folga para a cópia de 4 bytes)
+char *buffer_exportacao = NULL;
+
+/**
+ * Exporta imagem para arquivo PGM
+ * O P2 é formatado no buffer de exportação com a tabela decimal e gravado em
+ * blocos de TAM_BUFFER_EXPORTACAO; o P5 sai em uma única escrita vetorizada
+ * (cabeçalho + pixels)
+ */
+bool exportar_pgm(RegistroImagem *img, const char *nome_saida, bool formato_p2) {
+    double inicio = agora_segundos();
+    SaidaArquivo saida;
+    if (!abrir_saida(&saida, nome_saida)) {
+        fprintf(stderr, "Erro ao criar arquivo %s\n", nome_saida);
+        return false;
+    }
+    
+    char cabecalho[64];
+    size_t tamanho_cabecalho = (size_t)snprintf(cabecalho, sizeof(cabecalho), "%s\n%d %d\n%d\n",
+                                                formato_p2 ? "P2" : "P5",
+                                                img->largura, img->altura, img->max_valor);
+    size_t total_pixels = (size_t)img->largura * img->altura;
+    
+    if (formato_p2) {
+        // Formato P2 (ASCII), 20 valores por linha
+        if (!tabela_decimal_pronta) {
+            preparar_tabela_decimal();
+        }
+        if (!buffer_exportacao) {
+            buffer_exportacao = malloc(TAM_BUFFER_EXPORTACAO + 4);
+        }
+        
+        char *buf = buffer_exportacao;
+        memcpy(buf, cabecalho, tamanho_cabecalho);
+        size_t usado = tamanho_cabecalho;
+        size_t limite = TAM_BUFFER_EXPORTACAO - (4 * PIXELS_POR_LINHA_P2 + 2);
+        
+        for (size_t i = 0; i < total_pixels; i += PIXELS_POR_LINHA_P2) {
+            if (usado > limite) {
+                escrever_saida(&saida, buf, usado);
+                usado = 0;
+            }
+            size_t fim = i + PIXELS_POR_LINHA_P2 < total_pixels ? i + PIXELS_POR_LINHA_P2 : total_pixels;
+            for (size_t j = i; j < fim; j++) {
+                unsigned char v = img->dados[j];
+                memcpy(buf + usado, tabela_decimal[v], 4);
+                usado += tamanho_decimal[v];
+            }
+            if (fim - i == PIXELS_POR_LINHA_P2) {
+                buf[usado++] = '\n';
+            }
+        }
+        buf[usado++] = '\n';
+        escrever_saida(&saida, buf, usado);
+    } else {
+        // Formato P5 (binário)
+        const void *blocos[2] = {cabecalho, img->dados};
+        size_t tamanhos[2] = {tamanho_cabecalho, total_pixels};
+        escrever_blocos_saida(&saida, blocos, tamanhos, 2);
+    }
+    
+    bool ok = fechar_saida(&saida);
+    if (!ok) {
+        fprintf(stderr, "Erro ao gravar arquivo %s\n", nome_saida);
+    }
+    registrar_latencia(OP_EXPORTAR, inicio);
+    return ok;
+}
+
+// Funções de deduplicação de registros
+#define CAPACIDADE_MAPA_INICIAL 64
+
+void iniciar_mapa(MapaRegistros *mapa) {
+    mapa->capacidade = CAPACIDADE_MAPA_INICIAL;
+    mapa->num_entradas = 0;
+    mapa->num_removidas = 0;
+    mapa->entradas = malloc(mapa->capacidade * sizeof(EntradaRegistro));
+    for (int i = 0; i < mapa->capacidade; i++) {
+        mapa->entradas[i].offset = -1;
+    }
+}
+
+void destruir_mapa(MapaRegistros *mapa) {
+    free(mapa->entradas);
+    mapa->entradas = NULL;
+    mapa->capacidade = 0;
+    mapa->num_entradas = 0;
+}
+
+int posicao_inicial_mapa(MapaRegistros *mapa, unsigned long long hash) {
+    // Mistura os bits altos: offsets usados como chave têm os baixos repetidos
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+    return (int)(hash & (unsigned long long)(mapa->capacidade - 1));
+}
+
+void inserir_no_mapa(MapaRegistros *mapa, unsigned long long hash, long offset);
+
+/**
+ * Dobra a tabela (e descarta as marcas de removido) quando passa de 70%
+ */
+void redimensionar_mapa(MapaRegistros *mapa) {
+    EntradaRegistro *antigas = mapa->entradas;
+    int capacidade_antiga = mapa->capacidade;
+    
+    if (mapa->num_entradas * 2 >= capacidade_antiga) {
+        mapa->capacidade *= 2;
+    }
+    mapa->entradas = malloc(mapa->capacidade * sizeof(EntradaRegistro));
+    for (int i = 0; i < mapa->capacidade; i++) {
+        mapa->entradas[i].offset = -1;
+    }
+    mapa->num_entradas = 0;
+    mapa->num_removidas = 0;
+    
+    for (int i = 0; i < capacidade_antiga; i++) {
+        if (antigas[i].offset >= 0) {
+            inserir_no_mapa(mapa, antigas[i].hash, antigas[i].offset);
+        }
+    }
+    free(antigas);
+}
+
+void inserir_no_mapa(MapaRegistros *mapa, unsigned long long hash, long offset) {
+    if ((mapa->num_entradas + mapa->num_removidas + 1) * 10 > mapa->capacidade * 7) {
+        redimensionar_mapa(mapa);
+    }
+    int i = posicao_inicial_mapa(mapa, hash);
+    while (mapa->entradas[i].offset >= 0) {
+        i = (i + 1) & (mapa->capacidade - 1);
+    }
+    if (mapa->entradas[i].offset == -2) {
+        mapa->num_removidas--;
+    }
+    mapa->entradas[i].hash = hash;
+    mapa->entradas[i].offset = offset;
+    mapa->num_entradas++;
+}
+
+void remover_do_mapa(MapaRegistros *mapa, unsigned long long hash, long offset) {
+    int i = posicao_inicial_mapa(mapa, hash);
+    while (mapa->entradas[i].offset != -1) {
+        if (mapa->entradas[i].offset == offset && mapa->entradas[i].hash == hash) {
+            mapa->entradas[i].offset = -2;
+            mapa->num_entradas--;
+            mapa->num_removidas++;
+            return;
+        }
+        i = (i + 1) & (mapa->capacidade - 1);
+    }
+}
+
+/**
+ * Soma delta ao valor da primeira entrada do hash, ou a insere com delta
+ * (mapa usado como contador, com valores positivos)
+ */
+void somar_no_mapa(MapaRegistros *mapa, unsigned long long hash, long delta) {
+    int i = posicao_inicial_mapa(mapa, hash);
+    while (mapa->entradas[i].offset != -1) {
+        if (mapa->entradas[i].offset >= 0 && mapa->entradas[i].hash == hash) {
+            mapa->entradas[i].offset += delta;
+            return;
+        }
+        i = (i + 1) & (mapa->capacidade - 1);
+    }
+    inserir_no_mapa(mapa, hash, delta);
+}
+
+/**
+ * Primeiro offset associado ao hash, ou -1
+ */
+long buscar_no_mapa(MapaRegistros *mapa, unsigned long long hash) {
+    int i = posicao_inicial_mapa(mapa, hash);
+    while (mapa->entradas[i].offset != -1) {
+        if (mapa->entradas[i].offset >= 0 && mapa->entradas[i].hash == hash) {
+            return mapa->entradas[i].offset;
+        }
+        i = (i + 1) & (mapa->capacidade - 1);
+    }
+    return -1;
+}
+
+// Funções de geração dos registros
+
+/**
+ * Arquivo e mapa em que os registros novos são gravados: dados_novo.bin
+ * durante a compactação incremental, dados.bin fora dela
+ */
+FILE* arquivo_gravacao(BancoDados *bd) {
+    return COMPACTANDO(bd) ? bd->arquivo_novo : bd->arquivo_dados;
+}
+
+MapaRegistros* mapa_gravacao(BancoDados *bd) {
+    return COMPACTANDO(bd) ? &bd->registros_novos : &bd->registros;
+}
+
+/**
+ * offset_dados de uma chave que aponta para o registro gravado no offset
+ * do arquivo de gravação (a geração vai no bit BIT_GERACAO_DADOS)
+ */
+long long offset_da_chave(BancoDados *bd, long offset) {
+    int geracao = bd->cabecalho.geracao_dados ^ (COMPACTANDO(bd) ? 1 : 0);
+    return geracao ? (offset | BIT_GERACAO_DADOS) : offset;
+}
+
+/**
+ * Arquivo do registro de uma chave; offset recebe a posição nele
+ */
+FILE* arquivo_do_registro(BancoDados *bd, long long offset_chave, long *offset) {
+    *offset = OFFSET_REGISTRO(offset_chave);
+    if (COMPACTANDO(bd) && GERACAO_OFFSET(offset_chave) != bd->cabecalho.geracao_dados) {
+        return bd->arquivo_novo;
+    }
+    return bd->arquivo_dados;
+}
+
+/**
+ * Carrega a imagem apontada por uma chave, no arquivo de dados certo
+ */
+bool carregar_imagem_chave(BancoDados *bd, const Chave *chave, RegistroImagem *img) {
+    long offset;
+    FILE *arquivo = arquivo_do_registro(bd, chave->offset_dados, &offset);
+    return carregar_imagem(arquivo, offset, img);
+}
+
+// Funções de espaço livre do arquivo de dados
+
+/**
+ * Listas de buracos vazias (dados.bin novo ou recém-compactado)
+ */
+void esvaziar_livres_dados(CabecalhoIndice *cab) {
+    cab->magico_livres_dados = MAGICO_LIVRES_DADOS;
+    for (int c = 0; c < NUM_CLASSES_DADOS; c++) {
+        cab->livres_dados[c] = -1;
+    }
+    cab->bytes_livres_dados = 0;
+}
+
+/**
+ * Classe de um trecho de tamanho bytes: k tal que 2^k <= tamanho < 2^(k+1)
+ */
+int classe_extensao(long tamanho) {
+    int classe = 0;
+    while (classe < NUM_CLASSES_DADOS - 1 && (2L << classe) <= tamanho) {
+        classe++;
+    }
+    return classe;
+}
+
+/**
+ * Transforma um registro sem referências em buraco no início da lista da
+ * sua classe. O buraco continua um registro válido para quem percorre o
+ * arquivo (referencias = 0), e o hash, sem uso, guarda o próximo da lista.
+ */
+void empilhar_buraco(BancoDados *bd, long offset, CabecalhoRegistro *cab) {
+    long tamanho = sizeof(CabecalhoRegistro) + cab->tamanho_dados;
+    int classe = classe_extensao(tamanho);
+    cab->magico = MAGICO_REGISTRO;
+    cab->referencias = 0;
+    cab->hash = (unsigned long long)bd->cabecalho.livres_dados[classe];
+    escrever_cabecalho_registro(arquivo_gravacao(bd), offset, cab);
+    
+    bd->cabecalho.livres_dados[classe] = offset;
+    bd->cabecalho.bytes_livres_dados += tamanho;
+    marcar_cabecalho_sujo(bd);
+}
+
+/**
+ * Guarda um registro que acabou de ficar sem referências. Ele só vira
+ * buraco no commit: antes disso uma queda volta ao índice confirmado, que
+ * ainda pode apontar para ele, então nenhuma gravação do mesmo grupo pode
+ * reaproveitar o espaço
+ */
+void adiar_buraco(BancoDados *bd, long offset) {
+    if (bd->num_buracos_pendentes == bd->capacidade_buracos_pendentes) {
+        bd->capacidade_buracos_pendentes = bd->capacidade_buracos_pendentes > 0 ?
+                                           2 * bd->capacidade_buracos_pendentes : 64;
+        bd->buracos_pendentes = realloc(bd->buracos_pendentes,
+                                        bd->capacidade_buracos_pendentes * sizeof(long));
+    }
+    bd->buracos_pendentes[bd->num_buracos_pendentes++] = offset;
+}
+
+/**
+ * Põe nas listas de buracos os registros que ficaram sem referências desde
+ * o último commit (chamada pelo confirmar, depois do commit)
+ */
+void ligar_buracos_pendentes(BancoDados *bd) {
+    for (int i = 0; i < bd->num_buracos_pendentes; i++) {
+        CabecalhoRegistro cab;
+        if (ler_cabecalho_registro(arquivo_gravacao(bd), bd->buracos_pendentes[i], &cab) &&
+            cab.referencias == 0) {
+            empilhar_buraco(bd, bd->buracos_pendentes[i], &cab);
+        }
+    }
+    bd->num_buracos_pendentes = 0;
+}
+
+/**
+ * Liga o buraco anterior (ou o início da lista, se anterior = -1) ao próximo
+ */
+void religar_buraco(BancoDados *bd, int classe, long anterior, long proximo) {
+    if (anterior < 0) {
+        bd->cabecalho.livres_dados[classe] = proximo;
+        marcar_cabecalho_sujo(bd);
+        return;
+    }
+    CabecalhoRegistro cab;
+    if (ler_cabecalho_registro(arquivo_gravacao(bd), anterior, &cab)) {
+        cab.hash = (unsigned long long)proximo;
+        escrever_cabecalho_registro(arquivo_gravacao(bd), anterior, &cab);
+    }
+}
+
+/**
+ * Procura um buraco para um registro de tamanho bytes (cabeçalho incluído)
+ * Examina alguns buracos da própria classe e depois os primeiros das classes
+ * maiores, em que qualquer buraco é grande o bastante. O registro ocupa o
+ * começo do buraco e a sobra vira um buraco menor, por isso só serve um
+ * buraco exato ou que sobre pelo menos um cabeçalho. Durante a compactação
+ * incremental os registros só são acrescentados: um registro copiado e
+ * liberado em seguida precisa continuar reconhecível (sem referências) até
+ * o fim dela.
+ * Retorna o offset, ou -1 para gravar no fim do arquivo
+ */
+long alocar_extensao(BancoDados *bd, long tamanho) {
+    if (COMPACTANDO(bd)) {
+        return -1;
+    }
+    for (int c = classe_extensao(tamanho); c < NUM_CLASSES_DADOS; c++) {
+        long anterior = -1;
+        long offset = bd->cabecalho.livres_dados[c];
+        for (int tentativa = 0; offset >= 0 && tentativa < MAX_TENTATIVAS_BURACO; tentativa++) {
+            CabecalhoRegistro buraco;
+            if (!ler_cabecalho_registro(arquivo_gravacao(bd), offset, &buraco) || buraco.referencias != 0) {
+                // Lista mais nova que o cabeçalho gravado (queda antes do
+                // commit): descarta o resto dela, que a compactação recupera
+                religar_buraco(bd, c, anterior, -1);
+                break;
+            }
+            long proximo = (long)buraco.hash;
+            long disponivel = sizeof(CabecalhoRegistro) + buraco.tamanho_dados;
+            long sobra = disponivel - tamanho;
+            if (sobra == 0 || sobra >= (long)sizeof(CabecalhoRegistro)) {
+                religar_buraco(bd, c, anterior, proximo);
+                bd->cabecalho.bytes_livres_dados -= disponivel;
+                marcar_cabecalho_sujo(bd);
+                if (sobra > 0) {
+                    buraco.tamanho_dados = (int)(sobra - sizeof(CabecalhoRegistro));
+                    empilhar_buraco(bd, offset + tamanho, &buraco);
+                }
+                metricas.registros_em_buracos++;
+                return offset;
+            }
+            anterior = offset;
+            offset = proximo;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Monta o mapa de um arquivo de dados percorrendo os cabeçalhos dos registros
+ * Com montar_livres, os registros sem referências entram nas listas de buracos
+ */
+void percorrer_registros(BancoDados *bd, FILE *arquivo, MapaRegistros *mapa, bool montar_livres) {
+    iniciar_mapa(mapa);
+    long offset = 0;
+    CabecalhoRegistro cab;
+    while (ler_cabecalho_registro(arquivo, offset, &cab)) {
+        if (cab.referencias > 0) {
+            inserir_no_mapa(mapa, cab.hash, offset);
+        } else if (montar_livres) {
+            empilhar_buraco(bd, offset, &cab);
+        }
+        offset += sizeof(CabecalhoRegistro) + cab.tamanho_dados;
+    }
+}
+
+/**
+ * Monta o mapa de registros de dados.bin
+ * Registros sem referências são buracos; se o cabeçalho do índice ainda não
+ * tiver as listas de buracos (índice de versão anterior), elas são montadas
+ * aqui
+ */
+void carregar_mapa_registros(BancoDados *bd) {
+    bool montar_livres = bd->cabecalho.magico_livres_dados != MAGICO_LIVRES_DADOS;
+    if (montar_livres) {
+        esvaziar_livres_dados(&bd->cabecalho);
+        marcar_cabecalho_sujo(bd);
+    }
+    percorrer_registros(bd, bd->arquivo_dados, &bd->registros, montar_livres);
+}
+
+/**
+ * Confere se o registro no offset tem exatamente o conteúdo informado
+ */
+bool registro_igual(BancoDados *bd, long offset, const CabecalhoRegistro *cab, const unsigned char *dados) {
+    FILE *arquivo = arquivo_gravacao(bd);
+    CabecalhoRegistro existente;
+    if (!ler_cabecalho_registro(arquivo, offset, &existente) ||
+        existente.referencias <= 0 || existente.hash != cab->hash ||
+        existente.largura != cab->largura || existente.altura != cab->altura ||
+        existente.max_valor != cab->max_valor || existente.codificacao != cab->codificacao ||
+        existente.tamanho_dados != cab->tamanho_dados) {
+        return false;
+    }
+    
+    unsigned char *conteudo = malloc(cab->tamanho_dados);
+    bool igual = fread(conteudo, 1, cab->tamanho_dados, arquivo) == (size_t)cab->tamanho_dados &&
+                 memcmp(conteudo, dados, cab->tamanho_dados) == 0;
+    metricas.bytes_lidos_dados += cab->tamanho_dados;
+    free(conteudo);
+    return igual;
+}
+
+/**
+ * Soma delta ao contador de referências do registro apontado pelo
+ * offset_dados de uma chave (o contador fica no próprio cabeçalho). Sem
+ * referências, o registro sai do mapa.
+ * Retorna o novo contador, ou -1 se o offset não tiver um registro válido
+ */
+int alterar_referencias(BancoDados *bd, long long offset_chave, int delta) {
+    long offset;
+    FILE *arquivo = arquivo_do_registro(bd, offset_chave, &offset);
+    CabecalhoRegistro cab;
+    if (!ler_cabecalho_registro(arquivo, offset, &cab) || cab.referencias <= 0) {
+        return -1;
+    }
+    
+    cab.referencias += delta;
+    if (cab.referencias <= 0 && arquivo == arquivo_gravacao(bd)) {
+        // Último dono removido: o espaço do registro vira um buraco no
+        // próximo commit
+        remover_do_mapa(mapa_gravacao(bd), cab.hash, offset);
+        cab.referencias = 0;
+        escrever_cabecalho_registro(arquivo, offset, &cab);
+        adiar_buraco(bd, offset);
+        return 0;
+    }
+    if (cab.referencias <= 0) {
+        // dados.bin sendo compactado: o arquivo inteiro será descartado
+        remover_do_mapa(&bd->registros, cab.hash, offset);
+    }
+    escrever_cabecalho_registro(arquivo, offset, &cab);
+    return cab.referencias;
+}
+
+/**
+ * Grava um registro já codificado (com uma referência) no arquivo de
+ * gravação ou reaproveita um registro igual
+ * Retorna o offset_dados para a chave, com a referência já contada
+ */
+long long armazenar_registro(BancoDados *bd, CabecalhoRegistro *cab, const unsigned char *dados) {
+    // Percorre todos os registros com o mesmo hash
+    MapaRegistros *mapa = mapa_gravacao(bd);
+    int i = posicao_inicial_mapa(mapa, cab->hash);
+    while (mapa->entradas[i].offset != -1) {
+        long candidato = mapa->entradas[i].offset;
+        if (candidato >= 0 && mapa->entradas[i].hash == cab->hash &&
+            registro_igual(bd, candidato, cab, dados)) {
+            alterar_referencias(bd, offset_da_chave(bd, candidato), +1);
+            metricas.registros_reaproveitados++;
+            return offset_da_chave(bd, candidato);
+        }
+        i = (i + 1) & (mapa->capacidade - 1);
+    }
+    
+    long tamanho = sizeof(CabecalhoRegistro) + cab->tamanho_dados;
+    long offset = gravar_registro(arquivo_gravacao(bd), alocar_extensao(bd, tamanho), cab, dados);
+    inserir_no_mapa(mapa, cab->hash, offset);
+    return offset_da_chave(bd, offset);
+}
+
+/**
+ * Grava a imagem no arquivo de dados ou reaproveita um registro igual
+ * Retorna o offset_dados para a chave, que passa a ter mais uma referência
+ */
+long long armazenar_imagem(BancoDados *bd, RegistroImagem *img) {
+    CabecalhoRegistro cab;
+    unsigned char *dados = codificar_imagem(img, &cab);
+    long long offset = armazenar_registro(bd, &cab, dados);
+    free(dados);
+    return offset;
+}
+
+// Funções do dicionário de nomes
+#define CAPACIDADE_DICIONARIO_INICIAL 64
+
+int posicao_inicial_nome(DicionarioNomes *dic, const char *nome) {
+    unsigned long long hash = hash_fnv(14695981039346656037ULL, nome, strlen(nome));
+    return (int)(hash & (unsigned long long)(dic->capacidade_tabela - 1));
+}
+
+/**
+ * Registra o nome na tabela hash (id ainda não presente)
+ */
+void indexar_nome(DicionarioNomes *dic, int id) {
+    int i = posicao_inicial_nome(dic, dic->nomes[id]);
+    while (dic->tabela[i] >= 0) {
+        i = (i + 1) & (dic->capacidade_tabela - 1);
+    }
+    dic->tabela[i] = id;
+}
+
+/**
+ * Dobra a tabela hash quando passa de 50% de ocupação
+ */
+void redimensionar_tabela_nomes(DicionarioNomes *dic) {
+    free(dic->tabela);
+    dic->capacidade_tabela *= 2;
+    dic->tabela = malloc(dic->capacidade_tabela * sizeof(int));
+    for (int i = 0; i < dic->capacidade_tabela; i++) {
+        dic->tabela[i] = -1;
+    }
+    for (int id = 0; id < dic->num_nomes; id++) {
+        indexar_nome(dic, id);
+    }
+}
+
+/**
+ * Acrescenta um nome em memória e devolve o id dele
+ * A gravação fica para o próximo commit (gravar_dicionario)
+ */
+unsigned int acrescentar_nome(DicionarioNomes *dic, const char *nome) {
+    if (dic->num_nomes >= dic->capacidade_nomes) {
+        dic->capacidade_nomes *= 2;
+        dic->nomes = realloc(dic->nomes, dic->capacidade_nomes * sizeof(char*));
+    }
+    int id = dic->num_nomes++;
+    dic->nomes[id] = malloc(strlen(nome) + 1);
+    strcpy(dic->nomes[id], nome);
+    
+    if (dic->num_nomes * 2 > dic->capacidade_tabela) {
+        redimensionar_tabela_nomes(dic);
+    } else {
+        indexar_nome(dic, id);
+    }
+    return (unsigned int)id;
+}
+
+/**
+ * Id do nome, ou ID_NOME_AUSENTE se ele nunca foi registrado
+ */
+unsigned int buscar_id_nome(BancoDados *bd, const char *nome) {
+    DicionarioNomes *dic = &bd->nomes;
+    int i = posicao_inicial_nome(dic, nome);
+    while (dic->tabela[i] >= 0) {
+        if (strcmp(dic->nomes[dic->tabela[i]], nome) == 0) {
+            return (unsigned int)dic->tabela[i];
+        }
+        i = (i + 1) & (dic->capacidade_tabela - 1);
+    }
+    return ID_NOME_AUSENTE;
+}
+
+/**
+ * Id do nome, registrando-o no dicionário se for novo
+ */
+unsigned int obter_id_nome(BancoDados *bd, const char *nome) {
+    unsigned int id = buscar_id_nome(bd, nome);
+    if (id == ID_NOME_AUSENTE) {
+        id = acrescentar_nome(&bd->nomes, nome);
+    }
+    return id;
+}
+
+const char* nome_do_id(BancoDados *bd, unsigned int id) {
+    if (id >= (unsigned int)bd->nomes.num_nomes) return "?";
+    return bd->nomes.nomes[id];
+}
+
+int comparar_nomes_ordenados(const void *a, const void *b) {
+    return strcmp(((const NomeOrdenado*)a)->nome, ((const NomeOrdenado*)b)->nome);
+}
+
+int comparar_ids(const void *a, const void *b) {
+    unsigned int ia = *(const unsigned int*)a;
+    unsigned int ib = *(const unsigned int*)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/**
+ * Põe na ordem alfabética os nomes acrescentados desde a última consulta:
+ * os novos são ordenados entre si e intercalados com os já ordenados, em
+ * O(k log k + n) para k nomes novos
+ */
+void ordenar_nomes_novos(DicionarioNomes *dic) {
+    int antigos = dic->num_ordenados;
+    int total = dic->num_nomes;
+    if (antigos == total) return;
+    
+    NomeOrdenado *novos = malloc((total - antigos) * sizeof(NomeOrdenado));
+    for (int id = antigos; id < total; id++) {
+        novos[id - antigos].nome = dic->nomes[id];
+        novos[id - antigos].id = (unsigned int)id;
+    }
+    qsort(novos, total - antigos, sizeof(NomeOrdenado), comparar_nomes_ordenados);
+    
+    NomeOrdenado *mesclados = malloc(total * sizeof(NomeOrdenado));
+    int a = 0, b = 0, n = 0;
+    while (a < antigos && b < total - antigos) {
+        if (strcmp(dic->ordenados[a].nome, novos[b].nome) <= 0) {
+            mesclados[n++] = dic->ordenados[a++];
+        } else {
+            mesclados[n++] = novos[b++];
+        }
+    }
+    while (a < antigos) mesclados[n++] = dic->ordenados[a++];
+    while (b < total - antigos) mesclados[n++] = novos[b++];
+    
+    free(novos);
+    free(dic->ordenados);
+    dic->ordenados = mesclados;
+    dic->num_ordenados = total;
+}
+
+/**
+ * Ids (crescentes) dos nomes que começam com o prefixo
+ * Na ordem alfabética eles formam uma faixa contígua, achada por busca
+ * binária: O(log n + m) para m nomes com o prefixo, mais a ordenação dos
+ * nomes novos (ordenar_nomes_novos)
+ * ids precisa ter espaço para todos os nomes do dicionário
+ */
+int ids_com_prefixo(BancoDados *bd, const char *prefixo, unsigned int *ids) {
+    DicionarioNomes *dic = &bd->nomes;
+    ordenar_nomes_novos(dic);
+    
+    // Primeiro nome >= prefixo: os que começam com ele vêm logo em seguida
+    int inicio = 0, fim = dic->num_ordenados;
+    while (inicio < fim) {
+        int meio = inicio + (fim - inicio) / 2;
+        if (strcmp(dic->ordenados[meio].nome, prefixo) < 0) {
+            inicio = meio + 1;
+        } else {
+            fim = meio;
+        }
+    }
+    
+    size_t tamanho = strlen(prefixo);
+    int num_ids = 0;
+    for (int i = inicio; i < dic->num_ordenados &&
+                        strncmp(dic->ordenados[i].nome, prefixo, tamanho) == 0; i++) {
+        ids[num_ids++] = dic->ordenados[i].id;
+    }
+    // Em ordem de id, para os ids consecutivos virarem um só intervalo
+    qsort(ids, num_ids, sizeof(unsigned int), comparar_ids);
+    return num_ids;
+}
+
+/**
+ * Grava os nomes novos no fim do arquivo e depois o cabeçalho com a contagem
+ * Um nome gravado sem a contagem atualizada é ignorado na próxima abertura
+ */
+void gravar_dicionario(DicionarioNomes *dic) {
+    if (!dic->arquivo || dic->num_gravados == dic->num_nomes) return;
+    
+    fseek(dic->arquivo, dic->fim_arquivo, SEEK_SET);
+    for (int id = dic->num_gravados; id < dic->num_nomes; id++) {
+        unsigned char tamanho = (unsigned char)strlen(dic->nomes[id]);
+        fwrite(&tamanho, 1, 1, dic->arquivo);
+        fwrite(dic->nomes[id], 1, tamanho, dic->arquivo);
+        dic->fim_arquivo += 1 + tamanho;
     }
+    dic->num_gravados = dic->num_nomes;
     
-    return true;
+    CabecalhoNomes cab = {MAGICO_NOMES, dic->num_nomes};
+    fseek(dic->arquivo, 0, SEEK_SET);
+    fwrite(&cab, sizeof(CabecalhoNomes), 1, dic->arquivo);
+    fflush(dic->arquivo);
+    metricas.fflushes++;
 }
 
-// Funções de percurso
-void percurso_em_ordem_recursivo(BancoDados *bd, Pagina *pagina) {
-    if (pagina == NULL) return;
+/**
+ * Abre o dicionário e carrega todos os nomes em memória
+ * Com novo = true (índice novo) começa um dicionário vazio
+ */
+bool abrir_dicionario(DicionarioNomes *dic, bool novo) {
+    dic->capacidade_nomes = CAPACIDADE_DICIONARIO_INICIAL;
+    dic->nomes = malloc(dic->capacidade_nomes * sizeof(char*));
+    dic->num_nomes = 0;
+    dic->num_gravados = 0;
+    dic->capacidade_tabela = 2 * CAPACIDADE_DICIONARIO_INICIAL;
+    dic->tabela = malloc(dic->capacidade_tabela * sizeof(int));
+    dic->ordenados = NULL;
+    dic->num_ordenados = 0;
+    for (int i = 0; i < dic->capacidade_tabela; i++) {
+        dic->tabela[i] = -1;
+    }
     
-    int i;
-    for (i = 0; i < pagina->num_chaves; i++) {
-        if (!pagina->eh_folha) {
-            Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
-            percurso_em_ordem_recursivo(bd, filho);
-            free(filho);
-        }
-        printf("  %s, limiar=%d (offset: %ld)\n", 
-               pagina->chaves[i].nome_arquivo, 
-               pagina->chaves[i].limiar,
-               pagina->chaves[i].offset_dados);
+    dic->arquivo = fopen(ARQUIVO_NOMES, novo ? "w+b" : "r+b");
+    CabecalhoNomes cab = {MAGICO_NOMES, 0};
+    if (!dic->arquivo) {
+        return false;
+    }
+    if (novo) {
+        fwrite(&cab, sizeof(CabecalhoNomes), 1, dic->arquivo);
+    } else if (fread(&cab, sizeof(CabecalhoNomes), 1, dic->arquivo) != 1 ||
+               cab.magico != MAGICO_NOMES || cab.num_nomes < 0) {
+        fclose(dic->arquivo);
+        dic->arquivo = NULL;
+        return false;
     }
     
-    if (!pagina->eh_folha) {
-        Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
-        percurso_em_ordem_recursivo(bd, filho);
-        free(filho);
+    char nome[TAM_NOME_ARQUIVO];
+    for (int id = 0; id < cab.num_nomes; id++) {
+        unsigned char tamanho;
+        if (fread(&tamanho, 1, 1, dic->arquivo) != 1 ||
+            fread(nome, 1, tamanho, dic->arquivo) != tamanho) {
+            // Nada é regravado: o arquivo fica como estava
+            fclose(dic->arquivo);
+            dic->arquivo = NULL;
+            return false;
+        }
+        nome[tamanho] = '\0';
+        acrescentar_nome(dic, nome);
+    }
+    dic->num_gravados = dic->num_nomes;
+    dic->fim_arquivo = ftell(dic->arquivo);
+    return true;
+}
+
+void fechar_dicionario(DicionarioNomes *dic) {
+    gravar_dicionario(dic);
+    if (dic->arquivo) fclose(dic->arquivo);
+    for (int id = 0; id < dic->num_nomes; id++) {
+        free(dic->nomes[id]);
     }
+    free(dic->nomes);
+    free(dic->tabela);
+    free(dic->ordenados);
 }
 
+// Funções de carga em massa
+#define MAX_NIVEIS_CARGA 64
+
 /**
- * Percurso em ordem - interface pública
+ * Carga em massa: monta um índice novo a partir de chaves já ordenadas
+ * Folhas são preenchidas por completo da esquerda para a direita e as chaves
+ * que não cabem sobem como separadoras, montando os níveis de cima. Cada
+ * página é gravada uma única vez, com offsets crescentes. Páginas internas
+ * deixam livre o espaço de uma chave: o rebalanceamento final pode trocar a
+ * última separadora por uma que comprime menos.
+ * No modo B+ a chave que não cabe abre a folha seguinte e só uma cópia
+ * sobe; as cópias ficam guardadas até a última folha, então as folhas
+ * ocupam um trecho contíguo do arquivo e os níveis de cima vêm depois.
  */
-void percurso_em_ordem(BancoDados *bd) {
-    printf("\n=== Percurso em Ordem (Chaves Ordenadas) ===\n");
-    percurso_em_ordem_recursivo(bd, bd->raiz_ram);
-    printf("============================================\n\n");
+typedef struct {
+    FILE *arquivo;                       // Índice de destino (vazio)
+    int ordem;
+    int num_niveis;
+    Pagina *abertas[MAX_NIVEIS_CARGA];   // Página sendo preenchida em cada nível
+    Pagina *anteriores[MAX_NIVEIS_CARGA];// Última página fechada (gravação adiada)
+    int bytes_abertas[MAX_NIVEIS_CARGA]; // Bytes em disco das chaves de cada página aberta
+    Chave ultima;                        // Para validar a ordenação
+    long num_chaves;
+    long proximo_offset;
+    int num_paginas;
+    bool folhas_encadeadas;              // Modo B+
+    Chave *separadoras;                  // Modo B+: primeira chave de cada folha após a primeira
+    long *folhas_esquerdas;              // Folha à esquerda de cada separadora
+    int num_separadoras;
+    int capacidade_separadoras;
+} CargaEmMassa;
+
+void iniciar_carga(CargaEmMassa *carga, FILE *arquivo, int ordem, bool folhas_encadeadas) {
+    carga->arquivo = arquivo;
+    carga->ordem = ordem;
+    carga->folhas_encadeadas = folhas_encadeadas;
+    carga->separadoras = NULL;
+    carga->folhas_esquerdas = NULL;
+    carga->num_separadoras = 0;
+    carga->capacidade_separadoras = 0;
+    carga->num_niveis = 0;
+    for (int i = 0; i < MAX_NIVEIS_CARGA; i++) {
+        carga->abertas[i] = NULL;
+        carga->anteriores[i] = NULL;
+        carga->bytes_abertas[i] = 0;
+    }
+    carga->num_chaves = 0;
+    carga->proximo_offset = TAM_PAGINA;
+    carga->num_paginas = 0;
 }
 
-// Funções de visualização de páginas
-void imprimir_pagina(Pagina *pagina, int num_pagina) {
-    printf("Página [%d]: (offset: %ld, folha: %s, chaves: %d)\n", 
-           num_pagina, 
-           pagina->offset_proprio,
-           pagina->eh_folha ? "SIM" : "NÃO",
-           pagina->num_chaves);
-    
-    for (int i = 0; i < pagina->num_chaves; i++) {
-        printf("  Chave [%s], limiar=[%d], offset_dados=%ld\n",
-               pagina->chaves[i].nome_arquivo,
-               pagina->chaves[i].limiar,
-               pagina->chaves[i].offset_dados);
+Pagina* nova_pagina_carga(CargaEmMassa *carga, int nivel) {
+    Pagina *pagina = alocar_memoria_pagina(carga->ordem);
+    pagina->num_chaves = 0;
+    pagina->eh_folha = (nivel == 0);
+    pagina->offset_proprio = -1;
+    pagina->proxima_folha = -1;
+    for (int i = 0; i <= carga->ordem; i++) {
+        pagina->filhos[i] = -1;
     }
-    
-    if (!pagina->eh_folha) {
-        printf("  Filhos: ");
-        for (int i = 0; i <= pagina->num_chaves; i++) {
-            printf("[%ld] ", pagina->filhos[i]);
-        }
-        printf("\n");
+    return pagina;
+}
+
+/**
+ * Grava a página anterior de um nível, que não pode mais mudar
+ */
+void gravar_anterior_carga(CargaEmMassa *carga, int nivel) {
+    Pagina *anterior = carga->anteriores[nivel];
+    if (anterior) {
+        escrever_pagina_arquivo(carga->arquivo, anterior, anterior->offset_proprio);
+        free(anterior);
+        carga->anteriores[nivel] = NULL;
     }
-    printf("\n");
 }
 
 /**
- * Visualiza todas as páginas do arquivo de índice
+ * Fecha a página aberta de um nível e reserva seu offset
+ * A gravação fica adiada: a última página de cada nível ainda pode ser
+ * rebalanceada com ela no final da carga
  */
-void visualizar_paginas(BancoDados *bd) {
-    printf("\n=== Visualização de Páginas do Índice ===\n");
-    printf("Total de páginas: %d\n", bd->cabecalho.num_paginas);
-    printf("Altura da árvore: %d\n\n", bd->cabecalho.altura);
+long fechar_pagina_carga(CargaEmMassa *carga, int nivel) {
+    Pagina *pagina = carga->abertas[nivel];
+    pagina->offset_proprio = carga->proximo_offset;
+    carga->proximo_offset += TAM_PAGINA;
+    carga->num_paginas++;
     
-    long offset = sizeof(CabecalhoIndice);
-    int num_pagina = 0;
-    
-    while (offset < bd->cabecalho.proximo_offset) {
-        Pagina *pagina = ler_pagina(bd->arquivo_indice, offset);
-        imprimir_pagina(pagina, num_pagina);
-        free(pagina);
-        
-        offset += sizeof(Pagina);
-        num_pagina++;
+    if (nivel == 0 && carga->folhas_encadeadas && carga->anteriores[0]) {
+        carga->anteriores[0]->proxima_folha = pagina->offset_proprio;
     }
-    
-    printf("=========================================\n\n");
+    gravar_anterior_carga(carga, nivel);
+    carga->anteriores[nivel] = pagina;
+    carga->abertas[nivel] = NULL;
+    return pagina->offset_proprio;
 }
 
-// Funções de manipulação de imagens
-void aplicar_limiarizacao(RegistroImagem *img_orig, RegistroImagem *img_bin, int limiar) {
-    *img_bin = *img_orig;
-    img_bin->limiar = limiar;
-    
-    int total_pixels = img_orig->largura * img_orig->altura;
-    for (int i = 0; i < total_pixels; i++) {
-        img_bin->dados[i] = (img_orig->dados[i] >= limiar) ? 255 : 0;
+/**
+ * Modo B+: guarda a cópia da primeira chave de uma folha nova e a folha à
+ * esquerda dela, para montar os níveis de cima depois das folhas
+ */
+void guardar_separadora_carga(CargaEmMassa *carga, Chave *chave, long folha_esquerda) {
+    if (carga->num_separadoras >= carga->capacidade_separadoras) {
+        carga->capacidade_separadoras = carga->capacidade_separadoras ? 2 * carga->capacidade_separadoras : 64;
+        carga->separadoras = realloc(carga->separadoras, carga->capacidade_separadoras * sizeof(Chave));
+        carga->folhas_esquerdas = realloc(carga->folhas_esquerdas, carga->capacidade_separadoras * sizeof(long));
     }
+    carga->separadoras[carga->num_separadoras] = *chave;
+    carga->folhas_esquerdas[carga->num_separadoras] = folha_esquerda;
+    carga->num_separadoras++;
 }
 
 /**
- * Lê arquivo PGM
+ * Acrescenta uma chave (com o filho à sua esquerda) na página aberta do nível
+ * Se a página já está cheia, ela é fechada e a chave sobe como separadora
  */
-bool ler_pgm(const char *nome_arquivo, RegistroImagem *img) {
-    FILE *fp = fopen(nome_arquivo, "rb");
-    if (!fp) {
-        printf("Erro ao abrir arquivo %s\n", nome_arquivo);
+bool adicionar_no_nivel(CargaEmMassa *carga, int nivel, Chave *chave, long filho_esquerdo) {
+    if (nivel >= MAX_NIVEIS_CARGA) {
         return false;
     }
+    if (nivel == carga->num_niveis) {
+        carga->num_niveis++;
+    }
+    if (!carga->abertas[nivel]) {
+        carga->abertas[nivel] = nova_pagina_carga(carga, nivel);
+        carga->bytes_abertas[nivel] = 0;
+    }
     
-    char formato[3];
-    fscanf(fp, "%2s", formato);
+    Pagina *pagina = carga->abertas[nivel];
+    pagina->filhos[pagina->num_chaves] = filho_esquerdo;
+    int tamanho = tamanho_chave_disco(chave, pagina->num_chaves > 0 ? &pagina->chaves[pagina->num_chaves - 1] : NULL,
+                                      pagina->eh_folha);
+    int limite = pagina->eh_folha ? TAM_UTIL_PAGINA : TAM_UTIL_PAGINA - MAX_TAM_CHAVE_DISCO;
+    if (pagina->num_chaves < carga->ordem - 1 && carga->bytes_abertas[nivel] + tamanho <= limite) {
+        pagina->chaves[pagina->num_chaves++] = *chave;
+        carga->bytes_abertas[nivel] += tamanho;
+        return true;
+    }
     
-    if (strcmp(formato, "P5") != 0 && strcmp(formato, "P2") != 0) {
-        printf("Formato não suportado (apenas P2 e P5)\n");
-        fclose(fp);
+    // Página cheia: o filho vira o último dela e a chave sobe
+    long offset = fechar_pagina_carga(carga, nivel);
+    carga->abertas[nivel] = nova_pagina_carga(carga, nivel);
+    carga->bytes_abertas[nivel] = 0;
+    if (nivel == 0 && carga->folhas_encadeadas) {
+        // Modo B+: a chave abre a folha nova e a cópia sobe no final
+        guardar_separadora_carga(carga, chave, offset);
+        return adicionar_no_nivel(carga, 0, chave, -1);
+    }
+    return adicionar_no_nivel(carga, nivel + 1, chave, offset);
+}
+
+/**
+ * Acrescenta a próxima chave da sequência ordenada
+ * Retorna false se a chave não for maior que a anterior
+ */
+bool adicionar_chave_carga(CargaEmMassa *carga, Chave *chave) {
+    if (carga->num_chaves > 0 && comparar_chaves(chave, &carga->ultima) <= 0) {
         return false;
     }
+    carga->ultima = *chave;
+    carga->num_chaves++;
+    return adicionar_no_nivel(carga, 0, chave, -1);
+}
+
+/**
+ * Redistribui a última página de um nível com a anterior quando ela
+ * ficou abaixo do mínimo. A separadora entre as duas é a última chave da
+ * primeira página aberta não vazia acima do nível.
+ */
+void rebalancear_ultima_carga(CargaEmMassa *carga, int nivel) {
+    Pagina *anterior = carga->anteriores[nivel];
+    Pagina *ultima = carga->abertas[nivel];
     
-    // Ignora comentários
-    char c = getc(fp);
-    while (c == '#') {
-        while (getc(fp) != '\n');
-        c = getc(fp);
-    }
-    ungetc(c, fp);
+    int acima = nivel + 1;
+    while (carga->abertas[acima]->num_chaves == 0) acima++;
+    Pagina *pai = carga->abertas[acima];
+    Chave *separadora = &pai->chaves[pai->num_chaves - 1];
     
-    fscanf(fp, "%d %d", &img->largura, &img->altura);
-    fscanf(fp, "%d", &img->max_valor);
-    fgetc(fp); // Consome newline
+    int total = anterior->num_chaves + 1 + ultima->num_chaves;
+    Chave *chaves = malloc(total * sizeof(Chave));
+    long *filhos = malloc((total + 1) * sizeof(long));
     
-    int total_pixels = img->largura * img->altura;
+    int n = 0;
+    for (int i = 0; i < anterior->num_chaves; i++) chaves[n++] = anterior->chaves[i];
+    chaves[n++] = *separadora;
+    for (int i = 0; i < ultima->num_chaves; i++) chaves[n++] = ultima->chaves[i];
     
-    if (total_pixels > TAM_MAX_IMAGEM) {
-        printf("Imagem muito grande (máximo %d pixels)\n", TAM_MAX_IMAGEM);
-        fclose(fp);
-        return false;
-    }
+    n = 0;
+    for (int i = 0; i <= anterior->num_chaves; i++) filhos[n++] = anterior->filhos[i];
+    for (int i = 0; i <= ultima->num_chaves; i++) filhos[n++] = ultima->filhos[i];
     
-    if (strcmp(formato, "P5") == 0) {
-        fread(img->dados, sizeof(unsigned char), total_pixels, fp);
-    } else {
-        for (int i = 0; i < total_pixels; i++) {
-            int valor;
-            fscanf(fp, "%d", &valor);
-            img->dados[i] = (unsigned char)valor;
-        }
-    }
+    int meio = escolher_divisao(chaves, total, anterior->eh_folha, carga->ordem - 1, false);
+    anterior->num_chaves = meio;
+    for (int i = 0; i < meio; i++) anterior->chaves[i] = chaves[i];
+    for (int i = 0; i <= meio; i++) anterior->filhos[i] = filhos[i];
     
-    fclose(fp);
-    strcpy(img->nome_original, nome_arquivo);
-    return true;
+    *separadora = chaves[meio];
+    
+    ultima->num_chaves = total - meio - 1;
+    for (int i = 0; i < ultima->num_chaves; i++) ultima->chaves[i] = chaves[meio + 1 + i];
+    for (int i = 0; i <= ultima->num_chaves; i++) ultima->filhos[i] = filhos[meio + 1 + i];
+    
+    free(chaves);
+    free(filhos);
 }
 
 /**
- * Salva imagem no arquivo de dados
+ * Modo B+: redistribui a última folha com a anterior quando ela ficou abaixo
+ * do mínimo; a separadora guardada passa a ser a nova primeira da última
  */
-long salvar_imagem(FILE *arquivo_dados, RegistroImagem *img) {
-    fseek(arquivo_dados, 0, SEEK_END);
-    long offset = ftell(arquivo_dados);
-    fwrite(img, sizeof(RegistroImagem), 1, arquivo_dados);
-    fflush(arquivo_dados);
-    return offset;
+void rebalancear_ultima_folha_carga(CargaEmMassa *carga) {
+    Pagina *anterior = carga->anteriores[0];
+    Pagina *ultima = carga->abertas[0];
+    
+    int total = anterior->num_chaves + ultima->num_chaves;
+    Chave *chaves = malloc(total * sizeof(Chave));
+    int n = 0;
+    for (int i = 0; i < anterior->num_chaves; i++) chaves[n++] = anterior->chaves[i];
+    for (int i = 0; i < ultima->num_chaves; i++) chaves[n++] = ultima->chaves[i];
+    
+    int meio = escolher_divisao(chaves, total, true, carga->ordem - 1, true);
+    anterior->num_chaves = meio;
+    for (int i = 0; i < meio; i++) anterior->chaves[i] = chaves[i];
+    ultima->num_chaves = total - meio;
+    for (int i = 0; i < ultima->num_chaves; i++) ultima->chaves[i] = chaves[meio + i];
+    carga->separadoras[carga->num_separadoras - 1] = chaves[meio];
+    free(chaves);
 }
 
 /**
- * Carrega imagem do arquivo de dados
+ * Modo B+: fecha a última folha e monta os níveis de cima com as
+ * separadoras guardadas, com offsets depois de todas as folhas
  */
-bool carregar_imagem(FILE *arquivo_dados, long offset, RegistroImagem *img) {
-    fseek(arquivo_dados, offset, SEEK_SET);
-    size_t lido = fread(img, sizeof(RegistroImagem), 1, arquivo_dados);
-    return lido == 1;
+void finalizar_folhas_carga(CargaEmMassa *carga) {
+    Pagina *ultima = carga->abertas[0];
+    if (abaixo_limites(ultima->chaves, ultima->num_chaves, true, carga->ordem - 1)) {
+        rebalancear_ultima_folha_carga(carga);
+    }
+    long offset = fechar_pagina_carga(carga, 0);
+    gravar_anterior_carga(carga, 0);
+    
+    for (int i = 0; i < carga->num_separadoras; i++) {
+        adicionar_no_nivel(carga, 1, &carga->separadoras[i], carga->folhas_esquerdas[i]);
+    }
+    Pagina *pai = carga->abertas[1];
+    pai->filhos[pai->num_chaves] = offset;
 }
 
 /**
- * Exporta imagem para arquivo PGM
+ * Termina a carga: fecha as últimas páginas de baixo para cima, grava o
+ * que ficou pendente e preenche o cabeçalho do novo índice
  */
-bool exportar_pgm(RegistroImagem *img, const char *nome_saida, bool formato_p2) {
-    FILE *fp = fopen(nome_saida, "wb");
-    if (!fp) {
-        printf("Erro ao criar arquivo %s\n", nome_saida);
-        return false;
+void finalizar_carga(CargaEmMassa *carga, CabecalhoIndice *cabecalho) {
+    if (carga->num_niveis == 0) {
+        // Nenhuma chave: índice com uma folha vazia como raiz
+        carga->abertas[0] = nova_pagina_carga(carga, 0);
+        carga->num_niveis = 1;
     }
     
-    if (formato_p2) {
-        // Formato P2 (ASCII)
-        fprintf(fp, "P2\n");
-        fprintf(fp, "%d %d\n", img->largura, img->altura);
-        fprintf(fp, "%d\n", img->max_valor);
+    int primeiro_nivel = 0;
+    if (carga->folhas_encadeadas && carga->num_separadoras > 0) {
+        finalizar_folhas_carga(carga);
+        primeiro_nivel = 1;
+    }
+    
+    long offset_raiz = -1;
+    for (int nivel = primeiro_nivel; nivel < carga->num_niveis; nivel++) {
+        bool eh_raiz = (nivel == carga->num_niveis - 1);
         
-        int total_pixels = img->largura * img->altura;
-        for (int i = 0; i < total_pixels; i++) {
-            fprintf(fp, "%d ", img->dados[i]);
-            if ((i + 1) % 20 == 0) fprintf(fp, "\n"); // 20 valores por linha
+        Pagina *ultima = carga->abertas[nivel];
+        if (!eh_raiz && abaixo_limites(ultima->chaves, ultima->num_chaves, ultima->eh_folha, carga->ordem - 1)) {
+            rebalancear_ultima_carga(carga, nivel);
         }
-        fprintf(fp, "\n");
-    } else {
-        // Formato P5 (binário)
-        fprintf(fp, "P5\n");
-        fprintf(fp, "%d %d\n", img->largura, img->altura);
-        fprintf(fp, "%d\n", img->max_valor);
         
-        int total_pixels = img->largura * img->altura;
-        fwrite(img->dados, sizeof(unsigned char), total_pixels, fp);
+        long offset = fechar_pagina_carga(carga, nivel);
+        gravar_anterior_carga(carga, nivel);
+        
+        if (eh_raiz) {
+            offset_raiz = offset;
+        } else {
+            // Último filho da página aberta do nível de cima
+            Pagina *pai = carga->abertas[nivel + 1];
+            pai->filhos[pai->num_chaves] = offset;
+        }
     }
     
-    fclose(fp);
-    return true;
+    cabecalho->magico = MAGICO_INDICE;
+    cabecalho->ordem = carga->ordem;
+    cabecalho->offset_raiz = offset_raiz;
+    cabecalho->proximo_offset = carga->proximo_offset;
+    cabecalho->altura = carga->num_niveis - 1;
+    cabecalho->num_paginas = carga->num_paginas;
+    cabecalho->folhas_encadeadas = carga->folhas_encadeadas;
+    cabecalho->primeira_livre = 0;
+    cabecalho->num_paginas_livres = 0;
+    esvaziar_livres_dados(cabecalho);    // dados.bin recém-compactado
+    cabecalho->geracao_dados = 0;
+    cabecalho->compactacao_ativa = 0;
+    cabecalho->progresso_compactacao = 0;
+    free(carga->separadoras);
+    free(carga->folhas_esquerdas);
 }
 
 // Funções de compactação
@@ -874,126 +4246,209 @@ typedef struct {
     int capacidade;
 } ListaChaves;
 
+void acrescentar_chave(ListaChaves *lista, const Chave *chave) {
+    if (lista->num_chaves >= lista->capacidade) {
+        lista->capacidade = lista->capacidade > 0 ? 2 * lista->capacidade : 100;
+        lista->chaves = realloc(lista->chaves, lista->capacidade * sizeof(Chave));
+    }
+    lista->chaves[lista->num_chaves++] = *chave;
+}
+
 /**
  * Coleta todas as chaves em ordem (para compactação)
+ * Retorna false se o cursor não conseguiu percorrer o índice inteiro
  */
-void coletar_chaves_recursivo(BancoDados *bd, Pagina *pagina, ListaChaves *lista) {
-    if (pagina == NULL) return;
+bool coletar_chaves(BancoDados *bd, ListaChaves *lista) {
+    Cursor cursor;
+    Chave chave;
+    cursor_abrir_tudo(bd, &cursor);
+    while (cursor_proximo(&cursor, &chave)) {
+        acrescentar_chave(lista, &chave);
+    }
+    return !cursor.invalido;
+}
+
+/**
+ * Copia para destino (vazio) os registros de origem cujos offsets estão em
+ * vivos, na ordem do arquivo, deixando de fora buracos e registros sem chave
+ * Os cabeçalhos são lidos em blocos de TAM_BLOCO_COPIA bytes, e registros
+ * vivos vizinhos formam uma extensão copiada de uma vez só
+ * vivos leva o offset de cada registro ao número de chaves que o apontam, e
+ * esse número vira o contador de referências da cópia: uma referência que
+ * sobrou de uma queda (ou de um passo de compactação sem commit) some aqui
+ * Preenche copiados (offset antigo -> novo) e novos_registros (hash -> offset
+ * novo). Retorna o tamanho do arquivo novo, ou -1 em caso de erro
+ */
+long copiar_registros_vivos(FILE *origem, FILE *destino, MapaRegistros *vivos,
+                            MapaRegistros *copiados, MapaRegistros *novos_registros) {
+    fseek(origem, 0, SEEK_END);
+    long tamanho_origem = ftell(origem);
+    unsigned char *cabecalhos = malloc(TAM_BLOCO_COPIA);
+    unsigned char *bloco = malloc(TAM_BLOCO_COPIA);
+    long inicio_bloco = 0, fim_bloco = 0;            // Trecho da origem em cabecalhos
+    long inicio_extensao = 0, tamanho_extensao = 0;  // Extensão ainda não copiada
+    long offset_destino = 0;                         // Onde ela começa no destino
+    bool ok = true;
+    // Cabeçalhos com o contador errado, corrigidos depois da cópia
+    CabecalhoRegistro *corrigidos = NULL;
+    long *offsets_corrigidos = NULL;
+    int num_corrigidos = 0, capacidade_corrigidos = 0;
     
-    int i;
-    for (i = 0; i < pagina->num_chaves; i++) {
-        if (!pagina->eh_folha) {
-            Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
-            coletar_chaves_recursivo(bd, filho, lista);
-            free(filho);
+    long offset = 0;
+    while (ok && offset + (long)sizeof(CabecalhoRegistro) <= tamanho_origem) {
+        if (offset + (long)sizeof(CabecalhoRegistro) > fim_bloco) {
+            inicio_bloco = offset;
+            fim_bloco = offset + ler_bloco_dados(origem, offset, cabecalhos, TAM_BLOCO_COPIA);
+            if (offset + (long)sizeof(CabecalhoRegistro) > fim_bloco) break;
+        }
+        CabecalhoRegistro cab;
+        memcpy(&cab, cabecalhos + (offset - inicio_bloco), sizeof(CabecalhoRegistro));
+        long tamanho = (long)sizeof(CabecalhoRegistro) + cab.tamanho_dados;
+        if (cab.magico != MAGICO_REGISTRO || cab.tamanho_dados < 0 ||
+            offset + tamanho > tamanho_origem) {
+            break;                       // Fim truncado: o resto não é percorrível
         }
         
-        if (lista->num_chaves >= lista->capacidade) {
-            lista->capacidade *= 2;
-            lista->chaves = realloc(lista->chaves, lista->capacidade * sizeof(Chave));
+        long referencias = buscar_no_mapa(vivos, (unsigned long long)offset);
+        if (referencias >= 0) {
+            if (tamanho_extensao > 0 && inicio_extensao + tamanho_extensao != offset) {
+                ok = copiar_extensao(origem, inicio_extensao, destino, offset_destino, tamanho_extensao, bloco);
+                offset_destino += tamanho_extensao;
+                tamanho_extensao = 0;
+            }
+            if (tamanho_extensao == 0) {
+                inicio_extensao = offset;
+            }
+            long novo_offset = offset_destino + tamanho_extensao;
+            if (cab.referencias != referencias) {
+                if (num_corrigidos == capacidade_corrigidos) {
+                    capacidade_corrigidos = capacidade_corrigidos > 0 ? 2 * capacidade_corrigidos : 16;
+                    corrigidos = realloc(corrigidos, capacidade_corrigidos * sizeof(CabecalhoRegistro));
+                    offsets_corrigidos = realloc(offsets_corrigidos, capacidade_corrigidos * sizeof(long));
+                }
+                cab.referencias = (int)referencias;
+                corrigidos[num_corrigidos] = cab;
+                offsets_corrigidos[num_corrigidos++] = novo_offset;
+            }
+            inserir_no_mapa(copiados, (unsigned long long)offset, novo_offset);
+            inserir_no_mapa(novos_registros, cab.hash, novo_offset);
+            tamanho_extensao += tamanho;
         }
-        lista->chaves[lista->num_chaves++] = pagina->chaves[i];
+        offset += tamanho;
     }
-    
-    if (!pagina->eh_folha) {
-        Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
-        coletar_chaves_recursivo(bd, filho, lista);
-        free(filho);
+    if (ok && tamanho_extensao > 0) {
+        ok = copiar_extensao(origem, inicio_extensao, destino, offset_destino, tamanho_extensao, bloco);
+        offset_destino += tamanho_extensao;
     }
+    for (int i = 0; ok && i < num_corrigidos; i++) {
+        escrever_cabecalho_registro(destino, offsets_corrigidos[i], &corrigidos[i]);
+    }
+    
+    free(corrigidos);
+    free(offsets_corrigidos);
+    free(cabecalhos);
+    free(bloco);
+    return ok ? offset_destino : -1;
 }
 
 /**
- * Busca o novo offset de uma chave na lista compactada
+ * Monta o índice novo em indice_temp.bin com carga em massa, sem tocar no
+ * atual. As chaves da lista precisam estar em ordem crescente
  */
-long buscar_novo_offset(Chave *chave_antiga, ListaChaves *lista) {
+bool montar_indice_temporario(BancoDados *bd, ListaChaves *lista, CabecalhoIndice *novo_cabecalho) {
+    FILE *temp_indice = fopen(ARQUIVO_INDICE_TEMP, "w+b");
+    if (!temp_indice) {
+        return false;
+    }
+    
+    CargaEmMassa carga;
+    iniciar_carga(&carga, temp_indice, bd->cabecalho.ordem, MODO_BMAIS(bd));
     for (int i = 0; i < lista->num_chaves; i++) {
-        if (strcmp(lista->chaves[i].nome_arquivo, chave_antiga->nome_arquivo) == 0 &&
-            lista->chaves[i].limiar == chave_antiga->limiar) {
-            return lista->chaves[i].offset_dados;
+        if (!adicionar_chave_carga(&carga, &lista->chaves[i])) {
+            free(carga.separadoras);
+            free(carga.folhas_esquerdas);
+            fclose(temp_indice);
+            remove(ARQUIVO_INDICE_TEMP);
+            return false;
         }
     }
-    return -1; // Não encontrado
+    
+    finalizar_carga(&carga, novo_cabecalho);
+    novo_cabecalho->geracao_dados = bd->cabecalho.geracao_dados;   // Offsets já marcados com ela
+    escrever_cabecalho(temp_indice, novo_cabecalho);
+    if (bd->arquivo_log || bd->paginas_sombra) {
+        sincronizar_arquivo(temp_indice);
+    }
+    fclose(temp_indice);
+    return true;
 }
 
 /**
- * Atualiza offsets recursivamente em todas as páginas da árvore
+ * Grava a marca de troca: a partir dela, dados_temp.bin e indice_temp.bin
+ * formam o par válido e a troca é completada mesmo depois de uma queda
  */
-void atualizar_offsets_recursivo(BancoDados *bd, Pagina *pagina, ListaChaves *lista) {
-    bool modificado = false;
-    
-    // Atualiza offsets das chaves nesta página
-    for (int i = 0; i < pagina->num_chaves; i++) {
-        long novo_offset = buscar_novo_offset(&pagina->chaves[i], lista);
-        if (novo_offset != -1 && novo_offset != pagina->chaves[i].offset_dados) {
-            pagina->chaves[i].offset_dados = novo_offset;
-            modificado = true;
-        }
-    }
-    
-    // Se a página foi modificada, grava de volta
-    if (modificado) {
-        escrever_pagina(bd->arquivo_indice, pagina, pagina->offset_proprio);
+bool marcar_troca(BancoDados *bd) {
+    FILE *marca = fopen(ARQUIVO_TROCA, "wb");
+    if (!marca) {
+        return false;
     }
-    
-    // Processa filhos recursivamente (se não for folha)
-    if (!pagina->eh_folha) {
-        for (int i = 0; i <= pagina->num_chaves; i++) {
-            Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
-            atualizar_offsets_recursivo(bd, filho, lista);
-            free(filho);
-        }
+    if (bd->arquivo_log || bd->paginas_sombra) {
+        sincronizar_arquivo(marca);
     }
+    fclose(marca);
+    return true;
 }
 
 /**
- * Compacta páginas recursivamente, escrevendo apenas páginas válidas
- * Retorna o novo offset da página escrita
+ * Substitui dados.bin e indice.bin pelos temporários que ainda existirem e
+ * apaga a marca. Pode ser repetida: um arquivo já renomeado é pulado
  */
-long compactar_paginas_recursivo(BancoDados *bd, Pagina *pagina, FILE *temp_indice, CabecalhoIndice *novo_cabecalho) {
-    // Ignora páginas inválidas (marcadas com num_chaves < 0)
-    if (pagina->num_chaves < 0) {
-        return -1;
+void trocar_arquivos_compactados(void) {
+    const char *temporarios[2] = { ARQUIVO_DADOS_TEMP, ARQUIVO_INDICE_TEMP };
+    const char *destinos[2] = { ARQUIVO_DADOS, ARQUIVO_INDICE };
+    for (int i = 0; i < 2; i++) {
+        FILE *temp = fopen(temporarios[i], "rb");
+        if (!temp) continue;
+        fclose(temp);
+        remove(destinos[i]);
+        rename(temporarios[i], destinos[i]);
     }
-    
-    // Se não é folha, compacta filhos primeiro e atualiza ponteiros
-    if (!pagina->eh_folha) {
-        long novos_filhos[MAX_FILHOS];
-        int filhos_validos = 0;
-        
-        for (int i = 0; i <= pagina->num_chaves; i++) {
-            Pagina *filho = ler_pagina(bd->arquivo_indice, pagina->filhos[i]);
-            long novo_offset_filho = compactar_paginas_recursivo(bd, filho, temp_indice, novo_cabecalho);
-            free(filho);
-            
-            if (novo_offset_filho != -1) {
-                novos_filhos[filhos_validos++] = novo_offset_filho;
-            }
-        }
-        
-        // Atualiza ponteiros para filhos
-        for (int i = 0; i < filhos_validos; i++) {
-            pagina->filhos[i] = novos_filhos[i];
-        }
+    remove(ARQUIVO_TROCA);
+}
+
+/**
+ * Na abertura, antes de abrir o índice: com a marca, completa a troca de uma
+ * compactação inteira interrompida; sem ela, os temporários são de uma
+ * compactação que não terminou e o par antigo continua valendo
+ */
+void retomar_troca_compactados(void) {
+    FILE *marca = fopen(ARQUIVO_TROCA, "rb");
+    if (marca) {
+        fclose(marca);
+        trocar_arquivos_compactados();
+        return;
     }
-    
-    // Escreve esta página no arquivo compactado
-    long novo_offset = ftell(temp_indice);
-    pagina->offset_proprio = novo_offset;
-    fwrite(pagina, sizeof(Pagina), 1, temp_indice);
-    
-    novo_cabecalho->num_paginas++;
-    novo_cabecalho->proximo_offset = ftell(temp_indice);
-    
-    return novo_offset;
+    remove(ARQUIVO_DADOS_TEMP);
+    remove(ARQUIVO_INDICE_TEMP);
 }
 
 /**
  * Compacta o arquivo de dados
- * Utiliza percurso em ordem para reorganizar os dados
- * Mantém a estrutura do índice intacta, apenas atualizando offsets
+ * Coleta as chaves com o cursor, copia os registros vivos em extensões e
+ * reconstrói o índice com carga em massa a partir das chaves já ordenadas
+ * Retorna o número de registros reorganizados, ou -1 em caso de erro (ou
+ * se houver instantâneos abertos, que ainda leem os arquivos atuais)
  */
-void compactar(BancoDados *bd) {
-    printf("Iniciando compactacao do arquivo de dados...\n");
+int reorganizar_arquivos(BancoDados *bd) {
+    if (bd->num_instantaneos > 0) {
+        return -1;
+    }
+    // Uma compactação incremental em andamento termina antes, de uma vez
+    if (COMPACTANDO(bd)) {
+        passo_compactacao(bd, INT_MAX);
+    }
+    // No modo sombra, o commit também libera as versões antigas
+    confirmar(bd);
     
     // Coleta todas as chaves em ordem
     ListaChaves lista;
@@ -1001,97 +4456,359 @@ void compactar(BancoDados *bd) {
     lista.num_chaves = 0;
     lista.chaves = malloc(lista.capacidade * sizeof(Chave));
     
-    coletar_chaves_recursivo(bd, bd->raiz_ram, &lista);
-    
+    if (!coletar_chaves(bd, &lista)) {
+        // Sem todas as chaves, a cópia deixaria registros vivos para trás
+        free(lista.chaves);
+        return -1;
+    }
     if (lista.num_chaves == 0) {
-        printf("Nenhuma imagem para compactar.\n");
         free(lista.chaves);
-        return;
+        return 0;
     }
     
-    printf("Coletadas %d chaves. Reorganizando arquivo de dados...\n", lista.num_chaves);
-    
     // === COMPACTAÇÃO DO ARQUIVO DE DADOS ===
-    FILE *temp_dados = fopen("models/dados_temp.bin", "wb");
+    FILE *temp_dados = fopen(ARQUIVO_DADOS_TEMP, "w+b");
     if (!temp_dados) {
-        printf("Erro ao criar arquivo temporario de dados.\n");
         free(lista.chaves);
-        return;
+        return -1;
     }
     
-    // Copia imagens para o arquivo temporário e atualiza offsets na lista
+    // Registros apontados por alguma chave, com quantas chaves apontam cada
+    // um (um registro compartilhado por várias chaves entra uma vez só)
+    MapaRegistros vivos, copiados, novos_registros;
+    iniciar_mapa(&vivos);
+    iniciar_mapa(&copiados);
+    iniciar_mapa(&novos_registros);
     for (int i = 0; i < lista.num_chaves; i++) {
-        RegistroImagem img;
-        if (carregar_imagem(bd->arquivo_dados, lista.chaves[i].offset_dados, &img)) {
-            long novo_offset = ftell(temp_dados);
-            fwrite(&img, sizeof(RegistroImagem), 1, temp_dados);
-            lista.chaves[i].offset_dados = novo_offset;
-        }
+        somar_no_mapa(&vivos, (unsigned long long)OFFSET_REGISTRO(lista.chaves[i].offset_dados), 1);
     }
     
+    // Copia os registros (ainda codificados) para o arquivo temporário, na
+    // ordem do arquivo e em extensões contíguas, e atualiza os offsets na lista
+    long tamanho_novo = copiar_registros_vivos(bd->arquivo_dados, temp_dados, &vivos,
+                                               &copiados, &novos_registros);
+    destruir_mapa(&vivos);
+    bool copiou_todos = tamanho_novo >= 0;
+    for (int i = 0; copiou_todos && i < lista.num_chaves; i++) {
+        long antigo = OFFSET_REGISTRO(lista.chaves[i].offset_dados);
+        long novo_offset = buscar_no_mapa(&copiados, (unsigned long long)antigo);
+        if (novo_offset < 0) {
+            // Registro de uma chave viva ilegível ou além de um trecho
+            // truncado: o arquivo antigo fica, senão a chave apontaria para
+            // um offset do arquivo novo
+            copiou_todos = false;
+            break;
+        }
+        lista.chaves[i].offset_dados = offset_da_chave(bd, novo_offset);
+    }
+    destruir_mapa(&copiados);
+    if (copiou_todos && (bd->arquivo_log || bd->paginas_sombra)) {
+        sincronizar_arquivo(temp_dados);
+    }
     fclose(temp_dados);
+    
+    // Índice novo montado ao lado do antigo (as chaves já estão em ordem).
+    // O log, com páginas do índice antigo, fica vazio antes da marca; até
+    // ela existir, uma queda deixa o par antigo intacto
+    CabecalhoIndice novo_cabecalho;
+    bool marcado = false;
+    if (copiou_todos && montar_indice_temporario(bd, &lista, &novo_cabecalho)) {
+        if (bd->arquivo_log) checkpoint_log(bd);
+        marcado = marcar_troca(bd);
+    }
+    if (!marcado) {
+        destruir_mapa(&novos_registros);
+        remove(ARQUIVO_DADOS_TEMP);
+        remove(ARQUIVO_INDICE_TEMP);
+        free(lista.chaves);
+        return -1;
+    }
+    destruir_mapa(&bd->registros);
+    bd->registros = novos_registros;
+    
+    // As páginas em cache pertencem ao índice antigo: descarta todas
+    liberar_pagina(bd, bd->raiz_ram);
+    bd->raiz_ram = NULL;
+    limpar_buffer(&bd->buffer);
+    desmapear_indice(bd);
+    fclose(bd->arquivo_indice);
     fclose(bd->arquivo_dados);
     
-    // Substitui o arquivo original de dados
-    remove(ARQUIVO_DADOS);
-    rename("models/dados_temp.bin", ARQUIVO_DADOS);
+    trocar_arquivos_compactados();
+    
+    bd->arquivo_dados = fopen(ARQUIVO_DADOS, "r+b");
+    bd->arquivo_indice = fopen(ARQUIVO_INDICE, "r+b");
+    bd->cabecalho = novo_cabecalho;
+    bd->cabecalho_sujo = false;
+    if (bd->mapear_indice) {
+        mapear_indice(bd, bd->cabecalho.proximo_offset);
+    }
+    bd->raiz_ram = ler_pagina(bd, novo_cabecalho.offset_raiz);
+    bd->raiz_confirmada = novo_cabecalho.offset_raiz;
+    bd->altura_confirmada = novo_cabecalho.altura;
+    
+    int num_registros = lista.num_chaves;
+    free(lista.chaves);
+    return num_registros;
+}
+
+// Funções de compactação incremental
+
+/**
+ * Começa a compactação incremental: as chaves passam, em ordem e aos
+ * poucos, a apontar para cópias dos seus registros em dados_novo.bin, que
+ * no fim substitui dados.bin. O bit de geração do offset_dados diz em qual
+ * dos dois arquivos está o registro de cada chave, então qualquer estado
+ * intermediário é consistente e a compactação continua depois de reabrir o
+ * banco, a partir da última chave migrada.
+ * Retorna false se o arquivo novo não puder ser criado
+ */
+bool iniciar_compactacao(BancoDados *bd) {
+    if (COMPACTANDO(bd)) {
+        return true;
+    }
+    // Buracos pendentes são de dados.bin: entram nas listas antes de elas
+    // serem esvaziadas
+    confirmar(bd);
+    
+    // O cabeçalho marca a compactação antes de o arquivo novo existir: um
+    // dados_novo.bin sem compactação ativa só sobra de uma conclusão
+    // interrompida (ver retomar_compactacao)
+    CabecalhoIndice anterior = bd->cabecalho;
+    bd->cabecalho.compactacao_ativa = 1;
+    bd->cabecalho.progresso_compactacao = 0;
+    esvaziar_livres_dados(&bd->cabecalho);   // Buracos de dados.bin ficam para trás
+    marcar_cabecalho_sujo(bd);
+    confirmar(bd);
     
-    // Reabre o arquivo de dados
+    bd->arquivo_novo = fopen(ARQUIVO_DADOS_NOVO, "w+b");
+    if (!bd->arquivo_novo) {
+        bd->cabecalho = anterior;
+        marcar_cabecalho_sujo(bd);
+        confirmar(bd);
+        return false;
+    }
+    iniciar_mapa(&bd->registros_novos);
+    iniciar_mapa(&bd->copiados);
+    return true;
+}
+
+/**
+ * Copia para dados_novo.bin o registro de uma chave que ainda aponta para
+ * dados.bin. Um registro compartilhado é copiado só uma vez (mapa
+ * copiados, O(1) por chave) e ganha uma referência por chave migrada.
+ * Retorna o novo offset_dados da chave, ou -1 se o registro for inválido
+ */
+long long migrar_registro(BancoDados *bd, long long offset_chave) {
+    long antigo = OFFSET_REGISTRO(offset_chave);
+    long copia = buscar_no_mapa(&bd->copiados, (unsigned long long)antigo);
+    if (copia >= 0) {
+        if (alterar_referencias(bd, offset_da_chave(bd, copia), +1) > 0) {
+            return offset_da_chave(bd, copia);
+        }
+        // A cópia perdeu todas as chaves nesse meio tempo: copia de novo
+        remover_do_mapa(&bd->copiados, (unsigned long long)antigo, copia);
+    }
+    
+    CabecalhoRegistro cab;
+    if (!ler_cabecalho_registro(bd->arquivo_dados, antigo, &cab)) {
+        return -1;
+    }
+    unsigned char *dados = malloc(cab.tamanho_dados > 0 ? cab.tamanho_dados : 1);
+    if (fread(dados, 1, cab.tamanho_dados, bd->arquivo_dados) != (size_t)cab.tamanho_dados) {
+        free(dados);
+        return -1;
+    }
+    metricas.bytes_lidos_dados += cab.tamanho_dados;
+    
+    // Depois de reabrir o banco o mapa copiados está vazio: um registro
+    // igual já em dados_novo.bin é achado pelo conteúdo
+    cab.referencias = 1;
+    long long novo = armazenar_registro(bd, &cab, dados);
+    free(dados);
+    inserir_no_mapa(&bd->copiados, (unsigned long long)antigo, OFFSET_REGISTRO(novo));
+    return novo;
+}
+
+/**
+ * Termina a compactação incremental: grava o cabeçalho com a geração nova
+ * e só então troca dados.bin por dados_novo.bin
+ */
+void concluir_compactacao(BancoDados *bd) {
+    // Referências soltas à espera do commit ainda são da geração atual
+    confirmar(bd);
+    bd->cabecalho.compactacao_ativa = 0;
+    bd->cabecalho.progresso_compactacao = 0;
+    bd->cabecalho.geracao_dados ^= 1;
+    marcar_cabecalho_sujo(bd);
+    confirmar(bd);
+    
+    fclose(bd->arquivo_novo);
+    bd->arquivo_novo = NULL;
+    fclose(bd->arquivo_dados);
+    remove(ARQUIVO_DADOS);
+    rename(ARQUIVO_DADOS_NOVO, ARQUIVO_DADOS);
     bd->arquivo_dados = fopen(ARQUIVO_DADOS, "r+b");
     
-    printf("Atualizando offsets no indice...\n");
+    destruir_mapa(&bd->registros);
+    bd->registros = bd->registros_novos;
+    destruir_mapa(&bd->copiados);
+}
+
+/**
+ * Troca o offset_dados de uma chave descendo da raiz pelo caminho copiado
+ * (no modo sombra, as páginas do cursor podem ser da versão confirmada)
+ */
+void trocar_offset_dados(BancoDados *bd, const Chave *chave) {
+    preparar_raiz(bd);
+    Pagina *pagina = bd->raiz_ram;
+    while (true) {
+        int i = buscar_posicao(pagina, chave);
+        if (i < pagina->num_chaves && comparar_chaves(chave, &pagina->chaves[i]) == 0) {
+            pagina->chaves[i].offset_dados = chave->offset_dados;
+            escrever_pagina(bd, pagina);
+            break;
+        }
+        if (pagina->eh_folha) break;
+        Pagina *filho = ler_filho_para_escrita(bd, pagina, i);
+        if (pagina != bd->raiz_ram) liberar_pagina(bd, pagina);
+        pagina = filho;
+    }
+    if (pagina != bd->raiz_ram) liberar_pagina(bd, pagina);
+}
+
+/**
+ * Avança a compactação incremental: migra as chaves seguintes em ordem e
+ * para no fim da primeira folha depois de max_chaves migradas, de forma que
+ * cada folha seja alterada (e regravada no commit) em um único passo
+ * Com instantâneos abertos (que ainda leem os registros de dados.bin) o
+ * passo não faz nada
+ * Retorna true quando a compactação terminou (ou não havia nenhuma)
+ */
+bool passo_compactacao(BancoDados *bd, int max_chaves) {
+    if (!COMPACTANDO(bd)) {
+        return true;
+    }
+    if (bd->num_instantaneos > 0) {
+        return false;
+    }
     
-    // Atualiza offsets em todas as páginas da árvore (mantendo estrutura)
-    atualizar_offsets_recursivo(bd, bd->raiz_ram, &lista);
+    unsigned long long progresso = bd->cabecalho.progresso_compactacao;
+    Chave inicio = {(unsigned int)(progresso >> 32), (int)(unsigned int)progresso, 0};
+    Chave fim = {UINT_MAX, -1, 0};
+    Cursor cursor;
+    Chave chave;
+    int migradas = 0;
+    bool terminou = true;
+    ListaChaves trocas = {NULL, 0, 0};   // Modo sombra: offsets trocados depois do cursor
     
-    // Compacta o arquivo de índice
-    printf("Compactando arquivo de indice...\n");
+    cursor_abrir(bd, &cursor, &inicio, &fim);
+    while (cursor_proximo(&cursor, &chave)) {
+        int posicao;
+        Pagina *pagina = cursor_pagina_atual(&cursor, &posicao);
+        // Chaves já migradas (ou inseridas durante a compactação) são puladas
+        if (GERACAO_OFFSET(chave.offset_dados) == bd->cabecalho.geracao_dados) {
+            long long novo = migrar_registro(bd, chave.offset_dados);
+            if (novo >= 0 && bd->paginas_sombra) {
+                chave.offset_dados = novo;
+                acrescentar_chave(&trocas, &chave);
+                metricas.chaves_migradas++;
+            } else if (novo >= 0) {
+                pagina->chaves[posicao].offset_dados = novo;
+                escrever_pagina(bd, pagina);
+                metricas.chaves_migradas++;
+            }
+            migradas++;
+        }
+        bd->cabecalho.progresso_compactacao = valor_chave(&chave);
+        if (migradas >= max_chaves && pagina->eh_folha && posicao == pagina->num_chaves - 1) {
+            // Olha se ainda há chaves; o próximo passo recomeça do progresso
+            terminou = !cursor_proximo(&cursor, &chave);
+            break;
+        }
+    }
+    cursor_fechar(&cursor);
+    if (cursor.invalido) {
+        // Chaves além do ponto em que o cursor parou não foram migradas
+        terminou = false;
+    }
+    for (int i = 0; i < trocas.num_chaves; i++) {
+        trocar_offset_dados(bd, &trocas.chaves[i]);
+    }
+    free(trocas.chaves);
+    marcar_cabecalho_sujo(bd);
     
-    // Cria arquivo temporário para índice
-    FILE *temp_indice = fopen("models/indice_temp.bin", "wb");
-    if (!temp_indice) {
-        printf("Erro ao criar arquivo temporario de indice.\n");
-        free(lista.chaves);
+    if (terminou) {
+        concluir_compactacao(bd);
+    }
+    return terminou;
+}
+
+/**
+ * Na abertura: reabre dados_novo.bin de uma compactação em andamento, ou
+ * completa a troca de arquivos de uma conclusão interrompida depois de o
+ * cabeçalho ser gravado
+ */
+void retomar_compactacao(BancoDados *bd) {
+    bd->arquivo_novo = NULL;
+    if (!COMPACTANDO(bd)) {
+        FILE *sobra = fopen(ARQUIVO_DADOS_NOVO, "rb");
+        if (sobra) {
+            fclose(sobra);
+            if (bd->arquivo_dados) fclose(bd->arquivo_dados);
+            remove(ARQUIVO_DADOS);
+            rename(ARQUIVO_DADOS_NOVO, ARQUIVO_DADOS);
+            bd->arquivo_dados = fopen(ARQUIVO_DADOS, "r+b");
+        }
         return;
     }
     
-    // Escreve cabeçalho temporário (será atualizado depois)
-    CabecalhoIndice novo_cabecalho = bd->cabecalho;
-    novo_cabecalho.proximo_offset = sizeof(CabecalhoIndice);
-    novo_cabecalho.num_paginas = 0;
-    fwrite(&novo_cabecalho, sizeof(CabecalhoIndice), 1, temp_indice);
-    
-    // Compacta páginas recursivamente, começando pela raiz
-    long novo_offset_raiz = compactar_paginas_recursivo(bd, bd->raiz_ram, temp_indice, &novo_cabecalho);
-    
-    fclose(temp_indice);
-    fclose(bd->arquivo_indice);
-    
-    // Substitui arquivo de índice
-    remove(ARQUIVO_INDICE);
-    rename("models/indice_temp.bin", ARQUIVO_INDICE);
-    
-    // Reabre arquivo de índice e atualiza cabeçalho
-    bd->arquivo_indice = fopen(ARQUIVO_INDICE, "r+b");
-    novo_cabecalho.offset_raiz = novo_offset_raiz;
-    escrever_cabecalho(bd->arquivo_indice, &novo_cabecalho);
-    
-    // Atualiza cabeçalho em memória
-    bd->cabecalho = novo_cabecalho;
+    bd->arquivo_novo = fopen(ARQUIVO_DADOS_NOVO, "r+b");
+    if (!bd->arquivo_novo) {
+        bd->arquivo_novo = fopen(ARQUIVO_DADOS_NOVO, "w+b");
+    }
+    percorrer_registros(bd, bd->arquivo_novo, &bd->registros_novos, false);
+    iniciar_mapa(&bd->copiados);
+}
+
+/**
+ * Compactação com registro de latência
+ */
+int compactar_banco(BancoDados *bd) {
+    double inicio = agora_segundos();
+    int num_registros = reorganizar_arquivos(bd);
+    registrar_latencia(OP_COMPACTAR, inicio);
+    return num_registros;
+}
+
+/**
+ * Compactação a partir do menu
+ */
+void compactar(BancoDados *bd) {
+    printf("Iniciando compactacao do arquivo de dados...\n");
     
-    // Recarrega raiz com novo offset
-    free(bd->raiz_ram);
-    bd->raiz_ram = ler_pagina(bd->arquivo_indice, novo_offset_raiz);
+    int num_registros = compactar_banco(bd);
+    if (num_registros < 0) {
+        printf("Erro na compactacao (arquivos originais mantidos).\n");
+        return;
+    }
+    if (num_registros == 0) {
+        printf("Nenhuma imagem para compactar.\n");
+        return;
+    }
     
-    free(lista.chaves);
-    printf("Compactacao concluida! %d registros reorganizados.\n", lista.num_chaves);
-    printf("Paginas validas: %d (altura: %d)\n\n", novo_cabecalho.num_paginas, novo_cabecalho.altura);
+    printf("Compactacao concluida! %d registros reorganizados.\n", num_registros);
+    printf("Paginas validas: %d (altura: %d)\n\n", bd->cabecalho.num_paginas, bd->cabecalho.altura);
 }
 
 // Funções de inicialização e finalização do banco de dados
-BancoDados* inicializar_banco() {
+BancoDados* inicializar_banco(const OpcoesBanco *opcoes) {
     BancoDados *bd = malloc(sizeof(BancoDados));
     
+    // Uma compactação inteira interrompida termina (ou é descartada) antes
+    // de qualquer arquivo ser aberto
+    retomar_troca_compactados();
+    
     // Abre ou cria arquivo de índice
     bd->arquivo_indice = fopen(ARQUIVO_INDICE, "r+b");
     bool indice_novo = false;
@@ -1101,46 +4818,219 @@ BancoDados* inicializar_banco() {
         indice_novo = true;
     }
     
+    if (!bd->arquivo_indice) {
+        fprintf(stderr, "Erro ao abrir arquivo de indice %s\n", ARQUIVO_INDICE);
+        free(bd);
+        return NULL;
+    }
+    
+    // Commits do log que podem não ter chegado ao índice (queda do processo
+    // ou do sistema): refeitos antes de qualquer leitura
+    if (indice_novo) {
+        remove(ARQUIVO_LOG);
+    } else {
+        int refeitos = refazer_log(bd->arquivo_indice);
+        if (refeitos > 0) {
+            fprintf(stderr, "Aviso: %d commits refeitos a partir de %s.\n", refeitos, ARQUIVO_LOG);
+        }
+    }
+    bd->arquivo_log = NULL;
+    if (opcoes && opcoes->usar_log && opcoes->paginas_sombra) {
+        fprintf(stderr, "Aviso: --wal ignorado com --sombra (o commit ja troca a raiz de uma vez).\n");
+    } else if (opcoes && opcoes->usar_log) {
+        bd->arquivo_log = fopen(ARQUIVO_LOG, "w+b");
+        if (!bd->arquivo_log) {
+            fprintf(stderr, "Aviso: nao foi possivel criar %s (commits sem log).\n", ARQUIVO_LOG);
+        }
+    }
+    bd->bytes_dados_sincronizados = metricas.bytes_escritos_dados;
+    
     // Abre ou cria arquivo de dados
     bd->arquivo_dados = fopen(ARQUIVO_DADOS, "r+b");
     if (!bd->arquivo_dados) {
         bd->arquivo_dados = fopen(ARQUIVO_DADOS, "w+b");
     }
     
+    int capacidade_buffer = (opcoes && opcoes->capacidade_buffer > 0) ?
+                            opcoes->capacidade_buffer : CAPACIDADE_BUFFER_PADRAO;
+    bd->ops_por_commit = (opcoes && opcoes->ops_por_commit > 0) ?
+                         opcoes->ops_por_commit : OPS_POR_COMMIT_PADRAO;
+    bd->ops_pendentes = 0;
+    bd->cabecalho_sujo = false;
+    bd->passo_compactacao = (opcoes && opcoes->passo_compactacao > 0) ?
+                            opcoes->passo_compactacao : PASSO_COMPACTACAO_PADRAO;
+    bd->arquivo_novo = NULL;
+    bd->mapear_indice = opcoes && opcoes->mapear_indice;
+    bd->mapa_indice = NULL;
+    bd->tamanho_mapa = 0;
+    bd->paginas_sombra = opcoes && opcoes->paginas_sombra;
+    bd->versao = 0;
+    bd->liberacoes = NULL;
+    bd->num_liberacoes = 0;
+    bd->capacidade_liberacoes = 0;
+    bd->instantaneos = NULL;
+    bd->num_instantaneos = 0;
+    bd->buracos_pendentes = NULL;
+    bd->num_buracos_pendentes = 0;
+    bd->capacidade_buracos_pendentes = 0;
+    
+    if (!abrir_dicionario(&bd->nomes, indice_novo)) {
+        fprintf(stderr, "Dicionario de nomes %s ausente ou invalido.\n", ARQUIVO_NOMES);
+        fechar_dicionario(&bd->nomes);
+        fclose(bd->arquivo_indice);
+        if (bd->arquivo_dados) fclose(bd->arquivo_dados);
+        if (bd->arquivo_log) fclose(bd->arquivo_log);
+        free(bd);
+        return NULL;
+    }
+    
     if (indice_novo) {
-        // Inicializa novo banco
-        bd->cabecalho.offset_raiz = sizeof(CabecalhoIndice);
-        bd->cabecalho.proximo_offset = sizeof(CabecalhoIndice) + sizeof(Pagina);
+        // Inicializa novo banco com a ordem escolhida (padrão: página cheia)
+        int ordem = (opcoes && opcoes->ordem > 0) ? opcoes->ordem : ORDEM_MAXIMA;
+        if (bd->paginas_sombra && opcoes->folhas_encadeadas) {
+            fprintf(stderr, "Aviso: indice B+ nao aceita paginas sombra (--sombra ignorado).\n");
+            bd->paginas_sombra = false;
+        }
+        bd->cabecalho.magico = MAGICO_INDICE;
+        bd->cabecalho.ordem = ordem;
+        bd->cabecalho.proximo_offset = TAM_PAGINA;
         bd->cabecalho.altura = 0;
-        bd->cabecalho.num_paginas = 1;
-        escrever_cabecalho(bd->arquivo_indice, &bd->cabecalho);
+        bd->cabecalho.num_paginas = 0;
+        bd->cabecalho.folhas_encadeadas = opcoes && opcoes->folhas_encadeadas;
+        bd->cabecalho.primeira_livre = 0;
+        bd->cabecalho.num_paginas_livres = 0;
+        esvaziar_livres_dados(&bd->cabecalho);
+        bd->cabecalho.geracao_dados = 0;
+        bd->cabecalho.compactacao_ativa = 0;
+        bd->cabecalho.progresso_compactacao = 0;
+        remove(ARQUIVO_DADOS_NOVO);
+        inicializar_buffer(&bd->buffer, capacidade_buffer);
+        if (bd->mapear_indice && !mapear_indice(bd, bd->cabecalho.proximo_offset)) {
+            fprintf(stderr, "Aviso: nao foi possivel mapear %s (usando fseek/fread).\n", ARQUIVO_INDICE);
+        }
         
         // Cria raiz vazia
-        bd->raiz_ram = criar_pagina(true);
-        bd->raiz_ram->offset_proprio = bd->cabecalho.offset_raiz;
-        escrever_pagina(bd->arquivo_indice, bd->raiz_ram, bd->raiz_ram->offset_proprio);
+        bd->raiz_ram = criar_pagina(bd, true);
+        bd->cabecalho.offset_raiz = bd->raiz_ram->offset_proprio;
+        escrever_pagina(bd, bd->raiz_ram);
+        confirmar(bd);
+        iniciar_mapa(&bd->registros);
     } else {
         // Carrega banco existente
-        ler_cabecalho(bd->arquivo_indice, &bd->cabecalho);
-        bd->raiz_ram = ler_pagina(bd->arquivo_indice, bd->cabecalho.offset_raiz);
+        if (!ler_cabecalho(bd->arquivo_indice, &bd->cabecalho)) {
+            fprintf(stderr, "Arquivo de indice %s invalido ou de formato antigo.\n", ARQUIVO_INDICE);
+            fechar_dicionario(&bd->nomes);
+            fclose(bd->arquivo_indice);
+            if (bd->arquivo_dados) fclose(bd->arquivo_dados);
+            if (bd->arquivo_log) fclose(bd->arquivo_log);
+            free(bd);
+            return NULL;
+        }
+        if (opcoes && opcoes->ordem > 0 && opcoes->ordem != bd->cabecalho.ordem) {
+            fprintf(stderr, "Aviso: indice existente usa ordem %d (ordem %d ignorada).\n",
+                   bd->cabecalho.ordem, opcoes->ordem);
+        }
+        if (opcoes && opcoes->folhas_encadeadas && !MODO_BMAIS(bd)) {
+            fprintf(stderr, "Aviso: indice existente e uma Arvore-B comum (--bmais ignorado).\n");
+        }
+        if (bd->paginas_sombra && MODO_BMAIS(bd)) {
+            // Copiar uma folha exigiria copiar também a anterior no encadeamento
+            fprintf(stderr, "Aviso: indice B+ nao aceita paginas sombra (--sombra ignorado).\n");
+            bd->paginas_sombra = false;
+        }
+        inicializar_buffer(&bd->buffer, capacidade_buffer);
+        if (bd->mapear_indice && !mapear_indice(bd, bd->cabecalho.proximo_offset)) {
+            fprintf(stderr, "Aviso: nao foi possivel mapear %s (usando fseek/fread).\n", ARQUIVO_INDICE);
+        }
+        bd->raiz_ram = ler_pagina(bd, bd->cabecalho.offset_raiz);
+        retomar_compactacao(bd);
+        carregar_mapa_registros(bd);
     }
+    bd->raiz_confirmada = bd->cabecalho.offset_raiz;
+    bd->altura_confirmada = bd->cabecalho.altura;
     
     return bd;
 }
 
 /**
  * Finaliza o banco de dados
+ * Retorna false, sem fechar nada, se ainda houver instantâneos abertos: as
+ * versões que eles leem não podem ser liberadas (feche-os antes)
  */
-void finalizar_banco(BancoDados *bd) {
+bool finalizar_banco(BancoDados *bd) {
+    if (bd->num_instantaneos > 0) {
+        fprintf(stderr, "Aviso: %d instantaneo(s) aberto(s); o banco continua aberto.\n",
+                bd->num_instantaneos);
+        return false;
+    }
     if (bd->raiz_ram) {
-        escrever_pagina(bd->arquivo_indice, bd->raiz_ram, bd->raiz_ram->offset_proprio);
-        free(bd->raiz_ram);
+        if (!bd->paginas_sombra) {
+            // No modo sombra a raiz confirmada não é regravada
+            escrever_pagina(bd, bd->raiz_ram);
+        }
+        // O segundo commit grava as páginas livres e os buracos que o
+        // primeiro liberou
+        confirmar(bd);
+        confirmar(bd);
+        liberar_pagina(bd, bd->raiz_ram);
+    }
+    if (bd->arquivo_log) {
+        // Fechamento limpo: índice no disco e log vazio
+        checkpoint_log(bd);
+        fclose(bd->arquivo_log);
+        remove(ARQUIVO_LOG);
+    }
+    destruir_buffer(&bd->buffer);
+    desmapear_indice(bd);
+    destruir_mapa(&bd->registros);
+    fechar_dicionario(&bd->nomes);
+    if (bd->arquivo_novo) {
+        // Compactação incremental pela metade: continua na próxima abertura
+        fclose(bd->arquivo_novo);
+        destruir_mapa(&bd->registros_novos);
+        destruir_mapa(&bd->copiados);
     }
     
     if (bd->arquivo_indice) fclose(bd->arquivo_indice);
     if (bd->arquivo_dados) fclose(bd->arquivo_dados);
     
+    free(bd->liberacoes);
+    free(bd->buracos_pendentes);
     free(bd);
+    return true;
+}
+
+/**
+ * Limiariza a imagem com todos os limiares de uma vez, grava os resultados
+ * no arquivo de dados e indexa (inseridas, se não for NULL, recebe as chaves)
+ * Retorna false, sem gravar nada, se algum limiar estiver fora de 0 a 255
+ */
+bool inserir_limiares(BancoDados *bd, RegistroImagem *img_original, const char *nome_arquivo,
+                      const int *limiares, int num_limiares, Chave *inseridas) {
+    for (int k = 0; k < num_limiares; k++) {
+        if (!limiar_valido(limiares[k])) {
+            return false;
+        }
+    }
+    RegistroImagem *binarias = malloc(num_limiares * sizeof(RegistroImagem));
+    limiarizar_multiplos(img_original, limiares, num_limiares, binarias);
+    unsigned int id_nome = obter_id_nome(bd, nome_arquivo);
+    
+    for (int k = 0; k < num_limiares; k++) {
+        Chave chave;
+        memset(&chave, 0, sizeof(Chave));
+        chave.id_nome = id_nome;
+        chave.limiar = limiares[k];
+        chave.offset_dados = armazenar_imagem(bd, &binarias[k]);
+        liberar_imagem(&binarias[k]);
+        
+        inserir(bd, &chave);
+        if (inseridas) {
+            inseridas[k] = chave;
+        }
+    }
+    free(binarias);
+    return true;
 }
 
 // Funções de interface do usuário
@@ -1160,6 +5050,7 @@ void inserir_multiplos_limiares(BancoDados *bd) {
     
     if (num_limiares <= 0 || num_limiares > 20) {
         printf("Número inválido (1-20).\n");
+        liberar_imagem(&img_original);
         return;
     }
     
@@ -1168,25 +5059,22 @@ void inserir_multiplos_limiares(BancoDados *bd) {
     for (int i = 0; i < num_limiares; i++) {
         printf("  Limiar %d: ", i + 1);
         scanf("%d", &limiares[i]);
+        if (!limiar_valido(limiares[i])) {
+            printf("Limiar invalido (0-255).\n");
+            free(limiares);
+            liberar_imagem(&img_original);
+            return;
+        }
     }
     
     printf("\nProcessando...\n");
+    inserir_limiares(bd, &img_original, nome_arquivo, limiares, num_limiares, NULL);
     for (int i = 0; i < num_limiares; i++) {
-        RegistroImagem img_binaria;
-        aplicar_limiarizacao(&img_original, &img_binaria, limiares[i]);
-        
-        long offset = salvar_imagem(bd->arquivo_dados, &img_binaria);
-        
-        Chave chave;
-        strcpy(chave.nome_arquivo, nome_arquivo);
-        chave.limiar = limiares[i];
-        chave.offset_dados = offset;
-        
-        inserir(bd, &chave);
         printf("  [OK] Inserido: %s (limiar %d)\n", nome_arquivo, limiares[i]);
     }
     
     free(limiares);
+    liberar_imagem(&img_original);
     printf("\n[OK] %d imagens inseridas com sucesso!\n", num_limiares);
 }
 
@@ -1201,16 +5089,20 @@ void buscar_imagem(BancoDados *bd) {
     scanf("%s", nome_arquivo);
     printf("Limiar: ");
     scanf("%d", &limiar);
+    if (!limiar_valido(limiar)) {
+        printf("\n[ERRO] Limiar invalido (0-255).\n");
+        return;
+    }
     
     Chave chave_busca, resultado;
-    strcpy(chave_busca.nome_arquivo, nome_arquivo);
+    chave_busca.id_nome = buscar_id_nome(bd, nome_arquivo);
     chave_busca.limiar = limiar;
     
     if (buscar(bd, &chave_busca, &resultado)) {
         printf("\n[OK] Imagem encontrada!\n");
-        printf("  Arquivo: %s\n", resultado.nome_arquivo);
+        printf("  Arquivo: %s\n", nome_do_id(bd, resultado.id_nome));
         printf("  Limiar: %d\n", resultado.limiar);
-        printf("  Offset: %ld\n", resultado.offset_dados);
+        printf("  Offset: %ld\n", OFFSET_REGISTRO(resultado.offset_dados));
     } else {
         printf("\n[ERRO] Imagem nao encontrada.\n");
     }
@@ -1227,9 +5119,13 @@ void remover_imagem(BancoDados *bd) {
     scanf("%s", nome_arquivo);
     printf("Limiar: ");
     scanf("%d", &limiar);
+    if (!limiar_valido(limiar)) {
+        printf("\n[ERRO] Limiar invalido (0-255).\n");
+        return;
+    }
     
     Chave chave;
-    strcpy(chave.nome_arquivo, nome_arquivo);
+    chave.id_nome = buscar_id_nome(bd, nome_arquivo);
     chave.limiar = limiar;
     
     if (remover(bd, &chave)) {
@@ -1255,39 +5151,200 @@ void exportar_imagem(BancoDados *bd) {
     scanf("%s", nome_saida);
     printf("Formato de saida (1=P2 ASCII, 2=P5 Binario): ");
     scanf("%d", &formato);
+    if (!limiar_valido(limiar)) {
+        printf("\n[ERRO] Limiar invalido (0-255).\n");
+        return;
+    }
     
     Chave chave_busca, resultado;
-    strcpy(chave_busca.nome_arquivo, nome_arquivo);
+    chave_busca.id_nome = buscar_id_nome(bd, nome_arquivo);
     chave_busca.limiar = limiar;
     
     if (buscar(bd, &chave_busca, &resultado)) {
         RegistroImagem img;
-        if (carregar_imagem(bd->arquivo_dados, resultado.offset_dados, &img)) {
+        if (carregar_imagem_chave(bd, &resultado, &img)) {
             bool formato_p2 = (formato == 1);
             if (exportar_pgm(&img, nome_saida, formato_p2)) {
                 printf("\n[OK] Imagem exportada para %s (formato %s)\n", 
                        nome_saida, formato_p2 ? "P2" : "P5");
             }
+            liberar_imagem(&img);
+        } else {
+            printf("\n[ERRO] Registro de imagem invalido no arquivo de dados.\n");
         }
     } else {
         printf("\n[ERRO] Imagem nao encontrada.\n");
     }
 }
 
+/**
+ * Imprime as chaves do cursor até ele acabar (lote: linhas OK do comando)
+ * Retorna o número de chaves
+ */
+int imprimir_cursor(BancoDados *bd, Cursor *cursor, const char *comando) {
+    Chave chave;
+    int encontradas = 0;
+    while (cursor_proximo(cursor, &chave)) {
+        if (comando) {
+            printf("OK\t%s\t%s\t%d\t%ld\n", comando, nome_do_id(bd, chave.id_nome),
+                   chave.limiar, OFFSET_REGISTRO(chave.offset_dados));
+        } else {
+            printf("  %s, limiar=%d (offset: %ld)\n", nome_do_id(bd, chave.id_nome),
+                   chave.limiar, OFFSET_REGISTRO(chave.offset_dados));
+        }
+        encontradas++;
+    }
+    return encontradas;
+}
+
+/**
+ * Imprime todas as chaves dos arquivos cujo nome começa com o prefixo
+ * Ids consecutivos (arquivos cadastrados em sequência) viram um só intervalo
+ */
+int imprimir_prefixo(BancoDados *bd, const char *prefixo, const char *comando) {
+    unsigned int *ids = malloc((bd->nomes.num_nomes + 1) * sizeof(unsigned int));
+    int num_ids = ids_com_prefixo(bd, prefixo, ids);
+    int encontradas = 0;
+    
+    int a = 0;
+    while (a < num_ids) {
+        int b = a;
+        while (b + 1 < num_ids && ids[b + 1] == ids[b] + 1) b++;
+        Cursor cursor;
+        cursor_abrir_ids(bd, &cursor, ids[a], ids[b], 0, 255);
+        encontradas += imprimir_cursor(bd, &cursor, comando);
+        a = b + 1;
+    }
+    free(ids);
+    return encontradas;
+}
+
+/**
+ * Consulta por intervalo de limiares de um arquivo, ou por prefixo do nome
+ */
+void consultar_intervalo(BancoDados *bd) {
+    char nome[TAM_NOME_ARQUIVO];
+    printf("\nNome do arquivo (ou prefixo terminado em *): ");
+    scanf("%s", nome);
+    
+    int encontradas;
+    size_t tamanho = strlen(nome);
+    if (tamanho > 0 && nome[tamanho - 1] == '*') {
+        nome[tamanho - 1] = '\0';
+        printf("\n=== Arquivos com prefixo \"%s\" ===\n", nome);
+        encontradas = imprimir_prefixo(bd, nome, NULL);
+    } else {
+        int limiar_min, limiar_max;
+        printf("Limiar minimo: ");
+        scanf("%d", &limiar_min);
+        printf("Limiar maximo: ");
+        scanf("%d", &limiar_max);
+        // Nenhuma chave tem limiar fora de 0 a 255
+        if (limiar_min < 0) limiar_min = 0;
+        if (limiar_max > 255) limiar_max = 255;
+        
+        printf("\n=== %s, limiares %d a %d ===\n", nome, limiar_min, limiar_max);
+        unsigned int id = buscar_id_nome(bd, nome);
+        encontradas = 0;
+        if (id != ID_NOME_AUSENTE) {
+            Cursor cursor;
+            cursor_abrir_ids(bd, &cursor, id, id, limiar_min, limiar_max);
+            encontradas = imprimir_cursor(bd, &cursor, NULL);
+        }
+    }
+    printf("%d chave(s) encontrada(s).\n", encontradas);
+}
+
 /**
  * Exibe estatísticas
  */
 void exibir_estatisticas(BancoDados *bd) {
     printf("\n=== Estatísticas da Árvore-B ===\n");
-    printf("Ordem: %d\n", ORDEM);
+    printf("Ordem: %d (max. %d chaves e %d bytes de celulas por pagina de %d bytes)\n",
+           bd->cabecalho.ordem, MAX_CHAVES(bd), TAM_UTIL_PAGINA, TAM_PAGINA);
+    printf("Modo: %s\n", MODO_BMAIS(bd) ? "B+ (chaves nas folhas, folhas encadeadas)" : "Arvore-B");
+    if (bd->mapa_indice) {
+        printf("Acesso ao indice: mmap (%ld bytes mapeados)\n", bd->tamanho_mapa);
+    } else {
+        printf("Acesso ao indice: fseek/fread\n");
+    }
     printf("Altura: %d\n", bd->cabecalho.altura);
-    printf("Número de páginas: %d\n", bd->cabecalho.num_paginas);
+    printf("Número de páginas: %d (+%d livres para reuso)\n",
+           bd->cabecalho.num_paginas, bd->cabecalho.num_paginas_livres);
     printf("Offset da raiz: %ld\n", bd->cabecalho.offset_raiz);
     printf("Chaves na raiz: %d\n", bd->raiz_ram->num_chaves);
     printf("Raiz é folha: %s\n", bd->raiz_ram->eh_folha ? "SIM" : "NÃO");
+    
+    long acessos = bd->buffer.acertos + bd->buffer.faltas;
+    printf("Buffer de paginas: %d/%d quadros\n", bd->buffer.num_quadros, bd->buffer.capacidade);
+    printf("  Acertos: %ld  Faltas: %ld  (taxa de acerto: %.1f%%)\n",
+           bd->buffer.acertos, bd->buffer.faltas,
+           acessos > 0 ? 100.0 * bd->buffer.acertos / acessos : 0.0);
+    
+    printf("E/S do indice: %ld paginas lidas, %ld escritas, %ld cabecalhos\n",
+           metricas.paginas_lidas, metricas.paginas_escritas, metricas.cabecalhos_escritos);
+    printf("  indice.bin: %ld bytes lidos, %ld escritos\n",
+           metricas.bytes_lidos_indice, metricas.bytes_escritos_indice);
+    printf("  dados.bin:  %ld bytes lidos, %ld escritos\n",
+           metricas.bytes_lidos_dados, metricas.bytes_escritos_dados);
+    printf("  fseek: %ld  fflush: %ld  fsync: %ld\n", metricas.fseeks, metricas.fflushes, metricas.fsyncs);
+    printf("Log (indice.log): %s, %ld commits, %ld bytes, %ld checkpoints, %ld commits refeitos\n",
+           bd->arquivo_log ? "ligado" : "desligado", metricas.commits_log, metricas.bytes_escritos_log,
+           metricas.checkpoints, metricas.commits_refeitos);
+    printf("Paginas sombra: %s, versao %lu, %ld paginas copiadas, %d liberacoes pendentes, %d instantaneos\n",
+           bd->paginas_sombra ? "ligado" : "desligado", bd->versao, metricas.copias_sombra,
+           bd->num_liberacoes, bd->num_instantaneos);
+    printf("Divisoes: %ld  Fusoes: %ld  Emprestimos: %ld\n",
+           metricas.divisoes, metricas.fusoes, metricas.emprestimos);
+    printf("Registros de imagem: %d unicos, %ld insercoes reaproveitadas\n",
+           bd->registros.num_entradas, metricas.registros_reaproveitados);
+    printf("  Buracos em dados.bin: %ld bytes livres, %ld registros gravados em buracos\n",
+           bd->cabecalho.bytes_livres_dados, metricas.registros_em_buracos);
+    printf("  Compactacao incremental: %s (%ld chaves migradas, %d por passo)\n",
+           COMPACTANDO(bd) ? "em andamento" : "parada", metricas.chaves_migradas,
+           bd->passo_compactacao);
+    printf("  Compactacao completa: %ld extensoes de registros copiadas\n", metricas.extensoes_copiadas);
+    printf("  Codificacao dos registros gravados:");
+    for (int c = 0; c < NUM_CODIFICACOES; c++) {
+        printf(" %s=%ld", CODECS[c].nome, metricas.registros_por_codificacao[c]);
+    }
+    printf("\n");
+    
+    printf("Latencias (us):\n");
+    for (int op = 0; op < NUM_OPERACOES; op++) {
+        HistogramaLatencia *h = &metricas.latencias[op];
+        if (h->contagem == 0) continue;
+        printf("  %-10s n=%-8ld media=%-10.1f p50<=%-8.0f p99<=%-8.0f max=%.1f\n",
+               NOMES_OPERACOES[op], h->contagem, h->total_us / h->contagem,
+               percentil_histograma(h, 0.50), percentil_histograma(h, 0.99), h->maximo_us);
+    }
     printf("================================\n");
 }
 
+/**
+ * Grava as métricas em JSON na tela ou em um arquivo
+ */
+void exportar_metricas(BancoDados *bd) {
+    char nome_saida[TAM_NOME_ARQUIVO];
+    printf("\nArquivo de saida (- para a tela): ");
+    scanf("%255s", nome_saida);
+    
+    if (strcmp(nome_saida, "-") == 0) {
+        printf("\n");
+        escrever_metricas_json(bd, stdout, false);
+        return;
+    }
+    
+    FILE *saida = fopen(nome_saida, "w");
+    if (!saida) {
+        printf("\n[ERRO] Nao foi possivel criar %s\n", nome_saida);
+        return;
+    }
+    escrever_metricas_json(bd, saida, false);
+    fclose(saida);
+    printf("\n[OK] Metricas gravadas em %s\n", nome_saida);
+}
+
 /**
  * Exibe informações do sistema
  */
@@ -1296,7 +5353,7 @@ void exibir_informacoes() {
     printf("        INFORMACOES DO SISTEMA\n");
     printf("===================================================\n");
     printf("\n[PROJETO]\n");
-    printf("  Titulo: Arvore-B de Ordem 3 para Banco de Imagens\n");
+    printf("  Titulo: Arvore-B Paginada para Banco de Imagens\n");
     printf("  Descricao: Sistema de indexacao de imagens PGM\n");
     printf("             usando Arvore-B com multiplos limiares\n");
     printf("\n[ACADEMICO]\n");
@@ -1306,7 +5363,7 @@ void exibir_informacoes() {
     printf("\n[TECNOLOGIAS]\n");
     printf("  Linguagem: C (padrao C11)\n");
     printf("  Compilador: GCC\n");
-    printf("  Estrutura: Arvore-B de ordem 3\n");
+    printf("  Estrutura: Arvore-B de ordem configuravel (paginas de 4 KiB)\n");
     printf("  Formato: Arquivos binarios (.bin)\n");
     printf("  Imagens: PGM (P2 ASCII e P5 binario)\n");
     printf("\n[CARACTERISTICAS]\n");
@@ -1314,7 +5371,7 @@ void exibir_informacoes() {
     printf("  - Insercao multipla de limiares\n");
     printf("  - Remocao fisica de chaves\n");
     printf("  - Compactacao de dados\n");
-    printf("  - Suporte a imagens ate 640x480 pixels\n");
+    printf("  - Registros de tamanho variavel (qualquer resolucao)\n");
     printf("===================================================\n\n");
 }
 
@@ -1323,7 +5380,7 @@ void exibir_informacoes() {
  */
 void exibir_menu() {
     printf("\n===============================================\n");
-    printf("   ARVORE-B DE ORDEM 3 - BANCO DE IMAGENS\n");
+    printf("   ARVORE-B PAGINADA - BANCO DE IMAGENS\n");
     printf("===============================================\n");
     printf(" 1. Inserir imagem (multiplos limiares)\n");
     printf(" 2. Buscar imagem\n");
@@ -1334,21 +5391,381 @@ void exibir_menu() {
     printf(" 7. Compactar arquivo de dados\n");
     printf(" 8. Estatisticas\n");
     printf(" 9. Informacoes do sistema\n");
+    printf("10. Exportar metricas (JSON)\n");
+    printf("11. Consultar intervalo ou prefixo\n");
     printf(" 0. Sair\n");
     printf("===============================================\n");
     printf("Opcao: ");
 }
 
+// Funções do modo em lote
+#define TAM_LINHA_LOTE 1024
+
+/**
+ * Monta a chave de busca a partir dos argumentos <nome> <limiar>
+ * O id vem do dicionário (ID_NOME_AUSENTE para um nome nunca inserido)
+ */
+bool chave_dos_argumentos(BancoDados *bd, const char *nome, const char *limiar, Chave *chave) {
+    if (!nome || !limiar || strlen(nome) >= TAM_NOME_ARQUIVO) {
+        return false;
+    }
+    char *fim;
+    long valor = strtol(limiar, &fim, 10);
+    if (*fim != '\0' || valor < 0 || valor > 255) {
+        return false;
+    }
+    memset(chave, 0, sizeof(Chave));
+    chave->id_nome = buscar_id_nome(bd, nome);
+    chave->limiar = (int)valor;
+    return true;
+}
+
+/**
+ * Executa um comando do lote e escreve o resultado em uma linha
+ * Formato: STATUS<TAB>COMANDO<TAB>campos...
+ * Retorna false se o comando for inválido ou falhar
+ */
+bool executar_comando_lote(BancoDados *bd, char *linha, int num_linha) {
+    const char *separadores = " \t\r\n";
+    char *comando = strtok(linha, separadores);
+    Chave chave, resultado;
+    
+    if (strcmp(comando, "INSERT") == 0) {
+        // INSERT <arquivo.pgm> <limiar> [<limiar> ...]
+        char *nome = strtok(NULL, separadores);
+        char *limiar = strtok(NULL, separadores);
+        if (!chave_dos_argumentos(bd, nome, limiar, &chave)) {
+            printf("ERROR\t%d\tuso: INSERT <arquivo.pgm> <limiar> [<limiar> ...]\n", num_linha);
+            return false;
+        }
+        RegistroImagem img_original;
+        if (!ler_pgm(nome, &img_original)) {
+            printf("ERROR\t%d\tnao foi possivel ler %s\n", num_linha, nome);
+            return false;
+        }
+        // Os limiares novos são limiarizados juntos, em uma única passada; as
+        // linhas OK saem depois das linhas de erro e de chaves já indexadas
+        int novos[256], num_novos = 0;
+        int repetidos[TAM_LINHA_LOTE / 2], num_repetidos = 0;
+        bool pendente[256] = {false};
+        bool ok = true;
+        while (limiar) {
+            if (!chave_dos_argumentos(bd, nome, limiar, &chave)) {
+                printf("ERROR\t%d\tlimiar invalido: %s\n", num_linha, limiar);
+                ok = false;
+            } else if (pendente[chave.limiar]) {
+                repetidos[num_repetidos++] = chave.limiar;
+            } else if (buscar(bd, &chave, &resultado)) {
+                printf("EXISTS\tINSERT\t%s\t%d\t%ld\n", nome, chave.limiar, OFFSET_REGISTRO(resultado.offset_dados));
+            } else {
+                pendente[chave.limiar] = true;
+                novos[num_novos++] = chave.limiar;
+            }
+            limiar = strtok(NULL, separadores);
+        }
+        
+        Chave inseridas[256];
+        if (num_novos > 0) {
+            inserir_limiares(bd, &img_original, nome, novos, num_novos, inseridas);
+        }
+        for (int k = 0; k < num_novos; k++) {
+            registrar_operacao(bd);
+            printf("OK\tINSERT\t%s\t%d\t%ld\n", nome, inseridas[k].limiar, OFFSET_REGISTRO(inseridas[k].offset_dados));
+        }
+        for (int k = 0; k < num_repetidos; k++) {
+            chave.limiar = repetidos[k];
+            buscar(bd, &chave, &resultado);
+            printf("EXISTS\tINSERT\t%s\t%d\t%ld\n", nome, chave.limiar, OFFSET_REGISTRO(resultado.offset_dados));
+        }
+        liberar_imagem(&img_original);
+        return ok;
+    }
+    
+    if (strcmp(comando, "SEARCH") == 0 || strcmp(comando, "DELETE") == 0) {
+        // SEARCH|DELETE <arquivo> <limiar>
+        char *nome = strtok(NULL, separadores);
+        char *limiar = strtok(NULL, separadores);
+        if (!chave_dos_argumentos(bd, nome, limiar, &chave)) {
+            printf("ERROR\t%d\tuso: %s <arquivo> <limiar>\n", num_linha, comando);
+            return false;
+        }
+        if (comando[0] == 'S') {
+            if (buscar(bd, &chave, &resultado)) {
+                printf("OK\tSEARCH\t%s\t%d\t%ld\n", nome, chave.limiar, OFFSET_REGISTRO(resultado.offset_dados));
+            } else {
+                printf("NOT_FOUND\tSEARCH\t%s\t%d\n", nome, chave.limiar);
+            }
+        } else {
+            if (remover(bd, &chave)) {
+                registrar_operacao(bd);
+                printf("OK\tDELETE\t%s\t%d\n", nome, chave.limiar);
+            } else {
+                printf("NOT_FOUND\tDELETE\t%s\t%d\n", nome, chave.limiar);
+            }
+        }
+        return true;
+    }
+    
+    if (strcmp(comando, "RANGE") == 0) {
+        // RANGE <arquivo> [<limiar_min> <limiar_max>]: uma linha OK por chave
+        char *nome = strtok(NULL, separadores);
+        char *minimo = strtok(NULL, separadores);
+        char *maximo = strtok(NULL, separadores);
+        Chave ate;
+        if ((minimo && !maximo) ||
+            !chave_dos_argumentos(bd, nome, minimo ? minimo : "0", &chave) ||
+            !chave_dos_argumentos(bd, nome, maximo ? maximo : "255", &ate) ||
+            chave.limiar > ate.limiar) {
+            printf("ERROR\t%d\tuso: RANGE <arquivo> [<limiar_min> <limiar_max>]\n", num_linha);
+            return false;
+        }
+        int encontradas = 0;
+        if (chave.id_nome != ID_NOME_AUSENTE) {
+            Cursor cursor;
+            cursor_abrir(bd, &cursor, &chave, &ate);
+            encontradas = imprimir_cursor(bd, &cursor, "RANGE");
+        }
+        if (encontradas == 0) {
+            printf("NOT_FOUND\tRANGE\t%s\t%d\t%d\n", nome, chave.limiar, ate.limiar);
+        }
+        return true;
+    }
+    
+    if (strcmp(comando, "PREFIX") == 0) {
+        // PREFIX <prefixo>: chaves de todos os arquivos com o prefixo
+        char *prefixo = strtok(NULL, separadores);
+        if (!prefixo) {
+            printf("ERROR\t%d\tuso: PREFIX <prefixo>\n", num_linha);
+            return false;
+        }
+        if (imprimir_prefixo(bd, prefixo, "PREFIX") == 0) {
+            printf("NOT_FOUND\tPREFIX\t%s\n", prefixo);
+        }
+        return true;
+    }
+    
+    if (strcmp(comando, "EXPORT") == 0) {
+        // EXPORT <arquivo> <limiar> <saida.pgm> [P2|P5]
+        char *nome = strtok(NULL, separadores);
+        char *limiar = strtok(NULL, separadores);
+        char *saida = strtok(NULL, separadores);
+        char *formato = strtok(NULL, separadores);
+        if (!chave_dos_argumentos(bd, nome, limiar, &chave) || !saida ||
+            (formato && strcmp(formato, "P2") != 0 && strcmp(formato, "P5") != 0)) {
+            printf("ERROR\t%d\tuso: EXPORT <arquivo> <limiar> <saida.pgm> [P2|P5]\n", num_linha);
+            return false;
+        }
+        if (!buscar(bd, &chave, &resultado)) {
+            printf("NOT_FOUND\tEXPORT\t%s\t%d\n", nome, chave.limiar);
+            return true;
+        }
+        bool formato_p2 = formato && strcmp(formato, "P2") == 0;
+        RegistroImagem img;
+        if (!carregar_imagem_chave(bd, &resultado, &img)) {
+            printf("ERROR\t%d\tregistro invalido no offset %ld\n", num_linha, OFFSET_REGISTRO(resultado.offset_dados));
+            return false;
+        }
+        bool exportou = exportar_pgm(&img, saida, formato_p2);
+        liberar_imagem(&img);
+        if (!exportou) {
+            printf("ERROR\t%d\tfalha ao exportar para %s\n", num_linha, saida);
+            return false;
+        }
+        printf("OK\tEXPORT\t%s\t%d\t%s\n", nome, chave.limiar, saida);
+        return true;
+    }
+    
+    if (strcmp(comando, "COMPACT") == 0) {
+        // COMPACT ONLINE inicia a compactação incremental (um passo por
+        // operação seguinte); COMPACT STEP [n] avança um passo de n chaves
+        char *modo = strtok(NULL, separadores);
+        if (modo && strcmp(modo, "ONLINE") == 0) {
+            if (!iniciar_compactacao(bd)) {
+                printf("ERROR\t%d\tnao foi possivel criar %s\n", num_linha, ARQUIVO_DADOS_NOVO);
+                return false;
+            }
+            printf("OK\tCOMPACT\tONLINE\t%d\n", bd->passo_compactacao);
+            return true;
+        }
+        if (modo && strcmp(modo, "STEP") == 0) {
+            char *passo = strtok(NULL, separadores);
+            int max_chaves = passo ? atoi(passo) : bd->passo_compactacao;
+            if (max_chaves < 1) {
+                printf("ERROR\t%d\tuso: COMPACT STEP [chaves]\n", num_linha);
+                return false;
+            }
+            bool terminou = passo_compactacao(bd, max_chaves);
+            printf("OK\tCOMPACT\tSTEP\t%s\t%ld\n", terminou ? "DONE" : "RUNNING",
+                   metricas.chaves_migradas);
+            return true;
+        }
+        if (modo) {
+            printf("ERROR\t%d\tuso: COMPACT [ONLINE|STEP [chaves]]\n", num_linha);
+            return false;
+        }
+        int num_registros = compactar_banco(bd);
+        if (num_registros < 0) {
+            printf("ERROR\t%d\tfalha na compactacao\n", num_linha);
+            return false;
+        }
+        printf("OK\tCOMPACT\t%d\t%d\t%d\n", num_registros,
+               bd->cabecalho.num_paginas, bd->cabecalho.altura);
+        return true;
+    }
+    
+    if (strcmp(comando, "STATS") == 0) {
+        // STATS [arquivo.json]: sem arquivo, o JSON vai na própria linha
+        char *saida = strtok(NULL, separadores);
+        if (!saida) {
+            printf("OK\tSTATS\t");
+            escrever_metricas_json(bd, stdout, true);
+            return true;
+        }
+        FILE *arquivo = fopen(saida, "w");
+        if (!arquivo) {
+            printf("ERROR\t%d\tnao foi possivel criar %s\n", num_linha, saida);
+            return false;
+        }
+        escrever_metricas_json(bd, arquivo, false);
+        fclose(arquivo);
+        printf("OK\tSTATS\t%s\n", saida);
+        return true;
+    }
+    
+    printf("ERROR\t%d\tcomando desconhecido: %s\n", num_linha, comando);
+    return false;
+}
+
+/**
+ * Executa um arquivo de comandos (ou stdin com "-") sem prompts
+ * Linhas vazias e iniciadas por '#' são ignoradas
+ * Retorna o número de comandos que falharam, ou -1 se a entrada não abriu
+ */
+int executar_lote(BancoDados *bd, const char *caminho) {
+    FILE *entrada = strcmp(caminho, "-") == 0 ? stdin : fopen(caminho, "r");
+    if (!entrada) {
+        fprintf(stderr, "[ERRO] Nao foi possivel abrir %s\n", caminho);
+        return -1;
+    }
+    
+    char linha[TAM_LINHA_LOTE];
+    int num_linha = 0, num_comandos = 0, num_erros = 0;
+    double inicio = agora_segundos();
+    
+    while (fgets(linha, sizeof(linha), entrada)) {
+        num_linha++;
+        char *p = linha + strspn(linha, " \t\r\n");
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        num_comandos++;
+        if (!executar_comando_lote(bd, p, num_linha)) {
+            num_erros++;
+        }
+    }
+    
+    confirmar(bd);
+    double segundos = agora_segundos() - inicio;
+    printf("DONE\t%d\t%d\t%.6f\t%.1f\n", num_comandos, num_erros, segundos,
+           segundos > 0 ? num_comandos / segundos : 0.0);
+    
+    if (entrada != stdin) {
+        fclose(entrada);
+    }
+    return num_erros;
+}
+
+/**
+ * Exibe as opções de linha de comando
+ */
+void exibir_uso(const char *programa) {
+    printf("Uso: %s [--ordem N] [--bmais] [--mmap] [--wal] [--sombra] [--buffer N] [--commit N]\n"
+           "          [--passo-compactacao N] [--batch ARQUIVO]\n", programa);
+    printf("  --ordem N   Ordem de um indice novo (%d a %d, padrao %d)\n",
+           ORDEM_MINIMA, ORDEM_MAXIMA, ORDEM_MAXIMA);
+    printf("  --bmais     Indice novo em modo B+ (chaves nas folhas, folhas encadeadas)\n");
+    printf("  --mmap      Acessa indice.bin mapeado em memoria (sem fseek/fread por pagina)\n");
+    printf("  --wal       Commits atomicos e duraveis (log com um fsync por commit)\n");
+    printf("  --sombra    Copia na escrita: o commit troca a raiz de uma vez (arvore B comum)\n");
+    printf("  --buffer N  Paginas mantidas no buffer LRU (padrao %d)\n",
+           CAPACIDADE_BUFFER_PADRAO);
+    printf("  --commit N  Grava paginas sujas a cada N operacoes (padrao %d)\n",
+           OPS_POR_COMMIT_PADRAO);
+    printf("  --passo-compactacao N  Chaves migradas por operacao na compactacao\n"
+           "              incremental (padrao %d)\n", PASSO_COMPACTACAO_PADRAO);
+    printf("  --batch ARQUIVO  Executa os comandos do arquivo (\"-\" para stdin) sem menu\n");
+}
+
 // main function    
-int main() {
+// bench.c inclui este arquivo com ARVORE_B_BIBLIOTECA definido e usa o próprio main
+#ifndef ARVORE_B_BIBLIOTECA
+int main(int argc, char *argv[]) {
+    OpcoesBanco opcoes = {0};
+    const char *arquivo_lote = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ordem") == 0 && i + 1 < argc) {
+            opcoes.ordem = atoi(argv[++i]);
+            if (opcoes.ordem < ORDEM_MINIMA || opcoes.ordem > ORDEM_MAXIMA) {
+                printf("[ERRO] Ordem deve estar entre %d e %d.\n", ORDEM_MINIMA, ORDEM_MAXIMA);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bmais") == 0) {
+            opcoes.folhas_encadeadas = true;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            opcoes.mapear_indice = true;
+        } else if (strcmp(argv[i], "--wal") == 0) {
+            opcoes.usar_log = true;
+        } else if (strcmp(argv[i], "--sombra") == 0) {
+            opcoes.paginas_sombra = true;
+        } else if (strcmp(argv[i], "--passo-compactacao") == 0 && i + 1 < argc) {
+            opcoes.passo_compactacao = atoi(argv[++i]);
+            if (opcoes.passo_compactacao < 1) {
+                printf("[ERRO] O passo de compactacao deve ser de pelo menos 1 chave.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--buffer") == 0 && i + 1 < argc) {
+            opcoes.capacidade_buffer = atoi(argv[++i]);
+            if (opcoes.capacidade_buffer < CAPACIDADE_BUFFER_MINIMA) {
+                printf("[ERRO] O buffer precisa de pelo menos %d paginas.\n", CAPACIDADE_BUFFER_MINIMA);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--commit") == 0 && i + 1 < argc) {
+            opcoes.ops_por_commit = atoi(argv[++i]);
+            if (opcoes.ops_por_commit < 1) {
+                printf("[ERRO] O intervalo de commit deve ser de pelo menos 1 operacao.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            arquivo_lote = argv[++i];
+        } else {
+            exibir_uso(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (arquivo_lote) {
+        // Modo em lote: sem banner nem prompts, só as linhas de resultado
+        BancoDados *bd = inicializar_banco(&opcoes);
+        if (!bd) {
+            return 1;
+        }
+        int num_erros = executar_lote(bd, arquivo_lote);
+        finalizar_banco(bd);
+        return num_erros == 0 ? 0 : 1;
+    }
+    
     printf("===================================================\n");
-    printf("  Arvore-B Paginada de Ordem 3\n");
+    printf("  Arvore-B Paginada\n");
     printf("  Banco de Dados de Imagens\n");
     printf("===================================================\n\n");
     
     printf("Inicializando banco de dados...\n");
-    BancoDados *bd = inicializar_banco();
-    printf("[OK] Banco de dados pronto!\n");
+    BancoDados *bd = inicializar_banco(&opcoes);
+    if (!bd) {
+        return 1;
+    }
+    printf("[OK] Banco de dados pronto! (ordem %d)\n", bd->cabecalho.ordem);
     
     int opcao;
     do {
@@ -1383,16 +5800,24 @@ int main() {
             case 9:
                 exibir_informacoes();
                 break;
+            case 10:
+                exportar_metricas(bd);
+                break;
+            case 11:
+                consultar_intervalo(bd);
+                break;
             case 0:
                 printf("\nEncerrando...\n");
                 break;
             default:
                 printf("\n[ERRO] Opcao invalida!\n");
         }
+        registrar_operacao(bd);
     } while(opcao != 0);
     
     finalizar_banco(bd);
     printf("[OK] Banco de dados fechado. Ate logo!\n\n");
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,638 @@
+/*
+ * ============================================================================
+ * Benchmark da Árvore-B Paginada
+ * Mede vazão (ops/s) e latência (p50/p99) de inserir, buscar, remover,
+ * percurso_em_ordem, percurso de um instantâneo (com --sombra) e compactar
+ * (inteira e em passos) para vários tamanhos
+ * de índice, e da leitura e exportação de PGM e da limiarização com
+ * vários limiares
+ * ============================================================================
+ */
+
+// Usa as funções do banco sem o main interativo
+#define ARVORE_B_BIBLIOTECA
+#include "arvore_b.c"
+
+#define TAMANHOS_PADRAO "10000,100000,1000000"
+#define MAX_TAMANHOS 16
+#define LIMIARES_POR_ARQUIVO 8           // Chaves sintéticas por nome de arquivo
+#define REPETICOES_PERCURSO 5
+#define LEITURAS_POR_ESCRITA 16          // Percurso do instantâneo: chaves lidas por inserção
+#define LIMIARES_LIMIARIZACAO 20         // Máximo aceito pelo menu de inserção
+#define REPETICOES_LIMIARIZACAO 50
+#define REPETICOES_LEITURA 50
+#define REPETICOES_EXPORTACAO 50
+#define ARQUIVO_EXPORTACAO "bench_exportacao.pgm"
+#define REGISTROS_COPIA 32768            // Registros do arquivo de dados da medição de cópia
+#define REPETICOES_COPIA 3
+#define ARQUIVO_COPIA_ORIGEM "bench_copia_origem.bin"
+#define ARQUIVO_COPIA_DESTINO "bench_copia_destino.bin"
+#define IMAGEM_PADRAO "balloons_noisy.ascii.pgm"
+#define CSV_PADRAO "bench.csv"
+
+#ifdef _WIN32
+#define DISPOSITIVO_NULO "NUL"
+#else
+#define DISPOSITIVO_NULO "/dev/null"
+#endif
+
+/**
+ * Opções do benchmark
+ */
+typedef struct {
+    long tamanhos[MAX_TAMANHOS];
+    int num_tamanhos;
+    const char *imagem;                  // PGM de onde saem as imagens derivadas
+    const char *saida_csv;
+    const char *rotulo;                  // Identifica a versão no CSV
+    unsigned long semente;
+    OpcoesBanco banco;
+} OpcoesBench;
+
+/**
+ * Latências de uma operação, em segundos
+ */
+typedef struct {
+    double *amostras;
+    long num_amostras;
+    double total;
+} Medicao;
+
+// Gerador xorshift: a sequência não depende da libc, então é a mesma em toda versão
+static unsigned long estado_aleatorio = 88172645463325252UL;
+
+unsigned long proximo_aleatorio() {
+    estado_aleatorio ^= estado_aleatorio << 13;
+    estado_aleatorio ^= estado_aleatorio >> 7;
+    estado_aleatorio ^= estado_aleatorio << 17;
+    return estado_aleatorio;
+}
+
+void embaralhar(long *v, long n) {
+    for (long i = n - 1; i > 0; i--) {
+        long j = (long)(proximo_aleatorio() % (unsigned long)(i + 1));
+        long t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+    }
+}
+
+/**
+ * Chave sintética de número i: cada nome de arquivo recebe vários limiares,
+ * como na inserção de múltiplos limiares do menu
+ * O id do nome fica para o chamador (buscar_id_nome ou obter_id_nome)
+ */
+void chave_sintetica(long i, char *nome, Chave *chave) {
+    memset(chave, 0, sizeof(Chave));
+    snprintf(nome, TAM_NOME_ARQUIVO, "sintetica/img_%07ld.pgm", i / LIMIARES_POR_ARQUIVO);
+    chave->limiar = 16 + 32 * (int)(i % LIMIARES_POR_ARQUIVO);
+}
+
+void iniciar_medicao(Medicao *m, long capacidade) {
+    m->amostras = malloc(capacidade * sizeof(double));
+    m->num_amostras = 0;
+    m->total = 0;
+}
+
+void registrar_amostra(Medicao *m, double inicio) {
+    double duracao = agora_segundos() - inicio;
+    m->amostras[m->num_amostras++] = duracao;
+    m->total += duracao;
+}
+
+int comparar_amostras(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double percentil(Medicao *m, double p) {
+    if (m->num_amostras == 0) {
+        return 0.0;
+    }
+    long idx = (long)(p * (m->num_amostras - 1) + 0.5);
+    return m->amostras[idx];
+}
+
+/**
+ * Acrescenta uma linha ao CSV (e um resumo na saída de erro)
+ */
+void gravar_medicao(FILE *csv, const OpcoesBench *opcoes, BancoDados *bd, const char *data,
+                    const char *operacao, long num_chaves, Medicao *m) {
+    qsort(m->amostras, m->num_amostras, sizeof(double), comparar_amostras);
+    double ops_por_seg = m->total > 0 ? m->num_amostras / m->total : 0.0;
+    double p50 = percentil(m, 0.50) * 1e6;
+    double p99 = percentil(m, 0.99) * 1e6;
+
+    fprintf(csv, "%s,%s,%s,%ld,%d,%d,%d,%ld,%.6f,%.1f,%.2f,%.2f\n",
+            data, opcoes->rotulo, operacao, num_chaves, bd->cabecalho.ordem,
+            bd->buffer.capacidade, bd->ops_por_commit,
+            m->num_amostras, m->total, ops_por_seg, p50, p99);
+    fflush(csv);
+
+    fprintf(stderr, "  %-18s %9ld ops %12.1f ops/s  p50 %9.2f us  p99 %9.2f us\n",
+            operacao, m->num_amostras, ops_por_seg, p50, p99);
+    free(m->amostras);
+}
+
+/**
+ * Lê a imagem de origem das imagens derivadas
+ * Sem ela, usa um gradiente sintético de 640x480
+ */
+void carregar_origem(const char *caminho, RegistroImagem *original) {
+    if (ler_pgm(caminho, original)) {
+        return;
+    }
+    fprintf(stderr, "Aviso: usando gradiente sintetico no lugar de %s\n", caminho);
+    alocar_imagem(original, 640, 480);
+    original->limiar = 0;
+    original->max_valor = 255;
+    for (int y = 0; y < original->altura; y++) {
+        for (int x = 0; x < original->largura; x++) {
+            original->dados[y * original->largura + x] = (unsigned char)((x + y) * 255 / (640 + 480));
+        }
+    }
+}
+
+/**
+ * Grava no arquivo de dados as imagens referenciadas pelas chaves sintéticas:
+ * a imagem de origem limiarizada com cada um dos limiares usados nas chaves.
+ * Cada chave inserida soma uma referência ao registro da sua imagem.
+ */
+void preparar_imagens(BancoDados *bd, const char *caminho, long long *offsets) {
+    RegistroImagem original;
+    carregar_origem(caminho, &original);
+    
+    int limiares[LIMIARES_POR_ARQUIVO];
+    for (int i = 0; i < LIMIARES_POR_ARQUIVO; i++) {
+        Chave modelo;
+        char nome[TAM_NOME_ARQUIVO];
+        chave_sintetica(i, nome, &modelo);
+        limiares[i] = modelo.limiar;
+    }
+    RegistroImagem binarias[LIMIARES_POR_ARQUIVO];
+    limiarizar_multiplos(&original, limiares, LIMIARES_POR_ARQUIVO, binarias);
+    for (int i = 0; i < LIMIARES_POR_ARQUIVO; i++) {
+        offsets[i] = armazenar_imagem(bd, &binarias[i]);
+        liberar_imagem(&binarias[i]);
+    }
+    confirmar(bd);
+    liberar_imagem(&original);
+}
+
+/**
+ * Leitura da imagem de origem com ler_pgm (arquivo já no cache do sistema)
+ */
+void medir_leitura_pgm(FILE *csv, const OpcoesBench *opcoes, BancoDados *bd, const char *data, long n) {
+    RegistroImagem img;
+    if (!ler_pgm(opcoes->imagem, &img)) {
+        return;
+    }
+    liberar_imagem(&img);
+    
+    Medicao m;
+    iniciar_medicao(&m, REPETICOES_LEITURA);
+    for (int r = 0; r < REPETICOES_LEITURA; r++) {
+        double inicio = agora_segundos();
+        ler_pgm(opcoes->imagem, &img);
+        registrar_amostra(&m, inicio);
+        liberar_imagem(&img);
+    }
+    gravar_medicao(csv, opcoes, bd, data, "ler_pgm", n, &m);
+}
+
+/**
+ * Exportação da imagem de origem (tons de cinza) em P2 e em P5
+ */
+void medir_exportacao(FILE *csv, const OpcoesBench *opcoes, BancoDados *bd, const char *data, long n) {
+    RegistroImagem original;
+    carregar_origem(opcoes->imagem, &original);
+    
+    for (int formato = 0; formato < 2; formato++) {
+        bool p2 = (formato == 0);
+        Medicao m;
+        iniciar_medicao(&m, REPETICOES_EXPORTACAO);
+        for (int r = 0; r < REPETICOES_EXPORTACAO; r++) {
+            double inicio = agora_segundos();
+            exportar_pgm(&original, ARQUIVO_EXPORTACAO, p2);
+            registrar_amostra(&m, inicio);
+        }
+        gravar_medicao(csv, opcoes, bd, data, p2 ? "exportar_p2" : "exportar_p5", n, &m);
+    }
+    remove(ARQUIVO_EXPORTACAO);
+    liberar_imagem(&original);
+}
+
+/**
+ * Limiarização de uma imagem com LIMIARES_LIMIARIZACAO limiares: uma chamada
+ * de aplicar_limiarizacao por limiar contra uma passada de limiarizar_multiplos
+ * Cada amostra é a imagem inteira com todos os limiares
+ */
+void medir_limiarizacao(FILE *csv, const OpcoesBench *opcoes, BancoDados *bd, const char *data, long n) {
+    RegistroImagem original;
+    carregar_origem(opcoes->imagem, &original);
+    
+    int limiares[LIMIARES_LIMIARIZACAO];
+    for (int k = 0; k < LIMIARES_LIMIARIZACAO; k++) {
+        limiares[k] = 12 * (k + 1);
+    }
+    RegistroImagem binarias[LIMIARES_LIMIARIZACAO];
+    Medicao m;
+    double inicio;
+    
+    iniciar_medicao(&m, REPETICOES_LIMIARIZACAO);
+    for (int r = 0; r < REPETICOES_LIMIARIZACAO; r++) {
+        inicio = agora_segundos();
+        for (int k = 0; k < LIMIARES_LIMIARIZACAO; k++) {
+            aplicar_limiarizacao(&original, &binarias[k], limiares[k]);
+        }
+        registrar_amostra(&m, inicio);
+        for (int k = 0; k < LIMIARES_LIMIARIZACAO; k++) liberar_imagem(&binarias[k]);
+    }
+    gravar_medicao(csv, opcoes, bd, data, "limiarizar_laco", n, &m);
+    
+    iniciar_medicao(&m, REPETICOES_LIMIARIZACAO);
+    for (int r = 0; r < REPETICOES_LIMIARIZACAO; r++) {
+        inicio = agora_segundos();
+        limiarizar_multiplos(&original, limiares, LIMIARES_LIMIARIZACAO, binarias);
+        registrar_amostra(&m, inicio);
+        for (int k = 0; k < LIMIARES_LIMIARIZACAO; k++) liberar_imagem(&binarias[k]);
+    }
+    gravar_medicao(csv, opcoes, bd, data, "limiarizar_multiplos", n, &m);
+    
+    liberar_imagem(&original);
+}
+
+/**
+ * Cópia dos registros vivos de um arquivo de dados sintético (registros de
+ * até 64 KiB, um em cada quatro sem chave): um copiar_registro por registro
+ * contra copiar_registros_vivos, que copia os vizinhos em extensões
+ * Cada amostra é o arquivo inteiro; a vazão em MB/s sai só no resumo
+ */
+void medir_copia_dados(FILE *csv, const OpcoesBench *opcoes, BancoDados *bd, const char *data, long n) {
+    FILE *origem = fopen(ARQUIVO_COPIA_ORIGEM, "w+b");
+    if (!origem) {
+        return;
+    }
+    unsigned char *pixels = malloc(64 * 1024);
+    for (int i = 0; i < 64 * 1024; i++) pixels[i] = (unsigned char)(i * 31);
+    
+    static long offsets[REGISTROS_COPIA];
+    MapaRegistros vivos;
+    iniciar_mapa(&vivos);
+    long bytes_vivos = 0;
+    for (int r = 0; r < REGISTROS_COPIA; r++) {
+        CabecalhoRegistro cab;
+        memset(&cab, 0, sizeof(cab));
+        cab.magico = MAGICO_REGISTRO;
+        cab.codificacao = CODIFICACAO_BYTES;
+        cab.tamanho_dados = 1 + (int)((r * 40503L) % 4096);
+        cab.largura = cab.tamanho_dados;
+        cab.altura = 1;
+        cab.max_valor = 255;
+        cab.hash = (unsigned long long)r;
+        cab.referencias = (r % 4 != 3);
+        offsets[r] = gravar_registro(origem, -1, &cab, pixels);
+        if (cab.referencias > 0) {
+            inserir_no_mapa(&vivos, (unsigned long long)offsets[r], 1);   // Uma chave por registro
+            bytes_vivos += (long)sizeof(CabecalhoRegistro) + cab.tamanho_dados;
+        }
+    }
+    fflush(origem);
+    free(pixels);
+    
+    Medicao m;
+    double inicio;
+    for (int modo = 0; modo < 2; modo++) {
+        bool extensoes = (modo == 1);
+        iniciar_medicao(&m, REPETICOES_COPIA);
+        for (int rep = 0; rep < REPETICOES_COPIA; rep++) {
+            FILE *destino = fopen(ARQUIVO_COPIA_DESTINO, "w+b");
+            if (!destino) break;
+            CabecalhoRegistro cab;
+            MapaRegistros copiados, novos_registros;
+            iniciar_mapa(&copiados);
+            iniciar_mapa(&novos_registros);
+            inicio = agora_segundos();
+            if (extensoes) {
+                copiar_registros_vivos(origem, destino, &vivos, &copiados, &novos_registros);
+            } else {
+                for (int r = 0; r < REGISTROS_COPIA; r++) {
+                    if (r % 4 != 3) copiar_registro(origem, offsets[r], destino, &cab);
+                }
+                fflush(destino);
+            }
+            registrar_amostra(&m, inicio);
+            destruir_mapa(&copiados);
+            destruir_mapa(&novos_registros);
+            fclose(destino);
+        }
+        double total = m.total;
+        long amostras = m.num_amostras;
+        gravar_medicao(csv, opcoes, bd, data, extensoes ? "copiar_extensoes" : "copiar_registros", n, &m);
+        fprintf(stderr, "  %-18s %9.1f MB/s\n", "",
+                total > 0 ? bytes_vivos * (double)amostras / total / 1e6 : 0.0);
+    }
+    
+    destruir_mapa(&vivos);
+    fclose(origem);
+    remove(ARQUIVO_COPIA_ORIGEM);
+    remove(ARQUIVO_COPIA_DESTINO);
+}
+
+void apagar_banco() {
+    remove(ARQUIVO_INDICE);
+    remove(ARQUIVO_DADOS);
+    remove(ARQUIVO_DADOS_NOVO);
+    remove(ARQUIVO_LOG);
+    remove(ARQUIVO_NOMES);
+}
+
+/**
+ * Executa todas as medições para um tamanho de índice
+ */
+bool executar_tamanho(FILE *csv, const OpcoesBench *opcoes, const char *data, long n) {
+    apagar_banco();
+    BancoDados *bd = inicializar_banco(&opcoes->banco);
+    if (!bd) {
+        return false;
+    }
+    fprintf(stderr, "\n%ld chaves (ordem %d%s%s%s%s, buffer %d, commit a cada %d)\n",
+            n, bd->cabecalho.ordem, MODO_BMAIS(bd) ? " B+" : "", bd->mapa_indice ? ", mmap" : "",
+            bd->arquivo_log ? ", log" : "", bd->paginas_sombra ? ", sombra" : "",
+            bd->buffer.capacidade, bd->ops_por_commit);
+    
+    long long offsets[LIMIARES_POR_ARQUIVO];
+    preparar_imagens(bd, opcoes->imagem, offsets);
+    medir_leitura_pgm(csv, opcoes, bd, data, n);
+    medir_exportacao(csv, opcoes, bd, data, n);
+    medir_limiarizacao(csv, opcoes, bd, data, n);
+    medir_copia_dados(csv, opcoes, bd, data, n);
+    
+    long *ordem = malloc(n * sizeof(long));
+    for (long i = 0; i < n; i++) ordem[i] = i;
+    Medicao m;
+    Chave chave;
+    char nome[TAM_NOME_ARQUIVO];
+    double inicio;
+    bool ok = true;
+    
+    // Inserção em ordem aleatória (cada operação resolve o nome no dicionário)
+    embaralhar(ordem, n);
+    iniciar_medicao(&m, n);
+    for (long i = 0; i < n; i++) {
+        chave_sintetica(ordem[i], nome, &chave);
+        chave.offset_dados = offsets[ordem[i] % LIMIARES_POR_ARQUIVO];
+        inicio = agora_segundos();
+        chave.id_nome = obter_id_nome(bd, nome);
+        inserir(bd, &chave);
+        registrar_operacao(bd);
+        registrar_amostra(&m, inicio);
+        alterar_referencias(bd, chave.offset_dados, +1);
+    }
+    gravar_medicao(csv, opcoes, bd, data, "inserir", n, &m);
+    
+    // Busca de todas as chaves, em outra ordem
+    embaralhar(ordem, n);
+    iniciar_medicao(&m, n);
+    for (long i = 0; i < n; i++) {
+        chave_sintetica(ordem[i], nome, &chave);
+        inicio = agora_segundos();
+        chave.id_nome = buscar_id_nome(bd, nome);
+        bool achou = buscar(bd, &chave, NULL);
+        registrar_amostra(&m, inicio);
+        if (!achou) ok = false;
+    }
+    gravar_medicao(csv, opcoes, bd, data, "buscar", n, &m);
+    
+    // Consulta por intervalo: todos os limiares de um arquivo com o cursor
+    long num_arquivos = (n + LIMIARES_POR_ARQUIVO - 1) / LIMIARES_POR_ARQUIVO;
+    iniciar_medicao(&m, num_arquivos);
+    for (long i = 0; i < num_arquivos; i++) {
+        chave_sintetica(ordem[i] - ordem[i] % LIMIARES_POR_ARQUIVO, nome, &chave);
+        inicio = agora_segundos();
+        unsigned int id = buscar_id_nome(bd, nome);
+        Cursor cursor;
+        cursor_abrir_ids(bd, &cursor, id, id, 0, 255);
+        long encontradas = 0;
+        while (cursor_proximo(&cursor, &chave)) encontradas++;
+        registrar_amostra(&m, inicio);
+        if (encontradas == 0) ok = false;
+    }
+    gravar_medicao(csv, opcoes, bd, data, "intervalo", n, &m);
+    
+    // Percurso completo (a listagem vai para o dispositivo nulo)
+    iniciar_medicao(&m, REPETICOES_PERCURSO);
+    for (int r = 0; r < REPETICOES_PERCURSO; r++) {
+        inicio = agora_segundos();
+        percurso_em_ordem(bd);
+        fflush(stdout);
+        registrar_amostra(&m, inicio);
+    }
+    gravar_medicao(csv, opcoes, bd, data, "percurso_em_ordem", n, &m);
+    
+    // Remoção de metade das chaves
+    embaralhar(ordem, n);
+    long num_remocoes = n / 2;
+    iniciar_medicao(&m, num_remocoes);
+    for (long i = 0; i < num_remocoes; i++) {
+        chave_sintetica(ordem[i], nome, &chave);
+        inicio = agora_segundos();
+        chave.id_nome = buscar_id_nome(bd, nome);
+        bool removeu = remover(bd, &chave);
+        registrar_operacao(bd);
+        registrar_amostra(&m, inicio);
+        if (!removeu) ok = false;
+    }
+    gravar_medicao(csv, opcoes, bd, data, "remover", n, &m);
+    long restantes = n - num_remocoes;
+    
+    // Percurso de um instantâneo enquanto chaves removidas voltam (com commit
+    // a cada ops_por_commit): uma amostra por chave lida, que tem de ser da
+    // versão do instantâneo
+    Instantaneo instantaneo;
+    if (abrir_instantaneo(bd, &instantaneo)) {
+        iniciar_medicao(&m, restantes);
+        Cursor cursor;
+        Chave inicio_chave = {0, 0, 0};
+        Chave fim_chave = {UINT_MAX, -1, 0};
+        cursor_abrir_instantaneo(bd, &cursor, &instantaneo, &inicio_chave, &fim_chave);
+        long lidas = 0, reinseridas = 0;
+        while (true) {
+            inicio = agora_segundos();
+            bool leu = cursor_proximo(&cursor, &chave);
+            if (!leu) break;
+            registrar_amostra(&m, inicio);
+            lidas++;
+            if (lidas % LEITURAS_POR_ESCRITA == 0 && reinseridas < num_remocoes) {
+                chave_sintetica(ordem[reinseridas], nome, &chave);
+                chave.offset_dados = offsets[ordem[reinseridas] % LIMIARES_POR_ARQUIVO];
+                chave.id_nome = obter_id_nome(bd, nome);
+                inserir(bd, &chave);
+                registrar_operacao(bd);
+                alterar_referencias(bd, chave.offset_dados, +1);
+                reinseridas++;
+            }
+        }
+        fechar_instantaneo(bd, &instantaneo);
+        if (lidas != restantes) ok = false;
+        restantes += reinseridas;
+        gravar_medicao(csv, opcoes, bd, data, "percurso_instantaneo", n, &m);
+    }
+    
+    // Compactação das chaves restantes: reconstrói o índice e copia cada
+    // registro compartilhado uma única vez
+    iniciar_medicao(&m, 1);
+    inicio = agora_segundos();
+    if (compactar_banco(bd) != restantes) ok = false;
+    registrar_amostra(&m, inicio);
+    gravar_medicao(csv, opcoes, bd, data, "compactar", n, &m);
+    
+    // Compactação incremental das mesmas chaves, uma amostra por passo: o
+    // p99 é a pausa que um passo acrescenta a uma operação
+    iniciar_medicao(&m, restantes / PASSO_COMPACTACAO_PADRAO + 2);
+    if (!iniciar_compactacao(bd)) ok = false;
+    long migradas_antes = metricas.chaves_migradas;
+    bool terminou = false;
+    while (!terminou && m.num_amostras < restantes / PASSO_COMPACTACAO_PADRAO + 2) {
+        inicio = agora_segundos();
+        terminou = passo_compactacao(bd, PASSO_COMPACTACAO_PADRAO);
+        registrar_amostra(&m, inicio);
+    }
+    if (!terminou || metricas.chaves_migradas - migradas_antes != restantes) ok = false;
+    gravar_medicao(csv, opcoes, bd, data, "compactar_passo", n, &m);
+    
+    if (!ok) {
+        fprintf(stderr, "[ERRO] Resultado inconsistente com %ld chaves\n", n);
+    }
+    
+    free(ordem);
+    finalizar_banco(bd);
+    apagar_banco();
+    return ok;
+}
+
+/**
+ * Lê uma lista de tamanhos separados por vírgula
+ */
+bool ler_tamanhos(const char *texto, OpcoesBench *opcoes) {
+    opcoes->num_tamanhos = 0;
+    const char *p = texto;
+    while (*p) {
+        char *fim;
+        long valor = strtol(p, &fim, 10);
+        if (fim == p || valor <= 0 || opcoes->num_tamanhos == MAX_TAMANHOS) {
+            return false;
+        }
+        opcoes->tamanhos[opcoes->num_tamanhos++] = valor;
+        p = (*fim == ',') ? fim + 1 : fim;
+        if (*fim != ',' && *fim != '\0') {
+            return false;
+        }
+    }
+    return opcoes->num_tamanhos > 0;
+}
+
+void exibir_uso_bench(const char *programa) {
+    fprintf(stderr, "Uso: %s [opcoes]\n", programa);
+    fprintf(stderr, "  --tamanhos A,B,...  Numeros de chaves (padrao %s)\n", TAMANHOS_PADRAO);
+    fprintf(stderr, "  --ordem N           Ordem do indice (padrao %d)\n", ORDEM_MAXIMA);
+    fprintf(stderr, "  --bmais             Indice em modo B+ (folhas encadeadas)\n");
+    fprintf(stderr, "  --mmap              Indice acessado por mmap\n");
+    fprintf(stderr, "  --wal               Commits com log (um fsync por commit)\n");
+    fprintf(stderr, "  --sombra            Paginas sombra (copia na escrita; mede o percurso de instantaneo)\n");
+    fprintf(stderr, "  --buffer N          Paginas no buffer LRU (padrao %d)\n", CAPACIDADE_BUFFER_PADRAO);
+    fprintf(stderr, "  --commit N          Commit a cada N operacoes (padrao %d)\n", OPS_POR_COMMIT_PADRAO);
+    fprintf(stderr, "  --imagem ARQUIVO    PGM de origem das imagens (padrao %s)\n", IMAGEM_PADRAO);
+    fprintf(stderr, "  --saida ARQUIVO     CSV onde as linhas sao acrescentadas (padrao %s)\n", CSV_PADRAO);
+    fprintf(stderr, "  --rotulo TEXTO      Identificacao da versao no CSV (padrao \"local\")\n");
+    fprintf(stderr, "  --semente N         Semente do embaralhamento\n");
+    fprintf(stderr, "Usa models/ no diretorio atual: rode em um diretorio de trabalho separado.\n");
+}
+
+int main(int argc, char *argv[]) {
+    OpcoesBench opcoes;
+    memset(&opcoes, 0, sizeof(opcoes));
+    ler_tamanhos(TAMANHOS_PADRAO, &opcoes);
+    opcoes.imagem = IMAGEM_PADRAO;
+    opcoes.saida_csv = CSV_PADRAO;
+    opcoes.rotulo = "local";
+    
+    for (int i = 1; i < argc; i++) {
+        bool tem_valor = i + 1 < argc;
+        if (strcmp(argv[i], "--tamanhos") == 0 && tem_valor) {
+            if (!ler_tamanhos(argv[++i], &opcoes)) {
+                exibir_uso_bench(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ordem") == 0 && tem_valor) {
+            opcoes.banco.ordem = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bmais") == 0) {
+            opcoes.banco.folhas_encadeadas = true;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            opcoes.banco.mapear_indice = true;
+        } else if (strcmp(argv[i], "--wal") == 0) {
+            opcoes.banco.usar_log = true;
+        } else if (strcmp(argv[i], "--sombra") == 0) {
+            opcoes.banco.paginas_sombra = true;
+        } else if (strcmp(argv[i], "--buffer") == 0 && tem_valor) {
+            opcoes.banco.capacidade_buffer = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--commit") == 0 && tem_valor) {
+            opcoes.banco.ops_por_commit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--imagem") == 0 && tem_valor) {
+            opcoes.imagem = argv[++i];
+        } else if (strcmp(argv[i], "--saida") == 0 && tem_valor) {
+            opcoes.saida_csv = argv[++i];
+        } else if (strcmp(argv[i], "--rotulo") == 0 && tem_valor) {
+            opcoes.rotulo = argv[++i];
+        } else if (strcmp(argv[i], "--semente") == 0 && tem_valor) {
+            opcoes.semente = strtoul(argv[++i], NULL, 10);
+        } else {
+            exibir_uso_bench(argv[0]);
+            return 1;
+        }
+    }
+    
+    if ((opcoes.banco.ordem != 0 &&
+         (opcoes.banco.ordem < ORDEM_MINIMA || opcoes.banco.ordem > ORDEM_MAXIMA)) ||
+        (opcoes.banco.capacidade_buffer != 0 && opcoes.banco.capacidade_buffer < CAPACIDADE_BUFFER_MINIMA) ||
+        opcoes.banco.ops_por_commit < 0) {
+        exibir_uso_bench(argv[0]);
+        return 1;
+    }
+    if (opcoes.semente != 0) {
+        estado_aleatorio = opcoes.semente;
+    }
+    
+    FILE *csv = fopen(opcoes.saida_csv, "a");
+    if (!csv) {
+        fprintf(stderr, "[ERRO] Nao foi possivel abrir %s\n", opcoes.saida_csv);
+        return 1;
+    }
+    fseek(csv, 0, SEEK_END);
+    if (ftell(csv) == 0) {
+        fprintf(csv, "data,rotulo,operacao,chaves,ordem,buffer,commit,operacoes,segundos,ops_por_seg,p50_us,p99_us\n");
+    }
+    
+    char data[32];
+    time_t agora = time(NULL);
+    strftime(data, sizeof(data), "%Y-%m-%dT%H:%M:%S", localtime(&agora));
+    
+    // O percurso imprime todas as chaves: a saída padrão é descartada e o
+    // resumo do benchmark vai para a saída de erro
+    if (!freopen(DISPOSITIVO_NULO, "w", stdout)) {
+        fprintf(stderr, "[ERRO] Nao foi possivel redirecionar a saida padrao\n");
+        fclose(csv);
+        return 1;
+    }
+    
+    bool ok = true;
+    for (int i = 0; i < opcoes.num_tamanhos; i++) {
+        if (!executar_tamanho(csv, &opcoes, data, opcoes.tamanhos[i])) {
+            ok = false;
+        }
+    }
+    
+    fclose(csv);
+    fprintf(stderr, "\nResultados acrescentados em %s\n", opcoes.saida_csv);
+    return ok ? 0 : 1;
+}
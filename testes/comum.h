@@ -0,0 +1,220 @@
+/*
+ * ============================================================================
+ * Funções comuns aos testes de testes/
+ * Cada teste inclui este arquivo (que inclui arvore_b.c como biblioteca),
+ * roda em um diretório de trabalho separado, usando models/ dele, e termina
+ * com terminar_teste: imprime OK ou ERRO e devolve o código de saída
+ * ============================================================================
+ */
+
+#ifndef TESTES_COMUM_H
+#define TESTES_COMUM_H
+
+#define ARVORE_B_BIBLIOTECA
+#include "../arvore_b.c"
+
+#include <stdarg.h>
+
+static bool falhou = false;
+
+/**
+ * Registra uma falha (só a primeira de cada tipo importa para o diagnóstico,
+ * mas todas são impressas)
+ */
+static inline void falha(const char *formato, ...) {
+    va_list args;
+    va_start(args, formato);
+    printf("FALHA: ");
+    vprintf(formato, args);
+    printf("\n");
+    va_end(args);
+    falhou = true;
+}
+
+static inline int terminar_teste(void) {
+    printf(falhou ? "ERRO\n" : "OK\n");
+    return falhou ? 1 : 0;
+}
+
+/**
+ * Apaga todos os arquivos que o banco pode deixar em models/
+ */
+static inline void apagar_banco(void) {
+    remove(ARQUIVO_INDICE);
+    remove(ARQUIVO_DADOS);
+    remove(ARQUIVO_DADOS_NOVO);
+    remove(ARQUIVO_DADOS_TEMP);
+    remove(ARQUIVO_INDICE_TEMP);
+    remove(ARQUIVO_TROCA);
+    remove(ARQUIVO_LOG);
+    remove(ARQUIVO_NOMES);
+}
+
+/**
+ * Banco vazio com as opções dadas; aborta o teste se não abrir
+ */
+static inline BancoDados* abrir_banco_novo(const OpcoesBanco *opcoes) {
+    apagar_banco();
+    BancoDados *bd = inicializar_banco(opcoes);
+    if (!bd) {
+        falha("inicializar_banco");
+        exit(terminar_teste());
+    }
+    return bd;
+}
+
+static unsigned long estado_aleatorio = 12345;
+
+/**
+ * Xorshift: a mesma semente (estado_aleatorio) reproduz a mesma sequência
+ */
+static inline unsigned long aleatorio(void) {
+    estado_aleatorio ^= estado_aleatorio << 13;
+    estado_aleatorio ^= estado_aleatorio >> 7;
+    estado_aleatorio ^= estado_aleatorio << 17;
+    return estado_aleatorio;
+}
+
+/**
+ * Imagem sintética de 8 bits; sementes diferentes (abaixo de 256) dão
+ * imagens diferentes, então só imagens de mesma semente e tamanho são
+ * deduplicadas
+ */
+static inline void gerar_imagem(RegistroImagem *img, int largura, int altura, int semente) {
+    alocar_imagem(img, largura, altura);
+    img->max_valor = 255;
+    img->limiar = 0;
+    for (int i = 0; i < largura * altura; i++) {
+        img->dados[i] = (unsigned char)(i * (semente % 250 + 3) + semente);
+    }
+}
+
+/**
+ * Grava num_registros imagens pequenas e distintas, que as chaves dos testes
+ * de carga apontam
+ */
+static inline void gravar_registros(BancoDados *bd, long long *registros, int num_registros) {
+    for (int r = 0; r < num_registros; r++) {
+        RegistroImagem img;
+        gerar_imagem(&img, 4 + r, 3, r);
+        registros[r] = armazenar_imagem(bd, &img);
+        liberar_imagem(&img);
+    }
+}
+
+/**
+ * Chave do arquivo img_<imagem>.pgm com o limiar dado (sem offset)
+ */
+static inline void chave_de(BancoDados *bd, int imagem, int limiar, Chave *chave) {
+    char nome[TAM_NOME_ARQUIVO];
+    snprintf(nome, sizeof(nome), "img_%05d.pgm", imagem);
+    memset(chave, 0, sizeof(Chave));
+    chave->id_nome = obter_id_nome(bd, nome);
+    chave->limiar = limiar;
+}
+
+/**
+ * Chave de número id dos testes de carga: quatro limiares por arquivo, e o
+ * registro escolhido pelo id
+ */
+static inline void chave_do_id(BancoDados *bd, long id, const long long *registros,
+                               int num_registros, Chave *chave) {
+    chave_de(bd, (int)(id / 4), (int)(id % 4) * 60, chave);
+    chave->offset_dados = registros[id % num_registros];
+}
+
+/**
+ * Número de chaves do índice percorrido com o cursor; -1 se o cursor não
+ * as devolver em ordem estritamente crescente
+ */
+static inline long contar_chaves(BancoDados *bd) {
+    Cursor cursor;
+    Chave chave, anterior;
+    long n = 0;
+    cursor_abrir_tudo(bd, &cursor);
+    while (cursor_proximo(&cursor, &chave)) {
+        if (n > 0 && comparar_chaves(&anterior, &chave) >= 0) {
+            cursor_fechar(&cursor);
+            return -1;
+        }
+        anterior = chave;
+        n++;
+    }
+    return n;
+}
+
+static inline long conferir_subarvore(BancoDados *bd, long offset, int nivel, const Chave *minimo,
+                                      const Chave *maximo, long *proxima);
+
+/**
+ * Confere uma página e a subárvore dela: chaves em ordem e dentro dos
+ * limites dados pelo pai, página dentro do máximo (e, fora a raiz, do
+ * mínimo), folhas todas na profundidade da altura e, no modo B+, o
+ * encadeamento igual à ordem das folhas (proxima guarda a proxima_folha da
+ * folha anterior; -2 antes da primeira)
+ * Retorna o número de chaves (no modo B+, só as das folhas), ou -1
+ */
+static inline long conferir_pagina(BancoDados *bd, Pagina *pagina, int nivel, const Chave *minimo,
+                                   const Chave *maximo, long *proxima) {
+    bool bmais = MODO_BMAIS(bd);
+    if (pagina_excedida(bd, pagina) || (nivel > 0 && pagina_abaixo_minimo(bd, pagina))) {
+        falha("pagina %ld com %d chaves fora dos limites", pagina->offset_proprio, pagina->num_chaves);
+        return -1;
+    }
+    for (int i = 0; i < pagina->num_chaves; i++) {
+        const Chave *chave = &pagina->chaves[i];
+        if ((i > 0 && comparar_chaves(&pagina->chaves[i - 1], chave) >= 0) ||
+            (minimo && comparar_chaves(chave, minimo) < (bmais ? 0 : 1)) ||
+            (maximo && comparar_chaves(chave, maximo) >= 0)) {
+            falha("pagina %ld: chave %d fora de ordem", pagina->offset_proprio, i);
+            return -1;
+        }
+    }
+    if (pagina->eh_folha) {
+        if (nivel != bd->cabecalho.altura) {
+            falha("folha %ld no nivel %d (altura %d)", pagina->offset_proprio, nivel, bd->cabecalho.altura);
+            return -1;
+        }
+        if (bmais) {
+            if (*proxima != -2 && *proxima != pagina->offset_proprio) {
+                falha("encadeamento aponta %ld em vez da folha %ld", *proxima, pagina->offset_proprio);
+                return -1;
+            }
+            *proxima = pagina->proxima_folha;
+        }
+        return pagina->num_chaves;
+    }
+    long chaves = bmais ? 0 : pagina->num_chaves;
+    for (int i = 0; i <= pagina->num_chaves; i++) {
+        long n = conferir_subarvore(bd, pagina->filhos[i], nivel + 1,
+                                    i > 0 ? &pagina->chaves[i - 1] : minimo,
+                                    i < pagina->num_chaves ? &pagina->chaves[i] : maximo, proxima);
+        if (n < 0) return -1;
+        chaves += n;
+    }
+    return chaves;
+}
+
+static inline long conferir_subarvore(BancoDados *bd, long offset, int nivel, const Chave *minimo,
+                                      const Chave *maximo, long *proxima) {
+    Pagina *pagina = ler_pagina(bd, offset);
+    long chaves = conferir_pagina(bd, pagina, nivel, minimo, maximo, proxima);
+    liberar_pagina(bd, pagina);
+    return chaves;
+}
+
+/**
+ * Invariantes da árvore inteira (ver conferir_subarvore)
+ * Retorna o número de chaves, ou -1
+ */
+static inline long conferir_arvore(BancoDados *bd) {
+    long proxima = -2;
+    long chaves = conferir_subarvore(bd, bd->cabecalho.offset_raiz, 0, NULL, NULL, &proxima);
+    if (chaves >= 0 && MODO_BMAIS(bd) && proxima != -1 && proxima != -2) {
+        falha("ultima folha encadeada a %ld", proxima);
+        return -1;
+    }
+    return chaves;
+}
+
+#endif
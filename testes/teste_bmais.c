@@ -0,0 +1,154 @@
+/*
+ * ============================================================================
+ * Teste do modo B+ (chaves nas folhas, folhas encadeadas)
+ * Em várias ordens aplica inserções e remoções aleatórias (divisões,
+ * empréstimos e fusões de folhas) e confere, além dos invariantes da árvore,
+ * que seguir proxima_folha a partir da folha mais à esquerda dá exatamente
+ * as chaves das folhas em ordem, que buscas acham as chaves presentes e não
+ * as removidas (mesmo as que ainda são separadoras), e que consultas por
+ * intervalo com o cursor batem com essa lista. Confere de novo depois da
+ * reabertura e da carga em massa
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_IDS 3000
+#define NUM_PASSOS (3 * NUM_IDS)
+#define NUM_REGISTROS 4
+#define PASSOS_POR_CONFERENCIA 1500
+#define NUM_INTERVALOS 40
+
+static long long registros[NUM_REGISTROS];
+
+/**
+ * Chaves na ordem do encadeamento, da folha mais à esquerda até proxima_folha
+ * -1; retorna quantas, ou -1 se a lista não vier em ordem crescente
+ */
+static long seguir_folhas(BancoDados *bd, Chave *chaves, long capacidade) {
+    long offset = bd->cabecalho.offset_raiz;
+    Pagina *pagina = ler_pagina(bd, offset);
+    while (!pagina->eh_folha) {
+        offset = pagina->filhos[0];
+        liberar_pagina(bd, pagina);
+        pagina = ler_pagina(bd, offset);
+    }
+    long n = 0;
+    bool em_ordem = true;
+    while (true) {
+        for (int i = 0; i < pagina->num_chaves && n < capacidade; i++) {
+            if (n > 0 && comparar_chaves(&chaves[n - 1], &pagina->chaves[i]) >= 0) em_ordem = false;
+            chaves[n++] = pagina->chaves[i];
+        }
+        long proxima = pagina->proxima_folha;
+        liberar_pagina(bd, pagina);
+        if (proxima == -1) break;
+        pagina = ler_pagina(bd, proxima);
+    }
+    return em_ordem ? n : -1;
+}
+
+/**
+ * Encadeamento, buscas e intervalos contra os ids presentes
+ */
+static void conferir_folhas(BancoDados *bd, const char *presente, long vivas, const char *etapa) {
+    if (conferir_arvore(bd) != vivas) {
+        falha("%s: arvore invalida", etapa);
+        return;
+    }
+    Chave *chaves = malloc(NUM_IDS * sizeof(Chave));
+    long n = seguir_folhas(bd, chaves, NUM_IDS);
+    if (n != vivas) falha("%s: encadeamento com %ld chaves, esperadas %ld", etapa, n, vivas);
+
+    for (long id = 0; id < NUM_IDS; id++) {
+        Chave chave, achada;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        if (buscar(bd, &chave, &achada) != (bool)presente[id]) {
+            falha("%s: busca do id %ld %s", etapa, id, presente[id] ? "nao achou" : "achou removida");
+            break;
+        }
+    }
+
+    // Intervalos entre duas chaves quaisquer (presentes ou não)
+    for (int k = 0; k < NUM_INTERVALOS && n > 0 && !falhou; k++) {
+        Chave inicio, fim, chave;
+        chave_do_id(bd, (long)(aleatorio() % NUM_IDS), registros, NUM_REGISTROS, &inicio);
+        chave_do_id(bd, (long)(aleatorio() % NUM_IDS), registros, NUM_REGISTROS, &fim);
+        if (comparar_chaves(&inicio, &fim) > 0) {
+            Chave t = inicio;
+            inicio = fim;
+            fim = t;
+        }
+        long primeira = 0, esperadas = 0;
+        while (primeira < n && comparar_chaves(&chaves[primeira], &inicio) < 0) primeira++;
+        while (primeira + esperadas < n && comparar_chaves(&chaves[primeira + esperadas], &fim) <= 0) esperadas++;
+
+        Cursor cursor;
+        long achadas = 0;
+        cursor_abrir(bd, &cursor, &inicio, &fim);
+        while (cursor_proximo(&cursor, &chave)) {
+            if (achadas < esperadas && comparar_chaves(&chave, &chaves[primeira + achadas]) != 0) break;
+            achadas++;
+        }
+        cursor_fechar(&cursor);
+        if (achadas != esperadas) falha("%s: intervalo com %ld chaves, esperadas %ld", etapa, achadas, esperadas);
+    }
+    free(chaves);
+}
+
+static void testar_ordem(int ordem) {
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = ordem;
+    opcoes.folhas_encadeadas = true;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    gravar_registros(bd, registros, NUM_REGISTROS);
+    int ordem_aberta = bd->cabecalho.ordem;
+    char etapa[64];
+
+    char *presente = calloc(NUM_IDS, 1);
+    long vivas = 0;
+    for (long passo = 1; passo <= NUM_PASSOS && !falhou; passo++) {
+        long id = (long)(aleatorio() % NUM_IDS);
+        Chave chave;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        // Mais inserções no começo, mais remoções no fim: a árvore cresce e encolhe
+        bool insercao = aleatorio() % 3 < (passo < 2 * NUM_PASSOS / 3 ? 2 : 1);
+        if (insercao && !presente[id]) {
+            inserir(bd, &chave);
+            alterar_referencias(bd, chave.offset_dados, +1);
+            presente[id] = 1;
+            vivas++;
+        } else if (!insercao && presente[id]) {
+            if (!remover(bd, &chave)) falha("ordem %d: remover nao achou %ld", ordem_aberta, id);
+            presente[id] = 0;
+            vivas--;
+        }
+        registrar_operacao(bd);
+        if (passo % PASSOS_POR_CONFERENCIA == 0) {
+            snprintf(etapa, sizeof(etapa), "ordem %d, passo %ld", ordem_aberta, passo);
+            conferir_folhas(bd, presente, vivas, etapa);
+        }
+    }
+    printf("B+ ordem %d: %ld chaves, altura %d, %d paginas\n", ordem_aberta, vivas,
+           bd->cabecalho.altura, bd->cabecalho.num_paginas);
+    finalizar_banco(bd);
+
+    bd = inicializar_banco(&opcoes);
+    snprintf(etapa, sizeof(etapa), "ordem %d reaberto", ordem_aberta);
+    conferir_folhas(bd, presente, vivas, etapa);
+    if (compactar_banco(bd) != vivas) falha("ordem %d: compactar_banco", ordem_aberta);
+    snprintf(etapa, sizeof(etapa), "ordem %d compactado", ordem_aberta);
+    conferir_folhas(bd, presente, vivas, etapa);
+    finalizar_banco(bd);
+    free(presente);
+}
+
+int main(void) {
+    int ordens[] = {ORDEM_MINIMA, 4, 7, 0};
+    for (size_t i = 0; i < sizeof(ordens) / sizeof(ordens[0]); i++) {
+        testar_ordem(ordens[i]);
+    }
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,120 @@
+/*
+ * ============================================================================
+ * Teste do buffer LRU de páginas do índice
+ * Com um buffer pequeno, confere que páginas presas (com pino) nunca saem
+ * do buffer nem mudam de conteúdo, que a página despejada é a usada há mais
+ * tempo entre as soltas, que o buffer só cresce além da capacidade quando
+ * todas as páginas estão presas, e que acertos e faltas são contados
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define CAPACIDADE CAPACIDADE_BUFFER_MINIMA
+#define NUM_PRESAS 3
+#define NUM_IDS 2000
+#define NUM_REGISTROS 4
+#define MAX_PAGINAS 4096
+
+static long long registros[NUM_REGISTROS];
+
+/**
+ * Offsets de todas as páginas da árvore (em pré-ordem)
+ */
+static void coletar_paginas(BancoDados *bd, long offset, long *paginas, int *num_paginas) {
+    Pagina *pagina = ler_pagina(bd, offset);
+    if (*num_paginas < MAX_PAGINAS) paginas[(*num_paginas)++] = offset;
+    for (int i = 0; !pagina->eh_folha && i <= pagina->num_chaves; i++) {
+        coletar_paginas(bd, pagina->filhos[i], paginas, num_paginas);
+    }
+    liberar_pagina(bd, pagina);
+}
+
+int main(void) {
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = 4;                    // Muitas páginas pequenas
+    opcoes.capacidade_buffer = CAPACIDADE;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    gravar_registros(bd, registros, NUM_REGISTROS);
+    for (long id = 0; id < NUM_IDS; id++) {
+        Chave chave;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        inserir(bd, &chave);
+        alterar_referencias(bd, chave.offset_dados, +1);
+        registrar_operacao(bd);
+    }
+    finalizar_banco(bd);
+
+    // Reaberto, o buffer só tem a raiz
+    bd = inicializar_banco(&opcoes);
+    static long paginas[MAX_PAGINAS];
+    int num_paginas = 0;
+    coletar_paginas(bd, bd->cabecalho.offset_raiz, paginas, &num_paginas);
+    if (num_paginas < 4 * CAPACIDADE) falha("poucas paginas (%d)", num_paginas);
+    if (bd->buffer.num_quadros > CAPACIDADE) falha("buffer cresceu com paginas soltas");
+
+    // Páginas presas, com uma cópia das chaves para comparar depois
+    Pagina *presas[NUM_PRESAS];
+    Chave chaves_presas[NUM_PRESAS];
+    for (int i = 0; i < NUM_PRESAS; i++) {
+        presas[i] = ler_pagina(bd, paginas[1 + i]);
+        chaves_presas[i] = presas[i]->chaves[0];
+    }
+
+    // Todas as outras passam pelo buffer, soltas logo depois de lidas
+    for (int i = 1 + NUM_PRESAS; i < num_paginas; i++) {
+        liberar_pagina(bd, ler_pagina(bd, paginas[i]));
+        if (bd->buffer.num_quadros > CAPACIDADE) {
+            falha("buffer com %d quadros e paginas soltas para despejar", bd->buffer.num_quadros);
+            break;
+        }
+    }
+    for (int i = 0; i < NUM_PRESAS; i++) {
+        Quadro *q = buscar_quadro(&bd->buffer, paginas[1 + i]);
+        if (!q || q->pagina != presas[i] || presas[i]->offset_proprio != paginas[1 + i] ||
+            comparar_chaves(&presas[i]->chaves[0], &chaves_presas[i]) != 0) {
+            falha("pagina presa %d despejada ou alterada", i);
+        }
+    }
+
+    // LRU: a última lida continua no buffer, a primeira das soltas saiu
+    long acertos = bd->buffer.acertos, faltas = bd->buffer.faltas;
+    liberar_pagina(bd, ler_pagina(bd, paginas[num_paginas - 1]));
+    if (bd->buffer.acertos != acertos + 1) falha("pagina mais recente fora do buffer");
+    if (buscar_quadro(&bd->buffer, paginas[1 + NUM_PRESAS])) falha("pagina mais antiga ainda no buffer");
+    liberar_pagina(bd, ler_pagina(bd, paginas[1 + NUM_PRESAS]));
+    if (bd->buffer.faltas != faltas + 1) falha("falta nao contada");
+
+    // Com todas presas, o buffer cresce em vez de despejar uma delas
+    int num_extras = 2 * CAPACIDADE;
+    Pagina *extras[2 * CAPACIDADE];
+    for (int i = 0; i < num_extras; i++) {
+        extras[i] = ler_pagina(bd, paginas[num_paginas - 1 - i]);
+    }
+    if (bd->buffer.num_quadros < num_extras + NUM_PRESAS) {
+        falha("buffer com %d quadros para %d paginas presas", bd->buffer.num_quadros,
+              num_extras + NUM_PRESAS);
+    }
+    for (int i = 0; i < num_extras; i++) {
+        if (extras[i]->offset_proprio != paginas[num_paginas - 1 - i]) falha("pagina presa %d trocada", i);
+        liberar_pagina(bd, extras[i]);
+    }
+    for (int i = 0; i < NUM_PRESAS; i++) {
+        liberar_pagina(bd, presas[i]);
+    }
+
+    // Soltas de novo, os quadros extras são reaproveitados, não somados
+    int quadros = bd->buffer.num_quadros;
+    for (int i = 1; i < num_paginas; i++) {
+        liberar_pagina(bd, ler_pagina(bd, paginas[i]));
+    }
+    if (bd->buffer.num_quadros != quadros) falha("buffer cresceu de %d para %d", quadros, bd->buffer.num_quadros);
+    printf("%d paginas, buffer de %d quadros (capacidade %d), %ld acertos, %ld faltas\n",
+           num_paginas, bd->buffer.num_quadros, CAPACIDADE, bd->buffer.acertos, bd->buffer.faltas);
+
+    if (contar_chaves(bd) != NUM_IDS) falha("chaves depois do teste");
+    finalizar_banco(bd);
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,166 @@
+/*
+ * ============================================================================
+ * Teste do reaproveitamento de buracos de dados.bin
+ * Registros que ficam sem referências só viram buracos no commit: gravações
+ * do mesmo grupo vão para o fim do arquivo. Depois do commit, registros do
+ * mesmo tamanho ocupam os buracos sem crescer o arquivo, um registro menor
+ * deixa a sobra como buraco, e as listas (com os bytes livres) sobrevivem à
+ * reabertura. Nenhum registro vivo é sobrescrito no caminho
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_IMAGENS 60
+#define LARGURA 40
+#define ALTURA 30
+
+static long tamanho_dados(BancoDados *bd) {
+    fflush(bd->arquivo_dados);
+    fseek(bd->arquivo_dados, 0, SEEK_END);
+    return ftell(bd->arquivo_dados);
+}
+
+/**
+ * Grava a imagem de semente dada e a insere com a chave img_<semente>
+ */
+static long long inserir_semente(BancoDados *bd, int semente, int largura, int altura) {
+    RegistroImagem img;
+    gerar_imagem(&img, largura, altura, semente);
+    Chave chave;
+    chave_de(bd, semente, 0, &chave);
+    chave.offset_dados = armazenar_imagem(bd, &img);
+    inserir(bd, &chave);
+    liberar_imagem(&img);
+    return chave.offset_dados;
+}
+
+static void remover_semente(BancoDados *bd, int semente) {
+    Chave chave;
+    chave_de(bd, semente, 0, &chave);
+    if (!remover(bd, &chave)) falha("remover img_%05d", semente);
+}
+
+/**
+ * Percorre dados.bin: os buracos somam bytes_livres_dados e cada chave viva
+ * carrega a imagem que foi gravada para ela
+ */
+static void conferir_dados(BancoDados *bd, const bool *viva, const int *largura, const char *etapa) {
+    long offset = 0, livres = 0;
+    CabecalhoRegistro cab;
+    while (ler_cabecalho_registro(bd->arquivo_dados, offset, &cab)) {
+        long tamanho = (long)sizeof(CabecalhoRegistro) + cab.tamanho_dados;
+        if (cab.referencias == 0) livres += tamanho;
+        offset += tamanho;
+    }
+    if (offset != tamanho_dados(bd)) falha("%s: dados.bin nao percorrivel ate o fim", etapa);
+    if (livres != bd->cabecalho.bytes_livres_dados) {
+        falha("%s: buracos somam %ld bytes, cabecalho diz %ld", etapa, livres, bd->cabecalho.bytes_livres_dados);
+    }
+    for (int s = 0; s < NUM_IMAGENS; s++) {
+        Chave chave, achada;
+        chave_de(bd, s, 0, &chave);
+        bool achou = buscar(bd, &chave, &achada);
+        if (achou != viva[s]) {
+            falha("%s: img_%05d %s", etapa, s, viva[s] ? "ausente" : "presente");
+            continue;
+        }
+        if (!achou) continue;
+        RegistroImagem esperada, lida;
+        gerar_imagem(&esperada, largura[s], ALTURA, s);
+        if (!carregar_imagem_chave(bd, &achada, &lida)) {
+            falha("%s: img_%05d ilegivel", etapa, s);
+        } else {
+            if (lida.largura != largura[s] || lida.altura != ALTURA ||
+                memcmp(lida.dados, esperada.dados, (size_t)largura[s] * ALTURA) != 0) {
+                falha("%s: img_%05d sobrescrita", etapa, s);
+            }
+            liberar_imagem(&lida);
+        }
+        liberar_imagem(&esperada);
+    }
+}
+
+int main(void) {
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    bool viva[NUM_IMAGENS] = {false};
+    int largura[NUM_IMAGENS];
+    long long offsets[NUM_IMAGENS];
+    const long tamanho_registro = (long)sizeof(CabecalhoRegistro) + LARGURA * ALTURA;
+
+    // Metade das imagens, todas do mesmo tamanho
+    for (int s = 0; s < NUM_IMAGENS / 2; s++) {
+        largura[s] = LARGURA;
+        offsets[s] = inserir_semente(bd, s, LARGURA, ALTURA);
+        viva[s] = true;
+    }
+    confirmar(bd);
+    if (bd->cabecalho.bytes_livres_dados != 0) falha("buracos sem remocoes");
+
+    // Remoções e inserções no mesmo grupo: nada de buraco antes do commit
+    long tamanho = tamanho_dados(bd);
+    for (int s = 0; s < 10; s++) {
+        remover_semente(bd, s);
+        viva[s] = false;
+    }
+    for (int s = NUM_IMAGENS / 2; s < NUM_IMAGENS / 2 + 5; s++) {
+        largura[s] = LARGURA;
+        offsets[s] = inserir_semente(bd, s, LARGURA, ALTURA);
+        viva[s] = true;
+    }
+    if (bd->cabecalho.bytes_livres_dados != 0) falha("buraco antes do commit");
+    if (tamanho_dados(bd) != tamanho + 5 * tamanho_registro) falha("registro gravado em buraco do mesmo grupo");
+    confirmar(bd);
+    if (bd->cabecalho.bytes_livres_dados != 10 * tamanho_registro) {
+        falha("%ld bytes livres depois do commit, esperados %ld", bd->cabecalho.bytes_livres_dados,
+              10 * tamanho_registro);
+    }
+    conferir_dados(bd, viva, largura, "depois do commit");
+
+    // Reaberto, as listas continuam lá
+    long livres = bd->cabecalho.bytes_livres_dados;
+    finalizar_banco(bd);
+    bd = inicializar_banco(&opcoes);
+    if (bd->cabecalho.bytes_livres_dados != livres) falha("bytes livres perdidos na reabertura");
+    conferir_dados(bd, viva, largura, "reaberto");
+
+    // Mesmo tamanho: ocupa os buracos sem crescer o arquivo
+    tamanho = tamanho_dados(bd);
+    long em_buracos = metricas.registros_em_buracos;
+    for (int s = NUM_IMAGENS / 2 + 5; s < NUM_IMAGENS / 2 + 13; s++) {
+        largura[s] = LARGURA;
+        offsets[s] = inserir_semente(bd, s, LARGURA, ALTURA);
+        viva[s] = true;
+        bool em_buraco = false;
+        for (int r = 0; r < 10; r++) {
+            if (OFFSET_REGISTRO(offsets[s]) == OFFSET_REGISTRO(offsets[r])) em_buraco = true;
+        }
+        if (!em_buraco) falha("img_%05d fora dos buracos", s);
+    }
+    if (tamanho_dados(bd) != tamanho) falha("dados.bin cresceu com buracos do mesmo tamanho");
+    if (metricas.registros_em_buracos != em_buracos + 8) falha("registros em buracos nao contados");
+
+    // Menor: a sobra do buraco continua livre
+    livres = bd->cabecalho.bytes_livres_dados;
+    int s = NUM_IMAGENS / 2 + 13;
+    largura[s] = LARGURA / 2;
+    offsets[s] = inserir_semente(bd, s, LARGURA / 2, ALTURA);
+    viva[s] = true;
+    long menor = (long)sizeof(CabecalhoRegistro) + (LARGURA / 2) * ALTURA;
+    if (tamanho_dados(bd) != tamanho || bd->cabecalho.bytes_livres_dados != livres - menor) {
+        falha("registro menor: %ld bytes livres, esperados %ld", bd->cabecalho.bytes_livres_dados, livres - menor);
+    }
+    confirmar(bd);
+    conferir_dados(bd, viva, largura, "depois de reaproveitar");
+    printf("%ld bytes livres em dados.bin de %ld bytes, %ld registros em buracos\n",
+           bd->cabecalho.bytes_livres_dados, tamanho_dados(bd), metricas.registros_em_buracos);
+
+    finalizar_banco(bd);
+    bd = inicializar_banco(&opcoes);
+    conferir_dados(bd, viva, largura, "reaberto de novo");
+    finalizar_banco(bd);
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,117 @@
+/*
+ * ============================================================================
+ * Teste da carga em massa (índice remontado de baixo para cima no COMPACT)
+ * Insere chaves em ordem aleatória (páginas pela metade), compacta e confere
+ * a forma do índice novo: invariantes da árvore, as mesmas chaves, e cada
+ * nível com todas as páginas cheias exceto as duas últimas (que a carga
+ * rebalanceia), com e sem folhas encadeadas e com vários tamanhos, dos
+ * menores que uma página aos que precisam de vários níveis
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_REGISTROS 4
+#define MAX_NIVEIS 32
+
+static long long registros[NUM_REGISTROS];
+
+/**
+ * Páginas de cada nível, da esquerda para a direita: quantas e quantas
+ * delas não estão cheias, sem contar as duas últimas
+ */
+typedef struct {
+    int paginas[MAX_NIVEIS];
+    int incompletas[MAX_NIVEIS];
+    int ultimas[MAX_NIVEIS][2];          // Chaves das duas últimas páginas vistas
+} FormaNiveis;
+
+static void medir_niveis(BancoDados *bd, long offset, int nivel, FormaNiveis *forma) {
+    Pagina *pagina = ler_pagina(bd, offset);
+    // A penúltima vista deixa de ser uma das duas últimas
+    if (forma->paginas[nivel] >= 2 && forma->ultimas[nivel][0] < MAX_CHAVES(bd)) {
+        forma->incompletas[nivel]++;
+    }
+    forma->ultimas[nivel][0] = forma->ultimas[nivel][1];
+    forma->ultimas[nivel][1] = pagina->num_chaves;
+    forma->paginas[nivel]++;
+    for (int i = 0; !pagina->eh_folha && i <= pagina->num_chaves; i++) {
+        medir_niveis(bd, pagina->filhos[i], nivel + 1, forma);
+    }
+    liberar_pagina(bd, pagina);
+}
+
+static void testar_carga(int ordem, bool folhas_encadeadas, long num_chaves) {
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = ordem;
+    opcoes.folhas_encadeadas = folhas_encadeadas;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    gravar_registros(bd, registros, NUM_REGISTROS);
+
+    // Ids em ordem aleatória (embaralhamento de Fisher-Yates)
+    long *ids = malloc(num_chaves * sizeof(long));
+    for (long i = 0; i < num_chaves; i++) ids[i] = i;
+    for (long i = num_chaves - 1; i > 0; i--) {
+        long j = (long)(aleatorio() % (unsigned long)(i + 1));
+        long t = ids[i];
+        ids[i] = ids[j];
+        ids[j] = t;
+    }
+    for (long i = 0; i < num_chaves; i++) {
+        Chave chave;
+        chave_do_id(bd, ids[i], registros, NUM_REGISTROS, &chave);
+        inserir(bd, &chave);
+        alterar_referencias(bd, chave.offset_dados, +1);
+        registrar_operacao(bd);
+    }
+    free(ids);
+    int paginas_antes = bd->cabecalho.num_paginas;
+
+    const char *modo = folhas_encadeadas ? "B+" : "B";
+    if (compactar_banco(bd) != num_chaves) falha("%s ordem %d: compactar_banco", modo, ordem);
+    if (conferir_arvore(bd) != num_chaves || contar_chaves(bd) != num_chaves) {
+        falha("%s ordem %d, %ld chaves: arvore invalida depois da carga", modo, ordem, num_chaves);
+    }
+    if (bd->cabecalho.num_paginas > paginas_antes) {
+        falha("%s ordem %d: %d paginas depois da carga, %d antes", modo, ordem,
+              bd->cabecalho.num_paginas, paginas_antes);
+    }
+
+    // A ordem padrão é limitada pelos bytes, não pelo número de chaves
+    FormaNiveis forma;
+    memset(&forma, 0, sizeof(forma));
+    medir_niveis(bd, bd->cabecalho.offset_raiz, 0, &forma);
+    for (int nivel = 0; ordem > 0 && nivel <= bd->cabecalho.altura; nivel++) {
+        if (forma.incompletas[nivel] > 0) {
+            falha("%s ordem %d, %ld chaves: %d paginas incompletas no nivel %d", modo, ordem,
+                  num_chaves, forma.incompletas[nivel], nivel);
+        }
+    }
+    printf("%s ordem %d, %ld chaves: altura %d, %d paginas (%d antes)\n", modo,
+           bd->cabecalho.ordem, num_chaves, bd->cabecalho.altura, bd->cabecalho.num_paginas, paginas_antes);
+
+    // O índice carregado continua aceitando alterações
+    Chave chave;
+    chave_do_id(bd, num_chaves, registros, NUM_REGISTROS, &chave);
+    inserir(bd, &chave);
+    alterar_referencias(bd, chave.offset_dados, +1);
+    chave_do_id(bd, 0, registros, NUM_REGISTROS, &chave);
+    if (!remover(bd, &chave)) falha("%s ordem %d: remover depois da carga", modo, ordem);
+    if (conferir_arvore(bd) != num_chaves) falha("%s ordem %d: arvore invalida depois de alterar", modo, ordem);
+    finalizar_banco(bd);
+}
+
+int main(void) {
+    long tamanhos[] = {1, 4, 5, 1000, 6000};
+    int ordens[] = {ORDEM_MINIMA, 5, 0};
+    for (int bmais = 0; bmais <= 1; bmais++) {
+        for (size_t o = 0; o < sizeof(ordens) / sizeof(ordens[0]); o++) {
+            for (size_t t = 0; t < sizeof(tamanhos) / sizeof(tamanhos[0]); t++) {
+                testar_carga(ordens[o], bmais, tamanhos[t]);
+            }
+        }
+    }
+    apagar_banco();
+    return terminar_teste();
+}
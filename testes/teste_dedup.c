@@ -0,0 +1,122 @@
+/*
+ * ============================================================================
+ * Teste da deduplicação de registros de imagem
+ * A mesma imagem gravada várias vezes (por nomes diferentes ou por limiares
+ * que dão a mesma imagem binária) fica em um único registro cujo contador
+ * de referências é o número de chaves; dimensões diferentes com os mesmos
+ * pixels não são confundidas. Cada remoção desconta uma referência no
+ * commit, a última transforma o registro em buraco, e o mapa remontado na
+ * reabertura continua achando os registros vivos
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_COPIAS 5
+#define NUM_LIMIARES 3
+
+static long tamanho_dados(BancoDados *bd) {
+    fflush(bd->arquivo_dados);
+    fseek(bd->arquivo_dados, 0, SEEK_END);
+    return ftell(bd->arquivo_dados);
+}
+
+/**
+ * Contador de referências do registro apontado; -1 se não houver registro
+ */
+static int referencias(BancoDados *bd, long long offset_dados) {
+    CabecalhoRegistro cab;
+    if (!ler_cabecalho_registro(bd->arquivo_dados, OFFSET_REGISTRO(offset_dados), &cab)) return -1;
+    return cab.referencias;
+}
+
+int main(void) {
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+
+    // A mesma imagem em NUM_COPIAS nomes: um registro, NUM_COPIAS referências
+    RegistroImagem img;
+    gerar_imagem(&img, 40, 30, 7);
+    Chave copias[NUM_COPIAS];
+    long tamanho_registro = 0;
+    for (int i = 0; i < NUM_COPIAS; i++) {
+        long antes = tamanho_dados(bd);
+        chave_de(bd, i, 100, &copias[i]);
+        copias[i].offset_dados = armazenar_imagem(bd, &img);
+        inserir(bd, &copias[i]);
+        registrar_operacao(bd);
+        if (i == 0) {
+            tamanho_registro = tamanho_dados(bd) - antes;
+        } else if (copias[i].offset_dados != copias[0].offset_dados || tamanho_dados(bd) != antes) {
+            falha("copia %d gravou um registro novo", i);
+        }
+    }
+    if (referencias(bd, copias[0].offset_dados) != NUM_COPIAS) {
+        falha("%d referencias para %d copias", referencias(bd, copias[0].offset_dados), NUM_COPIAS);
+    }
+
+    // Os mesmos pixels em outras dimensões são outra imagem
+    RegistroImagem transposta;
+    alocar_imagem(&transposta, img.altura, img.largura);
+    transposta.max_valor = img.max_valor;
+    memcpy(transposta.dados, img.dados, (size_t)img.largura * img.altura);
+    Chave outra;
+    chave_de(bd, NUM_COPIAS, 100, &outra);
+    outra.offset_dados = armazenar_imagem(bd, &transposta);
+    inserir(bd, &outra);
+    liberar_imagem(&transposta);
+    if (outra.offset_dados == copias[0].offset_dados) falha("dimensoes diferentes deduplicadas");
+
+    // Sem pixels 0, os limiares 0 e 1 dão a mesma imagem (toda branca)
+    RegistroImagem clara;
+    gerar_imagem(&clara, 33, 9, 3);
+    for (int i = 0; i < clara.largura * clara.altura; i++) {
+        if (clara.dados[i] == 0) clara.dados[i] = 1;
+    }
+    int limiares[NUM_LIMIARES] = {0, 1, 200};
+    Chave limiarizadas[NUM_LIMIARES];
+    inserir_limiares(bd, &clara, "clara.pgm", limiares, NUM_LIMIARES, limiarizadas);
+    liberar_imagem(&clara);
+    if (limiarizadas[0].offset_dados != limiarizadas[1].offset_dados ||
+        referencias(bd, limiarizadas[0].offset_dados) != 2) {
+        falha("limiares 0 e 1 com registros separados");
+    }
+    if (limiarizadas[2].offset_dados == limiarizadas[0].offset_dados) falha("limiar 200 deduplicado");
+    confirmar(bd);
+    printf("%d copias em um registro de %ld bytes\n", NUM_COPIAS, tamanho_registro);
+
+    // Reaberto, o mapa remontado acha o registro compartilhado
+    finalizar_banco(bd);
+    bd = inicializar_banco(&opcoes);
+    Chave mais_uma;
+    chave_de(bd, NUM_COPIAS + 1, 100, &mais_uma);
+    mais_uma.offset_dados = armazenar_imagem(bd, &img);
+    inserir(bd, &mais_uma);
+    if (mais_uma.offset_dados != copias[0].offset_dados) falha("registro nao achado depois de reabrir");
+    if (!remover(bd, &mais_uma)) falha("remover a copia extra");
+    confirmar(bd);
+
+    // Cada remoção desconta uma referência no commit; a última vira buraco
+    for (int i = 0; i < NUM_COPIAS; i++) {
+        if (!remover(bd, &copias[i])) falha("remover copia %d", i);
+        if (referencias(bd, copias[0].offset_dados) != NUM_COPIAS - i) {
+            falha("referencia descontada antes do commit (copia %d)", i);
+        }
+        long livres = bd->cabecalho.bytes_livres_dados;
+        confirmar(bd);
+        int esperadas = NUM_COPIAS - 1 - i;
+        if (referencias(bd, copias[0].offset_dados) != esperadas) {
+            falha("%d referencias depois de remover %d copias", referencias(bd, copias[0].offset_dados), i + 1);
+        }
+        long ganho = bd->cabecalho.bytes_livres_dados - livres;
+        if (ganho != (esperadas == 0 ? tamanho_registro : 0)) {
+            falha("%ld bytes livres a mais com %d referencias", ganho, esperadas);
+        }
+    }
+    if (contar_chaves(bd) != 1 + NUM_LIMIARES) falha("chaves depois das remocoes");
+    finalizar_banco(bd);
+    liberar_imagem(&img);
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,160 @@
+/*
+ * ============================================================================
+ * Teste dos instantâneos do modo sombra (--sombra)
+ * Aplica inserções e remoções aleatórias com commits frequentes enquanto
+ * cursores de instantâneos leem a versão em que foram abertos, e confere que
+ * cada instantâneo devolve exatamente as chaves (e offsets) que tinha ao
+ * abrir. No fim confere que o banco não fecha com um instantâneo aberto e,
+ * com os instantâneos fechados, que as liberações adiadas foram todas
+ * feitas: nenhuma pendente e cada registro com uma referência por chave
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_IDS 8000
+#define NUM_PASSOS (3 * NUM_IDS)
+#define NUM_REGISTROS 8
+#define LEITURAS_POR_PASSO 3             // Chaves lidas do instantâneo a cada operação
+
+static long long registros[NUM_REGISTROS];
+
+/**
+ * Todas as chaves visíveis no instantâneo, em ordem; devolve quantas são
+ */
+static long ler_instantaneo(BancoDados *bd, const Instantaneo *inst, Chave *chaves, long capacidade) {
+    Chave inicio = {0, 0, 0};
+    Chave fim = {UINT_MAX, -1, 0};
+    Cursor cursor;
+    Chave chave;
+    long n = 0;
+    cursor_abrir_instantaneo(bd, &cursor, inst, &inicio, &fim);
+    while (cursor_proximo(&cursor, &chave)) {
+        if (n < capacidade) chaves[n] = chave;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Cada registro tem a referência da gravação mais uma por chave
+ */
+static void conferir_referencias(BancoDados *bd, const char *presente) {
+    long chaves_por_registro[NUM_REGISTROS] = {0};
+    for (long id = 0; id < NUM_IDS; id++) {
+        if (presente[id]) chaves_por_registro[id % NUM_REGISTROS]++;
+    }
+    for (int r = 0; r < NUM_REGISTROS; r++) {
+        CabecalhoRegistro cab;
+        if (!ler_cabecalho_registro(bd->arquivo_dados, OFFSET_REGISTRO(registros[r]), &cab) ||
+            cab.referencias != 1 + chaves_por_registro[r]) {
+            falha("referencias do registro %d", r);
+        }
+    }
+}
+
+int main(void) {
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = 5;                    // Árvore alta: cada commit copia vários níveis
+    opcoes.capacidade_buffer = 16;
+    opcoes.ops_por_commit = 7;
+    opcoes.paginas_sombra = true;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    if (!bd->paginas_sombra) {
+        falha("modo sombra recusado");
+        return terminar_teste();
+    }
+    gravar_registros(bd, registros, NUM_REGISTROS);
+
+    char *presente = calloc(NUM_IDS, 1);
+    Chave *foto = malloc(NUM_IDS * sizeof(Chave));
+    long vivas = 0, num_foto = 0, lidas = 0, num_instantaneos = 0;
+    Instantaneo inst;
+    Cursor cursor_inst;
+    bool aberto = false;
+
+    for (long passo = 0; passo < NUM_PASSOS && !falhou; passo++) {
+        if (!aberto && passo % (NUM_IDS / 3) == 1) {
+            // A foto é a versão confirmada: o commit antes dela inclui tudo
+            confirmar(bd);
+            abrir_instantaneo(bd, &inst);
+            num_foto = ler_instantaneo(bd, &inst, foto, NUM_IDS);
+            if (num_foto != vivas) falha("chaves no instantaneo (%ld)", num_foto);
+            Chave inicio = {0, 0, 0};
+            Chave fim = {UINT_MAX, -1, 0};
+            cursor_abrir_instantaneo(bd, &cursor_inst, &inst, &inicio, &fim);
+            aberto = true;
+            lidas = 0;
+            num_instantaneos++;
+
+            // Um segundo instantâneo aninhado, fechado logo, não solta nada
+            // que o primeiro ainda lê; com eles abertos a compactação espera
+            Instantaneo outro;
+            abrir_instantaneo(bd, &outro);
+            if (compactar_banco(bd) != -1) falha("compactacao com instantaneo aberto (%ld)", passo);
+            fechar_instantaneo(bd, &outro);
+        }
+
+        // O cursor do instantâneo avança entre as alterações
+        for (int l = 0; l < LEITURAS_POR_PASSO && aberto; l++) {
+            Chave chave;
+            if (!cursor_proximo(&cursor_inst, &chave)) {
+                if (lidas != num_foto) falha("instantaneo terminou antes (%ld)", lidas);
+                fechar_instantaneo(bd, &inst);
+                aberto = false;
+            } else if (lidas >= num_foto || comparar_chaves(&chave, &foto[lidas]) != 0 ||
+                       chave.offset_dados != foto[lidas].offset_dados) {
+                falha("instantaneo mudou (%ld)", lidas);
+            } else {
+                lidas++;
+            }
+        }
+
+        long id = (long)(aleatorio() % NUM_IDS);
+        bool insercao = passo < NUM_PASSOS / 2 ? aleatorio() % 4 != 0 : aleatorio() % 4 == 0;
+        Chave chave, achada;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        if (insercao && !presente[id]) {
+            inserir(bd, &chave);
+            alterar_referencias(bd, chave.offset_dados, +1);
+            presente[id] = 1;
+            vivas++;
+        } else if (!insercao && presente[id]) {
+            if (!remover(bd, &chave)) falha("remover nao achou (%ld)", id);
+            presente[id] = 0;
+            vivas--;
+        } else if (buscar(bd, &chave, &achada) != (bool)presente[id]) {
+            falha("busca (%ld)", id);
+        }
+        registrar_operacao(bd);
+    }
+    if (aberto) {
+        cursor_fechar(&cursor_inst);
+        fechar_instantaneo(bd, &inst);
+    }
+    // Com um instantâneo aberto o banco não fecha
+    abrir_instantaneo(bd, &inst);
+    if (finalizar_banco(bd)) {
+        falha("finalizar_banco com instantaneo aberto");
+        return terminar_teste();
+    }
+    fechar_instantaneo(bd, &inst);
+    confirmar(bd);
+
+    if (bd->num_liberacoes != 0) falha("%d liberacoes pendentes", bd->num_liberacoes);
+    if (contar_chaves(bd) != vivas) falha("chaves no indice (%ld)", vivas);
+    conferir_referencias(bd, presente);
+    printf("%ld instantaneos, versao %lu, %ld paginas copiadas, %ld chaves\n",
+           num_instantaneos, bd->versao, metricas.copias_sombra, vivas);
+
+    finalizar_banco(bd);
+    bd = inicializar_banco(&opcoes);
+    if (contar_chaves(bd) != vivas) falha("chaves depois de reabrir (%ld)", vivas);
+    finalizar_banco(bd);
+
+    free(presente);
+    free(foto);
+    apagar_banco();
+    return terminar_teste();
+}
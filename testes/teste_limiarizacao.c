@@ -0,0 +1,77 @@
+/*
+ * ============================================================================
+ * Teste da limiarização vetorizada
+ * Confere limiarizar_bloco (SSE2, quando disponível) contra a comparação
+ * escalar pixel a pixel para todos os limiares de 0 a 255, tamanhos que não
+ * são múltiplos de 16 e origens desalinhadas, sem escrever além do bloco, e
+ * limiarizar_multiplos contra aplicar_limiarizacao em uma imagem com vários
+ * blocos, inclusive para limiares fora de 0 a 255
+ * Não usa o banco
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define MAX_PIXELS 70
+#define SENTINELA 0x5A
+#define NUM_LIMIARES 7
+
+int main(void) {
+    unsigned char origem[MAX_PIXELS + 1], destino[MAX_PIXELS + 1];
+    for (int i = 0; i <= MAX_PIXELS; i++) {
+        origem[i] = (unsigned char)(aleatorio() >> 9);
+    }
+    origem[3] = 0;                       // Os extremos aparecem em todos os tamanhos
+    origem[5] = 255;
+    origem[20] = 128;
+
+    long comparacoes = 0;
+    for (int limiar = 0; limiar <= 255 && !falhou; limiar++) {
+        for (int desalinhamento = 0; desalinhamento <= 1; desalinhamento++) {
+            for (int n = 0; n + desalinhamento <= MAX_PIXELS; n++) {
+                const unsigned char *p = origem + desalinhamento;
+                memset(destino, SENTINELA, sizeof(destino));
+                limiarizar_bloco(p, destino, n, limiar);
+                for (int i = 0; i < n; i++) {
+                    if (destino[i] != (p[i] >= limiar ? 255 : 0)) {
+                        falha("limiar %d, %d pixels: pixel %d (%d) virou %d", limiar, n, i, p[i], destino[i]);
+                    }
+                }
+                if (destino[n] != SENTINELA) falha("limiar %d, %d pixels: escreveu alem do bloco", limiar, n);
+                comparacoes += n;
+            }
+        }
+    }
+#ifdef __SSE2__
+    const char *versao = "SSE2";
+#else
+    const char *versao = "escalar";
+#endif
+    printf("limiarizar_bloco (%s): %ld pixels conferidos\n", versao, comparacoes);
+
+    // Vários blocos de BLOCO_LIMIARIZACAO e um pedaço no fim
+    RegistroImagem img;
+    alocar_imagem(&img, 3 * BLOCO_LIMIARIZACAO / 61 + 7, 61);
+    img.max_valor = 255;
+    img.limiar = 0;
+    for (int i = 0; i < img.largura * img.altura; i++) {
+        img.dados[i] = (unsigned char)(aleatorio() >> 9);
+    }
+    int limiares[NUM_LIMIARES] = {-5, 0, 1, 127, 254, 255, 300};
+    RegistroImagem saidas[NUM_LIMIARES];
+    limiarizar_multiplos(&img, limiares, NUM_LIMIARES, saidas);
+    for (int k = 0; k < NUM_LIMIARES; k++) {
+        RegistroImagem esperada;
+        aplicar_limiarizacao(&img, &esperada, limiares[k]);
+        if (saidas[k].largura != img.largura || saidas[k].altura != img.altura ||
+            saidas[k].limiar != limiares[k] ||
+            memcmp(saidas[k].dados, esperada.dados, (size_t)img.largura * img.altura) != 0) {
+            falha("limiarizar_multiplos diverge de aplicar_limiarizacao no limiar %d", limiares[k]);
+        }
+        liberar_imagem(&esperada);
+        liberar_imagem(&saidas[k]);
+    }
+    printf("limiarizar_multiplos: %d limiares em %dx%d\n", NUM_LIMIARES, img.largura, img.altura);
+    liberar_imagem(&img);
+    return terminar_teste();
+}
@@ -0,0 +1,138 @@
+/*
+ * ============================================================================
+ * Teste da lista de páginas livres do índice
+ * Remove a maior parte das chaves de uma árvore de ordem pequena e confere a
+ * lista: o tamanho bate com o cabeçalho, cada página dela está marcada como
+ * livre e fora da árvore, e páginas da árvore mais livres somam todas as
+ * páginas do arquivo. A lista sobrevive à reabertura, e as inserções seguintes
+ * reaproveitam as páginas dela: indice.bin só cresce com a lista vazia
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_IDS 4000
+#define NUM_REGISTROS 4
+#define MAX_PAGINAS 8192
+
+static long long registros[NUM_REGISTROS];
+
+static void marcar_arvore(BancoDados *bd, long offset, char *na_arvore, int *num_paginas) {
+    Pagina *pagina = ler_pagina(bd, offset);
+    na_arvore[offset / TAM_PAGINA] = 1;
+    (*num_paginas)++;
+    for (int i = 0; !pagina->eh_folha && i <= pagina->num_chaves; i++) {
+        marcar_arvore(bd, pagina->filhos[i], na_arvore, num_paginas);
+    }
+    liberar_pagina(bd, pagina);
+}
+
+/**
+ * Percorre a lista livre e a árvore; retorna o número de páginas livres
+ */
+static int conferir_livres(BancoDados *bd, const char *etapa) {
+    static char na_arvore[MAX_PAGINAS];
+    memset(na_arvore, 0, sizeof(na_arvore));
+    int paginas_arvore = 0;
+    marcar_arvore(bd, bd->cabecalho.offset_raiz, na_arvore, &paginas_arvore);
+    if (paginas_arvore != bd->cabecalho.num_paginas) {
+        falha("%s: %d paginas na arvore, cabecalho diz %d", etapa, paginas_arvore, bd->cabecalho.num_paginas);
+    }
+
+    int livres = 0;
+    for (long offset = bd->cabecalho.primeira_livre; offset > 0 && livres <= MAX_PAGINAS; livres++) {
+        if (offset >= bd->cabecalho.proximo_offset || na_arvore[offset / TAM_PAGINA]) {
+            falha("%s: pagina livre %ld fora do arquivo ou na arvore", etapa, offset);
+            return -1;
+        }
+        Pagina *pagina = ler_pagina(bd, offset);
+        long proxima = pagina->proxima_folha;
+        bool marcada = pagina->num_chaves == -1;
+        liberar_pagina(bd, pagina);
+        if (!marcada) {
+            falha("%s: pagina livre %ld sem a marca de livre", etapa, offset);
+            return -1;
+        }
+        na_arvore[offset / TAM_PAGINA] = 1;   // Um ciclo na lista cai no teste acima
+        offset = proxima;
+    }
+    if (livres != bd->cabecalho.num_paginas_livres) {
+        falha("%s: %d paginas na lista, cabecalho diz %d", etapa, livres, bd->cabecalho.num_paginas_livres);
+    }
+    long blocos = bd->cabecalho.proximo_offset / TAM_PAGINA - 1;   // O primeiro é o cabeçalho
+    if (paginas_arvore + livres != blocos) {
+        falha("%s: %d paginas na arvore e %d livres em %ld blocos", etapa, paginas_arvore, livres, blocos);
+    }
+    return livres;
+}
+
+static void testar(bool folhas_encadeadas) {
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = 4;
+    opcoes.folhas_encadeadas = folhas_encadeadas;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    gravar_registros(bd, registros, NUM_REGISTROS);
+    const char *modo = folhas_encadeadas ? "B+" : "B";
+
+    for (long id = 0; id < NUM_IDS; id++) {
+        Chave chave;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        inserir(bd, &chave);
+        alterar_referencias(bd, chave.offset_dados, +1);
+        registrar_operacao(bd);
+    }
+    confirmar(bd);
+    long tamanho_cheio = bd->cabecalho.proximo_offset;
+    if (conferir_livres(bd, modo) != 0) falha("%s: paginas livres sem remocoes", modo);
+
+    // Sobram só as chaves de id múltiplo de 5
+    for (long id = 0; id < NUM_IDS; id++) {
+        if (id % 5 == 0) continue;
+        Chave chave;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        if (!remover(bd, &chave)) falha("%s: remover %ld", modo, id);
+        registrar_operacao(bd);
+    }
+    confirmar(bd);
+    int livres = conferir_livres(bd, modo);
+    if (livres <= 0) falha("%s: nenhuma pagina livre depois das remocoes", modo);
+    if (bd->cabecalho.proximo_offset != tamanho_cheio) falha("%s: indice cresceu nas remocoes", modo);
+    long primeira = bd->cabecalho.primeira_livre;
+    finalizar_banco(bd);
+
+    bd = inicializar_banco(&opcoes);
+    if (bd->cabecalho.primeira_livre != primeira || conferir_livres(bd, modo) != livres) {
+        falha("%s: lista livre diferente depois de reabrir", modo);
+    }
+
+    // Reinserções: o arquivo só cresce depois de esvaziar a lista
+    int crescimentos_com_lista = 0;
+    for (long id = 0; id < NUM_IDS; id++) {
+        if (id % 5 == 0) continue;
+        long tamanho = bd->cabecalho.proximo_offset;
+        Chave chave;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        inserir(bd, &chave);
+        alterar_referencias(bd, chave.offset_dados, +1);
+        registrar_operacao(bd);
+        if (bd->cabecalho.proximo_offset > tamanho && bd->cabecalho.num_paginas_livres > 0) {
+            crescimentos_com_lista++;
+        }
+    }
+    confirmar(bd);
+    if (crescimentos_com_lista > 0) {
+        falha("%s: indice cresceu %d vezes com paginas livres", modo, crescimentos_com_lista);
+    }
+    if (conferir_livres(bd, modo) < 0 || contar_chaves(bd) != NUM_IDS) falha("%s: indice depois de reinserir", modo);
+    printf("%s: %d paginas livres reaproveitadas, indice de %ld para %ld bytes\n", modo, livres,
+           tamanho_cheio, bd->cabecalho.proximo_offset);
+    finalizar_banco(bd);
+}
+
+int main(void) {
+    testar(false);
+    testar(true);
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,168 @@
+/*
+ * ============================================================================
+ * Teste do modo em lote (--batch)
+ * Executa um arquivo de comandos com a saída padrão desviada para um arquivo
+ * e confere, linha a linha, o status de cada resultado (OK, EXISTS,
+ * NOT_FOUND, ERROR com o número da linha do comando) e a linha DONE com o
+ * total de comandos e de erros, que executar_lote também devolve
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#ifdef _WIN32
+#define dup _dup
+#define dup2 _dup2
+#define close _close
+#define fileno _fileno
+#endif
+
+#define ARQUIVO_COMANDOS "lote.txt"
+#define ARQUIVO_SAIDA "lote_saida.txt"
+#define MAX_SAIDAS 4
+#define TAM_LINHA 4096
+
+/**
+ * Um comando do lote e o começo de cada linha que ele deve produzir
+ * "ERROR" é completado com o número da linha do comando
+ */
+typedef struct {
+    const char *comando;
+    const char *saidas[MAX_SAIDAS];
+} Passo;
+
+static const Passo passos[] = {
+    // Limiares novos saem depois dos erros; o repetido sai como EXISTS
+    {"INSERT a.pgm 10 20 20 300", {"ERROR", "OK\tINSERT\ta.pgm\t10\t", "OK\tINSERT\ta.pgm\t20\t",
+                                   "EXISTS\tINSERT\ta.pgm\t20\t"}},
+    {"INSERT a.pgm 10", {"EXISTS\tINSERT\ta.pgm\t10\t"}},
+    {"INSERT ausente.pgm 5", {"ERROR"}},
+    {"INSERT b.pgm", {"ERROR"}},
+    {"INSERT b.pgm 0 255", {"OK\tINSERT\tb.pgm\t0\t", "OK\tINSERT\tb.pgm\t255\t"}},
+    {"SEARCH a.pgm 10", {"OK\tSEARCH\ta.pgm\t10\t"}},
+    {"SEARCH a.pgm 30", {"NOT_FOUND\tSEARCH\ta.pgm\t30\n"}},
+    {"SEARCH c.pgm 10", {"NOT_FOUND\tSEARCH\tc.pgm\t10\n"}},
+    {"SEARCH a.pgm -1", {"ERROR"}},
+    {"RANGE a.pgm", {"OK\tRANGE\ta.pgm\t10\t", "OK\tRANGE\ta.pgm\t20\t"}},
+    {"RANGE a.pgm 15 255", {"OK\tRANGE\ta.pgm\t20\t"}},
+    {"RANGE a.pgm 30 40", {"NOT_FOUND\tRANGE\ta.pgm\t30\t40\n"}},
+    {"RANGE a.pgm 30 10", {"ERROR"}},
+    {"PREFIX b", {"OK\tPREFIX\tb.pgm\t0\t", "OK\tPREFIX\tb.pgm\t255\t"}},
+    {"PREFIX zz", {"NOT_FOUND\tPREFIX\tzz\n"}},
+    {"DELETE a.pgm 10", {"OK\tDELETE\ta.pgm\t10\n"}},
+    {"DELETE a.pgm 10", {"NOT_FOUND\tDELETE\ta.pgm\t10\n"}},
+    {"EXPORT a.pgm 20 exportada.pgm P2", {"OK\tEXPORT\ta.pgm\t20\texportada.pgm\n"}},
+    {"EXPORT a.pgm 10 exportada.pgm", {"NOT_FOUND\tEXPORT\ta.pgm\t10\n"}},
+    {"EXPORT a.pgm 20 exportada.pgm P7", {"ERROR"}},
+    {"COMPACT", {"OK\tCOMPACT\t"}},
+    {"COMPACT AGORA", {"ERROR"}},
+    {"SEARCH a.pgm 20", {"OK\tSEARCH\ta.pgm\t20\t"}},
+    {"STATS", {"OK\tSTATS\t{"}},
+    {"REMOVER a.pgm 20", {"ERROR"}},
+};
+
+#define NUM_PASSOS ((int)(sizeof(passos) / sizeof(passos[0])))
+#define LINHAS_INICIAIS 2                // Comentário e linha vazia, ignorados
+
+/**
+ * Executa o lote com a saída padrão desviada para ARQUIVO_SAIDA
+ */
+static int executar_desviado(BancoDados *bd, const char *caminho) {
+    fflush(stdout);
+    int salvo = dup(fileno(stdout));
+    if (salvo < 0 || !freopen(ARQUIVO_SAIDA, "w", stdout)) {
+        falha("nao foi possivel desviar a saida padrao");
+        exit(terminar_teste());
+    }
+    int num_erros = executar_lote(bd, caminho);
+    fflush(stdout);
+    dup2(salvo, fileno(stdout));
+    close(salvo);
+    clearerr(stdout);
+    return num_erros;
+}
+
+/**
+ * Grava a.pgm (P5) e b.pgm (P2), as imagens que o lote insere
+ */
+static void gravar_entradas(void) {
+    RegistroImagem img;
+    gerar_imagem(&img, 17, 9, 5);
+    exportar_pgm(&img, "a.pgm", false);
+    liberar_imagem(&img);
+    gerar_imagem(&img, 6, 11, 9);
+    exportar_pgm(&img, "b.pgm", true);
+    liberar_imagem(&img);
+}
+
+int main(void) {
+    gravar_entradas();
+    FILE *comandos = fopen(ARQUIVO_COMANDOS, "w");
+    fprintf(comandos, "# comandos do teste\n\n");
+    int esperados_erros = 0;
+    for (int i = 0; i < NUM_PASSOS; i++) {
+        fprintf(comandos, "%s\n", passos[i].comando);
+        for (int s = 0; s < MAX_SAIDAS && passos[i].saidas[s]; s++) {
+            if (strcmp(passos[i].saidas[s], "ERROR") == 0) {
+                esperados_erros++;
+                break;
+            }
+        }
+    }
+    fclose(comandos);
+
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    if (executar_desviado(bd, "inexistente.txt") != -1) falha("lote inexistente aceito");
+    int num_erros = executar_desviado(bd, ARQUIVO_COMANDOS);
+    if (num_erros != esperados_erros) falha("%d erros devolvidos, esperados %d", num_erros, esperados_erros);
+
+    FILE *saida = fopen(ARQUIVO_SAIDA, "r");
+    char linha[TAM_LINHA];
+    for (int i = 0; i < NUM_PASSOS && !falhou; i++) {
+        for (int s = 0; s < MAX_SAIDAS && passos[i].saidas[s] && !falhou; s++) {
+            char esperada[TAM_LINHA];
+            if (strcmp(passos[i].saidas[s], "ERROR") == 0) {
+                snprintf(esperada, sizeof(esperada), "ERROR\t%d\t", LINHAS_INICIAIS + i + 1);
+            } else {
+                snprintf(esperada, sizeof(esperada), "%s", passos[i].saidas[s]);
+            }
+            if (!fgets(linha, sizeof(linha), saida)) {
+                falha("\"%s\": saida terminou antes de \"%s\"", passos[i].comando, esperada);
+            } else if (strncmp(linha, esperada, strlen(esperada)) != 0) {
+                falha("\"%s\": linha \"%s\", esperada \"%s\"", passos[i].comando,
+                      strtok(linha, "\n"), esperada);
+            }
+        }
+    }
+    char done[64];
+    snprintf(done, sizeof(done), "DONE\t%d\t%d\t", NUM_PASSOS, esperados_erros);
+    if (!falhou && (!fgets(linha, sizeof(linha), saida) || strncmp(linha, done, strlen(done)) != 0)) {
+        falha("linha DONE diferente de \"%s\"", done);
+    }
+    if (!falhou && fgets(linha, sizeof(linha), saida)) falha("linha a mais: %s", linha);
+    fclose(saida);
+    printf("%d comandos, %d erros\n", NUM_PASSOS, num_erros);
+
+    // O que o lote confirmou continua lá depois de reabrir
+    finalizar_banco(bd);
+    bd = inicializar_banco(&opcoes);
+    if (!bd || contar_chaves(bd) != 3) falha("chaves depois de reabrir");
+    RegistroImagem exportada;
+    if (!ler_pgm("exportada.pgm", &exportada)) {
+        falha("exportada.pgm ilegivel");
+    } else {
+        if (exportada.largura != 17 || exportada.altura != 9) falha("exportada.pgm com outro tamanho");
+        liberar_imagem(&exportada);
+    }
+    if (bd) finalizar_banco(bd);
+
+    remove(ARQUIVO_COMANDOS);
+    remove(ARQUIVO_SAIDA);
+    remove("a.pgm");
+    remove("b.pgm");
+    remove("exportada.pgm");
+    apagar_banco();
+    return terminar_teste();
+}
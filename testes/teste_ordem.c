@@ -0,0 +1,108 @@
+/*
+ * ============================================================================
+ * Teste da ordem configurável e do tamanho das páginas
+ * Para várias ordens (da mínima à padrão, limitada só pelos bytes da página
+ * de 4 KiB) aplica inserções e remoções aleatórias e confere os invariantes
+ * da árvore: nenhuma página passa do máximo de chaves nem de bytes, nenhuma
+ * (fora a raiz) fica abaixo do mínimo e todas as folhas têm a mesma
+ * profundidade. Confere também que a ordem de um índice existente prevalece
+ * sobre a pedida e que um cabeçalho com ordem fora dos limites é recusado
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_IDS 4000
+#define NUM_PASSOS (2 * NUM_IDS)
+#define NUM_REGISTROS 4
+#define PASSOS_POR_CONFERENCIA 500
+
+static long long registros[NUM_REGISTROS];
+
+static void testar_ordem(int ordem) {
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = ordem;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    int esperada = ordem > 0 ? ordem : ORDEM_MAXIMA;
+    if (bd->cabecalho.ordem != esperada) falha("ordem %d em vez de %d", bd->cabecalho.ordem, esperada);
+    gravar_registros(bd, registros, NUM_REGISTROS);
+
+    char *presente = calloc(NUM_IDS, 1);
+    long vivas = 0;
+    for (long passo = 1; passo <= NUM_PASSOS && !falhou; passo++) {
+        long id = (long)(aleatorio() % NUM_IDS);
+        Chave chave;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        if (aleatorio() % 3 != 0) {
+            if (!presente[id]) {
+                inserir(bd, &chave);
+                alterar_referencias(bd, chave.offset_dados, +1);
+                presente[id] = 1;
+                vivas++;
+            }
+        } else if (presente[id]) {
+            if (!remover(bd, &chave)) falha("ordem %d: remover nao achou %ld", esperada, id);
+            presente[id] = 0;
+            vivas--;
+        }
+        registrar_operacao(bd);
+        if (passo % PASSOS_POR_CONFERENCIA == 0 && conferir_arvore(bd) != vivas) {
+            falha("ordem %d: arvore invalida no passo %ld", esperada, passo);
+        }
+    }
+    printf("ordem %d: %ld chaves, altura %d, %d paginas\n", esperada, vivas,
+           bd->cabecalho.altura, bd->cabecalho.num_paginas);
+    finalizar_banco(bd);
+
+    // O índice existente mantém a sua ordem
+    opcoes.ordem = esperada == ORDEM_MINIMA ? ORDEM_MINIMA + 1 : ORDEM_MINIMA;
+    bd = inicializar_banco(&opcoes);
+    if (!bd || bd->cabecalho.ordem != esperada) {
+        falha("ordem %d trocada na reabertura", esperada);
+    } else if (conferir_arvore(bd) != vivas) {
+        falha("ordem %d: arvore invalida depois de reabrir", esperada);
+    }
+    if (bd) finalizar_banco(bd);
+    free(presente);
+}
+
+/**
+ * Um cabeçalho com ordem fora de ORDEM_MINIMA..ORDEM_MAXIMA não abre
+ */
+static void testar_cabecalho_invalido(int ordem) {
+    FILE *arquivo = fopen(ARQUIVO_INDICE, "r+b");
+    CabecalhoIndice cab;
+    if (!arquivo || !ler_cabecalho(arquivo, &cab)) {
+        falha("cabecalho ilegivel");
+        if (arquivo) fclose(arquivo);
+        return;
+    }
+    int original = cab.ordem;
+    cab.ordem = ordem;
+    escrever_cabecalho(arquivo, &cab);
+    fclose(arquivo);
+
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = inicializar_banco(&opcoes);
+    if (bd) {
+        falha("indice com ordem %d aberto", ordem);
+        finalizar_banco(bd);
+    }
+
+    arquivo = fopen(ARQUIVO_INDICE, "r+b");
+    cab.ordem = original;
+    escrever_cabecalho(arquivo, &cab);
+    fclose(arquivo);
+}
+
+int main(void) {
+    int ordens[] = {ORDEM_MINIMA, 4, 16, 0};
+    for (size_t i = 0; i < sizeof(ordens) / sizeof(ordens[0]); i++) {
+        testar_ordem(ordens[i]);
+    }
+    testar_cabecalho_invalido(ORDEM_MINIMA - 1);
+    testar_cabecalho_invalido(ORDEM_MAXIMA + 1);
+    apagar_banco();
+    return terminar_teste();
+}
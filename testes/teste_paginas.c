@@ -0,0 +1,194 @@
+/*
+ * ============================================================================
+ * Teste das páginas com slots e chaves comprimidas por prefixo
+ * Com a ordem padrão (limitada pelos bytes), insere em ordem aleatória
+ * chaves densas (todos os limiares de vários nomes, que diferem só no último
+ * byte) e esparsas (ids que mudam em vários bytes), remove metade e confere a
+ * árvore ao longo das divisões e fusões, depois da reabertura e da carga em
+ * massa. Cada página percorrida volta igual de serializar_pagina e
+ * desserializar_pagina e ocupa exatamente os bytes das células comprimidas;
+ * depois da carga, as folhas densas passam de 300 chaves
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_NOMES_DENSOS 240             // Todos os 256 limiares
+#define NUM_NOMES 900                    // Ids além de 255: prefixos de tamanhos variados
+#define NUM_CHAVES (NUM_NOMES_DENSOS * 256 + NUM_NOMES - NUM_NOMES_DENSOS)
+#define NUM_REGISTROS 4
+#define CHAVES_POR_CONFERENCIA 10000
+#define MIN_CHAVES_FOLHA_DENSA 300
+
+static long long registros[NUM_REGISTROS];
+
+typedef struct {
+    int paginas;
+    int folhas_densas;                   // Folhas com mais de MIN_CHAVES_FOLHA_DENSA chaves
+} ResumoPaginas;
+
+/**
+ * Bytes de slots e células calculados byte a byte, sem prefixo_comum
+ */
+static int bytes_esperados(const Pagina *pagina) {
+    int total = 0;
+    for (int i = 0; i < pagina->num_chaves; i++) {
+        int prefixo = 0;
+        if (i > 0) {
+            unsigned long long a = valor_chave(&pagina->chaves[i]), b = valor_chave(&pagina->chaves[i - 1]);
+            while (prefixo < TAM_VALOR_CHAVE &&
+                   ((a >> (56 - 8 * prefixo)) & 0xFF) == ((b >> (56 - 8 * prefixo)) & 0xFF)) {
+                prefixo++;
+            }
+        }
+        total += (int)sizeof(SlotPagina) + 1 + (TAM_VALOR_CHAVE - prefixo) + (int)sizeof(long long) +
+                 (pagina->eh_folha ? 0 : (int)sizeof(long));
+    }
+    return total;
+}
+
+/**
+ * Serializa a página, confere os bytes ocupados e desserializa em outra
+ */
+static void conferir_serializacao(BancoDados *bd, const Pagina *pagina) {
+    unsigned char buffer[TAM_PAGINA];
+    serializar_pagina(pagina, buffer);
+    CabecalhoPagina cab;
+    memcpy(&cab, buffer, sizeof(CabecalhoPagina));
+    int ocupados = TAM_PAGINA - cab.inicio_celulas + pagina->num_chaves * (int)sizeof(SlotPagina);
+    if (ocupados != bytes_esperados(pagina)) {
+        falha("pagina %ld ocupa %d bytes, esperados %d", pagina->offset_proprio, ocupados,
+              bytes_esperados(pagina));
+    }
+
+    Pagina *copia = alocar_memoria_pagina(bd->cabecalho.ordem);
+    desserializar_pagina(buffer, bd->cabecalho.ordem, copia);
+    bool igual = copia->num_chaves == pagina->num_chaves && copia->eh_folha == pagina->eh_folha &&
+                 copia->offset_proprio == pagina->offset_proprio;
+    for (int i = 0; igual && i < pagina->num_chaves; i++) {
+        igual = comparar_chaves(&copia->chaves[i], &pagina->chaves[i]) == 0 &&
+                copia->chaves[i].offset_dados == pagina->chaves[i].offset_dados;
+    }
+    if (igual && pagina->eh_folha) {
+        igual = copia->proxima_folha == pagina->proxima_folha;
+    }
+    for (int i = 0; igual && !pagina->eh_folha && i <= pagina->num_chaves; i++) {
+        igual = copia->filhos[i] == pagina->filhos[i];
+    }
+    if (!igual) falha("pagina %ld muda na ida e volta da serializacao", pagina->offset_proprio);
+    free(copia);
+}
+
+static void percorrer_paginas(BancoDados *bd, long offset, ResumoPaginas *resumo) {
+    Pagina *pagina = ler_pagina(bd, offset);
+    conferir_serializacao(bd, pagina);
+    resumo->paginas++;
+    if (pagina->eh_folha && pagina->num_chaves > MIN_CHAVES_FOLHA_DENSA) resumo->folhas_densas++;
+    for (int i = 0; !pagina->eh_folha && i <= pagina->num_chaves; i++) {
+        percorrer_paginas(bd, pagina->filhos[i], resumo);
+    }
+    liberar_pagina(bd, pagina);
+}
+
+static ResumoPaginas conferir_paginas(BancoDados *bd, long vivas, const char *etapa) {
+    ResumoPaginas resumo = {0, 0};
+    if (conferir_arvore(bd) != vivas) falha("%s: arvore invalida", etapa);
+    percorrer_paginas(bd, bd->cabecalho.offset_raiz, &resumo);
+    printf("%s: %ld chaves, altura %d, %d paginas, %d folhas com mais de %d chaves\n", etapa, vivas,
+           bd->cabecalho.altura, resumo.paginas, resumo.folhas_densas, MIN_CHAVES_FOLHA_DENSA);
+    return resumo;
+}
+
+/**
+ * Chave de número n: as primeiras são densas, as demais uma por nome
+ */
+static void chave_numero(BancoDados *bd, long n, Chave *chave) {
+    if (n < NUM_NOMES_DENSOS * 256) {
+        chave_de(bd, (int)(n / 256), (int)(n % 256), chave);
+    } else {
+        chave_de(bd, (int)(n - NUM_NOMES_DENSOS * 256 + NUM_NOMES_DENSOS), 7, chave);
+    }
+    chave->offset_dados = registros[n % NUM_REGISTROS];
+}
+
+static void testar(bool folhas_encadeadas) {
+    OpcoesBanco opcoes = {0};
+    opcoes.folhas_encadeadas = folhas_encadeadas;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    gravar_registros(bd, registros, NUM_REGISTROS);
+    const char *modo = folhas_encadeadas ? "B+" : "B";
+
+    // Nomes cadastrados em ordem: o id é o número da imagem
+    for (int i = 0; i < NUM_NOMES; i++) {
+        Chave chave;
+        chave_de(bd, i, 0, &chave);
+    }
+
+    long *ordem = malloc(NUM_CHAVES * sizeof(long));
+    for (long i = 0; i < NUM_CHAVES; i++) ordem[i] = i;
+    for (long i = NUM_CHAVES - 1; i > 0; i--) {
+        long j = (long)(aleatorio() % (unsigned long)(i + 1));
+        long t = ordem[i];
+        ordem[i] = ordem[j];
+        ordem[j] = t;
+    }
+    for (long i = 0; i < NUM_CHAVES; i++) {
+        Chave chave;
+        chave_numero(bd, ordem[i], &chave);
+        inserir(bd, &chave);
+        alterar_referencias(bd, chave.offset_dados, +1);
+        registrar_operacao(bd);
+        if ((i + 1) % CHAVES_POR_CONFERENCIA == 0 && conferir_arvore(bd) != i + 1) {
+            falha("%s: arvore invalida depois de %ld insercoes", modo, i + 1);
+        }
+    }
+    char etapa[64];
+    snprintf(etapa, sizeof(etapa), "%s inserido", modo);
+    conferir_paginas(bd, NUM_CHAVES, etapa);
+
+    // Metade removida, também em ordem aleatória: fusões e empréstimos
+    long vivas = NUM_CHAVES;
+    for (long i = 0; i < NUM_CHAVES / 2; i++) {
+        Chave chave;
+        chave_numero(bd, ordem[i], &chave);
+        if (!remover(bd, &chave)) falha("%s: remover %ld", modo, ordem[i]);
+        vivas--;
+        registrar_operacao(bd);
+        if ((i + 1) % CHAVES_POR_CONFERENCIA == 0 && conferir_arvore(bd) != vivas) {
+            falha("%s: arvore invalida depois de %ld remocoes", modo, i + 1);
+        }
+    }
+    free(ordem);
+    finalizar_banco(bd);
+
+    bd = inicializar_banco(&opcoes);
+    snprintf(etapa, sizeof(etapa), "%s reaberto", modo);
+    conferir_paginas(bd, vivas, etapa);
+
+    // Reinserida a metade densa que faltava, a carga em massa enche as folhas
+    for (long n = 0; n < NUM_NOMES_DENSOS * 256; n++) {
+        Chave chave, achada;
+        chave_numero(bd, n, &chave);
+        if (!buscar(bd, &chave, &achada)) {
+            inserir(bd, &chave);
+            alterar_referencias(bd, chave.offset_dados, +1);
+            registrar_operacao(bd);
+            vivas++;
+        }
+    }
+    if (compactar_banco(bd) != vivas) falha("%s: compactar_banco", modo);
+    snprintf(etapa, sizeof(etapa), "%s compactado", modo);
+    ResumoPaginas resumo = conferir_paginas(bd, vivas, etapa);
+    if (resumo.folhas_densas < NUM_NOMES_DENSOS * 256 / (MIN_CHAVES_FOLHA_DENSA + 40)) {
+        falha("%s: so %d folhas densas depois da carga", modo, resumo.folhas_densas);
+    }
+    finalizar_banco(bd);
+}
+
+int main(void) {
+    testar(false);
+    testar(true);
+    apagar_banco();
+    return terminar_teste();
+}
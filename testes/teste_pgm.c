@@ -0,0 +1,82 @@
+/*
+ * ============================================================================
+ * Teste da leitura de arquivos PGM (ler_pgm)
+ * Grava arquivos P2 e P5 pequenos e confere que os válidos (com comentários
+ * e qualquer espaço em branco como separador) são lidos com os pixels certos
+ * e que os inválidos são recusados: pixels acima do valor máximo, valor
+ * máximo fora de 1 a 255, falta do separador depois dele, pixels faltando,
+ * dimensões que estouram e formatos não suportados
+ * Não usa o banco
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define ARQUIVO_PGM "teste.pgm"
+
+typedef struct {
+    const char *descricao;
+    const char *conteudo;
+    size_t tamanho;                      // Os P5 têm bytes nulos no meio
+    bool valido;
+    int largura, altura, max_valor;
+    const char *pixels;
+} CasoPgm;
+
+#define TEXTO(s) s, sizeof(s) - 1
+
+static const CasoPgm casos[] = {
+    {"P2 com comentarios", TEXTO("P2\n# comentario\n3 2\n# outro\n255\n0 1 2\n3 4 255\n"), true,
+     3, 2, 255, "\x00\x01\x02\x03\x04\xFF"},
+    {"P2 com \\v, \\f, \\t e \\r", TEXTO("P2\v3\f1\t9\r1\v2\f9"), true, 3, 1, 9, "\x01\x02\x09"},
+    {"P5 com comentario entre campos", TEXTO("P5\n3 #x\n 1 255\n\x00\xFF\x80"), true, 3, 1, 255,
+     "\x00\xFF\x80"},
+    {"P5 com maxval 100", TEXTO("P5 2 2 100\n\x00\x64\x32\x01"), true, 2, 2, 100, "\x00\x64\x32\x01"},
+    {"P5 com \\v depois do maxval", TEXTO("P5 1 1 255\v\x0A"), true, 1, 1, 255, "\x0A"},
+    {"P5 com pixel acima do maxval", TEXTO("P5 2 2 100\n\x00\x65\x32\x01"), false, 0, 0, 0, NULL},
+    {"P2 com pixel acima do maxval", TEXTO("P2 2 1 9\n9 10\n"), false, 0, 0, 0, NULL},
+    {"P5 sem separador depois do maxval", TEXTO("P5 2 1 255AB"), false, 0, 0, 0, NULL},
+    {"P2 sem separador depois do maxval", TEXTO("P2 1 1 9#\n1\n"), false, 0, 0, 0, NULL},
+    {"P5 truncado", TEXTO("P5 4 4 255\n0123456789"), false, 0, 0, 0, NULL},
+    {"P5 sem pixels", TEXTO("P5 1 1 255"), false, 0, 0, 0, NULL},
+    {"P2 truncado", TEXTO("P2 3 1 255\n1 2"), false, 0, 0, 0, NULL},
+    {"P2 com pixel nao numerico", TEXTO("P2 2 1 255\n1 x\n"), false, 0, 0, 0, NULL},
+    {"maxval 0", TEXTO("P5 1 1 0\n\x00"), false, 0, 0, 0, NULL},
+    {"maxval 256", TEXTO("P5 1 1 256\n\x00\x00"), false, 0, 0, 0, NULL},
+    {"maxval 65535", TEXTO("P2 1 1 65535\n7\n"), false, 0, 0, 0, NULL},
+    {"largura 0", TEXTO("P5 0 1 255\n"), false, 0, 0, 0, NULL},
+    {"largura negativa", TEXTO("P2 -3 1 255\n1 2 3\n"), false, 0, 0, 0, NULL},
+    {"pixels estouram int", TEXTO("P5 99999 99999 255\n"), false, 0, 0, 0, NULL},
+    {"largura estoura int", TEXTO("P2 99999999999 1 255\n1\n"), false, 0, 0, 0, NULL},
+    {"cabecalho incompleto", TEXTO("P5 3 3"), false, 0, 0, 0, NULL},
+    {"formato P3", TEXTO("P3 1 1 255\n1 2 3\n"), false, 0, 0, 0, NULL},
+    {"so a assinatura", TEXTO("P5"), false, 0, 0, 0, NULL},
+    {"vazio", TEXTO(""), false, 0, 0, 0, NULL},
+};
+
+int main(void) {
+    int aceitos = 0;
+    for (size_t c = 0; c < sizeof(casos) / sizeof(casos[0]); c++) {
+        FILE *arquivo = fopen(ARQUIVO_PGM, "wb");
+        fwrite(casos[c].conteudo, 1, casos[c].tamanho, arquivo);
+        fclose(arquivo);
+
+        RegistroImagem img;
+        bool lido = ler_pgm(ARQUIVO_PGM, &img);
+        if (lido != casos[c].valido) {
+            falha("%s: %s", casos[c].descricao, lido ? "aceito" : "recusado");
+        } else if (lido) {
+            aceitos++;
+            if (img.largura != casos[c].largura || img.altura != casos[c].altura ||
+                img.max_valor != casos[c].max_valor ||
+                memcmp(img.dados, casos[c].pixels, (size_t)img.largura * img.altura) != 0) {
+                falha("%s: lido %dx%d (max %d) com outros pixels", casos[c].descricao,
+                      img.largura, img.altura, img.max_valor);
+            }
+        }
+        if (lido) liberar_imagem(&img);
+    }
+    printf("%zu arquivos, %d aceitos\n", sizeof(casos) / sizeof(casos[0]), aceitos);
+    remove(ARQUIVO_PGM);
+    return terminar_teste();
+}
@@ -0,0 +1,77 @@
+/*
+ * ============================================================================
+ * Teste da consulta por prefixo (PREFIX) contra o percurso completo
+ * Cadastra nomes fora da ordem alfabética (ids não consecutivos entre nomes
+ * vizinhos), tenta inserir limiares fora de 0 a 255 (recusados) e confere,
+ * para cada prefixo, que imprimir_prefixo acha exatamente as chaves que o
+ * percurso completo acha com esse prefixo, com e sem folhas encadeadas
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_NOMES 6
+#define NUM_LIMIARES 3
+
+static const char *nomes[NUM_NOMES] = {
+    "img_b1.pgm", "img_a2.pgm", "img_ab1.pgm", "img_a1.pgm", "img_b0.pgm", "img_ab0.pgm"
+};
+static const int limiares[NUM_LIMIARES] = {0, 128, 255};
+static const char *prefixos[] = {"img_a", "img_ab", "img_b1", "x"};
+
+/**
+ * Chaves do percurso completo cujo nome começa com o prefixo
+ */
+static int contar_com_prefixo(BancoDados *bd, const char *prefixo) {
+    Cursor cursor;
+    Chave chave;
+    int n = 0;
+    cursor_abrir_tudo(bd, &cursor);
+    while (cursor_proximo(&cursor, &chave)) {
+        if (strncmp(nome_do_id(bd, chave.id_nome), prefixo, strlen(prefixo)) == 0) n++;
+    }
+    return n;
+}
+
+static void testar(bool folhas_encadeadas) {
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = ORDEM_MINIMA;         // Várias páginas mesmo com poucas chaves
+    opcoes.folhas_encadeadas = folhas_encadeadas;
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+
+    RegistroImagem img;
+    gerar_imagem(&img, 8, 4, 1);
+    int fora[2] = {-1, 256};
+    for (int i = 0; i < NUM_NOMES; i++) {
+        if (!inserir_limiares(bd, &img, nomes[i], limiares, NUM_LIMIARES, NULL)) {
+            falha("inserir_limiares recusou limiares validos (%s)", nomes[i]);
+        }
+        if (inserir_limiares(bd, &img, nomes[i], fora, 2, NULL)) {
+            falha("inserir_limiares aceitou limiar fora de 0-255 (%s)", nomes[i]);
+        }
+        Chave chave = {obter_id_nome(bd, nomes[i]), 1000, 0};
+        if (inserir(bd, &chave)) falha("inserir aceitou limiar 1000");
+    }
+    liberar_imagem(&img);
+    if (contar_chaves(bd) != NUM_NOMES * NUM_LIMIARES) {
+        falha("percurso completo com %ld chaves", contar_chaves(bd));
+    }
+
+    for (size_t p = 0; p < sizeof(prefixos) / sizeof(prefixos[0]); p++) {
+        int esperadas = contar_com_prefixo(bd, prefixos[p]);
+        int achadas = imprimir_prefixo(bd, prefixos[p], NULL);
+        printf("%s prefixo \"%s\": %d chaves\n", folhas_encadeadas ? "B+" : "B", prefixos[p], achadas);
+        if (achadas != esperadas) {
+            falha("prefixo \"%s\": %d chaves, percurso completo %d", prefixos[p], achadas, esperadas);
+        }
+    }
+    finalizar_banco(bd);
+}
+
+int main(void) {
+    testar(false);
+    testar(true);
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,264 @@
+/*
+ * ============================================================================
+ * Teste de queda do processo com o log de escrita antecipada (--wal) ou com
+ * páginas sombra (--sombra)
+ * Um processo filho aplica uma carga determinística de inserções e remoções,
+ * anotando quantas operações já foram confirmadas, e é morto com SIGKILL em
+ * um instante aleatório. O pai reabre o banco (refazendo o log, com --wal) e
+ * confere que o índice tem exatamente as chaves do último commit anotado, ou do
+ * commit seguinte, que pode ter chegado ao disco antes da anotação
+ * Antes das rodadas, um grupo de commit com uma remoção seguida de uma
+ * inserção é interrompido: o registro da chave removida não pode ter sido
+ * reaproveitado pela inserção, porque o índice recuperado ainda aponta para ele
+ * Só POSIX (fork/kill); roda em um diretório de trabalho separado
+ * Uso: teste_queda [rodadas] [--sombra]
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+#define NUM_IDS 6000                     // Chaves possíveis da carga
+#define NUM_REGISTROS 8                  // Imagens reais apontadas pelas chaves
+#define OPS_POR_COMMIT 5
+#define SEMENTE_CARGA 99
+#define ARQUIVO_PROGRESSO "progresso"    // Operações já confirmadas pelo filho
+
+static long long registros[NUM_REGISTROS];
+
+/**
+ * Passo da carga: a mesma semente reproduz a mesma sequência no pai e no filho
+ */
+static void proxima_operacao(long *id, bool *insercao) {
+    *id = (long)(aleatorio() % NUM_IDS);
+    *insercao = aleatorio() % 3 != 0;
+}
+
+/**
+ * Quais ids estão presentes depois dos primeiros passos da carga
+ */
+static void simular(long passos, char *presente) {
+    estado_aleatorio = SEMENTE_CARGA;
+    memset(presente, 0, NUM_IDS);
+    for (long passo = 0; passo < passos; passo++) {
+        long id;
+        bool insercao;
+        proxima_operacao(&id, &insercao);
+        presente[id] = insercao;
+    }
+}
+
+/**
+ * Grava as imagens que as chaves vão apontar e fecha o banco
+ */
+static void preparar_banco(const OpcoesBanco *opcoes) {
+    BancoDados *bd = abrir_banco_novo(opcoes);
+    gravar_registros(bd, registros, NUM_REGISTROS);
+    finalizar_banco(bd);
+}
+
+/**
+ * Processo filho: continua a carga a partir do passo inicial até ser morto
+ */
+static void rodar_carga(const OpcoesBanco *opcoes, long inicio) {
+    BancoDados *bd = inicializar_banco(opcoes);
+    if (!bd) _exit(1);
+    estado_aleatorio = SEMENTE_CARGA;
+    for (long passo = 0; passo < inicio; passo++) {
+        long id;
+        bool insercao;
+        proxima_operacao(&id, &insercao);
+    }
+    int progresso = open(ARQUIVO_PROGRESSO, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (long passo = inicio; ; passo++) {
+        long id;
+        bool insercao;
+        proxima_operacao(&id, &insercao);
+        Chave chave, achada;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        if (insercao) {
+            if (!buscar(bd, &chave, &achada)) {
+                inserir(bd, &chave);
+                alterar_referencias(bd, chave.offset_dados, +1);
+            }
+        } else {
+            remover(bd, &chave);
+        }
+        registrar_operacao(bd);
+        if (bd->ops_pendentes == 0) {
+            long confirmados = passo + 1;
+            if (pwrite(progresso, &confirmados, sizeof(long), 0) != sizeof(long)) _exit(1);
+        }
+    }
+}
+
+#define SEMENTE_REMOVIDA 7               // Imagem da chave removida no grupo interrompido
+#define SEMENTE_INSERIDA 11              // Imagem menor, que caberia no buraco dela
+
+/**
+ * Processo filho: remove a chave 0 e insere a chave 1 no mesmo grupo de
+ * commit, leva dados.bin ao disco e morre antes do commit
+ */
+static void interromper_grupo(const OpcoesBanco *opcoes) {
+    BancoDados *bd = inicializar_banco(opcoes);
+    if (!bd) _exit(1);
+    Chave removida, inserida;
+    chave_de(bd, 0, 0, &removida);
+    remover(bd, &removida);
+    registrar_operacao(bd);
+    RegistroImagem img;
+    gerar_imagem(&img, 32, 32, SEMENTE_INSERIDA);
+    chave_de(bd, 1, 0, &inserida);
+    inserida.offset_dados = armazenar_imagem(bd, &img);
+    inserir(bd, &inserida);
+    registrar_operacao(bd);
+    fflush(bd->arquivo_dados);
+    raise(SIGKILL);
+}
+
+/**
+ * Remoção e inserção no mesmo grupo de commit seguidas de queda: depois de
+ * reabrir, a chave removida continua lá e sua imagem está intacta
+ */
+static void testar_grupo_interrompido(const OpcoesBanco *opcoes) {
+    BancoDados *bd = abrir_banco_novo(opcoes);
+    RegistroImagem original;
+    gerar_imagem(&original, 64, 64, SEMENTE_REMOVIDA);
+    Chave chave;
+    chave_de(bd, 0, 0, &chave);
+    chave.offset_dados = armazenar_imagem(bd, &original);
+    inserir(bd, &chave);
+    finalizar_banco(bd);
+
+    pid_t filho = fork();
+    if (filho == 0) {
+        interromper_grupo(opcoes);
+    }
+    waitpid(filho, NULL, 0);
+
+    bd = inicializar_banco(opcoes);
+    if (!bd) {
+        falha("grupo interrompido: banco nao abre");
+        liberar_imagem(&original);
+        return;
+    }
+    Chave achada, inserida;
+    RegistroImagem img;
+    chave_de(bd, 1, 0, &inserida);
+    if (buscar(bd, &inserida, &achada)) {
+        falha("grupo interrompido: insercao sem commit no indice");
+    }
+    if (!buscar(bd, &chave, &achada)) {
+        falha("grupo interrompido: remocao sem commit no indice");
+    } else if (!carregar_imagem_chave(bd, &achada, &img)) {
+        falha("grupo interrompido: imagem da chave removida ilegivel");
+    } else {
+        if (img.largura != original.largura || img.altura != original.altura ||
+            memcmp(img.dados, original.dados, (size_t)img.largura * img.altura) != 0) {
+            falha("grupo interrompido: imagem da chave removida sobrescrita");
+        }
+        liberar_imagem(&img);
+    }
+    printf("grupo interrompido: chave removida %s\n", falhou ? "DIVERGE" : "intacta");
+    finalizar_banco(bd);
+    liberar_imagem(&original);
+}
+
+/**
+ * Confere o índice reaberto contra os dois estados aceitáveis
+ * Retorna o número de passos do estado encontrado, ou -1 se nenhum bate
+ */
+static long conferir_recuperacao(BancoDados *bd, long confirmados, char *esperado, char *seguinte) {
+    simular(confirmados, esperado);
+    simular(confirmados + OPS_POR_COMMIT, seguinte);
+    bool igual_esperado = true, igual_seguinte = true;
+    for (long id = 0; id < NUM_IDS; id++) {
+        Chave chave, achada;
+        chave_do_id(bd, id, registros, NUM_REGISTROS, &chave);
+        bool achou = buscar(bd, &chave, &achada);
+        if (achou && achada.offset_dados != chave.offset_dados) {
+            return -1;
+        }
+        if (achou != (bool)esperado[id]) igual_esperado = false;
+        if (achou != (bool)seguinte[id]) igual_seguinte = false;
+    }
+
+    // O cursor também precisa ver as chaves em ordem, sem repetição
+    long num_esperado = 0;
+    for (long id = 0; id < NUM_IDS; id++) {
+        num_esperado += igual_esperado ? esperado[id] : seguinte[id];
+    }
+    if (contar_chaves(bd) != num_esperado) return -1;
+    if (igual_esperado) return confirmados;
+    if (igual_seguinte) return confirmados + OPS_POR_COMMIT;
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    int rodadas = 20;
+    bool sombra = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sombra") == 0) {
+            sombra = true;
+        } else {
+            rodadas = atoi(argv[i]);
+        }
+    }
+    OpcoesBanco opcoes = {0};
+    opcoes.ordem = 5;                    // Árvore alta: muitas divisões e merges por commit
+    opcoes.capacidade_buffer = 8;        // Quadros sujos descartados antes do commit
+    opcoes.ops_por_commit = OPS_POR_COMMIT;
+    opcoes.paginas_sombra = sombra;      // O commit é a troca da raiz no cabeçalho
+    opcoes.usar_log = !sombra;
+
+    testar_grupo_interrompido(&opcoes);
+    preparar_banco(&opcoes);
+    char *esperado = malloc(NUM_IDS);
+    char *seguinte = malloc(NUM_IDS);
+    long base = 0;                       // Passos já duráveis nas rodadas anteriores
+    srand((unsigned)time(NULL));
+
+    for (int rodada = 0; rodada < rodadas && !falhou; rodada++) {
+        remove(ARQUIVO_PROGRESSO);
+        pid_t filho = fork();
+        if (filho == 0) {
+            rodar_carga(&opcoes, base);
+        }
+        struct timespec espera = {0, (20 + rand() % 200) * 1000000L};
+        nanosleep(&espera, NULL);
+        kill(filho, SIGKILL);
+        waitpid(filho, NULL, 0);
+
+        long confirmados = base;
+        int progresso = open(ARQUIVO_PROGRESSO, O_RDONLY);
+        if (progresso >= 0) {
+            if (pread(progresso, &confirmados, sizeof(long), 0) != sizeof(long)) confirmados = base;
+            close(progresso);
+        }
+
+        metricas.commits_refeitos = 0;
+        BancoDados *bd = inicializar_banco(&opcoes);
+        if (!bd) {
+            falha("rodada %d: banco nao abre depois da queda", rodada);
+            break;
+        }
+        long recuperado = conferir_recuperacao(bd, confirmados, esperado, seguinte);
+        printf("rodada %d%s: %ld passos confirmados, %ld commits refeitos, %s\n", rodada,
+               sombra ? " (sombra)" : "", confirmados, metricas.commits_refeitos,
+               recuperado < 0 ? "DIVERGE" : recuperado == confirmados ? "ultimo commit" : "commit seguinte");
+        if (recuperado < 0) {
+            falha("rodada %d: indice nao bate com nenhum commit", rodada);
+        } else {
+            base = recuperado;
+        }
+        finalizar_banco(bd);
+    }
+
+    free(esperado);
+    free(seguinte);
+    remove(ARQUIVO_PROGRESSO);
+    apagar_banco();
+    return terminar_teste();
+}
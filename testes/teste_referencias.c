@@ -0,0 +1,101 @@
+/*
+ * ============================================================================
+ * Teste das contagens de referência na compactação
+ * Injeta referências que nenhuma chave usa (como as que sobram de uma queda
+ * ou de um passo de compactação incremental sem commit) e confere que a
+ * compactação inteira deixa cada registro com exatamente uma referência por
+ * chave que o aponta
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_IMAGENS 6
+#define LIMIARES_POR_IMAGEM 4
+
+/**
+ * Confere, registro a registro de dados.bin, que o contador é igual ao
+ * número de chaves que apontam para ele; retorna a soma dos contadores
+ */
+static long conferir_contadores(BancoDados *bd, const char *etapa) {
+    MapaRegistros chaves_por_registro;
+    iniciar_mapa(&chaves_por_registro);
+    Cursor cursor;
+    Chave chave;
+    long num_chaves = 0;
+    cursor_abrir_tudo(bd, &cursor);
+    while (cursor_proximo(&cursor, &chave)) {
+        somar_no_mapa(&chaves_por_registro, (unsigned long long)OFFSET_REGISTRO(chave.offset_dados), 1);
+        num_chaves++;
+    }
+
+    long soma = 0, offset = 0;
+    CabecalhoRegistro cab;
+    bool diverge = false;
+    while (ler_cabecalho_registro(bd->arquivo_dados, offset, &cab)) {
+        long esperado = buscar_no_mapa(&chaves_por_registro, (unsigned long long)offset);
+        if (esperado < 0) esperado = 0;
+        if (cab.referencias > 0) soma += cab.referencias;
+        if (cab.referencias > 0 && cab.referencias != esperado) diverge = true;
+        offset += (long)sizeof(CabecalhoRegistro) + cab.tamanho_dados;
+    }
+    destruir_mapa(&chaves_por_registro);
+    printf("%s: %ld chaves, soma das referencias %ld%s\n", etapa, num_chaves, soma,
+           diverge ? " (diverge)" : "");
+    return diverge ? -1 : soma;
+}
+
+int main(void) {
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+
+    // Duas imagens por semente: cada registro é compartilhado por 2 nomes
+    long long offsets[NUM_IMAGENS];
+    for (int i = 0; i < NUM_IMAGENS; i++) {
+        RegistroImagem img;
+        gerar_imagem(&img, 16 + i / 2, 12, i / 2);
+        for (int l = 0; l < LIMIARES_POR_IMAGEM; l++) {
+            Chave chave;
+            chave_de(bd, i, l * 50, &chave);
+            chave.offset_dados = armazenar_imagem(bd, &img);
+            inserir(bd, &chave);
+            if (l == 0) offsets[i] = chave.offset_dados;
+        }
+        liberar_imagem(&img);
+    }
+    confirmar(bd);
+    long vivas = NUM_IMAGENS * LIMIARES_POR_IMAGEM;
+    if (conferir_contadores(bd, "inicial") != vivas) falha("contadores iniciais");
+
+    // Referências vazadas: uma a mais em dois registros, e um registro sem
+    // nenhuma chave que ficou com referência
+    alterar_referencias(bd, offsets[0], +1);
+    alterar_referencias(bd, offsets[4], +2);
+    RegistroImagem orfa;
+    gerar_imagem(&orfa, 16, 12, 99);
+    armazenar_imagem(bd, &orfa);
+    liberar_imagem(&orfa);
+    confirmar(bd);
+    if (conferir_contadores(bd, "com referencias injetadas") != -1) falha("injecao nao apareceu");
+
+    // Remove algumas chaves para a compactação também ter buracos
+    for (int l = 0; l < LIMIARES_POR_IMAGEM; l++) {
+        Chave chave;
+        chave_de(bd, 5, l * 50, &chave);
+        if (!remover(bd, &chave)) falha("remover");
+        vivas--;
+    }
+    confirmar(bd);
+
+    if (compactar_banco(bd) != vivas) falha("compactar_banco");
+    if (conferir_contadores(bd, "depois de compactar") != vivas) falha("contadores depois de compactar");
+
+    // Reaberto, o arquivo compactado continua certo
+    finalizar_banco(bd);
+    bd = inicializar_banco(&opcoes);
+    if (conferir_contadores(bd, "depois de reabrir") != vivas) falha("contadores depois de reabrir");
+    finalizar_banco(bd);
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,339 @@
+/*
+ * ============================================================================
+ * Teste dos registros de imagem em dados.bin
+ * Imagens de tons de cinza aleatórios, de 1x1 até maiores que o antigo limite
+ * de 640x480, ocupam só o cabeçalho mais um byte por pixel e voltam iguais
+ * depois do commit, da reabertura e da compactação. Imagens binárias (0 e 255)
+ * com números de pixels que não são múltiplos de 8 ocupam um bit por pixel e
+ * voltam iguais, inclusive as limiarizadas por inserir_limiares. Cada codec
+ * de CODECS devolve a imagem que codificou, respeita a capacidade dada, a
+ * gravação escolhe o menor, e o RLE recusa entradas corrompidas
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+typedef struct {
+    int largura;
+    int altura;
+} Dimensoes;
+
+static const Dimensoes dimensoes_cinza[] = {
+    {1, 1}, {1, 37}, {64, 64}, {3, 1000}, {640, 480}, {1201, 917}
+};
+
+#define NUM_CINZA ((int)(sizeof(dimensoes_cinza) / sizeof(dimensoes_cinza[0])))
+
+static const Dimensoes dimensoes_binarias[] = {
+    {1, 1}, {7, 1}, {3, 3}, {9, 7}, {13, 29}, {640, 480}, {1001, 999}
+};
+
+#define NUM_BINARIAS ((int)(sizeof(dimensoes_binarias) / sizeof(dimensoes_binarias[0])))
+#define MAX_PIXELS_BITS 70
+#define NUM_LIMIARES 4
+#define PIXELS_RLE 100
+
+/**
+ * Imagem com pixels aleatórios de 0 a 255 (quase certamente não binária)
+ */
+static void gerar_cinza(RegistroImagem *img, int largura, int altura) {
+    alocar_imagem(img, largura, altura);
+    img->max_valor = 255;
+    img->limiar = 0;
+    for (int i = 0; i < largura * altura; i++) {
+        img->dados[i] = (unsigned char)(aleatorio() >> 11);
+    }
+    img->dados[0] = 17;                  // Nem 0 nem 255: nunca binária
+}
+
+/**
+ * Imagem com pixels 0 e 255 aleatórios: ruidosa demais para o RLE
+ */
+static void gerar_binaria(RegistroImagem *img, int largura, int altura) {
+    alocar_imagem(img, largura, altura);
+    img->max_valor = 255;
+    img->limiar = 0;
+    for (int i = 0; i < largura * altura; i++) {
+        img->dados[i] = (aleatorio() >> 17) & 1 ? 255 : 0;
+    }
+}
+
+static long tamanho_dados(BancoDados *bd) {
+    fflush(bd->arquivo_dados);
+    fseek(bd->arquivo_dados, 0, SEEK_END);
+    return ftell(bd->arquivo_dados);
+}
+
+static bool imagens_iguais(const RegistroImagem *a, const RegistroImagem *b) {
+    return a->largura == b->largura && a->altura == b->altura &&
+           memcmp(a->dados, b->dados, (size_t)a->largura * a->altura) == 0;
+}
+
+/**
+ * Busca a chave de cada imagem e confere o registro que ela aponta
+ */
+static void conferir_imagens(BancoDados *bd, RegistroImagem *imagens, int num_imagens, int primeira,
+                             const char *etapa) {
+    for (int i = 0; i < num_imagens; i++) {
+        Chave chave, achada;
+        RegistroImagem lida;
+        chave_de(bd, primeira + i, 0, &chave);
+        if (!buscar(bd, &chave, &achada)) {
+            falha("%s: chave %d ausente", etapa, primeira + i);
+        } else if (!carregar_imagem_chave(bd, &achada, &lida)) {
+            falha("%s: registro da chave %d ilegivel", etapa, primeira + i);
+        } else {
+            if (!imagens_iguais(&imagens[i], &lida)) {
+                falha("%s: imagem %dx%d diferente", etapa, imagens[i].largura, imagens[i].altura);
+            }
+            liberar_imagem(&lida);
+        }
+    }
+}
+
+/**
+ * Registros de tamanho variável: cabeçalho mais largura * altura bytes
+ */
+static void testar_cinza(void) {
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    RegistroImagem imagens[NUM_CINZA];
+    for (int i = 0; i < NUM_CINZA; i++) {
+        gerar_cinza(&imagens[i], dimensoes_cinza[i].largura, dimensoes_cinza[i].altura);
+        long antes = tamanho_dados(bd);
+        Chave chave;
+        chave_de(bd, i, 0, &chave);
+        chave.offset_dados = armazenar_imagem(bd, &imagens[i]);
+        inserir(bd, &chave);
+        registrar_operacao(bd);
+
+        long esperado = (long)sizeof(CabecalhoRegistro) + (long)imagens[i].largura * imagens[i].altura;
+        CabecalhoRegistro cab;
+        if (tamanho_dados(bd) - antes != esperado) {
+            falha("imagem %dx%d ocupou %ld bytes, esperados %ld", imagens[i].largura,
+                  imagens[i].altura, tamanho_dados(bd) - antes, esperado);
+        }
+        if (!ler_cabecalho_registro(bd->arquivo_dados, OFFSET_REGISTRO(chave.offset_dados), &cab) ||
+            cab.codificacao != CODIFICACAO_BYTES || cab.largura != imagens[i].largura ||
+            cab.altura != imagens[i].altura) {
+            falha("cabecalho do registro %dx%d", imagens[i].largura, imagens[i].altura);
+        }
+    }
+    confirmar(bd);
+    conferir_imagens(bd, imagens, NUM_CINZA, 0, "cinza");
+    printf("cinza: %d imagens, dados.bin com %ld bytes\n", NUM_CINZA, tamanho_dados(bd));
+    finalizar_banco(bd);
+
+    bd = inicializar_banco(&opcoes);
+    conferir_imagens(bd, imagens, NUM_CINZA, 0, "cinza reaberto");
+    if (compactar_banco(bd) != NUM_CINZA) falha("cinza: compactar_banco");
+    conferir_imagens(bd, imagens, NUM_CINZA, 0, "cinza compactado");
+    finalizar_banco(bd);
+    for (int i = 0; i < NUM_CINZA; i++) {
+        liberar_imagem(&imagens[i]);
+    }
+}
+
+/**
+ * empacotar_bits e expandir_bits para 1 a MAX_PIXELS_BITS pixels: os bits
+ * que sobram no último byte ficam zerados e a volta reproduz os pixels
+ */
+static void testar_empacotamento(void) {
+    unsigned char pixels[MAX_PIXELS_BITS], expandidos[MAX_PIXELS_BITS];
+    unsigned char bits[(MAX_PIXELS_BITS + 7) / 8];
+    for (int n = 1; n <= MAX_PIXELS_BITS; n++) {
+        for (int i = 0; i < n; i++) {
+            pixels[i] = (aleatorio() >> 17) & 1 ? 255 : 0;
+        }
+        memset(bits, 0xAA, sizeof(bits));
+        empacotar_bits(pixels, bits, n);
+        for (int i = 0; i < n; i++) {
+            if (((bits[i / 8] >> (7 - i % 8)) & 1) != (pixels[i] == 255)) {
+                falha("%d pixels: bit %d errado", n, i);
+            }
+        }
+        if (n % 8 != 0 && (bits[n / 8] & (0xFF >> (n % 8))) != 0) {
+            falha("%d pixels: sobra do ultimo byte nao zerada", n);
+        }
+        memset(expandidos, 0x55, sizeof(expandidos));
+        expandir_bits(bits, expandidos, n);
+        if (memcmp(pixels, expandidos, n) != 0) falha("%d pixels: expansao diferente", n);
+        if (n < MAX_PIXELS_BITS && expandidos[n] != 0x55) falha("%d pixels: expansao passou do fim", n);
+    }
+}
+
+/**
+ * Registros de 1 bit por pixel: (largura * altura + 7) / 8 bytes de dados
+ */
+static void testar_binarias(void) {
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    RegistroImagem imagens[NUM_BINARIAS];
+    for (int i = 0; i < NUM_BINARIAS; i++) {
+        gerar_binaria(&imagens[i], dimensoes_binarias[i].largura, dimensoes_binarias[i].altura);
+        Chave chave;
+        chave_de(bd, i, 0, &chave);
+        chave.offset_dados = armazenar_imagem(bd, &imagens[i]);
+        inserir(bd, &chave);
+        registrar_operacao(bd);
+
+        int total_pixels = imagens[i].largura * imagens[i].altura;
+        CabecalhoRegistro cab;
+        if (!ler_cabecalho_registro(bd->arquivo_dados, OFFSET_REGISTRO(chave.offset_dados), &cab)) {
+            falha("cabecalho do registro binario %dx%d", imagens[i].largura, imagens[i].altura);
+        } else if (total_pixels >= 8 && (cab.codificacao != CODIFICACAO_BITS ||
+                                         cab.tamanho_dados != (total_pixels + 7) / 8)) {
+            falha("imagem binaria %dx%d com codificacao %d e %d bytes", imagens[i].largura,
+                  imagens[i].altura, cab.codificacao, cab.tamanho_dados);
+        }
+    }
+
+    // Limiarizadas a partir de uma imagem de tons de cinza
+    RegistroImagem cinza;
+    gerar_cinza(&cinza, 333, 77);
+    int limiares[NUM_LIMIARES] = {0, 1, 128, 255};
+    Chave inseridas[NUM_LIMIARES];
+    if (!inserir_limiares(bd, &cinza, "cinza.pgm", limiares, NUM_LIMIARES, inseridas)) {
+        falha("inserir_limiares");
+    }
+    confirmar(bd);
+    conferir_imagens(bd, imagens, NUM_BINARIAS, 0, "binarias");
+    for (int k = 0; k < NUM_LIMIARES && !falhou; k++) {
+        RegistroImagem esperada, lida;
+        aplicar_limiarizacao(&cinza, &esperada, limiares[k]);
+        if (!carregar_imagem_chave(bd, &inseridas[k], &lida)) {
+            falha("limiar %d: registro ilegivel", limiares[k]);
+        } else {
+            if (!imagens_iguais(&esperada, &lida)) falha("limiar %d: imagem diferente", limiares[k]);
+            liberar_imagem(&lida);
+        }
+        liberar_imagem(&esperada);
+    }
+    printf("binarias: %d imagens e %d limiares, dados.bin com %ld bytes\n", NUM_BINARIAS,
+           NUM_LIMIARES, tamanho_dados(bd));
+    finalizar_banco(bd);
+
+    bd = inicializar_banco(&opcoes);
+    if (compactar_banco(bd) < NUM_BINARIAS) falha("binarias: compactar_banco");
+    conferir_imagens(bd, imagens, NUM_BINARIAS, 0, "binarias compactadas");
+    finalizar_banco(bd);
+    liberar_imagem(&cinza);
+    for (int i = 0; i < NUM_BINARIAS; i++) {
+        liberar_imagem(&imagens[i]);
+    }
+}
+
+/**
+ * Ida e volta de um codec; com a capacidade um byte abaixo do tamanho, a
+ * codificação precisa recusar em vez de passar do fim
+ */
+static void testar_codec(int c, const RegistroImagem *img, const char *descricao) {
+    int total_pixels = img->largura * img->altura;
+    int capacidade = 2 * total_pixels + 16;   // O RLE de uma imagem ruidosa passa dos pixels
+    unsigned char *codificado = malloc(capacidade);
+    int tamanho = CODECS[c].codificar(img, codificado, capacidade);
+    RegistroImagem decodificada;
+    alocar_imagem(&decodificada, img->largura, img->altura);
+    if (tamanho < 0) {
+        falha("%s, %s: codificacao recusada", CODECS[c].nome, descricao);
+    } else if (!CODECS[c].decodificar(codificado, tamanho, &decodificada) ||
+               !imagens_iguais(img, &decodificada)) {
+        falha("%s, %s: ida e volta diferente", CODECS[c].nome, descricao);
+    } else if (tamanho > 0 && CODECS[c].codificar(img, codificado, tamanho - 1) != -1) {
+        falha("%s, %s: capacidade %d ignorada", CODECS[c].nome, descricao, tamanho - 1);
+    }
+    liberar_imagem(&decodificada);
+    free(codificado);
+}
+
+/**
+ * Decodifica bytes RLE dados à mão para uma imagem de PIXELS_RLE pixels
+ */
+static bool decodificar_rle_manual(const unsigned char *dados, int tamanho) {
+    RegistroImagem img;
+    alocar_imagem(&img, PIXELS_RLE, 1);
+    bool ok = decodificar_rle(dados, tamanho, &img);
+    liberar_imagem(&img);
+    return ok;
+}
+
+static void testar_codecs(void) {
+    RegistroImagem lisa, ruidosa, cinza;
+    gerar_binaria(&ruidosa, 37, 11);
+    gerar_cinza(&cinza, 37, 11);
+    alocar_imagem(&lisa, 300, 200);      // Metade preta, metade branca: RLE
+    lisa.max_valor = 255;
+    memset(lisa.dados, 0, 300 * 100);
+    memset(lisa.dados + 300 * 100, 255, 300 * 100);
+    for (int c = 0; c < NUM_CODIFICACOES; c++) {
+        testar_codec(c, &lisa, "lisa");
+        testar_codec(c, &ruidosa, "ruidosa");
+        if (!CODECS[c].so_binaria) testar_codec(c, &cinza, "cinza");
+    }
+
+    // A gravação fica com o codec que gera menos bytes
+    const RegistroImagem *imagens[3] = {&lisa, &ruidosa, &cinza};
+    int esperados[3] = {CODIFICACAO_RLE, CODIFICACAO_BITS, CODIFICACAO_BYTES};
+    for (int i = 0; i < 3; i++) {
+        CabecalhoRegistro cab;
+        free(codificar_imagem(imagens[i], &cab));
+        if (cab.codificacao != esperados[i]) {
+            falha("imagem %d gravada com %s em vez de %s", i, CODECS[cab.codificacao].nome,
+                  CODECS[esperados[i]].nome);
+        }
+    }
+    liberar_imagem(&lisa);
+    liberar_imagem(&ruidosa);
+    liberar_imagem(&cinza);
+
+    // RLE: sequências de 0 e 255 alternadas, começando por 0
+    static const struct {
+        unsigned char dados[8];
+        int tamanho;
+        bool valido;
+        const char *descricao;
+    } casos[] = {
+        {{50, 50}, 2, true, "50 + 50"},
+        {{0, PIXELS_RLE}, 2, true, "sequencia de 0 vazia"},
+        {{0x80, 0x80, 0x80, 0x80, 0x00, PIXELS_RLE}, 6, true, "varint de 5 bytes"},
+        {{0x80}, 1, false, "varint truncado"},
+        {{50, 0xB2}, 2, false, "ultimo varint truncado"},
+        {{0x80, 0x80, 0x80, 0x80, 0x10, PIXELS_RLE}, 6, false, "quinto byte passa de 32 bits"},
+        {{0x80, 0x80, 0x80, 0x80, 0x80, 0x00, PIXELS_RLE}, 7, false, "quinto byte com continuacao"},
+        {{0xFF, 0xFF, 0xFF, 0xFF, 0x0F}, 5, false, "sequencia de 2^32 - 1"},
+        {{PIXELS_RLE + 1}, 1, false, "sequencia passa do total"},
+        {{50, 49}, 2, false, "total curto"},
+        {{50, 50, 0}, 3, true, "sequencia vazia no fim"},
+        {{50, 50, 1}, 3, false, "pixel a mais no fim"},
+        {{0}, 0, false, "vazio"},
+    };
+    for (size_t i = 0; i < sizeof(casos) / sizeof(casos[0]); i++) {
+        if (decodificar_rle_manual(casos[i].dados, casos[i].tamanho) != casos[i].valido) {
+            falha("RLE \"%s\" %s", casos[i].descricao, casos[i].valido ? "recusado" : "aceito");
+        }
+    }
+
+    // Bytes e bits com o tamanho errado para as dimensões
+    RegistroImagem img;
+    unsigned char dados[PIXELS_RLE + 1] = {0};
+    alocar_imagem(&img, PIXELS_RLE, 1);
+    if (decodificar_bytes(dados, PIXELS_RLE + 1, &img) || decodificar_bytes(dados, PIXELS_RLE - 1, &img)) {
+        falha("bytes aceitou tamanho errado");
+    }
+    if (decodificar_bits(dados, (PIXELS_RLE + 7) / 8 + 1, &img) ||
+        decodificar_bits(dados, (PIXELS_RLE + 7) / 8 - 1, &img)) {
+        falha("bits aceitou tamanho errado");
+    }
+    liberar_imagem(&img);
+    printf("codecs: %d codecs, %zu entradas RLE\n", NUM_CODIFICACOES, sizeof(casos) / sizeof(casos[0]));
+}
+
+int main(void) {
+    testar_cinza();
+    testar_empacotamento();
+    testar_binarias();
+    testar_codecs();
+    apagar_banco();
+    return terminar_teste();
+}
@@ -0,0 +1,163 @@
+/*
+ * ============================================================================
+ * Teste da troca de arquivos da compactação inteira
+ * Reproduz os estados que uma queda pode deixar em models/ durante o COMPACT
+ * e confere que a abertura fica sempre com um par dados.bin/indice.bin
+ * coerente: o antigo, se a marca de troca não chegou a ser gravada, ou o
+ * novo, se a queda foi no meio dos renomes
+ * Roda em um diretório de trabalho separado (usa models/ do diretório atual)
+ * ============================================================================
+ */
+
+#include "comum.h"
+
+#define NUM_IMAGENS 8
+#define LIMIARES_POR_IMAGEM 3
+
+#define COPIA_DADOS_ANTIGO "models/copia_dados_antigo.bin"
+#define COPIA_INDICE_ANTIGO "models/copia_indice_antigo.bin"
+#define COPIA_DADOS_NOVO "models/copia_dados_novo.bin"
+#define COPIA_INDICE_NOVO "models/copia_indice_novo.bin"
+
+static void apagar_copias(void) {
+    remove(COPIA_DADOS_ANTIGO);
+    remove(COPIA_INDICE_ANTIGO);
+    remove(COPIA_DADOS_NOVO);
+    remove(COPIA_INDICE_NOVO);
+}
+
+static bool copiar_arquivo(const char *origem, const char *destino) {
+    FILE *entrada = fopen(origem, "rb");
+    FILE *saida = fopen(destino, "wb");
+    bool ok = entrada && saida;
+    char bloco[4096];
+    size_t lidos;
+    while (ok && (lidos = fread(bloco, 1, sizeof(bloco), entrada)) > 0) {
+        ok = fwrite(bloco, 1, lidos, saida) == lidos;
+    }
+    if (entrada) fclose(entrada);
+    if (saida) fclose(saida);
+    return ok;
+}
+
+static bool arquivos_iguais(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    bool iguais = fa && fb;
+    while (iguais) {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        if (ca != cb) iguais = false;
+        if (ca == EOF) break;
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return iguais;
+}
+
+static bool existe(const char *caminho) {
+    FILE *arquivo = fopen(caminho, "rb");
+    if (arquivo) fclose(arquivo);
+    return arquivo != NULL;
+}
+
+/**
+ * Confere que todas as chaves esperadas existem e que a imagem de cada uma
+ * é lida de dados.bin com as dimensões certas; retorna o número de chaves
+ */
+static int conferir_banco(BancoDados *bd, const char *etapa) {
+    int encontradas = 0;
+    for (int i = 0; i < NUM_IMAGENS; i++) {
+        for (int l = 0; l < LIMIARES_POR_IMAGEM; l++) {
+            Chave chave;
+            chave_de(bd, i, l * 60, &chave);
+            Chave achada;
+            if (!buscar(bd, &chave, &achada)) continue;
+            RegistroImagem img;
+            if (!carregar_imagem_chave(bd, &achada, &img) ||
+                img.largura != 20 + i || img.altura != 10) {
+                printf("%s: imagem de img_%05d.pgm/%d ilegivel\n", etapa, i, l * 60);
+                return -1;
+            }
+            liberar_imagem(&img);
+            encontradas++;
+        }
+    }
+    printf("%s: %d chaves\n", etapa, encontradas);
+    return encontradas;
+}
+
+int main(void) {
+    OpcoesBanco opcoes = {0};
+    BancoDados *bd = abrir_banco_novo(&opcoes);
+    for (int i = 0; i < NUM_IMAGENS; i++) {
+        for (int l = 0; l < LIMIARES_POR_IMAGEM; l++) {
+            // Uma imagem diferente por chave: nenhuma é deduplicada
+            RegistroImagem img;
+            gerar_imagem(&img, 20 + i, 10, i * LIMIARES_POR_IMAGEM + l);
+            Chave chave;
+            chave_de(bd, i, l * 60, &chave);
+            chave.offset_dados = armazenar_imagem(bd, &img);
+            inserir(bd, &chave);
+            liberar_imagem(&img);
+        }
+    }
+    // Buracos no arquivo de dados, para o par novo diferir do antigo
+    for (int i = 0; i < NUM_IMAGENS; i += 2) {
+        Chave chave;
+        chave_de(bd, i, 0, &chave);
+        if (!remover(bd, &chave)) falha("remover");
+    }
+    int vivas = NUM_IMAGENS * LIMIARES_POR_IMAGEM - NUM_IMAGENS / 2;
+    finalizar_banco(bd);
+    copiar_arquivo(ARQUIVO_DADOS, COPIA_DADOS_ANTIGO);
+    copiar_arquivo(ARQUIVO_INDICE, COPIA_INDICE_ANTIGO);
+
+    bd = inicializar_banco(&opcoes);
+    if (compactar_banco(bd) != vivas) falha("compactar_banco");
+    if (existe(ARQUIVO_TROCA) || existe(ARQUIVO_DADOS_TEMP) || existe(ARQUIVO_INDICE_TEMP)) {
+        falha("sobras da compactacao");
+    }
+    finalizar_banco(bd);
+    copiar_arquivo(ARQUIVO_DADOS, COPIA_DADOS_NOVO);
+    copiar_arquivo(ARQUIVO_INDICE, COPIA_INDICE_NOVO);
+    if (arquivos_iguais(COPIA_DADOS_ANTIGO, COPIA_DADOS_NOVO)) falha("compactacao nao mudou dados.bin");
+
+    // Queda antes da marca: temporários completos (ou não), sem marca. O par
+    // antigo continua valendo e os temporários são descartados
+    copiar_arquivo(COPIA_DADOS_ANTIGO, ARQUIVO_DADOS);
+    copiar_arquivo(COPIA_INDICE_ANTIGO, ARQUIVO_INDICE);
+    copiar_arquivo(COPIA_DADOS_NOVO, ARQUIVO_DADOS_TEMP);
+    copiar_arquivo(COPIA_INDICE_NOVO, ARQUIVO_INDICE_TEMP);
+    bd = inicializar_banco(&opcoes);
+    if (conferir_banco(bd, "queda antes da marca") != vivas) falha("par antigo depois da queda");
+    finalizar_banco(bd);
+    if (!arquivos_iguais(ARQUIVO_DADOS, COPIA_DADOS_ANTIGO)) falha("dados.bin antigo trocado sem marca");
+    if (existe(ARQUIVO_DADOS_TEMP) || existe(ARQUIVO_INDICE_TEMP)) falha("temporarios sem marca mantidos");
+
+    // Queda no meio dos renomes: dados.bin já é o novo, indice.bin ainda é o
+    // antigo (o par que a versão sem marca deixava, com offsets trocados)
+    copiar_arquivo(COPIA_DADOS_NOVO, ARQUIVO_DADOS);
+    copiar_arquivo(COPIA_INDICE_ANTIGO, ARQUIVO_INDICE);
+    copiar_arquivo(COPIA_INDICE_NOVO, ARQUIVO_INDICE_TEMP);
+    FILE *marca = fopen(ARQUIVO_TROCA, "wb");
+    if (marca) fclose(marca);
+    bd = inicializar_banco(&opcoes);
+    if (conferir_banco(bd, "queda no meio da troca") != vivas) falha("par novo depois da queda");
+    finalizar_banco(bd);
+    if (!arquivos_iguais(ARQUIVO_INDICE, COPIA_INDICE_NOVO)) falha("indice.bin novo nao instalado");
+    if (existe(ARQUIVO_TROCA) || existe(ARQUIVO_INDICE_TEMP)) falha("marca ou temporario mantidos");
+
+    // Queda entre os dois renomes com indice.bin já removido
+    copiar_arquivo(COPIA_DADOS_NOVO, ARQUIVO_DADOS);
+    remove(ARQUIVO_INDICE);
+    copiar_arquivo(COPIA_INDICE_NOVO, ARQUIVO_INDICE_TEMP);
+    marca = fopen(ARQUIVO_TROCA, "wb");
+    if (marca) fclose(marca);
+    bd = inicializar_banco(&opcoes);
+    if (!bd || conferir_banco(bd, "queda sem indice.bin") != vivas) falha("indice.bin ausente");
+    if (bd) finalizar_banco(bd);
+
+    apagar_banco();
+    apagar_copias();
+    return terminar_teste();
+}